@@ -0,0 +1,519 @@
+#include "baked_scene.h"
+#include "mapped_file.h"
+#include "image_levels.h"
+#include "block_compress.h"
+#include "thread_pool.h"
+#include "bounds.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <type_traits>
+
+static const uint32_t baked_scene_magic = 0x43534244; // "DBSC"
+
+// the gltf_scene_config.h switches that change what gets baked
+static uint32_t bake_settings() {
+	uint32_t settings = 0;
+#ifdef BAKED_SCENE_BLOCK_COMPRESSION
+	settings |= 0x1;
+#endif
+#ifdef BAKED_SCENE_FAST_BLOCK_COMPRESSION
+	settings |= 0x2;
+#endif
+	return settings;
+}
+
+uint64_t BakedScene::hash(const void* data, size_t size, uint64_t seed) {
+	// multiply-xorshift over 8 byte words. Only guards against stale caches, not adversarial input
+	const uint64_t prime = 0x9E3779B97F4A7C15ull;
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t h = seed ^ (size * prime);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i, sizeof(word));
+		h = (h ^ word) * prime;
+		h ^= h >> 29;
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, bytes + i, size - i);
+	h = (h ^ tail) * prime;
+	h ^= h >> 32;
+	return h;
+}
+
+namespace {
+
+// streams into the file as it goes, the baked scene is never held in memory as a whole
+class Writer {
+public:
+	Writer(const std::string& filename) : _file(filename, std::ios::binary | std::ios::trunc) {}
+
+	template<typename T>
+	void pod(const T& value) {
+		static_assert(std::is_trivially_copyable<T>::value, "pod() needs a trivially copyable type");
+		raw(&value, sizeof(T));
+	}
+
+	template<typename T>
+	void vector(const std::vector<T>& values) {
+		static_assert(std::is_trivially_copyable<T>::value, "vector() needs a trivially copyable element type");
+		pod((uint64_t)values.size());
+		raw(values.data(), values.size() * sizeof(T));
+	}
+
+	void string(const std::string& value) {
+		pod((uint64_t)value.size());
+		raw(value.data(), value.size());
+	}
+
+	// laid out like vector() of bytes
+	void span(const ByteSpan& value) {
+		pod((uint64_t)value.size);
+		raw(value.data, value.size);
+	}
+
+	void raw(const void* data, size_t size) {
+		_file.write(static_cast<const char*>(data), (std::streamsize)size);
+		_size += size;
+	}
+
+	// false once creating the file or any write failed
+	bool good() const { return (bool)_file; }
+
+	// flushes the rest. Returns false if anything failed
+	bool close() {
+		_file.close();
+		return !_file.fail();
+	}
+
+	size_t size() const { return _size; }
+
+private:
+	std::ofstream _file;
+	size_t _size = 0;
+};
+
+// reads out of a mapped file. Every read is bounds checked so that a truncated file fails instead of crashing
+class Reader {
+public:
+	Reader(const uint8_t* data, size_t size) : _ptr(data), _end(data + size) {}
+
+	template<typename T>
+	bool pod(T& value) {
+		return raw(&value, sizeof(T));
+	}
+
+	template<typename T>
+	bool vector(std::vector<T>& values) {
+		uint64_t count;
+		if (!pod(count) || count > (uint64_t)(_end - _ptr) / sizeof(T)) {
+			return false;
+		}
+		values.resize((size_t)count);
+		return raw(values.data(), (size_t)count * sizeof(T));
+	}
+
+	bool string(std::string& value) {
+		uint64_t size;
+		if (!pod(size) || size > (uint64_t)(_end - _ptr)) {
+			return false;
+		}
+		value.assign(reinterpret_cast<const char*>(_ptr), (size_t)size);
+		_ptr += size;
+		return true;
+	}
+
+	// what Writer::span wrote, pointing into the mapping instead of copying
+	bool span(ByteSpan& value) {
+		uint64_t size;
+		if (!pod(size) || size > (uint64_t)(_end - _ptr)) {
+			return false;
+		}
+		value = { _ptr, (size_t)size };
+		_ptr += size;
+		return true;
+	}
+
+	bool raw(void* data, size_t size) {
+		if (size > (size_t)(_end - _ptr)) {
+			return false;
+		}
+		std::memcpy(data, _ptr, size);
+		_ptr += size;
+		return true;
+	}
+
+private:
+	const uint8_t* _ptr;
+	const uint8_t* _end;
+};
+
+}
+
+enum class ImageRole {
+	Unused,
+	BaseColor,
+	Normal,
+	Emissive,
+	Data // metallic-roughness, occlusion
+};
+
+// same rule as BindlessDataManager::set_materials: the first material sampling an image decides
+static std::vector<ImageRole> image_roles(const MaterialResources& mat_res) {
+	std::vector<ImageRole> roles(mat_res.images.size(), ImageRole::Unused);
+	auto use = [&](int tex_id, ImageRole role) {
+		if (tex_id < 0) {
+			return;
+		}
+		int img_id = mat_res.textures[tex_id].image_id;
+		if (img_id < 0 || roles[img_id] != ImageRole::Unused) {
+			return;
+		}
+		roles[img_id] = role;
+	};
+	for (const std::shared_ptr<MaterialData>& mat : mat_res.materials) {
+		use(mat->base_color_id, ImageRole::BaseColor);
+		use(mat->normal_id, ImageRole::Normal);
+		use(mat->metallic_roughness_id, ImageRole::Data);
+		use(mat->occlusion_id, ImageRole::Data);
+		use(mat->emissive_id, ImageRole::Emissive);
+	}
+	return roles;
+}
+
+static bool has_alpha(const ImageData& image) {
+	for (size_t i = 3; i < image.mips[0].size; i += 4) {
+		if (image.pixel_data[i] != 255) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static BlockFormat block_format_of(ImageRole role, const ImageData& image) {
+#ifdef BAKED_SCENE_BLOCK_COMPRESSION
+	switch (role) {
+	case ImageRole::BaseColor:
+#ifdef BAKED_SCENE_FAST_BLOCK_COMPRESSION
+		return has_alpha(image) ? BlockFormat::BC3 : BlockFormat::BC1;
+#else
+		return BlockFormat::BC7;
+#endif
+	case ImageRole::Normal:
+		return BlockFormat::BC5;
+	case ImageRole::Emissive:
+	case ImageRole::Data:
+		return has_alpha(image) ? BlockFormat::BC7 : BlockFormat::BC1;
+	default:
+		return BlockFormat::None;
+	}
+#else
+	return BlockFormat::None;
+#endif
+}
+
+bool BakedScene::save(
+	const std::string& filename,
+	uint64_t source_stamp,
+	uint64_t source_hash,
+	const SceneGraph& graph,
+	const SceneGraphFlatRefs& graph_refs,
+	MaterialResources& mat_res) {
+
+	// complete images and meshes. Decoding runs on the shared pool, so wait here rather than inside pool tasks
+	for (const std::shared_ptr<ImageData>& image : mat_res.images) {
+		if (!image->wait()) {
+			std::cout << "cannot bake scene, failed to decode " << image->uri << std::endl;
+			return false;
+		}
+	}
+	std::vector<ImageRole> roles = image_roles(mat_res);
+	std::vector<std::future<void>> image_tasks;
+	for (uint32_t img_id = 0; img_id < mat_res.images.size(); ++img_id) {
+		std::shared_ptr<ImageData> image = mat_res.images[img_id];
+		if (image->block_format != BlockFormat::None) {
+			// pre-compressed ktx2
+			continue;
+		}
+		ImageRole role = roles[img_id];
+		image_tasks.push_back(ThreadPool::shared().submit([image, role]() {
+			if (image->mips.empty()) {
+				MipChain::build(*image, role == ImageRole::BaseColor || role == ImageRole::Emissive);
+			}
+			BlockFormat format = block_format_of(role, *image);
+			if (format != BlockFormat::None) {
+				BlockCompress::compress(*image, format);
+			}
+		}));
+	}
+
+	std::vector<std::shared_ptr<MeshData>> meshes;
+	std::map<const MeshData*, int32_t> mesh_ids;
+	for (const SceneNode& node : graph) {
+		for (const Renderable& renderable : node.renderables) {
+			if (renderable.mesh && mesh_ids.find(renderable.mesh.get()) == mesh_ids.end()) {
+				mesh_ids[renderable.mesh.get()] = (int32_t)meshes.size();
+				meshes.push_back(renderable.mesh);
+				if (!renderable.mesh->aabb_valid) {
+					Bounds::compute_aabb(*renderable.mesh);
+				}
+				if (!renderable.mesh->volumes_valid) {
+					Bounds::compute_volumes(*renderable.mesh);
+				}
+			}
+		}
+	}
+
+	for (std::future<void>& task : image_tasks) {
+		task.get();
+	}
+
+	// write to a temporary file first so that an interrupted bake never leaves a valid looking cache behind
+	std::string tmp_filename = filename + ".tmp";
+	Writer w(tmp_filename);
+	if (!w.good()) {
+		std::cout << "failed to create " << tmp_filename << std::endl;
+		return false;
+	}
+	w.pod(baked_scene_magic);
+	w.pod(version);
+	w.pod(bake_settings());
+	w.pod(source_stamp);
+	w.pod(source_hash);
+
+	// geometry
+	w.pod((uint32_t)meshes.size());
+	for (const std::shared_ptr<MeshData>& mesh : meshes) {
+		w.vector(mesh->positions);
+		w.vector(mesh->normals);
+		w.vector(mesh->uv0);
+		w.vector(mesh->uv1);
+		w.vector(mesh->tangents);
+		w.vector(mesh->indices);
+		w.pod(mesh->aabb);
+		w.pod(mesh->sphere);
+		w.pod(mesh->obb);
+		w.vector(mesh->meshlets);
+		w.pod((uint32_t)mesh->lods.size());
+		for (const MeshLod& lod : mesh->lods) {
+			w.vector(lod.indices);
+			w.pod(lod.error);
+		}
+	}
+
+	// scene graph
+	w.pod((uint32_t)graph.size());
+	for (const SceneNode& node : graph) {
+		w.pod(node.parent);
+		w.string(node.name);
+		w.pod(node.local_transform);
+		w.pod(node.world_transform);
+		w.pod((uint32_t)node.renderables.size());
+		for (const Renderable& renderable : node.renderables) {
+			w.pod(renderable.mesh ? mesh_ids[renderable.mesh.get()] : (int32_t)-1);
+			w.pod(renderable.material_id);
+		}
+	}
+	w.vector(graph_refs);
+
+	// materials
+	w.pod((uint32_t)mat_res.images.size());
+	for (const std::shared_ptr<ImageData>& image : mat_res.images) {
+		w.string(image->uri);
+		w.pod(image->width);
+		w.pod(image->height);
+		w.pod(image->channels);
+		w.pod(image->bit_depth);
+		w.pod(image->block_format);
+		w.vector(image->mips);
+		w.span({ image->pixels(), image->pixels_size() });
+	}
+	w.vector(mat_res.sampler_cfgs);
+	w.vector(mat_res.textures);
+	w.pod((uint32_t)mat_res.materials.size());
+	for (const std::shared_ptr<MaterialData>& mat : mat_res.materials) {
+		w.string(mat->name);
+		w.pod(mat->base_color_factor);
+		w.pod(mat->metallic_factor);
+		w.pod(mat->roughness_factor);
+		w.pod(mat->normal_scale);
+		w.pod(mat->occlusion_strength);
+		w.pod(mat->alpha_mode);
+		w.pod(mat->alpha_cutoff);
+		w.pod(mat->double_sided);
+		w.pod(mat->base_color_id);
+		w.pod(mat->metallic_roughness_id);
+		w.pod(mat->normal_id);
+		w.pod(mat->occlusion_id);
+		w.pod(mat->emissive_id);
+	}
+	w.pod(baked_scene_magic);
+
+	if (!w.close()) {
+		std::cout << "failed to write " << tmp_filename << std::endl;
+		std::remove(tmp_filename.c_str());
+		return false;
+	}
+	std::remove(filename.c_str());
+	if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		std::cout << "failed to rename " << tmp_filename << " to " << filename << std::endl;
+		return false;
+	}
+	std::cout << "baked scene to " << filename << ", " << w.size() / (1024 * 1024) << " MB" << std::endl;
+	return true;
+}
+
+bool BakedScene::load(
+	const std::string& filename,
+	uint64_t source_stamp,
+	const std::function<uint64_t()>& source_hash,
+	SceneGraph& graph,
+	SceneGraphFlatRefs& graph_refs,
+	MaterialResources& mat_res) {
+
+	// images keep the mapping open, their pixels are uploaded straight out of it
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->open(filename)) {
+		return false;
+	}
+	Reader r(file->data(), file->size());
+
+	uint32_t magic = 0;
+	uint32_t file_version = 0;
+	uint32_t file_settings = 0;
+	uint64_t file_source_stamp = 0;
+	uint64_t file_source_hash = 0;
+	if (!r.pod(magic) || !r.pod(file_version) || !r.pod(file_settings) || !r.pod(file_source_stamp) || !r.pod(file_source_hash) ||
+		magic != baked_scene_magic) {
+		std::cout << filename << " is not a baked scene" << std::endl;
+		return false;
+	}
+	if (file_version != version) {
+		std::cout << filename << " was baked with version " << file_version << ", current version is " << version << std::endl;
+		return false;
+	}
+	if (file_settings != bake_settings()) {
+		std::cout << filename << " was baked with different settings" << std::endl;
+		return false;
+	}
+	// the sources are only read through where their sizes or modification times changed, e.g. after a copy
+	if (file_source_stamp != source_stamp && file_source_hash != source_hash()) {
+		std::cout << filename << " is out of date" << std::endl;
+		return false;
+	}
+
+	bool ok = true;
+
+	// geometry
+	uint32_t n_meshes = 0;
+	ok &= r.pod(n_meshes);
+	std::vector<std::shared_ptr<MeshData>> meshes;
+	for (uint32_t i = 0; ok && i < n_meshes; ++i) {
+		std::shared_ptr<MeshData> mesh = std::make_shared<MeshData>();
+		ok &= r.vector(mesh->positions);
+		ok &= r.vector(mesh->normals);
+		ok &= r.vector(mesh->uv0);
+		ok &= r.vector(mesh->uv1);
+		ok &= r.vector(mesh->tangents);
+		ok &= r.vector(mesh->indices);
+		ok &= r.pod(mesh->aabb);
+		mesh->aabb_valid = true;
+		ok &= r.pod(mesh->sphere);
+		ok &= r.pod(mesh->obb);
+		mesh->volumes_valid = true;
+		ok &= r.vector(mesh->meshlets);
+		uint32_t n_lods = 0;
+		ok &= r.pod(n_lods);
+		ok &= n_lods < MeshLod::max_lods;
+		mesh->lods.resize(ok ? n_lods : 0);
+		for (MeshLod& lod : mesh->lods) {
+			ok &= r.vector(lod.indices);
+			ok &= r.pod(lod.error);
+		}
+		meshes.push_back(mesh);
+	}
+
+	// scene graph
+	uint32_t n_nodes = 0;
+	ok &= r.pod(n_nodes);
+	SceneGraph file_graph;
+	for (uint32_t i = 0; ok && i < n_nodes; ++i) {
+		SceneNode node;
+		uint32_t n_renderables = 0;
+		ok &= r.pod(node.parent);
+		ok &= r.string(node.name);
+		ok &= r.pod(node.local_transform);
+		ok &= r.pod(node.world_transform);
+		ok &= r.pod(n_renderables);
+		for (uint32_t j = 0; ok && j < n_renderables; ++j) {
+			Renderable renderable;
+			int32_t mesh_id = -1;
+			ok &= r.pod(mesh_id);
+			ok &= r.pod(renderable.material_id);
+			ok &= mesh_id < (int32_t)meshes.size();
+			if (ok && mesh_id >= 0) {
+				renderable.mesh = meshes[mesh_id];
+			}
+			node.renderables.push_back(renderable);
+		}
+		file_graph.push_back(std::move(node));
+	}
+	SceneGraphFlatRefs file_refs;
+	ok &= r.vector(file_refs);
+
+	// materials
+	MaterialResources file_res;
+	uint32_t n_images = 0;
+	ok &= r.pod(n_images);
+	for (uint32_t i = 0; ok && i < n_images; ++i) {
+		std::shared_ptr<ImageData> image = std::make_shared<ImageData>();
+		ok &= r.string(image->uri);
+		ok &= r.pod(image->width);
+		ok &= r.pod(image->height);
+		ok &= r.pod(image->channels);
+		ok &= r.pod(image->bit_depth);
+		ok &= r.pod(image->block_format);
+		ok &= r.vector(image->mips);
+		ok &= r.span(image->mapped_pixels);
+		image->mapping = file;
+		file_res.images.push_back(image);
+	}
+	ok &= r.vector(file_res.sampler_cfgs);
+	ok &= r.vector(file_res.textures);
+	uint32_t n_materials = 0;
+	ok &= r.pod(n_materials);
+	for (uint32_t i = 0; ok && i < n_materials; ++i) {
+		std::shared_ptr<MaterialData> mat = std::make_shared<MaterialData>();
+		ok &= r.string(mat->name);
+		ok &= r.pod(mat->base_color_factor);
+		ok &= r.pod(mat->metallic_factor);
+		ok &= r.pod(mat->roughness_factor);
+		ok &= r.pod(mat->normal_scale);
+		ok &= r.pod(mat->occlusion_strength);
+		ok &= r.pod(mat->alpha_mode);
+		ok &= r.pod(mat->alpha_cutoff);
+		ok &= r.pod(mat->double_sided);
+		ok &= r.pod(mat->base_color_id);
+		ok &= r.pod(mat->metallic_roughness_id);
+		ok &= r.pod(mat->normal_id);
+		ok &= r.pod(mat->occlusion_id);
+		ok &= r.pod(mat->emissive_id);
+		file_res.materials.push_back(mat);
+	}
+	uint32_t end_magic = 0;
+	ok &= r.pod(end_magic) && end_magic == baked_scene_magic;
+
+	if (!ok) {
+		std::cout << filename << " is truncated or corrupt" << std::endl;
+		return false;
+	}
+
+	graph = std::move(file_graph);
+	graph_refs = std::move(file_refs);
+	mat_res = std::move(file_res);
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+
+#include <functional>
+#include <string>
+
+// binary snapshot of a parsed scene: flattened scene graph and refs, geometry of every unique mesh with its AABB, meshlets and LODs,
+// materials and fully decoded images with their mip chains, block compressed as configured in gltf_scene_config.h.
+// Read back through a memory mapping, so a warm start skips glTF parsing, image decoding, mip generation,
+// texture compression and AABB computation
+struct BakedScene {
+	// bump whenever the layout written by save() changes
+	static constexpr uint32_t version = 7;
+
+	// false if the file is missing, truncated, of another version, baked with other settings or from a different source.
+	// The source is compared by source_stamp (see gltf_source_stamp) first, source_hash is only called where that
+	// differs. Image pixels point into the file, which stays mapped while any of the images is alive
+	static bool load(
+		const std::string& filename,
+		uint64_t source_stamp,
+		const std::function<uint64_t()>& source_hash,
+		SceneGraph& graph,
+		SceneGraphFlatRefs& graph_refs,
+		MaterialResources& mat_res);
+
+	// waits for image decoding, then builds mip chains, compresses images and computes AABBs in place so that the caller uses
+	// exactly what a later load() returns
+	static bool save(
+		const std::string& filename,
+		uint64_t source_stamp,
+		uint64_t source_hash,
+		const SceneGraph& graph,
+		const SceneGraphFlatRefs& graph_refs,
+		MaterialResources& mat_res);
+
+	// 64 bit hash used to identify source files
+	static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+};
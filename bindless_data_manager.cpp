@@ -1,9 +1,13 @@
 #pragma once
 #include "bindless_data_manager.h"
 #include "otcv_utils.h"
+#include "mesh_optimizer.h"
+#include "bounds.h"
 #include "tiny_gltf.h"
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
 
 BindlessDataManager::BindlessDataManager(VkPhysicalDevice physical_device,
 	const std::string& geometry_shader_path,
@@ -42,14 +46,14 @@ BindlessDataManager::BindlessDataManager(VkPhysicalDevice physical_device,
 }
 
 BindlessDataManager::~BindlessDataManager() {
+	_texture_streamer.reset();
 	delete _vb;
-	delete _ib;
+	for (otcv::Buffer* ib : _ibs) {
+		delete ib;
+	}
 	for (otcv::Image* img : _images) {
 		delete img;
 	}
-	for (otcv::Sampler* sampler : _samplers) {
-		delete sampler;
-	}
 	for (auto& p : _pipeline_bins) {
 		delete p.second;
 	}
@@ -66,9 +70,11 @@ void BindlessDataManager::build_all_pipelines(const std::string& geometry_shader
 	};
 	std::map<std::string, otcv::ShaderLoadHint> file_hints = {
 		{"geometry.vert", {otcv::ShaderLoadHint::Hint::DescriptorIndexing, &vs_indexing_limits}},
+		{"geometry_compact.vert", {otcv::ShaderLoadHint::Hint::DescriptorIndexing, &vs_indexing_limits}},
 		{"geometry.frag", {otcv::ShaderLoadHint::Hint::DescriptorIndexing, &fs_indexing_limits}}
 	};
 	_geometry_shader_blob = otcv::load_shaders_from_dir(geometry_shader_path, file_hints);
+	const char* vertex_shader = _vertex_layout == VertexLayout::Compact ? "geometry_compact.vert" : "geometry.vert";
 
 	// geometry pass, culled
 	{
@@ -80,13 +86,10 @@ void BindlessDataManager::build_all_pipelines(const std::string& geometry_shader
 			.depth_stencil_attachment_format(VK_FORMAT_D24_UNORM_S8_UINT)
 			.end();
 		builder
-			.shader_vertex(_geometry_shader_blob["geometry.vert"])
+			.shader_vertex(_geometry_shader_blob[vertex_shader])
 			.shader_fragment(_geometry_shader_blob["geometry.frag"]);
 		otcv::VertexBufferBuilder vbb;
-		vbb.add_binding().add_attribute(0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3))
-			.add_binding().add_attribute(1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3))
-			.add_binding().add_attribute(2, VK_FORMAT_R32G32_SFLOAT, sizeof(glm::vec2))
-			.add_binding().add_attribute(3, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(glm::vec4));
+		add_vertex_attributes(vbb);
 		builder.vertex_state(vbb);
 		builder.depth_test().cull_back_face();
 		builder
@@ -105,14 +108,11 @@ void BindlessDataManager::build_all_pipelines(const std::string& geometry_shader
 			.depth_stencil_attachment_format(VK_FORMAT_D24_UNORM_S8_UINT)
 			.end();
 		builder
-			.shader_vertex(_geometry_shader_blob["geometry.vert"])
+			.shader_vertex(_geometry_shader_blob[vertex_shader])
 			.shader_fragment(_geometry_shader_blob["geometry.frag"]);
 		{
 			otcv::VertexBufferBuilder vbb;
-			vbb.add_binding().add_attribute(0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3))
-				.add_binding().add_attribute(1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3))
-				.add_binding().add_attribute(2, VK_FORMAT_R32G32_SFLOAT, sizeof(glm::vec2))
-				.add_binding().add_attribute(3, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(glm::vec4));
+			add_vertex_attributes(vbb);
 			builder.vertex_state(vbb);
 		}
 		builder.depth_test();
@@ -124,6 +124,29 @@ void BindlessDataManager::build_all_pipelines(const std::string& geometry_shader
 
 }
 
+void BindlessDataManager::add_vertex_attributes(otcv::VertexBufferBuilder& vbb) const {
+	if (_vertex_layout == VertexLayout::Compact) {
+		vbb.add_binding().add_attribute(0, VK_FORMAT_R16G16B16A16_UNORM, 4 * sizeof(uint16_t))
+			.add_binding().add_attribute(1, VK_FORMAT_R16G16B16A16_SNORM, 4 * sizeof(int16_t))
+			.add_binding().add_attribute(2, VK_FORMAT_R16G16_UNORM, 2 * sizeof(uint16_t));
+	}
+	else {
+		vbb.add_binding().add_attribute(0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3))
+			.add_binding().add_attribute(1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3))
+			.add_binding().add_attribute(2, VK_FORMAT_R32G32_SFLOAT, sizeof(glm::vec2))
+			.add_binding().add_attribute(3, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(glm::vec4));
+	}
+}
+
+void BindlessDataManager::add_position_attribute(otcv::VertexBufferBuilder& vbb) const {
+	if (_vertex_layout == VertexLayout::Compact) {
+		vbb.add_binding().add_attribute(0, VK_FORMAT_R16G16B16A16_UNORM, 4 * sizeof(uint16_t));
+	}
+	else {
+		vbb.add_binding().add_attribute(0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3));
+	}
+}
+
 
 void BindlessDataManager::build_descriptor_sets() {
 	// bindless pool and descriptor
@@ -222,8 +245,8 @@ bool map_sampler_config(SamplerConfig config, otcv::SamplerBuilder& builder) {
 }
 
 
-VkFormat BindlessDataManager::choose_format(int channels, int bit_depth, bool srgb) {
-	uint32_t format_index = otcv::pack((uint16_t)channels, (uint16_t)bit_depth) | (srgb ? 0x8000 : 0x0);
+VkFormat BindlessDataManager::choose_format(int channels, int bit_depth, bool srgb, BlockFormat block_format) {
+	uint32_t format_index = otcv::pack((uint16_t)channels, (uint16_t)bit_depth) | block_format_key(block_format) | (srgb ? 0x8000 : 0x0);
 	auto iter = format_lut.find(format_index);
 	if (iter == format_lut.end()) {
 		return VK_FORMAT_UNDEFINED;
@@ -233,11 +256,11 @@ VkFormat BindlessDataManager::choose_format(int channels, int bit_depth, bool sr
 	}
 }
 
-otcv::Image* BindlessDataManager::upload_image_async(ImageData& img_data, bool srgb, bool swizzle) {
+otcv::Image* BindlessDataManager::upload_image_async(ImageData& img_data, bool srgb, bool swizzle, ImageLevelUploader& level_uploader, uint32_t first_level) {
 	otcv::ImageBuilder imb;
 	imb.size(img_data.width, img_data.height, img_data.bit_depth / 8)
 		.name(img_data.uri);
-	VkFormat format = choose_format(img_data.channels, img_data.bit_depth, srgb);
+	VkFormat format = choose_format(img_data.channels, img_data.bit_depth, srgb, img_data.block_format);
 	assert(format != VK_FORMAT_UNDEFINED);
 	imb
 		.format(format)
@@ -249,9 +272,16 @@ otcv::Image* BindlessDataManager::upload_image_async(ImageData& img_data, bool s
 		imb.swizzle(VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_R);
 	}
 	otcv::Image* image = new otcv::Image(imb);
+	// block compressed formats cannot be blitted, their mips always come pre-built
+	assert(img_data.block_format == BlockFormat::None || !img_data.mips.empty());
+	if (!img_data.mips.empty()) {
+		// pre-built chain, e.g. from a baked scene or a ktx2 file
+		level_uploader.add(image, img_data.pixels(), img_data.mips, first_level);
+		return image;
+	}
 	image->populate_async(
-		img_data.pixel_data.data(),
-		img_data.pixel_data.size(),
+		img_data.pixels(),
+		img_data.pixels_size(),
 		otcv::ResourceState::FragSample,
 		otcv::ResourceState::Created,
 		otcv::Image::SyncType::GPUBarrier);
@@ -269,48 +299,79 @@ bool BindlessDataManager::set_materials(const MaterialResources& mat_res) {
 	assert(images_res.size() == _n_images);
 	assert(sampler_cfgs_res.size() == _n_samplers);
 
-	// upload images 
+	// figure out how each image is sampled
+	std::vector<ImageUsage> usages = image_usages(mat_res);
+
+	// upload images in the order the parser's decode tasks complete
 	_images.resize(mat_res.images.size(), nullptr);
-	auto upload_image_by_texture_id = [&](int tex_id, bool srgb, bool swizzle) {
-		if (tex_id < 0) {
-			return;
-		}
-		int img_id = mat_res.textures[tex_id].image_id;
-		if (img_id < 0) {
-			return;
+	std::vector<uint32_t> unreferenced_image_ids;
+	std::vector<uint32_t> pending_image_ids;
+	for (uint32_t i = 0; i < images_res.size(); ++i) {
+		pending_image_ids.push_back(i);
+	}
+	ImageLevelUploader level_uploader;
+	_texture_streamer.reset(new TextureStreamer(images_res.size(), _streaming_bytes_per_frame));
+	auto wait_begin = std::chrono::steady_clock::now();
+	double wait_ms = 0.0;
+	while (!pending_image_ids.empty()) {
+		auto iter = std::find_if(pending_image_ids.begin(), pending_image_ids.end(), [&](uint32_t id) {
+			return images_res[id]->ready();
+		});
+		if (iter == pending_image_ids.end()) {
+			// nothing finished yet. block on the oldest one
+			auto block_begin = std::chrono::steady_clock::now();
+			images_res[pending_image_ids.front()]->wait();
+			wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - block_begin).count();
+			continue;
 		}
-		if (!_images[img_id]) {
-			_images[img_id] = upload_image_async(*images_res[img_id], srgb, swizzle);
+		uint32_t img_id = *iter;
+		pending_image_ids.erase(iter);
+
+		if (!images_res[img_id]->wait()) {
+			std::cout << "Failed to decode image index = " << img_id << std::endl;
+			assert(false);
+			return false;
 		}
-	};
-	for (std::shared_ptr<MaterialData> mat : materials_res) {
-		upload_image_by_texture_id(mat->base_color_id, true, false);
-		upload_image_by_texture_id(mat->normal_id, false, false);
-		upload_image_by_texture_id(mat->metallic_roughness_id, false, true);
-		upload_image_by_texture_id(mat->occlusion_id, false, false);
-		upload_image_by_texture_id(mat->emissive_id, true, false);
-	}
-	// some images may not be referenced by any material
-	std::vector<uint32_t> unreferenced_image_ids;
-	for (uint32_t i = 0; i < _images.size(); ++i) {
-		if (!_images[i]) {
+		const ImageUsage& usage = usages[img_id];
+		if (!usage.referenced) {
 			// This really should not happen. Why would a gltf file store images that are not referenced by anything
-			unreferenced_image_ids.push_back(i);
-			std::cout << "image index = " << i << " not referenced by any material. Upload to GPU anyway." << std::endl;
-			_images[i] = upload_image_async(*images_res[i], false, false);
+			unreferenced_image_ids.push_back(img_id);
+			std::cout << "image index = " << img_id << " not referenced by any material. Upload to GPU anyway." << std::endl;
+		}
+		// only pre-built chains can be streamed, GPU generated mips need the full image up front
+		const std::vector<MipLevel>& mips = images_res[img_id]->mips;
+		uint32_t first_level = mips.empty() ? 0 : TextureStreamer::first_resident_level(mips, _streaming_resident_size);
+		_images[img_id] = upload_image_async(*images_res[img_id], usage.srgb, usage.swizzle, level_uploader, first_level);
+		if (first_level > 0) {
+			_texture_streamer->add(img_id, _images[img_id], images_res[img_id], first_level);
 		}
 	}
-
-	// build samplers
-	for (const SamplerConfig& cfg : sampler_cfgs_res) {
+	level_uploader.flush();
+	double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_begin).count();
+	std::cout << "uploaded " << images_res.size() << " images in " << total_ms << " ms, "
+		<< wait_ms << " ms of which blocked on decoding" << std::endl;
+
+	// build samplers. Configs that map to the same sampler share it and its descriptor slot
+	std::vector<int> sampler_slots(sampler_cfgs_res.size());
+	std::unordered_map<SamplerHandle, int> slots_by_handle;
+	for (uint32_t sampler_id = 0; sampler_id < sampler_cfgs_res.size(); ++sampler_id) {
 		otcv::SamplerBuilder sb;
-		if (!map_sampler_config(cfg, sb)) {
+		if (!map_sampler_config(sampler_cfgs_res[sampler_id], sb)) {
 			std::cout << "Failed to map sampler configuration." << std::endl;
 			assert(false);
 			return false;
 		}
-		_samplers.push_back(new otcv::Sampler(sb));
+		SamplerHandle handle = _sampler_cache.get_handle(sb);
+		auto iter = slots_by_handle.find(handle);
+		if (iter == slots_by_handle.end()) {
+			iter = slots_by_handle.insert({ handle, (int)_samplers.size() }).first;
+			_samplers.push_back(_sampler_cache.get(handle));
+		}
+		sampler_slots[sampler_id] = iter->second;
 	}
+	auto sampler_slot = [&](int sampler_id) {
+		return sampler_id < 0 ? -1 : sampler_slots[sampler_id];
+	};
 
 	// bind image and sampler
 	auto bind_image_sampler_by_texture_id = [&](int tex_id) {
@@ -321,13 +382,13 @@ bool BindlessDataManager::set_materials(const MaterialResources& mat_res) {
 		if (img_id < 0) {
 			return;
 		}
-		int sampler_id = textures_res[tex_id].sampler_id;
-		if (sampler_id < 0) {
+		int slot = sampler_slot(textures_res[tex_id].sampler_id);
+		if (slot < 0) {
 			return;
 		}
 
 		_bindless_material_desc_set->bind_sampled_image(1, &_images[img_id], img_id);
-		_bindless_material_desc_set->bind_sampler(2, &_samplers[sampler_id], sampler_id);
+		_bindless_material_desc_set->bind_sampler(2, &_samplers[slot], slot);
 	};
 	for (std::shared_ptr<MaterialData> mat : materials_res) {
 		bind_image_sampler_by_texture_id(mat->base_color_id);
@@ -382,23 +443,38 @@ bool BindlessDataManager::set_materials(const MaterialResources& mat_res) {
 		int mr_id = mat_data.metallic_roughness_id;
 
 		image_id_write = bc_id >= 0 ? textures_res[bc_id].image_id : -1;
-		sampler_id_write = bc_id >= 0 ? textures_res[bc_id].sampler_id : -1;
+		sampler_id_write = bc_id >= 0 ? sampler_slot(textures_res[bc_id].sampler_id) : -1;
 		_material_ubos->set(mat_id, StaticUBOAccess()["texIds"]["baseColorId"], &image_id_write);
 		_material_ubos->set(mat_id, StaticUBOAccess()["samplerIds"]["baseColorId"], &sampler_id_write);
 
 		image_id_write = n_id >= 0 ? textures_res[n_id].image_id : -1;
-		sampler_id_write = n_id >= 0 ? textures_res[n_id].sampler_id : -1;
+		sampler_id_write = n_id >= 0 ? sampler_slot(textures_res[n_id].sampler_id) : -1;
 		_material_ubos->set(mat_id, StaticUBOAccess()["texIds"]["normalId"], &image_id_write);
 		_material_ubos->set(mat_id, StaticUBOAccess()["samplerIds"]["normalId"], &sampler_id_write);
 
 		image_id_write = mr_id >= 0 ? textures_res[mr_id].image_id : -1;
-		sampler_id_write = mr_id >= 0 ? textures_res[mr_id].sampler_id : -1;
+		sampler_id_write = mr_id >= 0 ? sampler_slot(textures_res[mr_id].sampler_id) : -1;
 		_material_ubos->set(mat_id, StaticUBOAccess()["texIds"]["metallicRoughnessId"], &image_id_write);
 		_material_ubos->set(mat_id, StaticUBOAccess()["samplerIds"]["metallicRoughnessId"], &sampler_id_write);
 	}
 
+	// how finely the compact vertex layout has to resolve the uvs of each material, see set_objects
+	_material_texture_sizes.assign(materials_res.size(), 0);
+	for (uint32_t mat_id = 0; mat_id < materials_res.size(); ++mat_id) {
+		const MaterialData& mat_data = *materials_res[mat_id];
+		for (int tex_id : { mat_data.base_color_id, mat_data.normal_id, mat_data.metallic_roughness_id, mat_data.occlusion_id, mat_data.emissive_id }) {
+			int img_id = tex_id >= 0 ? textures_res[tex_id].image_id : -1;
+			if (img_id >= 0) {
+				uint32_t size = (uint32_t)std::max(images_res[img_id]->width, images_res[img_id]->height);
+				_material_texture_sizes[mat_id] = std::max(_material_texture_sizes[mat_id], size);
+			}
+		}
+	}
+
 	// bind ubo 
 	_bindless_material_desc_set->bind_buffer_array(0, _material_ubos->_buf, 0, _material_ubos->_stride, _material_ubos->_n_ubos);
+	// bind the per image min LOD of streamed textures
+	_bindless_material_desc_set->bind_buffer(3, _texture_streamer->min_lod_buffer());
 
 	// wait for async image uploads
 	//for (uint32_t i = 0; i < _images.size(); ++i) {
@@ -410,55 +486,235 @@ bool BindlessDataManager::set_materials(const MaterialResources& mat_res) {
 void BindlessDataManager::set_objects(const SceneGraph& graph, const SceneGraphFlatRefs& graph_refs) {
 	assert(_n_objects == graph_refs.size());
 
-	// build index buffer
-	size_t n_indices_total = 0;
-	std::vector<uint32_t> obj_index_offsets;
-	std::vector<uint32_t> obj_index_counts;
-	for (const ObjectRef& obj_ref : graph_refs) {
-		std::shared_ptr<MeshData> mesh = graph[obj_ref.node_id].renderables[obj_ref.renderable_id].mesh;
-		obj_index_offsets.push_back(n_indices_total);
-		obj_index_counts.push_back(mesh->indices.size());
-		n_indices_total += obj_index_counts.back();
-
-		assert(n_indices_total <= std::numeric_limits<uint32_t>::max());
+	// objects sharing a MeshData share its geometry. Each mesh is uploaded once
+	std::vector<std::shared_ptr<MeshData>> meshes;
+	std::vector<uint32_t> obj_mesh_ids;
+	std::vector<PipelineVariant> mesh_variants;
+	{
+		std::map<const MeshData*, uint32_t> mesh_ids;
+		for (const ObjectRef& obj_ref : graph_refs) {
+			std::shared_ptr<MeshData> mesh = graph[obj_ref.node_id].renderables[obj_ref.renderable_id].mesh;
+			auto iter = mesh_ids.find(mesh.get());
+			if (iter == mesh_ids.end()) {
+				iter = mesh_ids.insert({ mesh.get(), (uint32_t)meshes.size() }).first;
+				meshes.push_back(mesh);
+				mesh_variants.push_back(obj_ref.pipeline_variant);
+			}
+			// the pipeline variant comes from the material, which is per primitive as well
+			assert(mesh_variants[iter->second] == obj_ref.pipeline_variant);
+			obj_mesh_ids.push_back(iter->second);
+		}
 	}
+	std::cout << graph_refs.size() << " objects, " << meshes.size() << " unique meshes" << std::endl;
+
+	// meshlets, one range per mesh. Meshes that did not go through MeshOptimizer get theirs here, before the indices are uploaded
+	std::vector<uint32_t> mesh_first_meshlets;
+	std::vector<Meshlet> meshlets;
+	for (std::shared_ptr<MeshData> mesh : meshes) {
+		if (mesh->meshlets.empty()) {
+			MeshOptimizer::build_meshlets(*mesh);
+		}
+		mesh_first_meshlets.push_back(meshlets.size());
+		meshlets.insert(meshlets.end(), mesh->meshlets.begin(), mesh->meshlets.end());
+	}
+	_mesh_preprocessor->set_meshlets(meshlets);
+	std::cout << meshlets.size() << " meshlets" << std::endl;
+
+	// build index buffers. each mesh goes to the pool of its index width, its coarser LODs right behind it
+	std::vector<uint32_t> mesh_index_offsets;
+	std::vector<uint32_t> mesh_index_counts;
+	std::vector<IndexWidth> mesh_index_widths;
+	std::vector<std::vector<uint32_t>> mesh_lod_offsets(meshes.size());
+	std::vector<uint16_t> indices16;
+	std::vector<uint32_t> indices32;
+	for (uint32_t mesh_id = 0; mesh_id < meshes.size(); ++mesh_id) {
+		const MeshData& mesh = *meshes[mesh_id];
+		IndexWidth width = index_width(mesh);
+		mesh_index_widths.push_back(width);
+		mesh_index_counts.push_back(mesh.indices.size());
+		if (width == IndexWidth::U16) {
+			mesh_index_offsets.push_back(indices16.size());
+			indices16.insert(indices16.end(), mesh.indices.begin(), mesh.indices.end());
+			for (const MeshLod& lod : mesh.lods) {
+				mesh_lod_offsets[mesh_id].push_back(indices16.size());
+				indices16.insert(indices16.end(), lod.indices.begin(), lod.indices.end());
+			}
+		}
+		else {
+			mesh_index_offsets.push_back(indices32.size());
+			indices32.insert(indices32.end(), mesh.indices.begin(), mesh.indices.end());
+			for (const MeshLod& lod : mesh.lods) {
+				mesh_lod_offsets[mesh_id].push_back(indices32.size());
+				indices32.insert(indices32.end(), lod.indices.begin(), lod.indices.end());
+			}
+		}
 
-	std::vector<uint16_t> indices;
-	indices.reserve(n_indices_total);
-
-	for (const ObjectRef& obj_ref : graph_refs) {
-		std::shared_ptr<MeshData> mesh = graph[obj_ref.node_id].renderables[obj_ref.renderable_id].mesh;
-		indices.insert(indices.end(), mesh->indices.begin(), mesh->indices.end());
+		assert(indices16.size() <= std::numeric_limits<uint32_t>::max());
+		assert(indices32.size() <= std::numeric_limits<uint32_t>::max());
 	}
-	{
+
+	auto build_index_buffer = [](const void* data, size_t size) {
 		otcv::BufferBuilder ibb;
-		ibb.size(indices.size() * sizeof(uint16_t))
+		ibb.size(size)
 			.usage(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)
 			.host_access(otcv::BufferBuilder::Access::Invisible);
-		_ib = new otcv::Buffer(ibb);
-		_ib->populate_async(indices.data(), otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::IndexRead, otcv::ResourceState::Created);
+		otcv::Buffer* ib = new otcv::Buffer(ibb);
+		ib->populate_async(data, otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::IndexRead, otcv::ResourceState::Created);
+		return ib;
+	};
+	if (!indices16.empty()) {
+		_ibs[(uint32_t)IndexWidth::U16] = build_index_buffer(indices16.data(), indices16.size() * sizeof(uint16_t));
+	}
+	if (!indices32.empty()) {
+		_ibs[(uint32_t)IndexWidth::U32] = build_index_buffer(indices32.data(), indices32.size() * sizeof(uint32_t));
 	}
+	std::cout << indices16.size() << " 16 bit indices, " << indices32.size() << " 32 bit indices" << std::endl;
 
 	// build vertex buffer
-	std::vector<int> obj_vertex_offsets;
-	std::vector<uint32_t> obj_vertex_counts;
+	std::vector<int> mesh_vertex_offsets;
+	std::vector<uint32_t> mesh_vertex_counts;
 	size_t n_vertices_total = 0;
-	for (const ObjectRef& obj_ref : graph_refs) {
-		std::shared_ptr<MeshData> mesh = graph[obj_ref.node_id].renderables[obj_ref.renderable_id].mesh;
+	for (std::shared_ptr<MeshData> mesh : meshes) {
 		// sanity checks
 		assert(!mesh->positions.empty());
 		assert(mesh->positions.size() == mesh->normals.size() || mesh->normals.empty());
 		assert(mesh->positions.size() == mesh->uv0.size() || mesh->uv0.empty());
 		assert(mesh->positions.size() == mesh->tangents.size() || mesh->tangents.empty());
 
-		obj_vertex_offsets.push_back(n_vertices_total);
-		obj_vertex_counts.push_back(mesh->positions.size());
+		mesh_vertex_offsets.push_back(n_vertices_total);
+		mesh_vertex_counts.push_back(mesh->positions.size());
 		n_vertices_total += mesh->positions.size();
 
 		// should not overflow
 		assert(n_vertices_total <= std::numeric_limits<int>::max());
 	}
 
+	// compact vertices are quantized to the bounds of their mesh, dequantized through the object ubo
+	std::vector<VertexPacking::Dequantization> mesh_position_dqs(meshes.size());
+	std::vector<VertexPacking::Dequantization> mesh_uv_dqs(meshes.size());
+	if (_vertex_layout == VertexLayout::Compact) {
+		std::vector<uint32_t> mesh_texture_sizes(meshes.size(), 0);
+		for (uint32_t obj_id = 0; obj_id < graph_refs.size(); ++obj_id) {
+			int mat_id = graph[graph_refs[obj_id].node_id].renderables[graph_refs[obj_id].renderable_id].material_id;
+			if (mat_id >= 0 && mat_id < (int)_material_texture_sizes.size()) {
+				uint32_t& size = mesh_texture_sizes[obj_mesh_ids[obj_id]];
+				size = std::max(size, _material_texture_sizes[mat_id]);
+			}
+		}
+		build_compact_vertex_buffer(meshes, mesh_texture_sizes, n_vertices_total, mesh_position_dqs, mesh_uv_dqs);
+	}
+	else {
+		build_float_vertex_buffer(meshes, n_vertices_total);
+	}
+
+	// aabbs, one per mesh. Baked scenes already carry them
+	bool aabbs_valid = std::all_of(meshes.begin(), meshes.end(), [](const std::shared_ptr<MeshData>& mesh) {
+		return mesh->aabb_valid;
+	});
+	if (aabbs_valid) {
+		std::vector<AABB> aabbs;
+		for (std::shared_ptr<MeshData> mesh : meshes) {
+			aabbs.push_back(mesh->aabb);
+		}
+		_mesh_preprocessor->set_aabb(aabbs);
+	}
+	else {
+		std::vector<uint32_t> mesh_vertex_offsets_uint;
+		mesh_vertex_offsets_uint.insert(mesh_vertex_offsets_uint.begin(), mesh_vertex_offsets.begin(), mesh_vertex_offsets.end());
+		_mesh_preprocessor->generate_aabb(
+			_vb->buffers[0],
+			mesh_vertex_offsets_uint,
+			mesh_vertex_counts,
+			otcv::ResourceState::ComputeSSBORead,
+			otcv::ResourceState::VertexRead,
+			otcv::ResourceState::ComputeSSBORead);
+	}
+
+	// spheres and obbs for culling, see SceneCulling::create_object_buffer_context
+	for (std::shared_ptr<MeshData> mesh : meshes) {
+		if (!mesh->volumes_valid) {
+			Bounds::compute_volumes(*mesh);
+		}
+	}
+	_scene_aabb = Bounds::world_aabb(graph, graph_refs);
+
+	// build object ubos
+	Std140AlignmentType ObjectUBO;
+	ObjectUBO.add(Std140AlignmentType::InlineType::Mat4, "model");
+	ObjectUBO.add(Std140AlignmentType::InlineType::Int, "matId");
+	ObjectUBO.add(Std140AlignmentType::InlineType::Vec4, "positionOffset");
+	ObjectUBO.add(Std140AlignmentType::InlineType::Vec4, "positionScale");
+	ObjectUBO.add(Std140AlignmentType::InlineType::Vec4, "uvTransform");
+	_object_ubos.reset(new StaticUBOArray(ObjectUBO, graph_refs.size(), _ubo_alignment));
+	// upload object data to ubo
+	for (uint32_t obj_id = 0; obj_id < graph_refs.size(); ++obj_id) {
+		glm::mat4 model = graph[graph_refs[obj_id].node_id].world_transform;
+		_object_ubos->set(obj_id, StaticUBOAccess()["model"], &model);
+		int mat_id = graph[graph_refs[obj_id].node_id].renderables[graph_refs[obj_id].renderable_id].material_id;
+		_object_ubos->set(obj_id, StaticUBOAccess()["matId"], &mat_id);
+		const VertexPacking::Dequantization& position_dq = mesh_position_dqs[obj_mesh_ids[obj_id]];
+		const VertexPacking::Dequantization& uv_dq = mesh_uv_dqs[obj_mesh_ids[obj_id]];
+		glm::vec4 position_offset(position_dq.offset, 0.0f);
+		glm::vec4 position_scale(position_dq.scale, 0.0f);
+		glm::vec4 uv_transform(uv_dq.offset.x, uv_dq.offset.y, uv_dq.scale.x, uv_dq.scale.y);
+		_object_ubos->set(obj_id, StaticUBOAccess()["positionOffset"], &position_offset);
+		_object_ubos->set(obj_id, StaticUBOAccess()["positionScale"], &position_scale);
+		_object_ubos->set(obj_id, StaticUBOAccess()["uvTransform"], &uv_transform);
+	}
+	// bind object ubo
+	_bindless_object_desc_set->bind_buffer_array(0, _object_ubos->_buf, 0, _object_ubos->_stride, _object_ubos->_n_ubos);
+
+	// instanced draws. Each mesh owns one indirect command slot per LOD in the bucket of its (pipeline variant, index
+	// width), and per LOD a contiguous range of the instance buffer with one entry per object using it
+	std::vector<uint32_t> mesh_draw_slots(meshes.size());
+	std::vector<uint32_t> mesh_first_instances(meshes.size());
+	std::vector<uint32_t> mesh_instance_counts(meshes.size(), 0);
+	{
+		for (uint32_t mesh_id : obj_mesh_ids) {
+			++mesh_instance_counts[mesh_id];
+		}
+		uint32_t n_slots[(uint32_t)PipelineVariant::All][(uint32_t)IndexWidth::All] = {};
+		uint32_t n_instances = 0;
+		for (uint32_t mesh_id = 0; mesh_id < meshes.size(); ++mesh_id) {
+			uint32_t n_lods = lod_count(*meshes[mesh_id]);
+			uint32_t& n_bucket_slots = n_slots[(uint32_t)mesh_variants[mesh_id]][(uint32_t)mesh_index_widths[mesh_id]];
+			mesh_draw_slots[mesh_id] = n_bucket_slots;
+			n_bucket_slots += n_lods;
+			mesh_first_instances[mesh_id] = n_instances;
+			n_instances += mesh_instance_counts[mesh_id] * n_lods;
+		}
+	}
+
+	// Build data segment
+	assert(obj_mesh_ids.size() == graph_refs.size());
+	for (uint32_t i = 0; i < obj_mesh_ids.size(); ++i) {
+		uint32_t mesh_id = obj_mesh_ids[i];
+		ObjectDataSegment segment;
+		segment.index_start = mesh_index_offsets[mesh_id];
+		segment.index_count = mesh_index_counts[mesh_id];
+		segment.vertex_start = mesh_vertex_offsets[mesh_id];
+		segment.index_width = mesh_index_widths[mesh_id];
+		segment.mesh_id = mesh_id;
+		segment.draw_slot = mesh_draw_slots[mesh_id];
+		segment.first_instance = mesh_first_instances[mesh_id];
+		segment.instance_count = mesh_instance_counts[mesh_id];
+		segment.first_meshlet = mesh_first_meshlets[mesh_id];
+		segment.meshlet_count = meshes[mesh_id]->meshlets.size();
+		// level 0 is the full mesh
+		const std::vector<MeshLod>& lods = meshes[mesh_id]->lods;
+		segment.lod_count = lod_count(*meshes[mesh_id]);
+		for (uint32_t lod = 0; lod < MeshLod::max_lods; ++lod) {
+			uint32_t level = std::min(lod, segment.lod_count - 1);
+			segment.lod_index_starts[lod] = level == 0 ? segment.index_start : mesh_lod_offsets[mesh_id][level - 1];
+			segment.lod_index_counts[lod] = level == 0 ? segment.index_count : lods[level - 1].indices.size();
+			segment.lod_errors[lod] = level == 0 ? 0.0f : lods[level - 1].error;
+		}
+		_object_data_segment.push_back(segment);
+	}
+
+}
+
+void BindlessDataManager::build_float_vertex_buffer(const std::vector<std::shared_ptr<MeshData>>& meshes, size_t n_vertices_total) {
 	std::vector<glm::vec3> positions;
 	positions.reserve(n_vertices_total);
 	std::vector<glm::vec3> normals;
@@ -468,8 +724,7 @@ void BindlessDataManager::set_objects(const SceneGraph& graph, const SceneGraphF
 	std::vector<glm::vec4> tangents;
 	tangents.reserve(n_vertices_total);
 
-	for (const ObjectRef& obj_ref : graph_refs) {
-		std::shared_ptr<MeshData> mesh = graph[obj_ref.node_id].renderables[obj_ref.renderable_id].mesh;
+	for (std::shared_ptr<MeshData> mesh : meshes) {
 		uint32_t n_vertices = mesh->positions.size();
 		// position
 		positions.insert(positions.end(), mesh->positions.begin(), mesh->positions.end());
@@ -541,56 +796,78 @@ void BindlessDataManager::set_objects(const SceneGraph& graph, const SceneGraphF
 		_vb->buffers[2]->populate_async(uv0.data(), otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::VertexRead, otcv::ResourceState::Created);
 		_vb->buffers[3]->populate_async(tangents.data(), otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::VertexRead, otcv::ResourceState::Created);
 	}
+}
 
-	// test: print out CPU aabb 
-	//for (uint32_t i = 0; i < _n_objects; ++i) {
-	//	glm::vec3 min(std::numeric_limits<float>::max());
-	//	glm::vec3 max(std::numeric_limits<float>::lowest());
-	//	uint32_t vertex_count = obj_vertex_counts[i];
-	//	uint32_t vertex_offset = obj_vertex_offsets[i];
-	//	for (uint32_t v = 0; v < vertex_count; ++v) {
-	//		min = glm::min(positions[v + vertex_offset], min);
-	//		max = glm::max(positions[v + vertex_offset], max);
-	//	}
-	//	std::cout << i <<  " min = " << min.x << ", " << min.y << ", " << min.z << "\t";
-	//	std::cout << "max = " << max.x << ", " << max.y << ", " << max.z << std::endl;
-	//}
-
-	// generate aabbs
-	std::vector<uint32_t> obj_vertex_offsets_uint;
-	obj_vertex_offsets_uint.insert(obj_vertex_offsets_uint.begin(), obj_vertex_offsets.begin(), obj_vertex_offsets.end());
-	_mesh_preprocessor->generate_aabb(
-		_vb->buffers[0],
-		obj_vertex_offsets_uint,
-		obj_vertex_counts,
-		otcv::ResourceState::ComputeSSBORead,
-		otcv::ResourceState::VertexRead,
-		otcv::ResourceState::ComputeSSBORead);
-
-	// build object ubos
-	Std140AlignmentType ObjectUBO;
-	ObjectUBO.add(Std140AlignmentType::InlineType::Mat4, "model");
-	ObjectUBO.add(Std140AlignmentType::InlineType::Int, "matId");
-	_object_ubos.reset(new StaticUBOArray(ObjectUBO, graph_refs.size(), _ubo_alignment));
-	// upload object data to ubo
-	for (uint32_t obj_id = 0; obj_id < graph_refs.size(); ++obj_id) {
-		glm::mat4 model = graph[graph_refs[obj_id].node_id].world_transform;
-		_object_ubos->set(obj_id, StaticUBOAccess()["model"], &model);
-		int mat_id = graph[graph_refs[obj_id].node_id].renderables[graph_refs[obj_id].renderable_id].material_id;
-		_object_ubos->set(obj_id, StaticUBOAccess()["matId"], &mat_id);
+void BindlessDataManager::build_compact_vertex_buffer(
+	const std::vector<std::shared_ptr<MeshData>>& meshes,
+	const std::vector<uint32_t>& mesh_texture_sizes,
+	size_t n_vertices_total,
+	std::vector<VertexPacking::Dequantization>& mesh_position_dqs,
+	std::vector<VertexPacking::Dequantization>& mesh_uv_dqs) {
+
+	std::vector<uint16_t> positions;
+	positions.reserve(n_vertices_total * 4);
+	std::vector<int16_t> tangent_frames;
+	tangent_frames.reserve(n_vertices_total * 4);
+	std::vector<uint16_t> uv0;
+	uv0.reserve(n_vertices_total * 2);
+
+	for (uint32_t mesh_id = 0; mesh_id < meshes.size(); ++mesh_id) {
+		MeshData& mesh = *meshes[mesh_id];
+		uint32_t n_vertices = mesh.positions.size();
+		// also lets MeshPreprocessor skip the GPU AABB pass, the positions are no longer float
+		if (!mesh.aabb_valid) {
+			Bounds::compute_aabb(mesh);
+		}
+		mesh_position_dqs[mesh_id] = VertexPacking::position_dequantization(mesh.aabb);
+		size_t first_position = positions.size();
+		VertexPacking::pack_positions(mesh.positions, mesh_position_dqs[mesh_id], positions);
+		VertexPacking::pack_tangent_frames(mesh.normals, mesh.tangents, n_vertices, tangent_frames);
+		// each mesh gets the precision of its own uv bounds, 24 bits hold all but the most extreme tiling to a texel
+		mesh_uv_dqs[mesh_id] = VertexPacking::uv_dequantization(mesh.uv0);
+		if (!VertexPacking::uvs_fit(mesh_uv_dqs[mesh_id], mesh_texture_sizes[mesh_id])) {
+			std::cout << "mesh " << mesh_id << " tiles its uvs too often to be held to a texel" << std::endl;
+		}
+		VertexPacking::pack_uvs(mesh.uv0, n_vertices, mesh_uv_dqs[mesh_id], uv0, positions.data() + first_position + 3);
 	}
-	// bind object ubo
-	_bindless_object_desc_set->bind_buffer_array(0, _object_ubos->_buf, 0, _object_ubos->_stride, _object_ubos->_n_ubos);
 
-	// Build data segment
-	assert(obj_index_counts.size() == obj_vertex_offsets.size());
-	assert(obj_index_offsets.size() == obj_vertex_offsets.size());
-	for (uint32_t i = 0; i < obj_index_counts.size(); ++i) {
-		ObjectDataSegment segment;
-		segment.index_start = obj_index_offsets[i];
-		segment.index_count = obj_index_counts[i];
-		segment.vertex_start = obj_vertex_offsets[i];
-		_object_data_segment.push_back(segment);
+	{
+		otcv::VertexBufferBuilder vb_builder;
+		{
+			// position
+			otcv::BufferBuilder b_builder;
+			b_builder
+				.size(positions.size() * sizeof(uint16_t))
+				.usage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+				.host_access(otcv::BufferBuilder::Access::Invisible);
+			vb_builder.add_binding(b_builder);
+			vb_builder.add_attribute(0, VK_FORMAT_R16G16B16A16_UNORM, 4 * sizeof(uint16_t));
+		}
+		{
+			// normal and tangent
+			otcv::BufferBuilder b_builder;
+			b_builder
+				.size(tangent_frames.size() * sizeof(int16_t))
+				.usage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+				.host_access(otcv::BufferBuilder::Access::Invisible);
+			vb_builder.add_binding(b_builder);
+			vb_builder.add_attribute(1, VK_FORMAT_R16G16B16A16_SNORM, 4 * sizeof(int16_t));
+		}
+		{
+			// uv0
+			otcv::BufferBuilder b_builder;
+			b_builder
+				.size(uv0.size() * sizeof(uint16_t))
+				.usage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+				.host_access(otcv::BufferBuilder::Access::Invisible);
+			vb_builder.add_binding(b_builder);
+			vb_builder.add_attribute(2, VK_FORMAT_R16G16_UNORM, 2 * sizeof(uint16_t));
+		}
+		_vb = new otcv::VertexBuffer(vb_builder);
+		_vb->buffers[0]->populate_async(positions.data(), otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::VertexRead, otcv::ResourceState::Created);
+		_vb->buffers[1]->populate_async(tangent_frames.data(), otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::VertexRead, otcv::ResourceState::Created);
+		_vb->buffers[2]->populate_async(uv0.data(), otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::VertexRead, otcv::ResourceState::Created);
 	}
-
-}
\ No newline at end of file
+	std::cout << n_vertices_total << " compact vertices, "
+		<< (positions.size() + tangent_frames.size() + uv0.size()) * sizeof(uint16_t) << " bytes" << std::endl;
+}
@@ -5,6 +5,10 @@
 #include "static_ubo.h"
 #include "expandable_descriptor_pool.h"
 #include "mesh_preprocessor.h"
+#include "image_levels.h"
+#include "texture_streamer.h"
+#include "shared_object_cache.h"
+#include "vertex_packing.h"
 
 #include <map>
 #include <vector>
@@ -40,11 +44,42 @@ public:
 	void set_objects(const SceneGraph& graph, const SceneGraphFlatRefs& graph_refs);
 
 	struct ObjectDataSegment {
-		uint32_t index_start;
+		uint32_t index_start; // relative to the index buffer of index_width
 		uint32_t index_count;
 		int vertex_start;
+		IndexWidth index_width;
+		uint32_t mesh_id; // objects sharing a mesh are drawn by one instanced command
+		uint32_t draw_slot; // first command slot of the mesh within its bucket, followed by one per further LOD
+		uint32_t first_instance; // start of the mesh's ranges in the instance buffer, one per LOD
+		uint32_t instance_count; // objects sharing the mesh, the length of each of its ranges
+		uint32_t first_meshlet; // into MeshPreprocessor::meshlet_SSBO()
+		uint32_t meshlet_count;
+		// level 0 is the full mesh. Unused levels repeat the last one
+		uint32_t lod_count;
+		uint32_t lod_index_starts[MeshLod::max_lods]; // relative to the index buffer of index_width
+		uint32_t lod_index_counts[MeshLod::max_lods];
+		float lod_errors[MeshLod::max_lods]; // in mesh units
 	};
+
+	// once per frame before recording, see TextureStreamer::update
+	void stream_textures() {
+		_texture_streamer->update();
+	}
+
+	// null if no object uses this index width
+	otcv::Buffer* index_buffer(IndexWidth width) {
+		return _ibs[(uint32_t)width];
+	}
+
+	static VkIndexType index_type(IndexWidth width) {
+		return width == IndexWidth::U16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	}
 	
+	// vertex input state of the geometry pipelines for _vertex_layout
+	void add_vertex_attributes(otcv::VertexBufferBuilder& vbb) const;
+	// binding 0 only, for depth only passes. Dequantized with positionOffset and positionScale of the object ubo
+	void add_position_attribute(otcv::VertexBufferBuilder& vbb) const;
+
 	otcv::DescriptorSetLayout* frame_descriptor_set_layout() {
 		return _pipeline_bins.begin()->second->desc_set_layouts[DescriptorSetRate::PerFrame];
 	}
@@ -55,16 +90,26 @@ public:
 	uint32_t _n_images;
 	uint32_t _n_samplers;
 
+#ifdef BINDLESS_COMPACT_VERTEX_LAYOUT
+	const VertexLayout _vertex_layout = VertexLayout::Compact;
+#else
+	const VertexLayout _vertex_layout = VertexLayout::Float;
+#endif
 	otcv::VertexBuffer* _vb;
-	otcv::Buffer* _ib;
+	// one index buffer per IndexWidth. small meshes keep 16 bit indices, large ones go to the 32 bit pool
+	otcv::Buffer* _ibs[(uint32_t)IndexWidth::All] = {};
 
 	std::vector<ObjectDataSegment> _object_data_segment;
+	// world space, of every object. Set by set_objects
+	AABB _scene_aabb;
 
 	std::shared_ptr<StaticUBOArray> _object_ubos;
 	std::shared_ptr<StaticUBOArray> _material_ubos;
 
 	std::vector<otcv::Image*> _images;
+	// one per unique VkSamplerCreateInfo, owned by _sampler_cache. Indexed by sampler slot
 	std::vector<otcv::Sampler*> _samplers;
+	SamplerCache _sampler_cache;
 
 	std::shared_ptr<NaiveExpandableDescriptorPool> _bindless_desc_pool;
 	otcv::DescriptorSet* _bindless_object_desc_set;
@@ -72,25 +117,55 @@ public:
 
 	std::map<PipelineVariant, otcv::GraphicsPipeline*> _pipeline_bins;
 	otcv::ShaderBlob _geometry_shader_blob;
+	// largest image of each material, by width or height. Set by set_materials
+	std::vector<uint32_t> _material_texture_sizes;
 
 	std::shared_ptr<MeshPreprocessor> _mesh_preprocessor;
 
+	// images with pre-built mips start out with the levels up to this size, the rest is streamed in
+	const uint32_t _streaming_resident_size = 128;
+	const size_t _streaming_bytes_per_frame = 8 * 1024 * 1024;
+	std::shared_ptr<TextureStreamer> _texture_streamer;
+
 private:
 
 	void build_all_pipelines(const std::string& geometry_shader_path);
 
 	void build_descriptor_sets();
 
-	VkFormat choose_format(int channels, int bit_depth, bool srgb);
+	void build_float_vertex_buffer(const std::vector<std::shared_ptr<MeshData>>& meshes, size_t n_vertices_total);
+
+	// fills in the dequantization of every mesh. mesh_texture_sizes: largest texture each mesh is sampled with, meshes
+	// whose uvs cannot be held to a texel of it are reported
+	void build_compact_vertex_buffer(
+		const std::vector<std::shared_ptr<MeshData>>& meshes,
+		const std::vector<uint32_t>& mesh_texture_sizes,
+		size_t n_vertices_total,
+		std::vector<VertexPacking::Dequantization>& mesh_position_dqs,
+		std::vector<VertexPacking::Dequantization>& mesh_uv_dqs);
 
-	otcv::Image* upload_image_async(ImageData& img_data, bool srgb, bool swizzle);
+	VkFormat choose_format(int channels, int bit_depth, bool srgb, BlockFormat block_format);
+
+	// images with pre-built mips are queued on level_uploader from first_level on, the rest generate their mips on the GPU
+	otcv::Image* upload_image_async(ImageData& img_data, bool srgb, bool swizzle, ImageLevelUploader& level_uploader, uint32_t first_level);
+
+	static constexpr uint32_t block_format_key(BlockFormat block_format) {
+		return (uint32_t)block_format << 8;
+	}
 
-	// pack(channels, bit_depth) | color_space, VkFormat
+	// pack(channels, bit_depth) | block_format | color_space, VkFormat
 	const std::map<uint32_t, VkFormat> format_lut = {
 	{otcv::pack(4, 8) | 0x8000,	VK_FORMAT_R8G8B8A8_SRGB},
 	{otcv::pack(4, 8),			VK_FORMAT_R8G8B8A8_UNORM},
 	{otcv::pack(3, 8) | 0x8000,	VK_FORMAT_R8G8B8_SRGB},
 	{otcv::pack(3, 8),			VK_FORMAT_R8G8B8_UNORM},
+	{otcv::pack(4, 8) | block_format_key(BlockFormat::BC1) | 0x8000,	VK_FORMAT_BC1_RGB_SRGB_BLOCK},
+	{otcv::pack(4, 8) | block_format_key(BlockFormat::BC1),			VK_FORMAT_BC1_RGB_UNORM_BLOCK},
+	{otcv::pack(4, 8) | block_format_key(BlockFormat::BC3) | 0x8000,	VK_FORMAT_BC3_SRGB_BLOCK},
+	{otcv::pack(4, 8) | block_format_key(BlockFormat::BC3),			VK_FORMAT_BC3_UNORM_BLOCK},
+	{otcv::pack(4, 8) | block_format_key(BlockFormat::BC5),			VK_FORMAT_BC5_UNORM_BLOCK},
+	{otcv::pack(4, 8) | block_format_key(BlockFormat::BC7) | 0x8000,	VK_FORMAT_BC7_SRGB_BLOCK},
+	{otcv::pack(4, 8) | block_format_key(BlockFormat::BC7),			VK_FORMAT_BC7_UNORM_BLOCK},
 	};
 
 };
@@ -0,0 +1,412 @@
+#include "block_compress.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+uint32_t BlockCompress::block_size(BlockFormat format) {
+	switch (format) {
+	case BlockFormat::BC1:
+		return 8;
+	case BlockFormat::BC3:
+	case BlockFormat::BC5:
+	case BlockFormat::BC7:
+		return 16;
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+size_t BlockCompress::level_size(BlockFormat format, uint32_t width, uint32_t height) {
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_size(format);
+}
+
+void BlockCompress::encode_level(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* dst) {
+	uint32_t stride = block_size(format);
+	uint8_t block[16][4];
+	for (uint32_t by = 0; by < height; by += 4) {
+		for (uint32_t bx = 0; bx < width; bx += 4) {
+			for (uint32_t i = 0; i < 16; ++i) {
+				uint32_t x = std::min(bx + i % 4, width - 1);
+				uint32_t y = std::min(by + i / 4, height - 1);
+				std::memcpy(block[i], rgba + ((size_t)y * width + x) * 4, 4);
+			}
+			switch (format) {
+			case BlockFormat::BC1:
+				encode_bc1(block, dst);
+				break;
+			case BlockFormat::BC3:
+				encode_bc3(block, dst);
+				break;
+			case BlockFormat::BC5:
+				encode_bc5(block, dst);
+				break;
+			case BlockFormat::BC7:
+				encode_bc7(block, dst);
+				break;
+			default:
+				assert(false);
+			}
+			dst += stride;
+		}
+	}
+}
+
+void BlockCompress::compress(ImageData& image, BlockFormat format) {
+	assert(image.block_format == BlockFormat::None && image.channels == 4 && image.bit_depth == 8);
+	assert(!image.mips.empty());
+
+	std::vector<MipLevel> levels;
+	size_t total_size = 0;
+	for (const MipLevel& src : image.mips) {
+		MipLevel level = { src.width, src.height, total_size, level_size(format, src.width, src.height) };
+		total_size += level.size;
+		levels.push_back(level);
+	}
+
+	std::vector<uint8_t> blocks(total_size);
+	for (uint32_t i = 0; i < levels.size(); ++i) {
+		encode_level(format, image.pixel_data.data() + image.mips[i].offset, levels[i].width, levels[i].height, blocks.data() + levels[i].offset);
+	}
+
+	image.pixel_data = std::move(blocks);
+	image.mips = std::move(levels);
+	image.block_format = format;
+}
+
+// dominant direction of the texels around their mean, by power iteration on the covariance.
+// Returns false if the block is a single color
+template<uint32_t N>
+static bool principal_axis(const uint8_t block[16][4], float mean[N], float axis[N]) {
+	for (uint32_t c = 0; c < N; ++c) {
+		mean[c] = 0.0f;
+		for (uint32_t i = 0; i < 16; ++i) {
+			mean[c] += block[i][c];
+		}
+		mean[c] /= 16.0f;
+	}
+	float cov[N][N] = {};
+	for (uint32_t i = 0; i < 16; ++i) {
+		for (uint32_t r = 0; r < N; ++r) {
+			for (uint32_t c = 0; c < N; ++c) {
+				cov[r][c] += (block[i][r] - mean[r]) * (block[i][c] - mean[c]);
+			}
+		}
+	}
+	for (uint32_t c = 0; c < N; ++c) {
+		axis[c] = 1.0f;
+	}
+	float length = 0.0f;
+	for (uint32_t iter = 0; iter < 8; ++iter) {
+		float next[N] = {};
+		for (uint32_t r = 0; r < N; ++r) {
+			for (uint32_t c = 0; c < N; ++c) {
+				next[r] += cov[r][c] * axis[c];
+			}
+		}
+		length = 0.0f;
+		for (uint32_t c = 0; c < N; ++c) {
+			length = std::max(length, std::fabs(next[c]));
+		}
+		if (length < 1e-6f) {
+			return false;
+		}
+		for (uint32_t c = 0; c < N; ++c) {
+			axis[c] = next[c] / length;
+		}
+	}
+	return true;
+}
+
+// endpoints of the texels projected onto the principal axis
+template<uint32_t N>
+static void fit_endpoints(const uint8_t block[16][4], float lo[N], float hi[N]) {
+	float mean[N];
+	float axis[N];
+	if (!principal_axis<N>(block, mean, axis)) {
+		for (uint32_t c = 0; c < N; ++c) {
+			lo[c] = hi[c] = mean[c];
+		}
+		return;
+	}
+	float t_min = std::numeric_limits<float>::max();
+	float t_max = std::numeric_limits<float>::lowest();
+	float axis_length2 = 0.0f;
+	for (uint32_t c = 0; c < N; ++c) {
+		axis_length2 += axis[c] * axis[c];
+	}
+	for (uint32_t i = 0; i < 16; ++i) {
+		float t = 0.0f;
+		for (uint32_t c = 0; c < N; ++c) {
+			t += (block[i][c] - mean[c]) * axis[c];
+		}
+		t_min = std::min(t_min, t);
+		t_max = std::max(t_max, t);
+	}
+	for (uint32_t c = 0; c < N; ++c) {
+		lo[c] = std::min(std::max(mean[c] + axis[c] * t_min / axis_length2, 0.0f), 255.0f);
+		hi[c] = std::min(std::max(mean[c] + axis[c] * t_max / axis_length2, 0.0f), 255.0f);
+	}
+}
+
+static uint16_t to_565(const float c[3]) {
+	uint32_t r = (uint32_t)std::lround(c[0] * 31.0f / 255.0f);
+	uint32_t g = (uint32_t)std::lround(c[1] * 63.0f / 255.0f);
+	uint32_t b = (uint32_t)std::lround(c[2] * 31.0f / 255.0f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void from_565(uint16_t c, int rgb[3]) {
+	uint32_t r = (c >> 11) & 31;
+	uint32_t g = (c >> 5) & 63;
+	uint32_t b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+void BlockCompress::encode_bc1(const uint8_t block[16][4], uint8_t* dst) {
+	float lo[3];
+	float hi[3];
+	fit_endpoints<3>(block, lo, hi);
+	uint16_t c0 = to_565(hi);
+	uint16_t c1 = to_565(lo);
+	// c0 > c1 selects the 4 color mode
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		int palette[4][3];
+		from_565(c0, palette[0]);
+		from_565(c1, palette[1]);
+		for (uint32_t c = 0; c < 3; ++c) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (uint32_t i = 0; i < 16; ++i) {
+			uint32_t best = 0;
+			int best_error = std::numeric_limits<int>::max();
+			for (uint32_t p = 0; p < 4; ++p) {
+				int error = 0;
+				for (uint32_t c = 0; c < 3; ++c) {
+					int d = palette[p][c] - block[i][c];
+					error += d * d;
+				}
+				if (error < best_error) {
+					best_error = error;
+					best = p;
+				}
+			}
+			indices |= best << (2 * i);
+		}
+	}
+
+	std::memcpy(dst, &c0, 2);
+	std::memcpy(dst + 2, &c1, 2);
+	std::memcpy(dst + 4, &indices, 4);
+}
+
+// single channel block, 8 interpolated values between max and min
+static void encode_bc4(const uint8_t block[16][4], uint32_t channel, uint8_t* dst) {
+	uint8_t a0 = 0;
+	uint8_t a1 = 255;
+	for (uint32_t i = 0; i < 16; ++i) {
+		a0 = std::max(a0, block[i][channel]);
+		a1 = std::min(a1, block[i][channel]);
+	}
+
+	uint64_t indices = 0;
+	if (a0 != a1) {
+		int palette[8];
+		palette[0] = a0;
+		palette[1] = a1;
+		for (uint32_t p = 2; p < 8; ++p) {
+			palette[p] = ((8 - p) * a0 + (p - 1) * a1) / 7;
+		}
+		for (uint32_t i = 0; i < 16; ++i) {
+			uint64_t best = 0;
+			int best_error = std::numeric_limits<int>::max();
+			for (uint32_t p = 0; p < 8; ++p) {
+				int error = std::abs(palette[p] - block[i][channel]);
+				if (error < best_error) {
+					best_error = error;
+					best = p;
+				}
+			}
+			indices |= best << (3 * i);
+		}
+	}
+
+	dst[0] = a0;
+	dst[1] = a1;
+	for (uint32_t i = 0; i < 6; ++i) {
+		dst[2 + i] = (uint8_t)(indices >> (8 * i));
+	}
+}
+
+void BlockCompress::encode_bc3(const uint8_t block[16][4], uint8_t* dst) {
+	encode_bc4(block, 3, dst);
+	encode_bc1(block, dst + 8);
+}
+
+void BlockCompress::encode_bc5(const uint8_t block[16][4], uint8_t* dst) {
+	encode_bc4(block, 0, dst);
+	encode_bc4(block, 1, dst + 8);
+}
+
+namespace {
+
+const int bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// mode 6 endpoint: 7 bits per channel plus a shared p-bit
+struct Bc7Endpoint {
+	uint32_t q[4];
+	uint32_t p;
+
+	int value(uint32_t c) const {
+		return (int)((q[c] << 1) | p);
+	}
+};
+
+class BitWriter {
+public:
+	void put(uint32_t value, uint32_t n_bits) {
+		for (uint32_t i = 0; i < n_bits; ++i, ++_pos) {
+			if (value & (1u << i)) {
+				_bytes[_pos / 8] |= (uint8_t)(1u << (_pos % 8));
+			}
+		}
+	}
+
+	const uint8_t* bytes() const { return _bytes; }
+
+private:
+	uint8_t _bytes[16] = {};
+	uint32_t _pos = 0;
+};
+
+}
+
+static Bc7Endpoint quantize_bc7_endpoint(const float v[4]) {
+	Bc7Endpoint best = {};
+	float best_error = std::numeric_limits<float>::max();
+	for (uint32_t p = 0; p < 2; ++p) {
+		Bc7Endpoint e;
+		e.p = p;
+		float error = 0.0f;
+		for (uint32_t c = 0; c < 4; ++c) {
+			e.q[c] = (uint32_t)std::min(std::max(std::lround((v[c] - p) / 2.0f), 0l), 127l);
+			float d = e.value(c) - v[c];
+			error += d * d;
+		}
+		if (error < best_error) {
+			best_error = error;
+			best = e;
+		}
+	}
+	return best;
+}
+
+// picks the closest of the 16 interpolated colors per texel. Returns the total squared error
+static int select_bc7_indices(const uint8_t block[16][4], const Bc7Endpoint& e0, const Bc7Endpoint& e1, uint32_t indices[16]) {
+	int palette[16][4];
+	for (uint32_t w = 0; w < 16; ++w) {
+		for (uint32_t c = 0; c < 4; ++c) {
+			palette[w][c] = ((64 - bc7_weights4[w]) * e0.value(c) + bc7_weights4[w] * e1.value(c) + 32) >> 6;
+		}
+	}
+	int total_error = 0;
+	for (uint32_t i = 0; i < 16; ++i) {
+		int best_error = std::numeric_limits<int>::max();
+		for (uint32_t w = 0; w < 16; ++w) {
+			int error = 0;
+			for (uint32_t c = 0; c < 4; ++c) {
+				int d = palette[w][c] - block[i][c];
+				error += d * d;
+			}
+			if (error < best_error) {
+				best_error = error;
+				indices[i] = w;
+			}
+		}
+		total_error += best_error;
+	}
+	return total_error;
+}
+
+// least squares endpoints for fixed indices. Returns false if all texels use the same weight
+static bool refit_bc7_endpoints(const uint8_t block[16][4], const uint32_t indices[16], float lo[4], float hi[4]) {
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {};
+	float bx[4] = {};
+	for (uint32_t i = 0; i < 16; ++i) {
+		float t = bc7_weights4[indices[i]] / 64.0f;
+		float a = 1.0f - t;
+		aa += a * a;
+		ab += a * t;
+		bb += t * t;
+		for (uint32_t c = 0; c < 4; ++c) {
+			ax[c] += a * block[i][c];
+			bx[c] += t * block[i][c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (std::fabs(det) < 1e-6f) {
+		return false;
+	}
+	for (uint32_t c = 0; c < 4; ++c) {
+		lo[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / det, 0.0f), 255.0f);
+		hi[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / det, 0.0f), 255.0f);
+	}
+	return true;
+}
+
+void BlockCompress::encode_bc7(const uint8_t block[16][4], uint8_t* dst) {
+	float lo[4];
+	float hi[4];
+	fit_endpoints<4>(block, lo, hi);
+	Bc7Endpoint e0 = quantize_bc7_endpoint(lo);
+	Bc7Endpoint e1 = quantize_bc7_endpoint(hi);
+	uint32_t indices[16];
+	int error = select_bc7_indices(block, e0, e1, indices);
+
+	// one refinement pass, kept only if it helps
+	if (error > 0 && refit_bc7_endpoints(block, indices, lo, hi)) {
+		Bc7Endpoint r0 = quantize_bc7_endpoint(lo);
+		Bc7Endpoint r1 = quantize_bc7_endpoint(hi);
+		uint32_t refit_indices[16];
+		int refit_error = select_bc7_indices(block, r0, r1, refit_indices);
+		if (refit_error < error) {
+			e0 = r0;
+			e1 = r1;
+			std::memcpy(indices, refit_indices, sizeof(indices));
+		}
+	}
+
+	// the anchor index is stored without its top bit
+	if (indices[0] & 8) {
+		std::swap(e0, e1);
+		for (uint32_t& index : indices) {
+			index = 15 - index;
+		}
+	}
+
+	BitWriter bits;
+	bits.put(1u << 6, 7);
+	for (uint32_t c = 0; c < 4; ++c) {
+		bits.put(e0.q[c], 7);
+		bits.put(e1.q[c], 7);
+	}
+	bits.put(e0.p, 1);
+	bits.put(e1.p, 1);
+	bits.put(indices[0], 3);
+	for (uint32_t i = 1; i < 16; ++i) {
+		bits.put(indices[i], 4);
+	}
+	std::memcpy(dst, bits.bytes(), 16);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+
+#include <cstdint>
+#include <cstddef>
+
+// CPU encoders for the BCn formats of ImageData::block_format. Inputs are rgba8 texels
+struct BlockCompress {
+	// bytes per 4x4 block
+	static uint32_t block_size(BlockFormat format);
+
+	// bytes of a width x height level, partial blocks rounded up
+	static size_t level_size(BlockFormat format, uint32_t width, uint32_t height);
+
+	// texels outside the level replicate the last row/column
+	static void encode_level(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* dst);
+
+	// replaces every level of an rgba8 image that has a full mip chain with its encoding
+	static void compress(ImageData& image, BlockFormat format);
+
+	// BC1: opaque color. 8 bytes
+	static void encode_bc1(const uint8_t block[16][4], uint8_t* dst);
+	// BC3: BC1 color + BC4 alpha. 16 bytes
+	static void encode_bc3(const uint8_t block[16][4], uint8_t* dst);
+	// BC5: BC4 red + BC4 green, for tangent space normals. 16 bytes
+	static void encode_bc5(const uint8_t block[16][4], uint8_t* dst);
+	// BC7: mode 6 only (one subset, rgba 7.7.7.7 endpoints with p-bits, 4 bit indices). 16 bytes
+	static void encode_bc7(const uint8_t block[16][4], uint8_t* dst);
+};
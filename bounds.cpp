@@ -0,0 +1,256 @@
+#include "bounds.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BOUNDS_SSE
+#include <xmmintrin.h>
+#endif
+
+AABB Bounds::aabb_scalar(const glm::vec3* positions, size_t n_positions) {
+	AABB aabb;
+	aabb.min = glm::vec3(std::numeric_limits<float>::max());
+	aabb.max = glm::vec3(std::numeric_limits<float>::lowest());
+	for (size_t i = 0; i < n_positions; ++i) {
+		aabb.min = glm::min(aabb.min, positions[i]);
+		aabb.max = glm::max(aabb.max, positions[i]);
+	}
+	return aabb;
+}
+
+AABB Bounds::aabb(const glm::vec3* positions, size_t n_positions) {
+#ifdef BOUNDS_SSE
+	// four tightly packed vertices are three registers: (x0 y0 z0 x1) (y1 z1 x2 y2) (z2 x3 y3 z3).
+	// Each register keeps its own min and max, the lanes are sorted back into components at the end
+	static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "positions must be tightly packed");
+	const float* xyz = reinterpret_cast<const float*>(positions);
+	size_t n_quads = n_positions / 4;
+
+	__m128 min0 = _mm_set1_ps(std::numeric_limits<float>::max());
+	__m128 min1 = min0;
+	__m128 min2 = min0;
+	__m128 max0 = _mm_set1_ps(std::numeric_limits<float>::lowest());
+	__m128 max1 = max0;
+	__m128 max2 = max0;
+	for (size_t q = 0; q < n_quads; ++q) {
+		const float* p = xyz + q * 12;
+		__m128 a = _mm_loadu_ps(p);
+		__m128 b = _mm_loadu_ps(p + 4);
+		__m128 c = _mm_loadu_ps(p + 8);
+		min0 = _mm_min_ps(min0, a);
+		min1 = _mm_min_ps(min1, b);
+		min2 = _mm_min_ps(min2, c);
+		max0 = _mm_max_ps(max0, a);
+		max1 = _mm_max_ps(max1, b);
+		max2 = _mm_max_ps(max2, c);
+	}
+
+	float mins[12];
+	float maxs[12];
+	_mm_storeu_ps(mins, min0);
+	_mm_storeu_ps(mins + 4, min1);
+	_mm_storeu_ps(mins + 8, min2);
+	_mm_storeu_ps(maxs, max0);
+	_mm_storeu_ps(maxs + 4, max1);
+	_mm_storeu_ps(maxs + 8, max2);
+
+	AABB aabb = aabb_scalar(positions + n_quads * 4, n_positions - n_quads * 4);
+	for (uint32_t lane = 0; lane < 12; ++lane) {
+		aabb.min[lane % 3] = std::min(aabb.min[lane % 3], mins[lane]);
+		aabb.max[lane % 3] = std::max(aabb.max[lane % 3], maxs[lane]);
+	}
+	return aabb;
+#else
+	return aabb_scalar(positions, n_positions);
+#endif
+}
+
+void Bounds::compute_aabb(MeshData& mesh) {
+	mesh.aabb = aabb(mesh.positions.data(), mesh.positions.size());
+	mesh.aabb_valid = true;
+}
+
+BoundingSphere Bounds::sphere(const glm::vec3* positions, size_t n_positions) {
+	BoundingSphere sphere = { glm::vec3(0.0f), 0.0f };
+	if (n_positions == 0) {
+		return sphere;
+	}
+
+	// Ritter: start from the most distant pair among the extreme points along x, y and z
+	size_t extremes[6] = {};
+	for (size_t i = 0; i < n_positions; ++i) {
+		for (uint32_t axis = 0; axis < 3; ++axis) {
+			if (positions[i][axis] < positions[extremes[axis * 2]][axis]) {
+				extremes[axis * 2] = i;
+			}
+			if (positions[i][axis] > positions[extremes[axis * 2 + 1]][axis]) {
+				extremes[axis * 2 + 1] = i;
+			}
+		}
+	}
+	glm::vec3 a = positions[extremes[0]];
+	glm::vec3 b = positions[extremes[1]];
+	for (uint32_t axis = 1; axis < 3; ++axis) {
+		glm::vec3 d0 = positions[extremes[axis * 2 + 1]] - positions[extremes[axis * 2]];
+		if (glm::dot(d0, d0) > glm::dot(b - a, b - a)) {
+			a = positions[extremes[axis * 2]];
+			b = positions[extremes[axis * 2 + 1]];
+		}
+	}
+	sphere.center = (a + b) * 0.5f;
+	sphere.radius = glm::length(b - a) * 0.5f;
+	// then grow towards every point left outside
+	for (size_t i = 0; i < n_positions; ++i) {
+		float distance = glm::length(positions[i] - sphere.center);
+		if (distance > sphere.radius) {
+			float radius = (sphere.radius + distance) * 0.5f;
+			sphere.center = sphere.center + (positions[i] - sphere.center) * ((radius - sphere.radius) / distance);
+			sphere.radius = radius;
+		}
+	}
+
+	AABB box = aabb(positions, n_positions);
+	BoundingSphere box_sphere = { (box.min + box.max) * 0.5f, 0.0f };
+	for (size_t i = 0; i < n_positions; ++i) {
+		box_sphere.radius = std::max(box_sphere.radius, glm::length(positions[i] - box_sphere.center));
+	}
+	return box_sphere.radius < sphere.radius ? box_sphere : sphere;
+}
+
+// eigenvectors of a symmetric 3x3 matrix by cyclic Jacobi rotations, as the columns of v
+static void jacobi_eigenvectors(float a[3][3], float v[3][3]) {
+	for (uint32_t i = 0; i < 3; ++i) {
+		for (uint32_t j = 0; j < 3; ++j) {
+			v[i][j] = i == j ? 1.0f : 0.0f;
+		}
+	}
+	for (uint32_t sweep = 0; sweep < 32; ++sweep) {
+		float off_diagonal = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+		if (off_diagonal < 1e-12f * (a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2]) + 1e-30f) {
+			break;
+		}
+		for (uint32_t p = 0; p < 2; ++p) {
+			for (uint32_t q = p + 1; q < 3; ++q) {
+				if (a[p][q] == 0.0f) {
+					continue;
+				}
+				// rotation zeroing a[p][q]
+				float theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+				float t = (theta >= 0.0f ? 1.0f : -1.0f) / (std::abs(theta) + std::sqrt(theta * theta + 1.0f));
+				float c = 1.0f / std::sqrt(t * t + 1.0f);
+				float s = t * c;
+				for (uint32_t k = 0; k < 3; ++k) {
+					float akp = a[k][p];
+					float akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for (uint32_t k = 0; k < 3; ++k) {
+					float apk = a[p][k];
+					float aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for (uint32_t k = 0; k < 3; ++k) {
+					float vkp = v[k][p];
+					float vkq = v[k][q];
+					v[k][p] = c * vkp - s * vkq;
+					v[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+}
+
+// tight box of the positions along given orthonormal axes
+static OBB fit_obb(const glm::vec3* positions, size_t n_positions, const glm::vec3 axes[3]) {
+	glm::vec3 min(std::numeric_limits<float>::max());
+	glm::vec3 max(std::numeric_limits<float>::lowest());
+	for (size_t i = 0; i < n_positions; ++i) {
+		for (uint32_t axis = 0; axis < 3; ++axis) {
+			float d = glm::dot(positions[i], axes[axis]);
+			min[axis] = std::min(min[axis], d);
+			max[axis] = std::max(max[axis], d);
+		}
+	}
+	OBB obb;
+	obb.center = glm::vec3(0.0f);
+	for (uint32_t axis = 0; axis < 3; ++axis) {
+		obb.axes[axis] = axes[axis];
+		obb.center = obb.center + axes[axis] * ((min[axis] + max[axis]) * 0.5f);
+	}
+	obb.half_extents = (max - min) * 0.5f;
+	return obb;
+}
+
+OBB Bounds::obb(const glm::vec3* positions, size_t n_positions) {
+	const glm::vec3 world_axes[3] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+	if (n_positions == 0) {
+		OBB obb;
+		obb.center = glm::vec3(0.0f);
+		std::copy(world_axes, world_axes + 3, obb.axes);
+		obb.half_extents = glm::vec3(0.0f);
+		return obb;
+	}
+
+	glm::vec3 mean(0.0f);
+	for (size_t i = 0; i < n_positions; ++i) {
+		mean = mean + positions[i];
+	}
+	mean = mean / (float)n_positions;
+	float covariance[3][3] = {};
+	for (size_t i = 0; i < n_positions; ++i) {
+		glm::vec3 d = positions[i] - mean;
+		for (uint32_t r = 0; r < 3; ++r) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				covariance[r][c] += d[r] * d[c];
+			}
+		}
+	}
+	float eigenvectors[3][3];
+	jacobi_eigenvectors(covariance, eigenvectors);
+
+	glm::vec3 axes[3];
+	for (uint32_t axis = 0; axis < 3; ++axis) {
+		axes[axis] = glm::vec3(eigenvectors[0][axis], eigenvectors[1][axis], eigenvectors[2][axis]);
+	}
+	// re-orthonormalize against rounding, right handed
+	axes[0] = glm::normalize(axes[0]);
+	axes[1] = glm::normalize(axes[1] - axes[0] * glm::dot(axes[0], axes[1]));
+	axes[2] = glm::cross(axes[0], axes[1]);
+
+	OBB pca = fit_obb(positions, n_positions, axes);
+	OBB box = fit_obb(positions, n_positions, world_axes);
+	auto volume = [](const OBB& obb) {
+		return obb.half_extents.x * obb.half_extents.y * obb.half_extents.z;
+	};
+	return volume(pca) < volume(box) ? pca : box;
+}
+
+void Bounds::compute_volumes(MeshData& mesh) {
+	mesh.sphere = sphere(mesh.positions.data(), mesh.positions.size());
+	mesh.obb = obb(mesh.positions.data(), mesh.positions.size());
+	mesh.volumes_valid = true;
+}
+
+AABB Bounds::world_aabb(const SceneGraph& graph, const SceneGraphFlatRefs& graph_refs) {
+	AABB box;
+	box.min = glm::vec3(std::numeric_limits<float>::max());
+	box.max = glm::vec3(-std::numeric_limits<float>::max());
+	for (const ObjectRef& ref : graph_refs) {
+		const SceneNode& node = graph[ref.node_id];
+		const MeshData& mesh = *node.renderables[ref.renderable_id].mesh;
+		assert(mesh.volumes_valid);
+		glm::vec3 center = node.world_transform * glm::vec4(mesh.obb.center, 1.0f);
+		glm::vec3 extent(0.0f);
+		for (uint32_t i = 0; i < 3; ++i) {
+			extent += glm::abs(glm::vec3(node.world_transform * glm::vec4(mesh.obb.axes[i] * mesh.obb.half_extents[i], 0.0f)));
+		}
+		box.min = glm::min(box.min, center - extent);
+		box.max = glm::max(box.max, center + extent);
+	}
+	return box;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+
+#include <cstddef>
+
+// bounding volumes of positions on the CPU. AABBs are min/max reductions, four vertices per iteration with SSE where available
+struct Bounds {
+	static AABB aabb(const glm::vec3* positions, size_t n_positions);
+
+	// one component at a time, reference for the SIMD path
+	static AABB aabb_scalar(const glm::vec3* positions, size_t n_positions);
+
+	// fills MeshData::aabb and sets aabb_valid
+	static void compute_aabb(MeshData& mesh);
+
+	// Ritter's sphere, or the one around the AABB center if that is smaller
+	static BoundingSphere sphere(const glm::vec3* positions, size_t n_positions);
+
+	// box along the principal axes of the positions' covariance, or the AABB if that has less volume
+	static OBB obb(const glm::vec3* positions, size_t n_positions);
+
+	// fills MeshData::sphere and MeshData::obb and sets volumes_valid
+	static void compute_volumes(MeshData& mesh);
+
+	// union of the objects' world space OBBs. Needs volumes_valid on every mesh
+	static AABB world_aabb(const SceneGraph& graph, const SceneGraphFlatRefs& graph_refs);
+};
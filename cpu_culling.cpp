@@ -0,0 +1,432 @@
+#include "cpu_culling.h"
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+#if defined(CPU_FEATURES_X64)
+#define CPU_CULLING_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef SCENE_CULLING_CPU_BENCHMARK
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+#endif
+
+static_assert(sizeof(CpuCulling::DrawCommand) == 5 * sizeof(uint32_t), "must match VkDrawIndexedIndirectCommand");
+
+static inline uint32_t popcount8(uint8_t v) {
+	uint32_t n = 0;
+	for (; v; v &= v - 1) {
+		++n;
+	}
+	return n;
+}
+
+CpuCulling::CpuCulling(const std::vector<Object>& objects, uint32_t n_buckets) {
+	_objects = objects;
+
+	std::vector<std::vector<uint32_t>> bucket_objects(n_buckets);
+	for (uint32_t i = 0; i < objects.size(); ++i) {
+		assert(objects[i].bucket < n_buckets);
+		bucket_objects[objects[i].bucket].push_back(i);
+	}
+
+	_bucket_first_draws.resize(n_buckets);
+	_bucket_max_draws.resize(n_buckets);
+	_n_draws = 0;
+	size_t n_positions = 0;
+	for (uint32_t bucket = 0; bucket < n_buckets; ++bucket) {
+		_bucket_first_draws[bucket] = _n_draws;
+		_bucket_max_draws[bucket] = (uint32_t)bucket_objects[bucket].size();
+		_n_draws += _bucket_max_draws[bucket];
+		n_positions += (bucket_objects[bucket].size() + 7) / 8 * 8;
+	}
+
+	_sphere_x.reserve(n_positions);
+	_sphere_y.reserve(n_positions);
+	_sphere_z.reserve(n_positions);
+	_sphere_r.reserve(n_positions);
+	_obb_x.reserve(n_positions);
+	_obb_y.reserve(n_positions);
+	_obb_z.reserve(n_positions);
+	for (std::vector<float>& axis : _obb_axes) {
+		axis.reserve(n_positions);
+	}
+	_object_ids.reserve(n_positions);
+
+	for (uint32_t bucket = 0; bucket < n_buckets; ++bucket) {
+		uint32_t begin = (uint32_t)_object_ids.size();
+		uint32_t n_padded = (uint32_t)(bucket_objects[bucket].size() + 7) / 8 * 8;
+		for (uint32_t i = 0; i < n_padded; ++i) {
+			bool padding = i >= bucket_objects[bucket].size();
+			Object o{};
+			o.sphere.w = -FLT_MAX; // outside of every plane
+			if (!padding) {
+				o = objects[bucket_objects[bucket][i]];
+			}
+			_sphere_x.push_back(o.sphere.x);
+			_sphere_y.push_back(o.sphere.y);
+			_sphere_z.push_back(o.sphere.z);
+			_sphere_r.push_back(o.sphere.w);
+			_obb_x.push_back(o.obb_center.x);
+			_obb_y.push_back(o.obb_center.y);
+			_obb_z.push_back(o.obb_center.z);
+			for (uint32_t axis = 0; axis < 3; ++axis) {
+				for (uint32_t c = 0; c < 3; ++c) {
+					_obb_axes[axis * 3 + c].push_back(o.obb_half_axes[axis][c]);
+				}
+			}
+			_object_ids.push_back(padding ? ~0u : bucket_objects[bucket][i]);
+		}
+
+		for (uint32_t chunk_begin = begin; chunk_begin < begin + n_padded; chunk_begin += _chunk_size) {
+			_chunks.push_back({ bucket, chunk_begin, std::min(chunk_begin + _chunk_size, begin + n_padded), {}, {} });
+		}
+	}
+}
+
+void CpuCulling::run_jobs(ThreadPool* pool, const std::function<void(Chunk&)>& job) {
+	if (!pool) {
+		for (Chunk& chunk : _chunks) {
+			job(chunk);
+		}
+		return;
+	}
+
+	// contiguous runs of chunks, a few per worker to even out the load
+	uint32_t n_jobs = std::min((uint32_t)_chunks.size(), pool->size() * 4);
+	std::vector<std::future<void>> jobs;
+	for (uint32_t i = 0; i < n_jobs; ++i) {
+		size_t begin = _chunks.size() * i / n_jobs;
+		size_t end = _chunks.size() * (i + 1) / n_jobs;
+		jobs.push_back(pool->submit([this, &job, begin, end]() {
+			for (size_t c = begin; c < end; ++c) {
+				job(_chunks[c]);
+			}
+		}));
+	}
+	for (std::future<void>& j : jobs) {
+		j.get();
+	}
+}
+
+void CpuCulling::cull(
+	const std::vector<View>& views,
+	DrawCommand* commands,
+	uint32_t* draw_counts,
+	uint32_t* instance_ids,
+	ThreadPool* pool) {
+
+	assert(!views.empty() && views.size() <= max_views);
+	_masks.resize(views.size() * _object_ids.size() / 8);
+
+	run_jobs(pool, [this, &views](Chunk& chunk) {
+		test_chunk(views, chunk);
+		count_layers(views, chunk);
+	});
+
+	// compacted per bucket in object order
+	uint32_t n_buckets = (uint32_t)_bucket_first_draws.size();
+	for (uint32_t view = 0; view < views.size(); ++view) {
+		uint32_t* view_counts = draw_counts + view * n_buckets;
+		for (uint32_t bucket = 0; bucket < n_buckets; ++bucket) {
+			view_counts[bucket] = 0;
+		}
+		for (Chunk& chunk : _chunks) {
+			chunk.first_draw[view] = view * _n_draws + _bucket_first_draws[chunk.bucket] + view_counts[chunk.bucket];
+			view_counts[chunk.bucket] += chunk.n_visible[view];
+		}
+	}
+
+	run_jobs(pool, [this, &views, commands, instance_ids](Chunk& chunk) {
+		write_chunk(views, chunk, commands, instance_ids);
+	});
+}
+
+#if defined(CPU_CULLING_AVX2)
+
+CPU_TARGET_AVX2 static inline __m256 dot_plane(__m256 x, __m256 y, __m256 z, const __m256 plane[4]) {
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, plane[0]), _mm256_mul_ps(y, plane[1])), _mm256_add_ps(_mm256_mul_ps(z, plane[2]), plane[3]));
+}
+
+CPU_TARGET_AVX2 static inline __m256 abs_dot(__m256 x, __m256 y, __m256 z, const __m256 plane[4]) {
+	__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, plane[0]), _mm256_mul_ps(y, plane[1])), _mm256_mul_ps(z, plane[2]));
+	return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), d);
+}
+
+CPU_TARGET_AVX2 void CpuCulling::test_chunk_avx2(const std::vector<View>& views, Chunk& chunk) {
+	uint32_t n_views = (uint32_t)views.size();
+	size_t view_stride = _object_ids.size() / 8;
+	__m256 planes[max_views][max_planes][4];
+	for (uint32_t view = 0; view < n_views; ++view) {
+		assert(views[view].planes.size() <= max_planes);
+		for (uint32_t p = 0; p < views[view].planes.size(); ++p) {
+			for (uint32_t c = 0; c < 4; ++c) {
+				planes[view][p][c] = _mm256_set1_ps(views[view].planes[p][c]);
+			}
+		}
+	}
+
+	for (uint32_t i = chunk.begin; i < chunk.end; i += 8) {
+		// same order as is_visible of the shaders: the sphere first, the box only where it straddles a plane.
+		// Both are loaded once for all views
+		__m256 x = _mm256_loadu_ps(&_sphere_x[i]);
+		__m256 y = _mm256_loadu_ps(&_sphere_y[i]);
+		__m256 z = _mm256_loadu_ps(&_sphere_z[i]);
+		__m256 r = _mm256_loadu_ps(&_sphere_r[i]);
+		__m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), r);
+		bool box_loaded = false;
+		__m256 cx, cy, cz;
+		__m256 axes[9];
+
+		for (uint32_t view = 0; view < n_views; ++view) {
+			__m256 outside = _mm256_setzero_ps();
+			__m256 straddling = _mm256_setzero_ps();
+			uint32_t n_planes = (uint32_t)views[view].planes.size();
+			for (uint32_t p = 0; p < n_planes; ++p) {
+				__m256 d = dot_plane(x, y, z, planes[view][p]);
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, r, _CMP_GT_OQ));
+				straddling = _mm256_or_ps(straddling, _mm256_cmp_ps(d, neg_r, _CMP_GT_OQ));
+			}
+			int rejected = _mm256_movemask_ps(outside);
+			int to_box = _mm256_movemask_ps(straddling) & ~rejected;
+
+			if (to_box) {
+				if (!box_loaded) {
+					cx = _mm256_loadu_ps(&_obb_x[i]);
+					cy = _mm256_loadu_ps(&_obb_y[i]);
+					cz = _mm256_loadu_ps(&_obb_z[i]);
+					for (uint32_t a = 0; a < 9; ++a) {
+						axes[a] = _mm256_loadu_ps(&_obb_axes[a][i]);
+					}
+					box_loaded = true;
+				}
+				__m256 box_outside = _mm256_setzero_ps();
+				for (uint32_t p = 0; p < n_planes; ++p) {
+					__m256 d = dot_plane(cx, cy, cz, planes[view][p]);
+					__m256 extent = _mm256_add_ps(
+						_mm256_add_ps(abs_dot(axes[0], axes[1], axes[2], planes[view][p]), abs_dot(axes[3], axes[4], axes[5], planes[view][p])),
+						abs_dot(axes[6], axes[7], axes[8], planes[view][p]));
+					box_outside = _mm256_or_ps(box_outside, _mm256_cmp_ps(d, extent, _CMP_GT_OQ));
+				}
+				rejected |= _mm256_movemask_ps(box_outside) & to_box;
+			}
+
+			uint8_t mask = (uint8_t)(~rejected & 0xff);
+			_masks[view * view_stride + i / 8] = mask;
+			chunk.n_visible[view] += popcount8(mask);
+		}
+	}
+}
+
+#endif
+
+void CpuCulling::test_chunk(const std::vector<View>& views, Chunk& chunk) {
+	uint32_t n_views = (uint32_t)views.size();
+	size_t view_stride = _object_ids.size() / 8;
+	for (uint32_t view = 0; view < n_views; ++view) {
+		chunk.n_visible[view] = 0;
+	}
+
+#if defined(CPU_CULLING_AVX2)
+	if (_simd && CpuFeatures::avx2()) {
+		test_chunk_avx2(views, chunk);
+		return;
+	}
+#endif
+
+	for (uint32_t i = chunk.begin; i < chunk.end; i += 8) {
+		uint8_t masks[max_views] = {};
+		for (uint32_t lane = 0; lane < 8; ++lane) {
+			uint32_t k = i + lane;
+			for (uint32_t view = 0; view < n_views; ++view) {
+				bool rejected = false;
+				bool straddling = false;
+				for (const glm::vec4& plane : views[view].planes) {
+					float d = _sphere_x[k] * plane.x + _sphere_y[k] * plane.y + _sphere_z[k] * plane.z + plane.w;
+					rejected = rejected || d > _sphere_r[k];
+					straddling = straddling || d > -_sphere_r[k];
+				}
+				if (!rejected && straddling) {
+					for (const glm::vec4& plane : views[view].planes) {
+						float d = _obb_x[k] * plane.x + _obb_y[k] * plane.y + _obb_z[k] * plane.z + plane.w;
+						float extent = 0.0f;
+						for (uint32_t a = 0; a < 3; ++a) {
+							extent += std::abs(_obb_axes[a * 3][k] * plane.x + _obb_axes[a * 3 + 1][k] * plane.y + _obb_axes[a * 3 + 2][k] * plane.z);
+						}
+						rejected = rejected || d > extent;
+					}
+				}
+				masks[view] |= rejected ? 0 : 1 << lane;
+			}
+		}
+		for (uint32_t view = 0; view < n_views; ++view) {
+			_masks[view * view_stride + i / 8] = masks[view];
+			chunk.n_visible[view] += popcount8(masks[view]);
+		}
+	}
+}
+
+uint8_t CpuCulling::layered_mask(const View& view, uint32_t view_id, uint32_t i) const {
+	size_t view_stride = _object_ids.size() / 8;
+	uint8_t mask = 0;
+	for (uint32_t layer = 0; layer < view.layers; ++layer) {
+		mask |= _masks[(view_id + layer) * view_stride + i / 8];
+	}
+	return mask;
+}
+
+void CpuCulling::count_layers(const std::vector<View>& views, Chunk& chunk) const {
+	for (uint32_t view = 0; view < views.size(); ++view) {
+		if (views[view].layers == 1) {
+			continue;
+		}
+		chunk.n_visible[view] = 0;
+		for (uint32_t i = chunk.begin; i < chunk.end && views[view].layers > 1; i += 8) {
+			chunk.n_visible[view] += popcount8(layered_mask(views[view], view, i));
+		}
+	}
+}
+
+uint32_t CpuCulling::select_lod(const View& view, uint32_t object_id) const {
+	// see select_lod of the culling shaders
+	const Object& o = _objects[object_id];
+	float distance = view.view_origin.w == 0.0f ? 1.0f : glm::length(glm::vec3(o.sphere) - glm::vec3(view.view_origin)) - o.sphere.w;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+
+	uint32_t lod = 0;
+	for (uint32_t i = 1; i < o.lod_count && o.lod_error[i] * view.lod_scale <= distance; ++i) {
+		lod = i;
+	}
+	return lod;
+}
+
+void CpuCulling::write_chunk(const std::vector<View>& views, const Chunk& chunk, DrawCommand* commands, uint32_t* instance_ids) {
+	size_t view_stride = _object_ids.size() / 8;
+	for (uint32_t view = 0; view < views.size(); ++view) {
+		if (views[view].layers == 0) {
+			continue;
+		}
+		bool layered = views[view].layers > 1;
+		uint32_t draw = chunk.first_draw[view];
+		for (uint32_t i = chunk.begin; i < chunk.end; i += 8) {
+			uint8_t visible = layered ? layered_mask(views[view], view, i) : _masks[view * view_stride + i / 8];
+			for (uint8_t mask = visible; mask; mask &= mask - 1) {
+				uint32_t lane = 0;
+				while (!(mask & (1 << lane))) {
+					++lane;
+				}
+				uint32_t object_id = _object_ids[i + lane];
+				const Object& o = _objects[object_id];
+
+				// drawn once per layer, at the LOD of the first layer it is in, the finest of them
+				uint32_t layer_mask = 0;
+				uint32_t lod_view = view;
+				for (uint32_t layer = views[view].layers; layered && layer-- > 0;) {
+					if (_masks[(view + layer) * view_stride + i / 8] & (1 << lane)) {
+						layer_mask |= 1 << layer;
+						lod_view = view + layer;
+					}
+				}
+				uint32_t lod = select_lod(views[lod_view], object_id);
+
+				DrawCommand& cmd = commands[draw];
+				cmd.index_count = o.lod_index_count[lod];
+				cmd.instance_count = views[view].layers;
+				cmd.first_index = o.lod_first_index[lod];
+				cmd.vertex_offset = o.vertex_offset;
+				// vertex shaders look up instance_ids[gl_InstanceIndex], or instance_ids[gl_InstanceIndex / layers]
+				cmd.first_instance = draw * views[view].layers;
+				instance_ids[draw] = object_id | layer_mask << layer_mask_shift;
+				++draw;
+			}
+		}
+		assert(draw == chunk.first_draw[view] + chunk.n_visible[view]);
+	}
+}
+
+#ifdef SCENE_CULLING_CPU_BENCHMARK
+void benchmark_cpu_culling(uint32_t n_objects) {
+	// unit-ish spheres scattered through a 1000^3 box, the camera at the center looking down -z. Fixed seed
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.5f, 4.0f);
+	std::vector<CpuCulling::Object> objects(n_objects);
+	for (CpuCulling::Object& o : objects) {
+		glm::vec3 center(position(rng), position(rng), position(rng));
+		glm::vec3 half_extents(size(rng), size(rng), size(rng));
+		o.sphere = glm::vec4(center, glm::length(half_extents));
+		o.obb_center = center;
+		o.obb_half_axes[0] = glm::vec3(half_extents.x, 0.0f, 0.0f);
+		o.obb_half_axes[1] = glm::vec3(0.0f, half_extents.y, 0.0f);
+		o.obb_half_axes[2] = glm::vec3(0.0f, 0.0f, half_extents.z);
+		o.bucket = rng() % 4;
+		o.vertex_offset = 0;
+		o.lod_count = 1;
+		o.lod_first_index[0] = 0;
+		o.lod_index_count[0] = 36;
+		o.lod_error[0] = 0.0f;
+	}
+
+	const uint32_t n_views = 4;
+	CpuCulling culling(objects, 4);
+	std::vector<CpuCulling::DrawCommand> commands(culling.n_draws() * n_views);
+	std::vector<uint32_t> draw_counts(4 * n_views);
+	std::vector<uint32_t> instance_ids(culling.n_draws() * n_views);
+
+	glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	FrustumUtils::Planes planes = FrustumUtils::view_frustum_planes(glm::inverse(proj), glm::inverse(view));
+	CpuCulling::View cull_view;
+	cull_view.planes.assign(planes.begin(), planes.end());
+	cull_view.view_origin = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	cull_view.lod_scale = 1.0f;
+
+	// the same camera turned around the y axis, like a camera and its shadow cascades covering different parts of the scene
+	std::vector<CpuCulling::View> cull_views(n_views, cull_view);
+	for (uint32_t i = 1; i < n_views; ++i) {
+		glm::mat4 turned = glm::rotate(view, glm::radians(90.0f * i), glm::vec3(0.0f, 1.0f, 0.0f));
+		planes = FrustumUtils::view_frustum_planes(glm::inverse(proj), glm::inverse(turned));
+		cull_views[i].planes.assign(planes.begin(), planes.end());
+	}
+
+	const uint32_t n_runs = 10;
+	auto time_ms = [&](const std::vector<CpuCulling::View>& views, bool simd, ThreadPool* pool) -> double {
+		culling._simd = simd;
+		culling.cull(views, commands.data(), draw_counts.data(), instance_ids.data(), pool); // warm up
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t run = 0; run < n_runs; ++run) {
+			culling.cull(views, commands.data(), draw_counts.data(), instance_ids.data(), pool);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / n_runs;
+	};
+
+	std::vector<CpuCulling::View> single_view(1, cull_view);
+	double scalar_ms = time_ms(single_view, false, nullptr);
+	double simd_ms = time_ms(single_view, true, nullptr);
+	double pooled_ms = time_ms(single_view, true, &ThreadPool::shared());
+
+	uint32_t n_visible = 0;
+	for (uint32_t bucket = 0; bucket < 4; ++bucket) {
+		n_visible += draw_counts[bucket];
+	}
+	std::cout << "cpu culling benchmark: " << n_objects << " objects, " << n_visible << " visible. scalar " << scalar_ms
+		<< " ms, simd " << simd_ms << " ms, simd on " << ThreadPool::shared().size() << " threads " << pooled_ms << " ms" << std::endl;
+
+	double separate_ms = 0.0;
+	for (const CpuCulling::View& v : cull_views) {
+		separate_ms += time_ms(std::vector<CpuCulling::View>(1, v), true, &ThreadPool::shared());
+	}
+	double multi_view_ms = time_ms(cull_views, true, &ThreadPool::shared());
+	std::cout << "cpu culling benchmark: " << n_views << " views, separately " << separate_ms << " ms, at once " << multi_view_ms << " ms" << std::endl;
+}
+#endif
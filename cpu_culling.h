@@ -0,0 +1,115 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+#include "math_common.h"
+#include "thread_pool.h"
+
+#include <vector>
+
+// frustum culling on the CPU, the counterpart of frustum_cull.comp without instancing. World space bounds are kept as
+// structure of arrays, grouped by bucket and padded to 8 objects, and tested 8 at a time with AVX2 where the CPU has it (scalar otherwise)
+// against every view while they are loaded. Chunks of objects are split into jobs over a ThreadPool.
+// Needs no GPU, SceneCulling uploads what it writes
+class CpuCulling {
+public:
+	// VkDrawIndexedIndirectCommand, same as DrawCommand of the culling shaders
+	struct DrawCommand {
+		uint32_t index_count;
+		uint32_t instance_count;
+		uint32_t first_index;
+		int32_t vertex_offset;
+		uint32_t first_instance;
+	};
+
+	struct Object {
+		glm::vec4 sphere; // world space center, radius
+		glm::vec3 obb_center; // world space
+		glm::vec3 obb_half_axes[3]; // box axes scaled by their half extents
+		uint32_t bucket; // SceneCulling::bucket_id
+		int32_t vertex_offset;
+		// level 0 is the full mesh
+		uint32_t lod_count;
+		uint32_t lod_first_index[MeshLod::max_lods];
+		uint32_t lod_index_count[MeshLod::max_lods];
+		float lod_error[MeshLod::max_lods]; // in world units
+	};
+
+	// what SceneCulling::update puts in the culling ubo
+	struct View {
+		std::vector<glm::vec4> planes; // normals point out, at most max_planes
+		glm::vec4 view_origin; // eye if w == 1, view direction if w == 0 (orthographic)
+		float lod_scale;
+		// 1 -- drawn on its own. n > 1 -- the first of n views drawn as layers of one pass, see SceneCulling::layer_views.
+		// 0 -- a later one of those layers, which gets no commands
+		uint32_t layers = 1;
+	};
+
+	static const uint32_t max_views = 8;
+	static const uint32_t max_planes = 16;
+	// instance ids of layered views hold the mask of their layers above this, see SceneCulling::layer_mask_shift
+	static const uint32_t layer_mask_shift = 24;
+
+	CpuCulling(const std::vector<Object>& objects, uint32_t n_buckets);
+
+	// the visible objects of a bucket get one command each from bucket_first_draw on, in object order.
+	// first_instance of a command indexes its object id in instance_ids, divided by the layers of layered views. Each view has n_draws() commands and instance ids
+	// and n_buckets counts, following those of the view before. Jobs go to pool, or run on the calling thread if null
+	void cull(
+		const std::vector<View>& views,
+		DrawCommand* commands,
+		uint32_t* draw_counts,
+		uint32_t* instance_ids,
+		ThreadPool* pool = &ThreadPool::shared());
+
+	// the AVX2 kernel is used where the CPU has it, unless set to false
+	bool _simd = true;
+
+	uint32_t bucket_first_draw(uint32_t bucket) const { return _bucket_first_draws[bucket]; }
+	uint32_t bucket_max_draws(uint32_t bucket) const { return _bucket_max_draws[bucket]; }
+	uint32_t n_draws() const { return _n_draws; }
+
+private:
+	// a range of 8-aligned positions within one bucket
+	struct Chunk {
+		uint32_t bucket;
+		uint32_t begin;
+		uint32_t end;
+		uint32_t n_visible[max_views];
+		uint32_t first_draw[max_views];
+	};
+
+	// fills _masks of the chunk in every view, one bit per position
+	void test_chunk(const std::vector<View>& views, Chunk& chunk);
+	// the same 8 positions at a time, x64 only
+	void test_chunk_avx2(const std::vector<View>& views, Chunk& chunk);
+	// what is visible in any layer of a layered view counts once, in its first view
+	void count_layers(const std::vector<View>& views, Chunk& chunk) const;
+	// positions i to i + 7 visible in any layer of the view
+	uint8_t layered_mask(const View& view, uint32_t view_id, uint32_t i) const;
+	void write_chunk(const std::vector<View>& views, const Chunk& chunk, DrawCommand* commands, uint32_t* instance_ids);
+
+	uint32_t select_lod(const View& view, uint32_t object_id) const;
+
+	void run_jobs(ThreadPool* pool, const std::function<void(Chunk&)>& job);
+
+	std::vector<Object> _objects;
+
+	// per position, objects sorted by bucket. Padding has a radius of -FLT_MAX and object id ~0u
+	std::vector<float> _sphere_x, _sphere_y, _sphere_z, _sphere_r;
+	std::vector<float> _obb_x, _obb_y, _obb_z;
+	std::vector<float> _obb_axes[9]; // xyz of the 3 half axes
+	std::vector<uint32_t> _object_ids;
+	std::vector<uint8_t> _masks; // one byte per 8 positions, all positions of a view after those of the view before
+
+	std::vector<Chunk> _chunks;
+	std::vector<uint32_t> _bucket_first_draws;
+	std::vector<uint32_t> _bucket_max_draws;
+	uint32_t _n_draws;
+	const uint32_t _chunk_size = 4096;
+};
+
+#ifdef SCENE_CULLING_CPU_BENCHMARK
+// culls n_objects random spheres in a fixed camera view, scalar and AVX2 on one thread and AVX2 over ThreadPool::shared().
+// Then in 4 views at once, against 4 separate culls
+void benchmark_cpu_culling(uint32_t n_objects);
+#endif
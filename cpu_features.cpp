@@ -0,0 +1,40 @@
+#include "cpu_features.h"
+
+#if defined(CPU_FEATURES_X64) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static bool detect_avx2() {
+#if defined(__AVX2__)
+	// the whole target is compiled for it already
+	return true;
+#elif defined(CPU_FEATURES_X64) && defined(_MSC_VER) && !defined(__clang__)
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7) {
+		return false;
+	}
+	__cpuid(regs, 1);
+	bool fma = regs[2] & (1 << 12);
+	bool osxsave = regs[2] & (1 << 27);
+	bool avx = regs[2] & (1 << 28);
+	// xmm and ymm state enabled in XCR0
+	if (!fma || !osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+		return false;
+	}
+	__cpuidex(regs, 7, 0);
+	return regs[1] & (1 << 5);
+#elif defined(CPU_FEATURES_X64)
+	// checks the OS support as well
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
+
+bool CpuFeatures::avx2() {
+	static const bool supported = detect_avx2();
+	return supported;
+}
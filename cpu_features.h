@@ -0,0 +1,18 @@
+#pragma once
+
+// SIMD kernels of the CPU side (Dequantize, CpuCulling) are compiled in for x64 whatever the compile flags of the
+// target, and picked at runtime. Functions using AVX2 intrinsics are marked CPU_TARGET_AVX2 and only called when
+// CpuFeatures::avx2() holds
+#if defined(__x86_64__) || defined(_M_X64)
+#define CPU_FEATURES_X64
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CPU_TARGET_AVX2 // MSVC emits AVX2 intrinsics without /arch:AVX2
+#else
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+struct CpuFeatures {
+	// AVX2 and FMA on the CPU, with the ymm registers saved by the OS. Detected once
+	static bool avx2();
+};
@@ -1,6 +1,9 @@
 #include "csm.h"
 #include "math_common.h"
 #include <array>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 // https://developer.nvidia.com/gpugems/gpugems3/part-ii-light-and-shadows/chapter-10-parallel-split-shadow-maps-programmable-gpus
 // "Practical split scheme"
@@ -45,18 +48,91 @@ CSM::SquareBound CSM::bound_frustum(glm::mat3 light_space_inv, uint32_t resoluti
 	// texel snapping
 	glm::vec2 c_xy_snapped = glm::roundEven(c_xy / unit_texel) * unit_texel;
 
+	// along z as well, so that the bounds of a still light only change when the camera moves by a texel
+	float c_z_snapped = std::round(c.z / unit_texel) * unit_texel;
+
 	SquareBound bound;
-	bound.center = glm::vec3(c_xy_snapped.x, c_xy_snapped.y, c.z);
+	bound.center = glm::vec3(c_xy_snapped.x, c_xy_snapped.y, c_z_snapped);
 	bound.half_width = r + margin;
 	return bound;
 }
 
+std::pair<float, float> CSM::depth_range(
+	glm::mat3 light_space_inv,
+	const SquareBound& bound,
+	const FrustumUtils::Frustum& frustum,
+	const AABB& scene_aabb) {
+
+	float frustum_min = std::numeric_limits<float>::max();
+	float frustum_max = -std::numeric_limits<float>::max();
+	for (const glm::vec3& v : frustum) {
+		float z = (light_space_inv * v).z;
+		frustum_min = std::min(frustum_min, z);
+		frustum_max = std::max(frustum_max, z);
+	}
+
+	if (glm::any(glm::greaterThan(scene_aabb.min, scene_aabb.max))) {
+		// empty scene
+		return { frustum_min, frustum_max };
+	}
+
+	// clip the faces of the scene box against the sides of the prism
+	glm::vec3 corners[8];
+	for (uint32_t i = 0; i < 8; ++i) {
+		glm::vec3 corner(
+			(i & 1) ? scene_aabb.max.x : scene_aabb.min.x,
+			(i & 2) ? scene_aabb.max.y : scene_aabb.min.y,
+			(i & 4) ? scene_aabb.max.z : scene_aabb.min.z);
+		corners[i] = light_space_inv * corner - bound.center;
+	}
+	const uint32_t faces[6][4] = {
+		{ 0, 2, 6, 4 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+	};
+	float scene_min = std::numeric_limits<float>::max();
+	float scene_max = -std::numeric_limits<float>::max();
+	for (const auto& face : faces) {
+		std::vector<glm::vec3> polygon = { corners[face[0]], corners[face[1]], corners[face[2]], corners[face[3]] };
+		// x <= hw, -x <= hw, y <= hw, -y <= hw
+		for (uint32_t side = 0; side < 4 && !polygon.empty(); ++side) {
+			uint32_t axis = side / 2;
+			float sign = (side & 1) ? -1.0f : 1.0f;
+			auto dist = [&](const glm::vec3& v) { return sign * v[axis] - bound.half_width; };
+			std::vector<glm::vec3> clipped;
+			for (size_t j = 0; j < polygon.size(); ++j) {
+				const glm::vec3& a = polygon[j];
+				const glm::vec3& b = polygon[(j + 1) % polygon.size()];
+				float da = dist(a);
+				float db = dist(b);
+				if (da <= 0.0f) {
+					clipped.push_back(a);
+				}
+				if ((da < 0.0f) != (db < 0.0f) && da != db) {
+					clipped.push_back(glm::mix(a, b, da / (da - db)));
+				}
+			}
+			polygon = clipped;
+		}
+		for (const glm::vec3& v : polygon) {
+			scene_min = std::min(scene_min, v.z + bound.center.z);
+			scene_max = std::max(scene_max, v.z + bound.center.z);
+		}
+	}
+
+	float z_min = std::max(scene_min, frustum_min);
+	if (scene_max <= z_min) {
+		return { frustum_min, frustum_max };
+	}
+	return { z_min, scene_max };
+}
+
 std::vector<CSM::CascadeContext> CSM::csm_ortho_projections(
 	PerspectiveCamera& camera,
 	glm::vec3 light_dir,
 	uint32_t n_cascades,
 	uint32_t resolution,
-	float blend_overlap) {
+	float blend_overlap,
+	const AABB& scene_aabb,
+	std::pair<float, float> split_range) {
 
 	//determine light space
 	glm::vec3 z = -glm::normalize(light_dir);
@@ -74,7 +150,16 @@ std::vector<CSM::CascadeContext> CSM::csm_ortho_projections(
 
 	FrustumUtils::Frustum f_whole = FrustumUtils::view_frustum_vertices(glm::inverse(camera.proj), glm::inverse(camera.view));
 
-	std::vector<std::pair<float, float>> partitions = split(camera.near, camera.far, n_cascades);
+	float split_near = std::max(split_range.first, camera.near);
+	float split_far = std::min(split_range.second, camera.far);
+	if (split_far <= split_near) {
+		split_near = camera.near;
+		split_far = camera.far;
+	}
+	std::vector<std::pair<float, float>> partitions = split(split_near, split_far, n_cascades);
+	// what came into view in front of the range since it was found goes to the first cascade, bounded from the near
+	// plane. The slice only grows by its narrow end
+	partitions.front().first = camera.near;
 
 	// add overlap to partitions
 	if (n_cascades > 1) {
@@ -111,14 +196,23 @@ std::vector<CSM::CascadeContext> CSM::csm_ortho_projections(
 		SquareBound square_bound = bound_frustum(light_space_inv, resolution, f_part);
 		float hw = square_bound.half_width;
 
-		// TODO: Ideally near/far plane should be determined by passing the AABB of the entire scene.
-		glm::mat4 ortho = glm::orthoRH_ZO(-hw, hw, -hw, hw, -6.0f * hw, 6.0f * hw);
+		// light space z points toward the light, the view looks down -z from the center
+		std::pair<float, float> z_range = depth_range(light_space_inv, square_bound, f_part, scene_aabb);
+		// snapped outwards, for the same reason as the center
+		float depth_step = hw * 0.125f;
+		float near = std::floor((square_bound.center.z - z_range.second) / depth_step) * depth_step;
+		float far = std::ceil((square_bound.center.z - z_range.first) / depth_step) * depth_step;
+		glm::mat4 ortho = glm::orthoRH_ZO(-hw, hw, -hw, hw, near, far);
 		ortho[1][1] *= -1.0f;
 		glm::mat4 light_view(1.0f);
 		light_view = light_space_inv;
 		light_view[3] = glm::vec4(-square_bound.center, 1.0f);
 		
-		cascade_ctxs.push_back({ partitions[i].first, partitions[i].second, light_view, ortho });
+		std::vector<glm::vec4> caster_planes = FrustumUtils::swept_frustum_planes(f_part, -light_dir);
+
+		// the last cascade is selected up to the far plane. Receivers beyond its box are lit (pbr.frag)
+		float z_end = i + 1 == partitions.size() ? camera.far : partitions[i].second;
+		cascade_ctxs.push_back({ partitions[i].first, z_end, light_view, ortho, caster_planes, f_part });
 	}
 	return cascade_ctxs;
 }
\ No newline at end of file
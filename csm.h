@@ -3,6 +3,7 @@
 #include "glm/glm.hpp"
 #include "camera.h"
 #include "math_common.h"
+#include "gltf_scene_bindless.h"
 #include <array>
 #include <vector>
 
@@ -13,13 +14,20 @@ public:
 		float z_end;
 		glm::mat4 light_view;
 		glm::mat4 light_proj;
+		// world space planes of the slice swept toward the light, bounding every object that can cast into it
+		std::vector<glm::vec4> caster_planes;
+		// world space corners of the slice, overlap included
+		FrustumUtils::Frustum slice;
 	};
+	// the view depths within split_range are split, e.g. camera.near to camera.far or the range of what is on screen
 	static std::vector<CascadeContext> csm_ortho_projections(
 		PerspectiveCamera& camera,
 		glm::vec3 light_dir,
 		uint32_t n_cascades,
 		uint32_t resolution,
-		float blend_overlap);
+		float blend_overlap,
+		const AABB& scene_aabb,
+		std::pair<float, float> split_range);
 
 
 private: 
@@ -31,4 +39,12 @@ private:
 	};
 
 	static SquareBound bound_frustum(glm::mat3 light_space_inv, uint32_t resolution, const FrustumUtils::Frustum& frustum);
+
+	// light space z range of the scene within the square's prism, from the top of the scene down to the bottom of the frustum.
+	// The frustum's own range if they don't intersect
+	static std::pair<float, float> depth_range(
+		glm::mat3 light_space_inv,
+		const SquareBound& bound,
+		const FrustumUtils::Frustum& frustum,
+		const AABB& scene_aabb);
 };
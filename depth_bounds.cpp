@@ -0,0 +1,108 @@
+#include "depth_bounds.h"
+
+#include <cstring>
+
+DepthBounds::DepthBounds(const std::string& shader_path, otcv::Image* depth_image, uint32_t in_flight_frames) {
+	_depth_image = depth_image;
+	_width = depth_image->builder._image_info.extent.width;
+	_height = depth_image->builder._image_info.extent.height;
+	// texel fetches only
+	_depth_sampler = otcv::SamplerBuilder()
+		.filter(VK_FILTER_NEAREST, VK_FILTER_NEAREST)
+		.build();
+
+	_shader_blob = otcv::load_shaders_from_dir(shader_path);
+	_pipeline = otcv::ComputePipeline::create(_shader_blob["depth_bounds.comp"]);
+	_desc_pool.reset(new NaiveExpandableDescriptorPool);
+
+	Std140AlignmentType UBO;
+	UBO.add(Std140AlignmentType::InlineType::Uint, "depthWidth");
+	UBO.add(Std140AlignmentType::InlineType::Uint, "depthHeight");
+	_ubo.reset(new StaticUBO(UBO));
+	_ubo->set(StaticUBOAccess()["depthWidth"], &_width);
+	_ubo->set(StaticUBOAccess()["depthHeight"], &_height);
+
+	Std430AlignmentType Bounds;
+	Bounds.add(Std430AlignmentType::InlineType::Uint, "minDepthBits");
+	Bounds.add(Std430AlignmentType::InlineType::Uint, "maxDepthBits");
+	_ssbo.reset(new SSBO(Bounds, 1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT));
+
+	_desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
+	_desc_set->bind_buffer(0, _ubo->_buf);
+	_in_desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::ComputeRead]);
+	_in_desc_set->bind_image_sampler(0, &_depth_image, &_depth_sampler);
+	_out_desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::ComputeWrite]);
+	_out_desc_set->bind_buffer(0, _ssbo->_buf);
+
+	// one per frame in flight, the others may still be written by the GPU
+	for (uint32_t i = 0; i < in_flight_frames; ++i) {
+		otcv::BufferBuilder bb;
+		bb.size(2 * sizeof(uint32_t))
+			.usage(VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+			.host_access(otcv::BufferBuilder::Access::Coherent);
+		_host_frames.emplace_back(new otcv::Buffer(bb));
+	}
+	_recorded.resize(in_flight_frames, false);
+}
+
+DepthBounds::~DepthBounds() {
+
+}
+
+static void memory_barrier(
+	otcv::CommandBuffer* cmd_buf,
+	VkPipelineStageFlags src_stage,
+	VkAccessFlags src_access,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access) {
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	vkCmdPipelineBarrier(cmd_buf->vk_command_buffer, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void DepthBounds::commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id) {
+	// the bounds were last copied out of by the frame before
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	vkCmdFillBuffer(cmd_buf->vk_command_buffer, _ssbo->_buf->vk_buffer, 0, sizeof(uint32_t), 0xffffffff);
+	vkCmdFillBuffer(cmd_buf->vk_command_buffer, _ssbo->_buf->vk_buffer, sizeof(uint32_t), sizeof(uint32_t), 0);
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	// the depth image was made readable by fragment shaders, chain that on to compute
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	cmd_buf->cmd_bind_compute_pipeline(_pipeline);
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, _desc_set, DescriptorSetRate::PerFrame);
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, _in_desc_set, DescriptorSetRate::ComputeRead);
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, _out_desc_set, DescriptorSetRate::ComputeWrite);
+	cmd_buf->cmd_dispatch(otcv::calc_group_count(_width, _group_size), otcv::calc_group_count(_height, _group_size), 1);
+	// the depth image goes back to a depth attachment at the end of the frame, with a fragment source stage. Chain the
+	// read on to it
+	memory_barrier(cmd_buf,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0);
+
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	VkBufferCopy region{};
+	region.size = 2 * sizeof(uint32_t);
+	vkCmdCopyBuffer(cmd_buf->vk_command_buffer, _ssbo->_buf->vk_buffer, _host_frames[frame_id]->vk_buffer, 1, &region);
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+
+	_recorded[frame_id] = true;
+}
+
+bool DepthBounds::read(uint32_t frame_id, float& min_depth, float& max_depth) const {
+	if (!_recorded[frame_id]) {
+		return false;
+	}
+	uint32_t bits[2];
+	std::memcpy(bits, _host_frames[frame_id]->mapped, sizeof(bits));
+	if (bits[0] > bits[1]) {
+		return false;
+	}
+	std::memcpy(&min_depth, &bits[0], sizeof(float));
+	std::memcpy(&max_depth, &bits[1], sizeof(float));
+	return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "otcv.h"
+#include "otcv_utils.h"
+#include "static_ubo.h"
+#include "expandable_descriptor_pool.h"
+
+// nearest and farthest depth of a depth image, other than its cleared far plane. Reduced on the GPU and copied to a host
+// buffer per frame in flight, read back once the frame is done. For fitting shadow cascades to what is on screen
+class DepthBounds {
+public:
+	DepthBounds(const std::string& shader_path, otcv::Image* depth_image, uint32_t in_flight_frames);
+	~DepthBounds();
+
+	// depth image in FragSample, left as is with its read ordered before the fragment stages
+	void commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id);
+
+	// what the last commands of frame_id found, after its fence was waited on. False if they found nothing or never ran
+	bool read(uint32_t frame_id, float& min_depth, float& max_depth) const;
+
+private:
+	otcv::Image* _depth_image;
+	otcv::Sampler* _depth_sampler;
+	otcv::ShaderBlob _shader_blob;
+	otcv::ComputePipeline* _pipeline;
+	std::shared_ptr<NaiveExpandableDescriptorPool> _desc_pool;
+
+	std::shared_ptr<StaticUBO> _ubo;
+	otcv::DescriptorSet* _desc_set;
+	otcv::DescriptorSet* _in_desc_set;
+	otcv::DescriptorSet* _out_desc_set;
+	std::shared_ptr<SSBO> _ssbo; // min and max depth bits
+
+	std::vector<std::shared_ptr<otcv::Buffer>> _host_frames;
+	std::vector<bool> _recorded;
+
+	uint32_t _width;
+	uint32_t _height;
+	const uint32_t _group_size = 16;
+};
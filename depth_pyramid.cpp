@@ -0,0 +1,95 @@
+#include "depth_pyramid.h"
+
+DepthPyramid::DepthPyramid(const std::string& shader_path, otcv::Image* depth_image) {
+	_depth_image = depth_image;
+	_width = depth_image->builder._image_info.extent.width;
+	_height = depth_image->builder._image_info.extent.height;
+	// texel fetches only
+	_depth_sampler = otcv::SamplerBuilder()
+		.filter(VK_FILTER_NEAREST, VK_FILTER_NEAREST)
+		.build();
+
+	_shader_blob = otcv::load_shaders_from_dir(shader_path);
+	_pipeline = otcv::ComputePipeline::create(_shader_blob["depth_reduce.comp"]);
+	_desc_pool.reset(new NaiveExpandableDescriptorPool);
+
+	// halve until 1x1, rounding up so that the edges stay covered
+	uint32_t n_texels = 0;
+	_n_levels = 0;
+	uint32_t level_width = _width;
+	uint32_t level_height = _height;
+	do {
+		level_width = (level_width + 1) / 2;
+		level_height = (level_height + 1) / 2;
+		n_texels += level_width * level_height;
+		++_n_levels;
+	} while (level_width > 1 || level_height > 1);
+
+	Std430AlignmentType Depth;
+	Depth.add(Std430AlignmentType::InlineType::Float, "value");
+	_ssbo.reset(new SSBO(Depth, n_texels));
+
+	for (uint32_t level = 0; level < _n_levels; ++level) {
+		Std140AlignmentType UBO;
+		UBO.add(Std140AlignmentType::InlineType::Uint, "level");
+		UBO.add(Std140AlignmentType::InlineType::Uint, "depthWidth");
+		UBO.add(Std140AlignmentType::InlineType::Uint, "depthHeight");
+		std::shared_ptr<StaticUBO> ubo(new StaticUBO(UBO));
+		ubo->set(StaticUBOAccess()["level"], &level);
+		ubo->set(StaticUBOAccess()["depthWidth"], &_width);
+		ubo->set(StaticUBOAccess()["depthHeight"], &_height);
+		_level_ubos.push_back(ubo);
+
+		otcv::DescriptorSet* desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
+		desc_set->bind_buffer(0, ubo->_buf);
+		_level_desc_sets.push_back(desc_set);
+	}
+
+	_in_desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::ComputeRead]);
+	_in_desc_set->bind_image_sampler(0, &_depth_image, &_depth_sampler);
+	_out_desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::ComputeWrite]);
+	_out_desc_set->bind_buffer(0, _ssbo->_buf);
+}
+
+DepthPyramid::~DepthPyramid() {
+
+}
+
+static void memory_barrier(
+	otcv::CommandBuffer* cmd_buf,
+	VkPipelineStageFlags src_stage,
+	VkAccessFlags src_access,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access) {
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	vkCmdPipelineBarrier(cmd_buf->vk_command_buffer, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void DepthPyramid::commands(otcv::CommandBuffer* cmd_buf) {
+	// the depth image was made readable by fragment shaders, chain that on to compute. The pyramid was last read by culling
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	cmd_buf->cmd_bind_compute_pipeline(_pipeline);
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, _in_desc_set, DescriptorSetRate::ComputeRead);
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, _out_desc_set, DescriptorSetRate::ComputeWrite);
+
+	uint32_t level_width = _width;
+	uint32_t level_height = _height;
+	for (uint32_t level = 0; level < _n_levels; ++level) {
+		level_width = (level_width + 1) / 2;
+		level_height = (level_height + 1) / 2;
+		cmd_buf->cmd_bind_descriptor_set(_pipeline, _level_desc_sets[level], DescriptorSetRate::PerFrame);
+		cmd_buf->cmd_dispatch(otcv::calc_group_count(level_width, _group_size), otcv::calc_group_count(level_height, _group_size), 1);
+		memory_barrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+	// the depth image goes back to a depth attachment after this, with a fragment source stage. Chain the compute
+	// reads on to it, so that the layout change waits for them
+	memory_barrier(cmd_buf,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0);
+}
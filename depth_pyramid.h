@@ -0,0 +1,43 @@
+#pragma once
+
+#include "otcv.h"
+#include "otcv_utils.h"
+#include "static_ubo.h"
+#include "expandable_descriptor_pool.h"
+
+// hierarchical z of a depth image for occlusion culling. Levels are stored one after another in a float SSBO,
+// texel (x, y) of level k holds the farthest depth of the depth pixels [x, y] * 2^(k+1) to [x + 1, y + 1] * 2^(k+1).
+// Level 0 is half the depth resolution rounded up, the last level is 1x1
+class DepthPyramid {
+public:
+	DepthPyramid(const std::string& shader_path, otcv::Image* depth_image);
+	~DepthPyramid();
+
+	// depth image in FragSample, left as is with its reads ordered before the fragment stages. The pyramid is left
+	// readable by compute shaders
+	void commands(otcv::CommandBuffer* cmd_buf);
+
+	std::shared_ptr<SSBO> ssbo() { return _ssbo; }
+	uint32_t width() const { return _width; }
+	uint32_t height() const { return _height; }
+	uint32_t n_levels() const { return _n_levels; }
+
+private:
+	otcv::Image* _depth_image;
+	otcv::Sampler* _depth_sampler;
+	otcv::ShaderBlob _shader_blob;
+	otcv::ComputePipeline* _pipeline;
+	std::shared_ptr<NaiveExpandableDescriptorPool> _desc_pool;
+
+	// one dispatch per level, each reads the level before it
+	std::vector<std::shared_ptr<StaticUBO>> _level_ubos;
+	std::vector<otcv::DescriptorSet*> _level_desc_sets;
+	otcv::DescriptorSet* _in_desc_set;
+	otcv::DescriptorSet* _out_desc_set;
+	std::shared_ptr<SSBO> _ssbo;
+
+	uint32_t _width;
+	uint32_t _height;
+	uint32_t _n_levels;
+	const uint32_t _group_size = 8;
+};
@@ -0,0 +1,196 @@
+#include "dequantize.h"
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(CPU_FEATURES_X64)
+// SSE2 is part of x64, AVX2 where the CPU has it
+#define DEQUANTIZE_AVX2
+#define DEQUANTIZE_SSE2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DEQUANTIZE_SSE2
+#include <emmintrin.h>
+#endif
+
+template<typename C>
+static void to_float_scalar(const C* src, size_t begin, size_t n, float scale, bool clamp, float* dst) {
+	for (size_t i = begin; i < n; ++i) {
+		float f = (float)src[i] * scale;
+		dst[i] = clamp ? std::max(f, -1.0f) : f;
+	}
+}
+
+#if defined(DEQUANTIZE_AVX2)
+
+// 8 components per iteration
+CPU_TARGET_AVX2 static inline void store_converted(__m256i ints, __m256 scale, bool clamp, float* dst) {
+	__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(ints), scale);
+	if (clamp) {
+		f = _mm256_max_ps(f, _mm256_set1_ps(-1.0f));
+	}
+	_mm256_storeu_ps(dst, f);
+}
+
+CPU_TARGET_AVX2 static size_t to_float_avx2(const int8_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m256 s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+		store_converted(_mm256_cvtepi8_epi32(bytes), s, clamp, dst + i);
+	}
+	return i;
+}
+
+CPU_TARGET_AVX2 static size_t to_float_avx2(const uint8_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m256 s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+		store_converted(_mm256_cvtepu8_epi32(bytes), s, clamp, dst + i);
+	}
+	return i;
+}
+
+CPU_TARGET_AVX2 static size_t to_float_avx2(const int16_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m256 s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i shorts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		store_converted(_mm256_cvtepi16_epi32(shorts), s, clamp, dst + i);
+	}
+	return i;
+}
+
+CPU_TARGET_AVX2 static size_t to_float_avx2(const uint16_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m256 s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i shorts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		store_converted(_mm256_cvtepu16_epi32(shorts), s, clamp, dst + i);
+	}
+	return i;
+}
+
+#endif
+
+#if defined(DEQUANTIZE_SSE2)
+
+// 4 components per iteration. SSE2 has no cvtep*, widen by unpacking instead
+static inline void store_converted(__m128i ints, __m128 scale, bool clamp, float* dst) {
+	__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(ints), scale);
+	if (clamp) {
+		f = _mm_max_ps(f, _mm_set1_ps(-1.0f));
+	}
+	_mm_storeu_ps(dst, f);
+}
+
+static inline __m128i load_4_bytes(const void* src) {
+	int32_t v;
+	std::memcpy(&v, src, sizeof(v));
+	return _mm_cvtsi32_si128(v);
+}
+
+static size_t to_float_sse2(const int8_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m128 s = _mm_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = load_4_bytes(src + i);
+		x = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8); // sign extend to 16 bits
+		x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16); // sign extend to 32 bits
+		store_converted(x, s, clamp, dst + i);
+	}
+	return i;
+}
+
+static size_t to_float_sse2(const uint8_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m128 s = _mm_set1_ps(scale);
+	__m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = load_4_bytes(src + i);
+		x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(x, zero), zero);
+		store_converted(x, s, clamp, dst + i);
+	}
+	return i;
+}
+
+static size_t to_float_sse2(const int16_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m128 s = _mm_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+		x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		store_converted(x, s, clamp, dst + i);
+	}
+	return i;
+}
+
+static size_t to_float_sse2(const uint16_t* src, size_t n, float scale, bool clamp, float* dst) {
+	__m128 s = _mm_set1_ps(scale);
+	__m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+		x = _mm_unpacklo_epi16(x, zero);
+		store_converted(x, s, clamp, dst + i);
+	}
+	return i;
+}
+
+#endif
+
+template<typename C>
+static size_t to_float_simd(const C* src, size_t n, float scale, bool clamp, float* dst) {
+#if defined(DEQUANTIZE_AVX2)
+	if (CpuFeatures::avx2()) {
+		return to_float_avx2(src, n, scale, clamp, dst);
+	}
+#endif
+#if defined(DEQUANTIZE_SSE2)
+	return to_float_sse2(src, n, scale, clamp, dst);
+#else
+	return 0;
+#endif
+}
+
+template<typename C>
+static void to_float_typed(const void* src, bool normalized, size_t n, float* dst) {
+	const C* typed = static_cast<const C*>(src);
+	bool is_signed = std::is_signed<C>::value;
+	float scale = normalized ? 1.0f / (float)std::numeric_limits<C>::max() : 1.0f;
+	// the most negative value maps below -1 and is clamped
+	bool clamp = normalized && is_signed;
+	size_t done = to_float_simd(typed, n, scale, clamp, dst);
+	to_float_scalar(typed, done, n, scale, clamp, dst);
+}
+
+void Dequantize::to_float(const void* src, ComponentType type, bool normalized, size_t n, float* dst) {
+	switch (type) {
+	case ComponentType::Byte:
+		to_float_typed<int8_t>(src, normalized, n, dst);
+		break;
+	case ComponentType::UnsignedByte:
+		to_float_typed<uint8_t>(src, normalized, n, dst);
+		break;
+	case ComponentType::Short:
+		to_float_typed<int16_t>(src, normalized, n, dst);
+		break;
+	case ComponentType::UnsignedShort:
+		to_float_typed<uint16_t>(src, normalized, n, dst);
+		break;
+	}
+}
+
+void Dequantize::pack(const uint8_t* src, size_t stride, size_t element_size, size_t count, uint8_t* dst) {
+	if (stride == element_size) {
+		std::memcpy(dst, src, element_size * count);
+		return;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		std::memcpy(dst + element_size * i, src + stride * i, element_size);
+	}
+}
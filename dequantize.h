@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// conversion of quantized glTF accessor data (KHR_mesh_quantization, normalized attributes) to float.
+// AVX2 kernels where the CPU has them, SSE2 or scalar otherwise (see cpu_features.h)
+struct Dequantize {
+	enum class ComponentType {
+		Byte = 0,
+		UnsignedByte,
+		Short,
+		UnsignedShort
+	};
+
+	// n tightly packed components -> n floats. normalized follows the glTF spec:
+	// unsigned c / (2^bits - 1), signed max(c / (2^(bits-1) - 1), -1)
+	static void to_float(const void* src, ComponentType type, bool normalized, size_t n, float* dst);
+
+	// gather count elements of element_size bytes each, stride bytes apart, into a tightly packed array
+	static void pack(const uint8_t* src, size_t stride, size_t element_size, size_t count, uint8_t* dst);
+};
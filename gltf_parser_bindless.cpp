@@ -7,54 +7,382 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "tiny_gltf.h"
 #include "gltf_traits.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "dequantize.h"
+#include "baked_scene.h"
+#include "ktx2.h"
+#include "bounds.h"
 
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <tuple>
 
 namespace tg = tinygltf;
 
-tg::Model model;
-tg::TinyGLTF loader;
-std::string err;
-std::string warn;
+// state of parsing one gltf file. Nothing is shared between instances,
+// so different files can be parsed on different threads at the same time
+class GltfParser {
+public:
+	bool parse(
+		const std::string& filename,
+		SceneGraph& graph,
+		SceneGraphFlatRefs& graph_refs,
+		MaterialResources& mat_res);
 
-std::vector<std::shared_ptr<ImageData>> g_images;
-std::vector<SamplerConfig> g_sampler_cfgs;
-std::vector<TextureBinding> g_textures;
-std::vector<std::shared_ptr<MaterialData>> g_materials;
+	void store_encoded_image(int image_id, const unsigned char* bytes, int size);
+
+private:
+	bool load_file(const std::string& filename, SceneGraph& scene);
+
+	bool redirect_buffers(std::string& json, const ByteSpan& glb_bin, const std::string& base_dir);
+	ByteSpan buffer_bytes(int buffer_id);
+	ByteSpan buffer_view_bytes(int buffer_view_id);
+
+	template<typename T>
+	bool load_accessor(int accessor_id, std::vector<T>& buffer);
+	bool load_indices(int accessor_id, std::vector<uint32_t>& indices);
+	template<typename T>
+	bool load_attribute(const tg::Primitive& prim, const std::string& name, std::vector<T>& buffer, int mesh_id, int prim_id);
+
+	ByteSpan encoded_image_bytes(int image_id);
+#ifdef GLTF_PARSER_DECODE_BENCHMARK
+	void benchmark_image_decode();
+#endif
+	std::shared_ptr<ImageData> load_image(int image_id);
+	bool load_all_images();
+	void load_all_samplers();
+	void setup_all_textures();
+	std::shared_ptr<MaterialData> load_material(int material_id);
+	bool load_all_materials();
+
+	bool load_primitive(int mesh_id, int prim_id, Renderable& renderable);
+	bool load_instance_transforms(const tg::Value& instancing, std::vector<glm::mat4>& transforms);
+	bool load_node(int node_id, int parent_id, SceneGraph& scene);
+
+	tg::Model _model;
+	tg::TinyGLTF _loader;
+	std::string _err;
+	std::string _warn;
+
+	std::vector<std::shared_ptr<ImageData>> _images;
+	std::vector<SamplerConfig> _sampler_cfgs;
+	std::vector<TextureBinding> _textures;
+	std::vector<std::shared_ptr<MaterialData>> _materials;
+
+	// (mesh id, primitive id) -- geometry shared by every node referencing the mesh
+	std::map<std::pair<int, int>, std::shared_ptr<MeshData>> _mesh_cache;
+
+	// binary payloads are kept out of tinygltf. Buffers stored in a .glb BIN chunk or in external files are memory-mapped
+	// and accessors read straight out of the mapping. tinygltf only sees a tiny placeholder buffer for each of them.
+	std::vector<std::shared_ptr<MappedFile>> _mapped_files;
+	std::vector<ByteSpan> _buffer_spans; // indexed by buffer id. empty span -- data owned by tg::Buffer (e.g. data uri)
+	std::vector<int> _image_buffer_views; // indexed by image id. bufferView of an image stored in a mapped buffer, or -1
+	std::vector<std::vector<uint8_t>> _encoded_images; // indexed by image id. encoded bytes handed over by tinygltf
+};
+
+static const char* placeholder_buffer_uri = "data:application/octet-stream;base64,AAAA";
+static const size_t placeholder_buffer_size = 3;
+// 1x1 png standing in for images stored in a mapped buffer. The real image is decoded from the mapping
+static const char* placeholder_image_uri =
+	"data:image/png;base64,iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAYAAAAfFcSJAAAADUlEQVR42mNkYPhfDwAChwGA60e6kgAAAABJRU5ErkJggg==";
+
+static std::string base_dir_of(const std::string& filename) {
+	size_t pos = filename.find_last_of("/\\");
+	return pos == std::string::npos ? std::string() : filename.substr(0, pos + 1);
+}
+
+// -1 if c is not a hex digit
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+// percent-escapes that are cut short or not hex are kept as they are
+static std::string decode_uri(const std::string& uri) {
+	std::string decoded;
+	for (size_t i = 0; i < uri.size(); ++i) {
+		int high = uri[i] == '%' && i + 2 < uri.size() ? hex_value(uri[i + 1]) : -1;
+		int low = high >= 0 ? hex_value(uri[i + 2]) : -1;
+		if (low >= 0) {
+			decoded.push_back((char)(high * 16 + low));
+			i += 2;
+		}
+		else {
+			decoded.push_back(uri[i]);
+		}
+	}
+	return decoded;
+}
+
+static bool is_data_uri(const std::string& uri) {
+	return uri.rfind("data:", 0) == 0;
+}
+
+// https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html#binary-gltf-layout
+static bool split_glb(const MappedFile& file, std::string& json, ByteSpan& bin) {
+	const uint32_t glb_magic = 0x46546C67; // "glTF"
+	const uint32_t chunk_json = 0x4E4F534A; // "JSON"
+	const uint32_t chunk_bin = 0x004E4942; // "BIN\0"
+
+	if (file.size() < 20) {
+		std::cout << "glb file too small" << std::endl;
+		return false;
+	}
+	uint32_t header[3];
+	std::memcpy(header, file.data(), sizeof(header));
+	if (header[0] != glb_magic || header[1] != 2) {
+		std::cout << "unsupported glb header. magic = " << header[0] << ", version = " << header[1] << std::endl;
+		return false;
+	}
+	size_t length = std::min<size_t>(header[2], file.size());
+
+	bool has_json = false;
+	size_t offset = sizeof(header);
+	while (offset + 8 <= length) {
+		uint32_t chunk[2]; // length, type
+		std::memcpy(chunk, file.data() + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (offset + chunk[0] > length) {
+			std::cout << "glb chunk exceeds file size" << std::endl;
+			return false;
+		}
+		if (chunk[1] == chunk_json) {
+			json.assign(reinterpret_cast<const char*>(file.data() + offset), chunk[0]);
+			has_json = true;
+		}
+		else if (chunk[1] == chunk_bin && !bin.data) {
+			bin.data = file.data() + offset;
+			bin.size = chunk[0];
+		}
+		offset += (chunk[0] + 3) & ~3u;
+	}
+
+	if (!has_json) {
+		std::cout << "glb file has no JSON chunk" << std::endl;
+	}
+	return has_json;
+}
+
+// map every non-embedded buffer and rewrite the json so that tinygltf does not copy buffer payloads.
+bool GltfParser::redirect_buffers(std::string& json, const ByteSpan& glb_bin, const std::string& base_dir) {
+	nlohmann::json doc = nlohmann::json::parse(json, nullptr, false);
+	if (doc.is_discarded()) {
+		std::cout << "failed to parse gltf json" << std::endl;
+		return false;
+	}
+
+	auto buffers = doc.find("buffers");
+	if (buffers != doc.end()) {
+		_buffer_spans.resize(buffers->size());
+		for (size_t buffer_id = 0; buffer_id < buffers->size(); ++buffer_id) {
+			nlohmann::json& buffer = (*buffers)[buffer_id];
+			size_t byte_length = buffer.value("byteLength", (size_t)0);
+
+			ByteSpan span;
+			if (!buffer.contains("uri")) {
+				// the BIN chunk of a glb
+				if (!glb_bin.data || glb_bin.size < byte_length) {
+					std::cout << "buffer " << buffer_id << " has no uri and no matching glb BIN chunk" << std::endl;
+					return false;
+				}
+				span = { glb_bin.data, byte_length };
+			}
+			else {
+				std::string uri = buffer["uri"].get<std::string>();
+				if (is_data_uri(uri)) {
+					// embedded base64. let tinygltf decode it
+					continue;
+				}
+				std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+				if (!file->open(base_dir + decode_uri(uri))) {
+					std::cout << "failed to map buffer file " << base_dir + uri << std::endl;
+					return false;
+				}
+				if (file->size() < byte_length) {
+					std::cout << "buffer file " << uri << " is smaller than byteLength = " << byte_length << std::endl;
+					return false;
+				}
+				span = { file->data(), byte_length };
+				_mapped_files.push_back(file);
+			}
+
+			_buffer_spans[buffer_id] = span;
+			buffer["uri"] = placeholder_buffer_uri;
+			buffer["byteLength"] = placeholder_buffer_size;
+		}
+	}
+
+	// images embedded in a redirected buffer must not be decoded by tinygltf from the placeholder
+	auto images = doc.find("images");
+	if (images != doc.end()) {
+		_image_buffer_views.resize(images->size(), -1);
+		for (size_t image_id = 0; image_id < images->size(); ++image_id) {
+			nlohmann::json& image = (*images)[image_id];
+			if (!image.contains("bufferView")) {
+				continue;
+			}
+			int bv_id = image["bufferView"].get<int>();
+			int buffer_id = doc["bufferViews"][bv_id].value("buffer", -1);
+			if (buffer_id < 0 || buffer_id >= (int)_buffer_spans.size() || !_buffer_spans[buffer_id].data) {
+				continue;
+			}
+			_image_buffer_views[image_id] = bv_id;
+			image.erase("bufferView");
+			image.erase("mimeType");
+			image["uri"] = placeholder_image_uri;
+		}
+	}
+
+	json = doc.dump();
+	return true;
+}
+
+ByteSpan GltfParser::buffer_bytes(int buffer_id) {
+	if (buffer_id < (int)_buffer_spans.size() && _buffer_spans[buffer_id].data) {
+		return _buffer_spans[buffer_id];
+	}
+	const tg::Buffer& buf = _model.buffers[buffer_id];
+	return { buf.data.data(), buf.data.size() };
+}
+
+ByteSpan GltfParser::buffer_view_bytes(int buffer_view_id) {
+	const tg::BufferView& bv = _model.bufferViews[buffer_view_id];
+	ByteSpan buffer = buffer_bytes(bv.buffer);
+	if (bv.byteOffset + bv.byteLength > buffer.size) {
+		std::cout << "bufferView " << buffer_view_id << " exceeds buffer size" << std::endl;
+		return {};
+	}
+	return { buffer.data + bv.byteOffset, bv.byteLength };
+}
+
+static bool dequantize_component_type(int gltf_component_type, Dequantize::ComponentType& type) {
+	switch (gltf_component_type) {
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+		type = Dequantize::ComponentType::Byte;
+		return true;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		type = Dequantize::ComponentType::UnsignedByte;
+		return true;
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+		type = Dequantize::ComponentType::Short;
+		return true;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		type = Dequantize::ComponentType::UnsignedShort;
+		return true;
+	default:
+		return false;
+	}
+}
 
 template<typename T>
-static bool load_accessor(int accessor_id, std::vector<T>& buffer) {
-	tg::Accessor& acc = model.accessors[accessor_id];
-	tg::BufferView& bv = model.bufferViews[acc.bufferView];
-	tg::Buffer& buf = model.buffers[bv.buffer];
-
-	// type check
-	if (GltfElementTraits<T>::gltf_type != acc.type ||
-		GltfElementTraits<T>::gltf_component_type != acc.componentType) {
+bool GltfParser::load_accessor(int accessor_id, std::vector<T>& buffer) {
+	tg::Accessor& acc = _model.accessors[accessor_id];
+
+	// type check. float attributes also accept quantized integer components
+	// https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Khronos/KHR_mesh_quantization
+	Dequantize::ComponentType quantized_type = Dequantize::ComponentType::Byte;
+	bool exact_match = GltfElementTraits<T>::gltf_component_type == acc.componentType;
+	bool quantized = !exact_match && GltfElementTraits<T>::dequantizable &&
+		dequantize_component_type(acc.componentType, quantized_type);
+	if (GltfElementTraits<T>::gltf_type != acc.type || (!exact_match && !quantized)) {
 		std::cout << "data type mismatch. accessor.type = " << acc.type
 			<< ", accessor.componentType = " << acc.componentType
 			<< ", target type = " << TypeReflect<T>::name << std::endl;
 		return false;
 	}
 
-	const unsigned char* ptr = buf.data.data() + bv.byteOffset + acc.byteOffset;
+	if (acc.sparse.isSparse) {
+		std::cout << "sparse accessor " << accessor_id << " is not supported" << std::endl;
+		return false;
+	}
 	size_t count = acc.count;
+	// accessors without a bufferView are all zeros
+	// https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html#accessor-data-types
+	if (acc.bufferView < 0 || acc.bufferView >= (int)_model.bufferViews.size()) {
+		if (acc.bufferView >= 0) {
+			std::cout << "accessor " << accessor_id << " has an invalid bufferView = " << acc.bufferView << std::endl;
+			return false;
+		}
+		buffer.resize(count);
+		std::memset(buffer.data(), 0, count * sizeof(T));
+		return true;
+	}
+	const tg::BufferView& bv = _model.bufferViews[acc.bufferView];
+	ByteSpan view = buffer_view_bytes(acc.bufferView);
 
-	size_t element_size = sizeof(T);
+	size_t element_size = tg::GetComponentSizeInBytes(acc.componentType) * GltfElementTraits<T>::n_components;
 	size_t stride = bv.byteStride ? bv.byteStride : element_size;
+	if (count > 0 && acc.byteOffset + stride * (count - 1) + element_size > view.size) {
+		std::cout << "accessor " << accessor_id << " exceeds its bufferView" << std::endl;
+		return false;
+	}
+	const unsigned char* ptr = view.data + acc.byteOffset;
 
 	buffer.resize(count);
-	for (size_t i = 0; i < count; ++i) {
-		const void* srcPtr = ptr + stride * i;
-		std::memcpy(&buffer[i], srcPtr, sizeof(T));
+	if (!quantized) {
+		// a single copy when tightly packed, per element otherwise
+		Dequantize::pack(ptr, stride, sizeof(T), count, reinterpret_cast<uint8_t*>(buffer.data()));
+		return true;
 	}
 
+	// interleaved quantized data is packed first so that the conversion runs over one contiguous array
+	std::vector<uint8_t> packed;
+	if (stride != element_size) {
+		packed.resize(element_size * count);
+		Dequantize::pack(ptr, stride, element_size, count, packed.data());
+		ptr = packed.data();
+	}
+	static_assert(!GltfElementTraits<T>::dequantizable || sizeof(T) == GltfElementTraits<T>::n_components * sizeof(float),
+		"dequantizable types must be tightly packed floats");
+	Dequantize::to_float(ptr, quantized_type, acc.normalized, count * GltfElementTraits<T>::n_components,
+		reinterpret_cast<float*>(buffer.data()));
+
 	return true;
 }
 
+// indices may be stored as uint8, uint16 or uint32. All of them are widened to uint32
+bool GltfParser::load_indices(int accessor_id, std::vector<uint32_t>& indices) {
+	const tg::Accessor& acc = _model.accessors[accessor_id];
+	switch (acc.componentType) {
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		return load_accessor(accessor_id, indices);
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+		std::vector<uint16_t> narrow;
+		if (!load_accessor(accessor_id, narrow)) {
+			return false;
+		}
+		indices.assign(narrow.begin(), narrow.end());
+		return true;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+		std::vector<uint8_t> narrow;
+		if (!load_accessor(accessor_id, narrow)) {
+			return false;
+		}
+		indices.assign(narrow.begin(), narrow.end());
+		return true;
+	}
+	default:
+		std::cout << "illegal index component type = " << acc.componentType << std::endl;
+		return false;
+	}
+}
+
 template<typename T>
-static bool load_attribute(
+bool GltfParser::load_attribute(
 	const tinygltf::Primitive& prim,
 	const std::string& name,
 	std::vector<T>& buffer,
@@ -71,61 +399,221 @@ static bool load_attribute(
 	return true;
 }
 
-static std::shared_ptr<ImageData> load_image(int image_id) {
+// stb_image is thread safe as long as the global flip/unpremultiply settings are left alone
+static bool decode_image(const uint8_t* encoded, size_t size, ImageData& image) {
+	if (Ktx2::is_ktx2(encoded, size)) {
+		return Ktx2::load(encoded, size, image);
+	}
+	int width, height, channels;
+	// always expand to rgba8. Some drivers do not support 24-bit images for Vulkan
+	stbi_uc* pixels = stbi_load_from_memory(encoded, (int)size, &width, &height, &channels, 4);
+	if (!pixels) {
+		std::cout << "failed to decode image " << image.uri << ": " << stbi_failure_reason() << std::endl;
+		return false;
+	}
+	image.pixel_data.assign(pixels, pixels + (size_t)width * height * 4);
+	stbi_image_free(pixels);
+	image.width = width;
+	image.height = height;
+	image.channels = 4;
+	image.bit_depth = 8;
+	return true;
+}
+
+// installed as the tinygltf image loader. Only keeps the encoded bytes, decoding happens on the thread pool
+static bool defer_image_decode(
+	tg::Image* image,
+	const int image_idx,
+	std::string* err,
+	std::string* warn,
+	int req_width,
+	int req_height,
+	const unsigned char* bytes,
+	int size,
+	void* user_data) {
+
+	static_cast<GltfParser*>(user_data)->store_encoded_image(image_idx, bytes, size);
+	return true;
+}
+
+void GltfParser::store_encoded_image(int image_id, const unsigned char* bytes, int size) {
+	if (image_id < (int)_image_buffer_views.size() && _image_buffer_views[image_id] >= 0) {
+		// placeholder of an image stored in a mapped buffer
+		return;
+	}
+	if (image_id >= (int)_encoded_images.size()) {
+		_encoded_images.resize(image_id + 1);
+	}
+	_encoded_images[image_id].assign(bytes, bytes + size);
+}
+
+ByteSpan GltfParser::encoded_image_bytes(int image_id) {
+	int bv_id = image_id < (int)_image_buffer_views.size() ? _image_buffer_views[image_id] : -1;
+	if (bv_id >= 0) {
+		return buffer_view_bytes(bv_id);
+	}
+	if (image_id < (int)_encoded_images.size()) {
+		return { _encoded_images[image_id].data(), _encoded_images[image_id].size() };
+	}
+	return {};
+}
+
+#ifdef GLTF_PARSER_DECODE_BENCHMARK
+void GltfParser::benchmark_image_decode() {
+	std::vector<ByteSpan> encoded;
+	size_t n_bytes = 0;
+	for (int image_id = 0; image_id < _model.images.size(); ++image_id) {
+		encoded.push_back(encoded_image_bytes(image_id));
+		n_bytes += encoded.back().size;
+	}
+
+	uint32_t max_threads = ThreadPool::default_thread_count();
+	for (uint32_t n_threads = 1; ; n_threads = std::min(n_threads * 2, max_threads)) {
+		ThreadPool pool(n_threads);
+		auto begin = std::chrono::steady_clock::now();
+		std::vector<std::future<bool>> results;
+		for (const ByteSpan& span : encoded) {
+			results.push_back(pool.submit([span]() {
+				ImageData scratch;
+				return decode_image(span.data, span.size, scratch);
+			}));
+		}
+		for (std::future<bool>& result : results) {
+			result.wait();
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		std::cout << "image decode benchmark: " << encoded.size() << " images (" << n_bytes / (1024 * 1024) << " MB encoded), "
+			<< n_threads << " threads, " << ms << " ms" << std::endl;
+
+		if (n_threads == max_threads) {
+			break;
+		}
+	}
+}
+#endif
+
+// returns immediately. The image is decoded on ThreadPool::shared(), see ImageData::decoded
+std::shared_ptr<ImageData> GltfParser::load_image(int image_id) {
 	if (image_id < 0) {
 		std::cout << "image id = " << image_id << std::endl;
 		return nullptr;
 	}
 
-	tg::Image& gltf_image = model.images[image_id];
+	tg::Image& gltf_image = _model.images[image_id];
 	std::shared_ptr<ImageData> i = std::make_shared<ImageData>();
-	i->uri = gltf_image.uri;
-	i->pixel_data = std::move(gltf_image.image);
-	i->width = gltf_image.width;
-	i->height = gltf_image.height;
-	i->channels = gltf_image.component;
-	i->bit_depth = gltf_image.bits;
+	if (!gltf_image.uri.empty() && !is_data_uri(gltf_image.uri)) {
+		i->uri = gltf_image.uri;
+	}
+	else {
+		i->uri = gltf_image.name.empty() ? "image_" + std::to_string(image_id) : gltf_image.name;
+	}
+
+	int bv_id = image_id < (int)_image_buffer_views.size() ? _image_buffer_views[image_id] : -1;
+	if (bv_id >= 0) {
+		ByteSpan encoded = buffer_view_bytes(bv_id);
+		if (!encoded.data) {
+			return nullptr;
+		}
+		// the worker keeps the mappings alive until it is done with them
+		std::vector<std::shared_ptr<MappedFile>> mappings = _mapped_files;
+		i->decoded = ThreadPool::shared().submit([i, encoded, mappings]() {
+			return decode_image(encoded.data, encoded.size, *i);
+		}).share();
+		return i;
+	}
+
+	if (image_id >= (int)_encoded_images.size() || _encoded_images[image_id].empty()) {
+		std::cout << "no encoded data for image " << image_id << std::endl;
+		return nullptr;
+	}
+	std::shared_ptr<std::vector<uint8_t>> encoded = std::make_shared<std::vector<uint8_t>>(std::move(_encoded_images[image_id]));
+	i->decoded = ThreadPool::shared().submit([i, encoded]() {
+		return decode_image(encoded->data(), encoded->size(), *i);
+	}).share();
 
 	return i;
 }
 
-static bool load_all_images() {
-	for (int image_id = 0; image_id < model.images.size(); ++image_id) {
+// fans out one decode task per distinct image. ImageData::wait() before touching the pixels
+bool GltfParser::load_all_images() {
+#ifdef GLTF_PARSER_DECODE_BENCHMARK
+	benchmark_image_decode();
+#endif
+	// images with byte-identical encoded data are decoded once and share their ImageData, which is what
+	// dedup_material_resources merges by. Compared before load_image hands the bytes over to the decode tasks
+	std::vector<int> first_ids(_model.images.size());
+	std::vector<uint64_t> hashes(_model.images.size(), 0);
+	std::vector<size_t> sizes(_model.images.size(), 0);
+	std::map<uint64_t, std::vector<int>> ids_by_hash;
+	for (int image_id = 0; image_id < _model.images.size(); ++image_id) {
+		first_ids[image_id] = image_id;
+		ByteSpan encoded = encoded_image_bytes(image_id);
+		if (!encoded.data) {
+			continue;
+		}
+		hashes[image_id] = BakedScene::hash(encoded.data, encoded.size);
+		sizes[image_id] = encoded.size;
+		std::vector<int>& candidates = ids_by_hash[hashes[image_id]];
+		auto match = std::find_if(candidates.begin(), candidates.end(), [&](int candidate) {
+			ByteSpan other = encoded_image_bytes(candidate);
+			return other.size == encoded.size && std::memcmp(other.data, encoded.data, encoded.size) == 0;
+		});
+		if (match != candidates.end()) {
+			first_ids[image_id] = *match;
+		}
+		else {
+			candidates.push_back(image_id);
+		}
+	}
+
+	for (int image_id = 0; image_id < _model.images.size(); ++image_id) {
+		if (first_ids[image_id] != image_id) {
+			_images.push_back(_images[first_ids[image_id]]);
+			continue;
+		}
 		std::shared_ptr<ImageData> image = load_image(image_id);
 		if (!image) {
 			std::cout << "Failed to load image." << std::endl;
 			return false;
 		}
-		g_images.push_back(image);
+		image->encoded_hash = hashes[image_id];
+		image->encoded_size = sizes[image_id];
+		_images.push_back(image);
 	}
 	return true;
 }
 
-static void load_all_samplers() {
-	for (tg::Sampler& gltf_sampler : model.samplers) {
+void GltfParser::load_all_samplers() {
+	for (tg::Sampler& gltf_sampler : _model.samplers) {
 		SamplerConfig sampler_cfg;
 		sampler_cfg.mag_filter = gltf_sampler.magFilter;
 		sampler_cfg.min_filter = gltf_sampler.minFilter;
 		sampler_cfg.wrap_s = gltf_sampler.wrapS;
 		sampler_cfg.wrap_t = gltf_sampler.wrapT;
 
-		g_sampler_cfgs.push_back(sampler_cfg);
+		_sampler_cfgs.push_back(sampler_cfg);
 	}
 }
 
-static void setup_all_textures() {
-	for (tg::Texture& gltf_texture : model.textures) {
-		g_textures.push_back({ gltf_texture.source, gltf_texture.sampler });
+void GltfParser::setup_all_textures() {
+	for (tg::Texture& gltf_texture : _model.textures) {
+		int source = gltf_texture.source;
+		// ktx2 only textures. Supercompressed (basis) payloads fail to decode later on
+		auto basisu = gltf_texture.extensions.find("KHR_texture_basisu");
+		if (source < 0 && basisu != gltf_texture.extensions.end() && basisu->second.Has("source")) {
+			source = basisu->second.Get("source").GetNumberAsInt();
+		}
+		_textures.push_back({ source, gltf_texture.sampler });
 	}
 }
 
-static std::shared_ptr<MaterialData> load_material(int material_id) {
+std::shared_ptr<MaterialData> GltfParser::load_material(int material_id) {
 	if (material_id < 0) {
 		std::cout << "material id = " << material_id << std::endl;
 		return nullptr;
 	}
 
-	const tg::Material& gltf_material = model.materials[material_id];
+	const tg::Material& gltf_material = _model.materials[material_id];
 	std::shared_ptr<MaterialData> m = std::make_shared<MaterialData>();
 	m->name = gltf_material.name;
 	m->base_color_factor[0] = gltf_material.pbrMetallicRoughness.baseColorFactor[0];
@@ -161,21 +649,29 @@ static std::shared_ptr<MaterialData> load_material(int material_id) {
 	return m;
 }
 
-static bool load_all_materials() {
-	for (int material_id = 0; material_id < model.materials.size(); ++material_id) {
+bool GltfParser::load_all_materials() {
+	for (int material_id = 0; material_id < _model.materials.size(); ++material_id) {
 		std::shared_ptr<MaterialData> material = load_material(material_id);
 		if (!material) {
 			std::cout << "Failed to load material." << std::endl;
 			return false;
 		}
-		g_materials.push_back(material);
+		_materials.push_back(material);
 	}
 	return true;
 }
 
 // a gltf mesh primitive corresponds to a renderable
-static bool load_primitive(int mesh_id, int prim_id, Renderable& renderable) {
-	const tg::Primitive& prim = model.meshes[mesh_id].primitives[prim_id];
+bool GltfParser::load_primitive(int mesh_id, int prim_id, Renderable& renderable) {
+	const tg::Primitive& prim = _model.meshes[mesh_id].primitives[prim_id];
+	renderable.material_id = prim.material;
+
+	// nodes referencing the same mesh share one MeshData
+	auto cached = _mesh_cache.find({ mesh_id, prim_id });
+	if (cached != _mesh_cache.end()) {
+		renderable.mesh = cached->second;
+		return true;
+	}
 
 	// load geometry
 	renderable.mesh = std::make_shared<MeshData>();
@@ -185,7 +681,7 @@ static bool load_primitive(int mesh_id, int prim_id, Renderable& renderable) {
 		return false;
 	}
 
-	if (!load_accessor(prim.indices, renderable.mesh->indices)) {
+	if (!load_indices(prim.indices, renderable.mesh->indices)) {
 		std::cout << "error parsing indices. indices_id = " << prim.indices << std::endl;
 		return false;
 	}
@@ -200,8 +696,22 @@ static bool load_primitive(int mesh_id, int prim_id, Renderable& renderable) {
 	if (!ret) {
 		return false;
 	}
-	
-	renderable.material_id = prim.material;
+
+	size_t n_vertices = renderable.mesh->positions.size();
+	for (uint32_t index : renderable.mesh->indices) {
+		if (index >= n_vertices) {
+			std::cout << "index " << index << " out of range. vertex count = " << n_vertices
+				<< ", mesh_id = " << mesh_id << ", prim_id = " << prim_id << std::endl;
+			return false;
+		}
+	}
+
+#ifdef GLTF_PARSER_CPU_AABB
+	Bounds::compute_aabb(*renderable.mesh);
+	Bounds::compute_volumes(*renderable.mesh);
+#endif
+
+	_mesh_cache[{ mesh_id, prim_id }] = renderable.mesh;
 	return true;
 }
 
@@ -241,8 +751,53 @@ static glm::mat4 parse_matrix(const tg::Node& node) {
 	return T * R * S;
 }
 
-static bool load_node(int node_id, int parent_id, SceneGraph& scene) {
-	const tg::Node& node = model.nodes[node_id];
+// https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_mesh_gpu_instancing
+bool GltfParser::load_instance_transforms(const tg::Value& instancing, std::vector<glm::mat4>& transforms) {
+	const tg::Value& attributes = instancing.Get("attributes");
+	if (!attributes.IsObject()) {
+		std::cout << "EXT_mesh_gpu_instancing without attributes" << std::endl;
+		return false;
+	}
+
+	std::vector<glm::vec3> translations;
+	std::vector<glm::vec4> rotations;
+	std::vector<glm::vec3> scales;
+	bool ret = true;
+	if (attributes.Has("TRANSLATION")) {
+		ret &= load_accessor(attributes.Get("TRANSLATION").GetNumberAsInt(), translations);
+	}
+	if (attributes.Has("ROTATION")) {
+		ret &= load_accessor(attributes.Get("ROTATION").GetNumberAsInt(), rotations);
+	}
+	if (attributes.Has("SCALE")) {
+		ret &= load_accessor(attributes.Get("SCALE").GetNumberAsInt(), scales);
+	}
+	if (!ret) {
+		std::cout << "error parsing instance attributes" << std::endl;
+		return false;
+	}
+
+	size_t n_instances = std::max({ translations.size(), rotations.size(), scales.size() });
+	if ((!translations.empty() && translations.size() != n_instances) ||
+		(!rotations.empty() && rotations.size() != n_instances) ||
+		(!scales.empty() && scales.size() != n_instances)) {
+		std::cout << "instance attribute counts do not match" << std::endl;
+		return false;
+	}
+
+	transforms.resize(n_instances);
+	for (size_t i = 0; i < n_instances; ++i) {
+		glm::vec3 t = translations.empty() ? glm::vec3(0.0f) : translations[i];
+		glm::quat r = rotations.empty() ? glm::quat(1.0f, 0.0f, 0.0f, 0.0f) :
+			glm::quat(rotations[i].w, rotations[i].x, rotations[i].y, rotations[i].z);
+		glm::vec3 s = scales.empty() ? glm::vec3(1.0f) : scales[i];
+		transforms[i] = glm::translate(glm::mat4(1.0f), t) * glm::toMat4(r) * glm::scale(glm::mat4(1.0f), s);
+	}
+	return true;
+}
+
+bool GltfParser::load_node(int node_id, int parent_id, SceneGraph& scene) {
+	const tg::Node& node = _model.nodes[node_id];
 
 	scene.emplace_back();
 	SceneNode& scene_node = scene.back();
@@ -260,7 +815,7 @@ static bool load_node(int node_id, int parent_id, SceneGraph& scene) {
 
 	// parse primitives
 	if (node.mesh != -1) {
-		for (int prim_id = 0; prim_id < model.meshes[node.mesh].primitives.size(); ++prim_id) {
+		for (int prim_id = 0; prim_id < _model.meshes[node.mesh].primitives.size(); ++prim_id) {
 			scene_node.renderables.emplace_back();
 			bool ret = load_primitive(node.mesh, prim_id, scene_node.renderables.back());
 			if (!ret) {
@@ -270,6 +825,27 @@ static bool load_node(int node_id, int parent_id, SceneGraph& scene) {
 		}
 	}
 
+	// each gpu instance becomes a child node carrying the mesh. They end up drawn instanced like any other shared mesh
+	auto instancing = node.extensions.find("EXT_mesh_gpu_instancing");
+	if (node.mesh != -1 && instancing != node.extensions.end()) {
+		std::vector<glm::mat4> instance_transforms;
+		if (!load_instance_transforms(instancing->second, instance_transforms)) {
+			std::cout << "error loading instances. node_id = " << node_id << std::endl;
+			return false;
+		}
+		std::vector<Renderable> renderables = std::move(scene_node.renderables);
+		scene_node.renderables.clear();
+		for (uint32_t i = 0; i < instance_transforms.size(); ++i) {
+			SceneNode instance_node;
+			instance_node.parent = this_id;
+			instance_node.name = node.name + "_instance_" + std::to_string(i);
+			instance_node.local_transform = instance_transforms[i];
+			instance_node.world_transform = scene[this_id].world_transform * instance_transforms[i];
+			instance_node.renderables = renderables;
+			scene.push_back(std::move(instance_node)); // invalidates scene_node
+		}
+	}
+
 	// recursively parse children
 	for (int node_id : node.children) {
 		bool ret = load_node(node_id, this_id, scene);
@@ -282,22 +858,131 @@ static bool load_node(int node_id, int parent_id, SceneGraph& scene) {
 	return true;
 }
 
-static bool load_gltf(const std::string& filename, SceneGraph& scene) {
-	bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, filename);
-	if (!err.empty()) {
-		std::cout << "Error loading file " << filename << ": " << err << std::endl;
+// the gltf file and every external buffer and image it references, in document order. false if the file cannot be read
+static bool gltf_source_files(const std::string& filename, std::vector<std::string>& files) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		return false;
+	}
+
+	std::string json;
+	ByteSpan glb_bin;
+	bool is_glb = file.size() >= 4 && std::memcmp(file.data(), "glTF", 4) == 0;
+	if (is_glb) {
+		if (!split_glb(file, json, glb_bin)) {
+			return false;
+		}
+	}
+	else {
+		json.assign(reinterpret_cast<const char*>(file.data()), file.size());
+	}
+	nlohmann::json doc = nlohmann::json::parse(json, nullptr, false);
+	if (doc.is_discarded()) {
+		return false;
+	}
+
+	files.push_back(filename);
+	std::string base_dir = base_dir_of(filename);
+	for (const char* key : { "buffers", "images" }) {
+		auto entries = doc.find(key);
+		if (entries == doc.end()) {
+			continue;
+		}
+		for (const nlohmann::json& entry : *entries) {
+			if (!entry.contains("uri")) {
+				continue;
+			}
+			std::string uri = entry["uri"].get<std::string>();
+			if (is_data_uri(uri)) {
+				continue;
+			}
+			files.push_back(base_dir + decode_uri(uri));
+		}
+	}
+	return true;
+}
+
+uint64_t gltf_source_hash(const std::string& filename) {
+	std::vector<std::string> files;
+	if (!gltf_source_files(filename, files)) {
+		return 0;
+	}
+	uint64_t h = 0;
+	for (const std::string& path : files) {
+		MappedFile source;
+		if (!source.open(path)) {
+			return 0;
+		}
+		h = BakedScene::hash(source.data(), source.size(), h);
+	}
+	return h;
+}
+
+uint64_t gltf_source_stamp(const std::string& filename) {
+	std::vector<std::string> files;
+	if (!gltf_source_files(filename, files)) {
+		return 0;
+	}
+	uint64_t h = 0;
+	for (const std::string& path : files) {
+		std::error_code ec;
+		uint64_t stamp[2];
+		stamp[0] = (uint64_t)std::filesystem::file_size(path, ec);
+		if (ec) {
+			return 0;
+		}
+		stamp[1] = (uint64_t)std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+		if (ec) {
+			return 0;
+		}
+		h = BakedScene::hash(stamp, sizeof(stamp), h);
+	}
+	return h;
+}
+
+bool GltfParser::load_file(const std::string& filename, SceneGraph& scene) {
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->open(filename)) {
+		std::cout << "Failed to open file " << filename << std::endl;
 		return false;
 	}
-	if (!warn.empty()) {
-		std::cout << "Warning loading file " << filename << ": " << warn << std::endl;
+	_mapped_files.push_back(file);
+
+	std::string json;
+	ByteSpan glb_bin;
+	bool is_glb = file->size() >= 4 && std::memcmp(file->data(), "glTF", 4) == 0;
+	if (is_glb) {
+		if (!split_glb(*file, json, glb_bin)) {
+			std::cout << "Failed to read glb file " << filename << std::endl;
+			return false;
+		}
+	}
+	else {
+		json.assign(reinterpret_cast<const char*>(file->data()), file->size());
 	}
 
-	if (model.scenes.size() != 1) {
+	std::string base_dir = base_dir_of(filename);
+	if (!redirect_buffers(json, glb_bin, base_dir)) {
+		std::cout << "Failed to map buffers of " << filename << std::endl;
+		return false;
+	}
+
+	_loader.SetImageLoader(defer_image_decode, this);
+	bool ret = _loader.LoadASCIIFromString(&_model, &_err, &_warn, json.c_str(), (unsigned int)json.size(), base_dir);
+	if (!_err.empty()) {
+		std::cout << "Error loading file " << filename << ": " << _err << std::endl;
+		return false;
+	}
+	if (!_warn.empty()) {
+		std::cout << "Warning loading file " << filename << ": " << _warn << std::endl;
+	}
+
+	if (_model.scenes.size() != 1) {
 		std::cout << "Parse gltf file with 1 scene only" << std::endl;
 		return false;
 	}
 
-	for (int node_id : model.scenes[0].nodes) {
+	for (int node_id : _model.scenes[0].nodes) {
 		bool ret = load_node(node_id, -1, scene);
 		if (!ret) {
 			std::cout << "error loading node. node_id = " << node_id << std::endl;
@@ -316,10 +1001,10 @@ static bool load_gltf(const std::string& filename, SceneGraph& scene) {
 		return false;
 	}
 
-	model = {};
-	loader = {};
-	err.clear();
-	warn.clear();
+	_buffer_spans.clear();
+	_image_buffer_views.clear();
+	_encoded_images.clear();
+	_mapped_files.clear(); // geometry is copied out by now. image decode tasks hold their own references
 
 	return true;
 }
@@ -333,28 +1018,22 @@ static PipelineVariant find_pipeline_variant(SceneGraph& scene, uint32_t node_id
 	}
 }
 
-bool load_gltf(
+bool GltfParser::parse(
 	const std::string& filename,
 	SceneGraph& graph,
 	SceneGraphFlatRefs& graph_refs,
 	MaterialResources& mat_res) {
 
-	if (!load_gltf(filename, graph)) {
+	if (!load_file(filename, graph)) {
 		std::cout << "error loading gltf file " << filename << std::endl;
-		// clear g_* buffers
 		assert(false);
 		return false;
 	}
 
-	mat_res.images = std::move(g_images);
-	mat_res.sampler_cfgs = std::move(g_sampler_cfgs);
-	mat_res.textures = std::move(g_textures);
-	mat_res.materials = std::move(g_materials);
-
-	g_images.clear();
-	g_sampler_cfgs.clear();
-	g_textures.clear();
-	g_materials.clear();
+	mat_res.images = std::move(_images);
+	mat_res.sampler_cfgs = std::move(_sampler_cfgs);
+	mat_res.textures = std::move(_textures);
+	mat_res.materials = std::move(_materials);
 
 	for (uint32_t node_id = 0; node_id < graph.size(); ++node_id) {
 		SceneNode& node = graph[node_id];
@@ -367,4 +1046,226 @@ bool load_gltf(
 	}
 
 	return true;
-}
\ No newline at end of file
+}
+
+bool load_gltf(
+	const std::string& filename,
+	SceneGraph& graph,
+	SceneGraphFlatRefs& graph_refs,
+	MaterialResources& mat_res) {
+
+	SceneGraph file_graph;
+	SceneGraphFlatRefs file_refs;
+	MaterialResources file_res;
+	GltfParser parser;
+	if (!parser.parse(filename, file_graph, file_refs, file_res)) {
+		return false;
+	}
+	merge_scene(graph, graph_refs, mat_res, file_graph, file_refs, file_res);
+	return true;
+}
+
+bool load_gltf(
+	const std::vector<std::string>& filenames,
+	SceneGraph& graph,
+	SceneGraphFlatRefs& graph_refs,
+	MaterialResources& mat_res) {
+
+	struct FileResult {
+		SceneGraph graph;
+		SceneGraphFlatRefs refs;
+		MaterialResources mat_res;
+	};
+	std::vector<FileResult> results(filenames.size());
+
+	// a pool of its own. Parse tasks must not wait behind the image decodes they submit to ThreadPool::shared()
+	ThreadPool pool(std::min<uint32_t>((uint32_t)filenames.size(), ThreadPool::default_thread_count()));
+	std::vector<std::future<bool>> parsed;
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		parsed.push_back(pool.submit([&filenames, &results, i]() {
+			GltfParser parser;
+			return parser.parse(filenames[i], results[i].graph, results[i].refs, results[i].mat_res);
+		}));
+	}
+
+	bool ret = true;
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		if (!parsed[i].get()) {
+			std::cout << "error loading gltf file " << filenames[i] << std::endl;
+			ret = false;
+		}
+	}
+	if (!ret) {
+		return false;
+	}
+
+	// merge in the order of filenames so that ids do not depend on which thread finished first
+	for (FileResult& result : results) {
+		merge_scene(graph, graph_refs, mat_res, result.graph, result.refs, result.mat_res);
+	}
+	return true;
+}
+
+void merge_scene(
+	SceneGraph& dst_graph,
+	SceneGraphFlatRefs& dst_refs,
+	MaterialResources& dst_res,
+	SceneGraph& src_graph,
+	const SceneGraphFlatRefs& src_refs,
+	MaterialResources& src_res) {
+
+	uint32_t node_offset = (uint32_t)dst_graph.size();
+	int image_offset = (int)dst_res.images.size();
+	int sampler_offset = (int)dst_res.sampler_cfgs.size();
+	int texture_offset = (int)dst_res.textures.size();
+	int material_offset = (int)dst_res.materials.size();
+
+	// negative ids mean "none" and are kept as they are
+	auto shift = [](int id, int offset) {
+		return id < 0 ? id : id + offset;
+	};
+
+	for (SceneNode& node : src_graph) {
+		node.parent = shift(node.parent, (int)node_offset);
+		for (Renderable& renderable : node.renderables) {
+			renderable.material_id = shift(renderable.material_id, material_offset);
+		}
+		dst_graph.push_back(std::move(node));
+	}
+	for (ObjectRef ref : src_refs) {
+		ref.node_id += node_offset;
+		dst_refs.push_back(ref);
+	}
+
+	for (TextureBinding texture : src_res.textures) {
+		texture.image_id = shift(texture.image_id, image_offset);
+		texture.sampler_id = shift(texture.sampler_id, sampler_offset);
+		dst_res.textures.push_back(texture);
+	}
+	for (std::shared_ptr<MaterialData>& material : src_res.materials) {
+		material->base_color_id = shift(material->base_color_id, texture_offset);
+		material->metallic_roughness_id = shift(material->metallic_roughness_id, texture_offset);
+		material->normal_id = shift(material->normal_id, texture_offset);
+		material->occlusion_id = shift(material->occlusion_id, texture_offset);
+		material->emissive_id = shift(material->emissive_id, texture_offset);
+		dst_res.materials.push_back(material);
+	}
+	dst_res.images.insert(dst_res.images.end(), src_res.images.begin(), src_res.images.end());
+	dst_res.sampler_cfgs.insert(dst_res.sampler_cfgs.end(), src_res.sampler_cfgs.begin(), src_res.sampler_cfgs.end());
+
+	src_graph.clear();
+	src_res = {};
+}
+
+static bool same_sampler(const SamplerConfig& a, const SamplerConfig& b) {
+	return a.min_filter == b.min_filter && a.mag_filter == b.mag_filter && a.wrap_s == b.wrap_s && a.wrap_t == b.wrap_t;
+}
+
+// whether two images of the same encoded hash and size decoded to the same texels. The encoded bytes are gone by now,
+// identical ones decode identically
+static bool same_image(const ImageData& a, const ImageData& b) {
+	if (&a == &b) {
+		return true;
+	}
+	if (!a.wait() || !b.wait()) {
+		return false;
+	}
+	return a.width == b.width && a.height == b.height && a.channels == b.channels && a.bit_depth == b.bit_depth &&
+		a.block_format == b.block_format && a.mips.size() == b.mips.size() && a.pixels_size() == b.pixels_size() &&
+		std::memcmp(a.pixels(), b.pixels(), a.pixels_size()) == 0;
+}
+
+void dedup_material_resources(MaterialResources& mat_res) {
+	auto begin = std::chrono::steady_clock::now();
+
+	// images of different files (merge_scene) with identical encoded bytes, and those the parser already shares one
+	// ImageData between. Images without encoded bytes only merge with themselves.
+	// The same data sampled differently (srgb, swizzle) needs an image of its own
+	std::vector<ImageUsage> usages = image_usages(mat_res);
+	std::map<std::tuple<uint64_t, size_t, bool, bool>, std::vector<int>> candidates_by_key;
+	std::vector<int> image_remap(mat_res.images.size());
+	std::vector<std::shared_ptr<ImageData>> unique_images;
+	for (int img_id = 0; img_id < (int)mat_res.images.size(); ++img_id) {
+		const ImageData& image = *mat_res.images[img_id];
+		std::vector<int>& candidates = candidates_by_key[{ image.encoded_hash, image.encoded_size, usages[img_id].srgb, usages[img_id].swizzle }];
+		auto match = std::find_if(candidates.begin(), candidates.end(), [&](int unique_id) {
+			const ImageData& unique = *unique_images[unique_id];
+			return image.encoded_size > 0 ? same_image(unique, image) : &unique == &image;
+		});
+		if (match != candidates.end()) {
+			image_remap[img_id] = *match;
+		}
+		else {
+			image_remap[img_id] = (int)unique_images.size();
+			candidates.push_back((int)unique_images.size());
+			unique_images.push_back(mat_res.images[img_id]);
+		}
+	}
+
+	std::vector<int> sampler_remap(mat_res.sampler_cfgs.size());
+	std::vector<SamplerConfig> unique_samplers;
+	for (int sampler_id = 0; sampler_id < (int)mat_res.sampler_cfgs.size(); ++sampler_id) {
+		const SamplerConfig& cfg = mat_res.sampler_cfgs[sampler_id];
+		auto match = std::find_if(unique_samplers.begin(), unique_samplers.end(), [&](const SamplerConfig& unique) {
+			return same_sampler(unique, cfg);
+		});
+		sampler_remap[sampler_id] = (int)(match - unique_samplers.begin());
+		if (match == unique_samplers.end()) {
+			unique_samplers.push_back(cfg);
+		}
+	}
+
+	for (TextureBinding& texture : mat_res.textures) {
+		if (texture.image_id >= 0) {
+			texture.image_id = image_remap[texture.image_id];
+		}
+		if (texture.sampler_id >= 0) {
+			texture.sampler_id = sampler_remap[texture.sampler_id];
+		}
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	std::cout << "deduplicated images " << mat_res.images.size() << " -> " << unique_images.size()
+		<< ", samplers " << mat_res.sampler_cfgs.size() << " -> " << unique_samplers.size()
+		<< " in " << ms << " ms" << std::endl;
+	mat_res.images = std::move(unique_images);
+	mat_res.sampler_cfgs = std::move(unique_samplers);
+}
+
+#ifdef GLTF_PARSER_LOAD_BENCHMARK
+void benchmark_load_gltf(const std::vector<std::string>& filenames) {
+	// image decoding runs asynchronously in both cases. Wait for it so that the timings cover the whole load
+	auto wait_for_images = [](const MaterialResources& mat_res) {
+		for (const std::shared_ptr<ImageData>& image : mat_res.images) {
+			image->wait();
+		}
+	};
+
+	double serial_ms = 0.0;
+	{
+		SceneGraph graph;
+		SceneGraphFlatRefs refs;
+		MaterialResources mat_res;
+		auto begin = std::chrono::steady_clock::now();
+		for (const std::string& filename : filenames) {
+			load_gltf(filename, graph, refs, mat_res);
+		}
+		wait_for_images(mat_res);
+		serial_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+	double concurrent_ms = 0.0;
+	{
+		SceneGraph graph;
+		SceneGraphFlatRefs refs;
+		MaterialResources mat_res;
+		auto begin = std::chrono::steady_clock::now();
+		load_gltf(filenames, graph, refs, mat_res);
+		wait_for_images(mat_res);
+		concurrent_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+	std::cout << "gltf load benchmark: " << filenames.size() << " files, serial " << serial_ms << " ms, concurrent "
+		<< concurrent_ms << " ms (" << serial_ms / concurrent_ms << "x)" << std::endl;
+}
+#endif
@@ -4,9 +4,43 @@
 #include "bindless_data_manager.h"
 
 #include <string>
+#include <vector>
 
+// appends the scene of one file to graph, graph_refs and mat_res.
+// Re-entrant: any number of files can be loaded from different threads at the same time
 bool load_gltf(
 	const std::string& filename,
 	SceneGraph& graph,
 	SceneGraphFlatRefs& graph_refs,
 	MaterialResources& mat_res);
+
+// parses all files concurrently, then appends them in the given order
+bool load_gltf(
+	const std::vector<std::string>& filenames,
+	SceneGraph& graph,
+	SceneGraphFlatRefs& graph_refs,
+	MaterialResources& mat_res);
+
+// moves src_* to the end of dst_*, remapping node, material, texture, image and sampler ids
+void merge_scene(
+	SceneGraph& dst_graph,
+	SceneGraphFlatRefs& dst_refs,
+	MaterialResources& dst_res,
+	SceneGraph& src_graph,
+	const SceneGraphFlatRefs& src_refs,
+	MaterialResources& src_res);
+
+// merges images decoded from byte-identical data and equal sampler configs, remapping the ids in textures.
+// Does not wait for image decoding
+void dedup_material_resources(MaterialResources& mat_res);
+
+// hash of the file and every external buffer and image it references. 0 if any of them cannot be read
+uint64_t gltf_source_hash(const std::string& filename);
+
+// the same files by size and modification time only, without reading them through. 0 if any of them cannot be found
+uint64_t gltf_source_stamp(const std::string& filename);
+
+#ifdef GLTF_PARSER_LOAD_BENCHMARK
+// loads the files one after another, then all at once, and prints both wall times
+void benchmark_load_gltf(const std::vector<std::string>& filenames);
+#endif
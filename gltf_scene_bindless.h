@@ -3,9 +3,13 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <future>
+#include <chrono>
+#include <limits>
 #include <glm/glm.hpp>
 
 #include "gltf_scene_config.h"
+#include "mapped_file.h"
 
 #include "otcv.h"
 #include "global_handles.h"
@@ -16,6 +20,44 @@ struct AABB {
     glm::vec3 max;
 };
 
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// oriented box, axes orthonormal and right handed
+struct OBB {
+    glm::vec3 center;
+    glm::vec3 axes[3];
+    glm::vec3 half_extents; // along axes
+};
+
+// cluster of at most max_vertices vertices and max_triangles triangles, contiguous in MeshData::indices.
+// Culled on the GPU by its bounding sphere and normal cone, see meshlet_cull.comp
+struct Meshlet {
+    static const uint32_t max_vertices = 64;
+    static const uint32_t max_triangles = 124;
+
+    uint32_t first_index; // relative to the mesh
+    uint32_t index_count;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 cone_axis;
+    // sine of the cone's half angle. Above 1 when the triangles face too many directions to ever be back facing together
+    float cone_cutoff;
+};
+
+// coarser set of triangles over the vertices of its mesh, built by MeshSimplifier
+struct MeshLod {
+    // including the full detail MeshData::indices
+    static const uint32_t max_lods = 4;
+
+    std::vector<uint32_t> indices;
+    // square root of the largest quadric error (area weighted mean squared distance to the planes merged into the
+    // surviving vertex) of any collapse up to this level, in mesh units. An estimate, not a bound on the distance
+    float error;
+};
+
 struct MeshData {
     std::vector<glm::vec3> positions;
     std::vector<glm::vec3> normals;
@@ -23,18 +65,107 @@ struct MeshData {
     std::vector<glm::vec2> uv1;
     std::vector<glm::vec4> tangents;
 
-    std::vector<uint16_t> indices;
+    // stored 32 bit regardless of the accessor's component type.
+    // narrowed to 16 bit on upload when the vertex count allows it, see index_width()
+    std::vector<uint32_t> indices;
 
     AABB aabb;
+    bool aabb_valid = false; // otherwise computed on the GPU by MeshPreprocessor. see GLTF_PARSER_CPU_AABB
+
+    // tighter volumes for culling, see Bounds::compute_volumes
+    BoundingSphere sphere;
+    OBB obb;
+    bool volumes_valid = false;
+
+    // in index order, built by MeshOptimizer::build_meshlets
+    std::vector<Meshlet> meshlets;
+
+    // coarser levels after indices, in increasing error. At most MeshLod::max_lods - 1, built by MeshOptimizer::build_lods
+    std::vector<MeshLod> lods;
+};
+
+enum class IndexWidth : uint32_t {
+    U16 = 0,
+    U32 = 1,
+    All = 2
+};
+
+inline IndexWidth index_width(const MeshData& mesh) {
+    return mesh.positions.size() <= (size_t)std::numeric_limits<uint16_t>::max() + 1 ? IndexWidth::U16 : IndexWidth::U32;
+}
+
+// levels drawn of the mesh, the full detail one included
+inline uint32_t lod_count(const MeshData& mesh) {
+    uint32_t n_lods = (uint32_t)mesh.lods.size() + 1;
+    return n_lods < MeshLod::max_lods ? n_lods : MeshLod::max_lods;
+}
+
+// GPU layouts of the bindless vertex buffers, one binding per attribute
+enum class VertexLayout : uint32_t {
+    // vec3 position, vec3 normal, vec2 uv0, vec4 tangent. 48 bytes
+    Float = 0,
+    // unorm16x4 position within the mesh AABB, snorm16x4 tangent frame quaternion, unorm16x2 uv0 within the mesh UV bounds
+    // whose high 8 bits per component are in the position w. 20 bytes
+    Compact = 1
+};
+
+struct MipLevel {
+    uint32_t width;
+    uint32_t height;
+    size_t offset; // into ImageData::pixels()
+    size_t size;
+};
+
+enum class BlockFormat : uint32_t {
+    None = 0,
+    BC1,
+    BC3,
+    BC5,
+    BC7
 };
 
 struct ImageData {
     std::string uri;
+    // of the encoded bytes the image is decoded from, set before decoding starts. 0 for images that had none (baked
+    // scenes). dedup_material_resources merges images of different files by them
+    uint64_t encoded_hash = 0;
+    size_t encoded_size = 0;
     std::vector<uint8_t> pixel_data;
+    // pixels of an image loaded from a baked scene, read in place from the file it keeps mapped. pixel_data stays
+    // empty then, see pixels()
+    ByteSpan mapped_pixels;
+    std::shared_ptr<MappedFile> mapping;
+    // full pre-built mip chain stored back to back in pixels(), level 0 first.
+    // empty -- pixels() is level 0 only and the mips are generated on the GPU
+    std::vector<MipLevel> mips;
     int width;
     int height;
+    // of the decoded texels, also for block compressed images
     int channels;
     int bit_depth;
+    // pixels() holds 4x4 blocks unless None. Block compressed images always come with mips
+    BlockFormat block_format = BlockFormat::None;
+
+    // valid while the image is decoded on a worker thread. Everything above except uri and the encoded hash and size
+    // must not be touched before the decode finished
+    std::shared_future<bool> decoded;
+
+    bool ready() const {
+        return !decoded.valid() || decoded.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // returns false if decoding failed
+    bool wait() const {
+        return !decoded.valid() || decoded.get();
+    }
+
+    // whichever of pixel_data and mapped_pixels holds the pixels
+    const uint8_t* pixels() const {
+        return mapped_pixels.data ? mapped_pixels.data : pixel_data.data();
+    }
+    size_t pixels_size() const {
+        return mapped_pixels.data ? mapped_pixels.size : pixel_data.size();
+    }
 };
 
 struct SamplerConfig {
@@ -109,3 +240,34 @@ struct MaterialResources {
     std::vector<TextureBinding> textures;
     std::vector<std::shared_ptr<MaterialData>> materials;
 };
+
+// how the materials sample an image. The first material referencing it decides
+struct ImageUsage {
+    bool referenced = false;
+    bool srgb = false;
+    bool swizzle = false; // metallic-roughness, see BindlessDataManager::upload_image_async
+};
+
+inline std::vector<ImageUsage> image_usages(const MaterialResources& mat_res) {
+    std::vector<ImageUsage> usages(mat_res.images.size());
+    auto use_image_by_texture_id = [&](int tex_id, bool srgb, bool swizzle) {
+        if (tex_id < 0) {
+            return;
+        }
+        int img_id = mat_res.textures[tex_id].image_id;
+        if (img_id < 0) {
+            return;
+        }
+        if (!usages[img_id].referenced) {
+            usages[img_id] = { true, srgb, swizzle };
+        }
+    };
+    for (const std::shared_ptr<MaterialData>& mat : mat_res.materials) {
+        use_image_by_texture_id(mat->base_color_id, true, false);
+        use_image_by_texture_id(mat->normal_id, false, false);
+        use_image_by_texture_id(mat->metallic_roughness_id, false, true);
+        use_image_by_texture_id(mat->occlusion_id, false, false);
+        use_image_by_texture_id(mat->emissive_id, true, false);
+    }
+    return usages;
+}
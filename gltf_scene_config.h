@@ -2,4 +2,53 @@
 
 #define GLTF_SCENE_USING_OTCV
 
-// #define GLTF_PARSER_RAY_TRACING
\ No newline at end of file
+// #define GLTF_PARSER_RAY_TRACING
+
+// decode all images with 1, 2, 4 ... threads at load time and print the wall time of each run
+// #define GLTF_PARSER_DECODE_BENCHMARK
+
+// load the scene files serially and concurrently at startup and print the wall time of both
+// #define GLTF_PARSER_LOAD_BENCHMARK
+
+// fill MeshData::aabb while parsing with a SIMD min/max, along with the culling spheres and obbs.
+// Otherwise MeshPreprocessor reduces the aabbs on the GPU and BindlessDataManager fits the rest when objects are set
+#define GLTF_PARSER_CPU_AABB
+
+// time AABBs of a synthetic 100K object scene on the CPU and the GPU at startup
+// #define MESH_PREPROCESSOR_AABB_BENCHMARK
+
+// block compress images when baking a scene: BC7 base color, BC5 normal maps, BC1 (BC7 with alpha) everything else
+// #define BAKED_SCENE_BLOCK_COMPRESSION
+
+// BC1/BC3 base color instead of BC7. Bakes faster at lower quality
+// #define BAKED_SCENE_FAST_BLOCK_COMPRESSION
+
+// VertexLayout::Compact for the bindless vertex buffers: quantized positions and uvs, tangent frame quaternions. 20 instead of 48 bytes per vertex.
+// UVs are 24 bit within the bounds of their mesh, so tiled ones stay sub-texel as well
+// #define BINDLESS_COMPACT_VERTEX_LAYOUT
+
+// cull meshlets after objects and draw the survivors one command each, instead of one instanced command per visible mesh
+// #define SCENE_CULLING_MESHLETS
+
+// two-phase occlusion culling of the g-pass: last frame's visible objects first, then the rest against a depth pyramid of those
+// #define SCENE_CULLING_OCCLUSION
+
+// frustum cull on the CPU with AVX2 and ThreadPool::shared() instead of the culling shaders. Overrides SCENE_CULLING_MESHLETS
+// #define SCENE_CULLING_CPU
+
+// time CPU culling of a synthetic 1M object scene at startup
+// #define SCENE_CULLING_CPU_BENCHMARK
+
+// split shadow cascades over the depth range of the g-buffer, read back from frames in flight ago, instead of the whole
+// camera range
+// #define SHADOW_SAMPLE_DISTRIBUTION
+
+// exponential variance shadow maps: cascades are blurred and mipmapped once when drawn and lighting takes one filtered
+// fetch, instead of jittered PCF. Costs 8 bytes per texel at half the shadowmap resolution, mipmapped, plus one layer of
+// scratch: about 34 + 8 MB for the three 2048 cascades of main.cpp
+// #define SHADOW_EVSM
+
+// draw all shadow cascades in one pass over the whole shadowmap array. Culling writes one list for all of them, each
+// command is instanced once per cascade and the vertex shader picks the layer. Needs the shaderOutputLayer device feature
+// enabled at device creation, which otcv::create_context does not do yet. One pass per cascade is drawn without it
+// #define SHADOW_LAYERED_CASCADES
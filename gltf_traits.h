@@ -8,6 +8,7 @@ struct GltfElementTraits<glm::vec2> {
 	static constexpr int n_components = 2;
 	static constexpr int gltf_type = TINYGLTF_TYPE_VEC2;
 	static constexpr int gltf_component_type = TINYGLTF_COMPONENT_TYPE_FLOAT;
+	static constexpr bool dequantizable = true; // accepts 8/16 bit integer components
 };
 
 template<>
@@ -15,6 +16,7 @@ struct GltfElementTraits<glm::vec3> {
 	static constexpr int n_components = 3;
 	static constexpr int gltf_type = TINYGLTF_TYPE_VEC3;
 	static constexpr int gltf_component_type = TINYGLTF_COMPONENT_TYPE_FLOAT;
+	static constexpr bool dequantizable = true; // accepts 8/16 bit integer components
 };
 
 template<>
@@ -22,6 +24,7 @@ struct GltfElementTraits<glm::vec4> {
 	static constexpr int n_components = 4;
 	static constexpr int gltf_type = TINYGLTF_TYPE_VEC4;
 	static constexpr int gltf_component_type = TINYGLTF_COMPONENT_TYPE_FLOAT;
+	static constexpr bool dequantizable = true; // accepts 8/16 bit integer components
 };
 
 template<>
@@ -29,6 +32,7 @@ struct GltfElementTraits<uint32_t> {
 	static constexpr int n_components = 1;
 	static constexpr int gltf_type = TINYGLTF_TYPE_SCALAR;
 	static constexpr int gltf_component_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+	static constexpr bool dequantizable = false;
 };
 
 template<>
@@ -36,6 +40,15 @@ struct GltfElementTraits<uint16_t> {
 	static constexpr int n_components = 1;
 	static constexpr int gltf_type = TINYGLTF_TYPE_SCALAR;
 	static constexpr int gltf_component_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+	static constexpr bool dequantizable = false;
+};
+
+template<>
+struct GltfElementTraits<uint8_t> {
+	static constexpr int n_components = 1;
+	static constexpr int gltf_type = TINYGLTF_TYPE_SCALAR;
+	static constexpr int gltf_component_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+	static constexpr bool dequantizable = false;
 };
 
 template<typename T>
@@ -64,4 +77,9 @@ struct TypeReflect<uint32_t> {
 template<>
 struct TypeReflect<uint16_t> {
 	static constexpr const char* name = "uint16_t";
-};
\ No newline at end of file
+};
+
+template<>
+struct TypeReflect<uint8_t> {
+	static constexpr const char* name = "uint8_t";
+};
@@ -0,0 +1,171 @@
+#include "image_levels.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+uint32_t MipChain::level_count(uint32_t width, uint32_t height) {
+	uint32_t levels = 1;
+	uint32_t size = std::max(width, height);
+	while (size > 1) {
+		size /= 2;
+		++levels;
+	}
+	return levels;
+}
+
+static float srgb_to_linear(float c) {
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float c) {
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// 2x2 box filter. Odd edges reuse the last row/column
+static void downsample_rgba8(
+	const uint8_t* src, uint32_t src_width, uint32_t src_height,
+	uint8_t* dst, uint32_t dst_width, uint32_t dst_height,
+	const float* to_linear, bool srgb) {
+
+	for (uint32_t y = 0; y < dst_height; ++y) {
+		uint32_t y0 = std::min(y * 2, src_height - 1);
+		uint32_t y1 = std::min(y * 2 + 1, src_height - 1);
+		for (uint32_t x = 0; x < dst_width; ++x) {
+			uint32_t x0 = std::min(x * 2, src_width - 1);
+			uint32_t x1 = std::min(x * 2 + 1, src_width - 1);
+			const uint8_t* p[4] = {
+				src + ((size_t)y0 * src_width + x0) * 4,
+				src + ((size_t)y0 * src_width + x1) * 4,
+				src + ((size_t)y1 * src_width + x0) * 4,
+				src + ((size_t)y1 * src_width + x1) * 4
+			};
+			uint8_t* out = dst + ((size_t)y * dst_width + x) * 4;
+			for (uint32_t c = 0; c < 4; ++c) {
+				// alpha is always linear
+				bool convert = srgb && c < 3;
+				float sum = 0.0f;
+				for (const uint8_t* texel : p) {
+					sum += convert ? to_linear[texel[c]] : texel[c] / 255.0f;
+				}
+				float v = sum * 0.25f;
+				if (convert) {
+					v = linear_to_srgb(v);
+				}
+				out[c] = (uint8_t)std::lround(std::min(std::max(v, 0.0f), 1.0f) * 255.0f);
+			}
+		}
+	}
+}
+
+void MipChain::build(ImageData& image, bool srgb) {
+	assert(image.channels == 4 && image.bit_depth == 8);
+
+	float to_linear[256];
+	for (uint32_t i = 0; i < 256; ++i) {
+		to_linear[i] = srgb_to_linear(i / 255.0f);
+	}
+
+	uint32_t n_levels = level_count(image.width, image.height);
+	image.mips.resize(n_levels);
+	size_t total_size = 0;
+	uint32_t width = image.width;
+	uint32_t height = image.height;
+	for (MipLevel& level : image.mips) {
+		level.width = width;
+		level.height = height;
+		level.offset = total_size;
+		level.size = (size_t)width * height * 4;
+		total_size += level.size;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	image.pixel_data.resize(total_size);
+	for (uint32_t i = 1; i < n_levels; ++i) {
+		const MipLevel& src = image.mips[i - 1];
+		const MipLevel& dst = image.mips[i];
+		downsample_rgba8(
+			image.pixel_data.data() + src.offset, src.width, src.height,
+			image.pixel_data.data() + dst.offset, dst.width, dst.height,
+			to_linear, srgb);
+	}
+}
+
+size_t ImageLevelUploader::align_up(size_t size) {
+	return (size + copy_alignment - 1) & ~(copy_alignment - 1);
+}
+
+ImageLevelUploader::ImageLevelUploader() {
+	_cmd_buf = otcv::get_context().command_pool->allocate();
+	_fence = otcv::Fence::create();
+}
+
+ImageLevelUploader::~ImageLevelUploader() {
+	assert(_pending.empty());
+}
+
+void ImageLevelUploader::add(otcv::Image* image, const uint8_t* data, const std::vector<MipLevel>& levels, uint32_t first_level) {
+	assert(levels.size() == image->builder._image_info.mipLevels && first_level < levels.size());
+	_pending.push_back({ image, data, levels, first_level });
+	for (uint32_t level_id = first_level; level_id < levels.size(); ++level_id) {
+		_pending_size += align_up(levels[level_id].size);
+	}
+}
+
+void ImageLevelUploader::flush() {
+	if (_pending.empty()) {
+		return;
+	}
+
+	otcv::BufferBuilder sbb;
+	sbb.size(_pending_size)
+		.usage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+		.host_access(otcv::BufferBuilder::Access::Coherent);
+	otcv::Buffer* staging = new otcv::Buffer(sbb);
+
+	_cmd_buf->begin(true);
+	size_t staging_offset = 0;
+	for (PendingImage& pending : _pending) {
+		std::vector<VkBufferImageCopy> regions;
+		for (uint32_t level_id = pending.first_level; level_id < pending.levels.size(); ++level_id) {
+			const MipLevel& level = pending.levels[level_id];
+			std::memcpy(static_cast<uint8_t*>(staging->mapped) + staging_offset, pending.data + level.offset, level.size);
+
+			VkBufferImageCopy region{};
+			region.bufferOffset = staging_offset;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = level_id;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent = { level.width, level.height, 1 };
+			regions.push_back(region);
+			staging_offset += align_up(level.size);
+		}
+
+		_cmd_buf->cmd_image_memory_barrier(pending.image, otcv::ResourceState::Created, otcv::ResourceState::TransferDst);
+		// otcv has no buffer to image copy taking explicit regions
+		vkCmdCopyBufferToImage(
+			_cmd_buf->vk_command_buffer,
+			staging->vk_buffer,
+			pending.image->vk_image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			(uint32_t)regions.size(),
+			regions.data());
+		_cmd_buf->cmd_image_memory_barrier(pending.image, otcv::ResourceState::TransferDst, otcv::ResourceState::FragSample);
+	}
+	_cmd_buf->end();
+
+	otcv::QueueSubmit submit;
+	submit.batch()
+		.add_command_buffer(_cmd_buf)
+		.end()
+		.signal(_fence);
+	otcv::get_context().queue->submit(submit);
+	_fence->wait_reset();
+
+	delete staging;
+	_pending.clear();
+	_pending_size = 0;
+}
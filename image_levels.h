@@ -0,0 +1,48 @@
+#pragma once
+
+#include "otcv.h"
+#include "gltf_scene_bindless.h"
+
+#include <vector>
+
+// CPU side mip chains of rgba8 images
+struct MipChain {
+	// number of levels down to 1x1. Matches the level count of an image built with ImageBuilder::enable_mips()
+	static uint32_t level_count(uint32_t width, uint32_t height);
+
+	// replaces the single level in image.pixel_data with the full chain and fills image.mips.
+	// srgb images are filtered in linear space
+	static void build(ImageData& image, bool srgb);
+};
+
+// copies pre-built mip levels from host memory into images.
+// Everything queued is staged into one buffer and submitted at once by flush()
+class ImageLevelUploader {
+public:
+	ImageLevelUploader();
+	~ImageLevelUploader();
+
+	// data must stay valid until flush(). Levels [first_level, end) are written, the finer ones are left
+	// undefined for a TextureStreamer to fill. The whole image ends up in ResourceState::FragSample
+	void add(otcv::Image* image, const uint8_t* data, const std::vector<MipLevel>& levels, uint32_t first_level = 0);
+
+	// blocks until the copies are done
+	void flush();
+
+private:
+	// copies out of the staging buffer start at a multiple of the texel/block size. 16 covers rgba8 and all BCn formats
+	static constexpr size_t copy_alignment = 16;
+	static size_t align_up(size_t size);
+
+	struct PendingImage {
+		otcv::Image* image;
+		const uint8_t* data;
+		std::vector<MipLevel> levels;
+		uint32_t first_level;
+	};
+	std::vector<PendingImage> _pending;
+	size_t _pending_size = 0;
+
+	otcv::CommandBuffer* _cmd_buf;
+	otcv::Fence* _fence;
+};
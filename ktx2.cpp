@@ -0,0 +1,136 @@
+#include "ktx2.h"
+#include "block_compress.h"
+#include "image_levels.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+static const uint8_t ktx2_identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+struct Ktx2Header {
+	uint32_t vk_format;
+	uint32_t type_size;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t layer_count;
+	uint32_t face_count;
+	uint32_t level_count;
+	uint32_t supercompression_scheme;
+	uint32_t dfd_byte_offset;
+	uint32_t dfd_byte_length;
+	uint32_t kvd_byte_offset;
+	uint32_t kvd_byte_length;
+	// followed by the 64 bit sgdByteOffset and sgdByteLength. Left out to keep the struct free of padding
+};
+static const size_t ktx2_level_index_offset = sizeof(ktx2_identifier) + sizeof(Ktx2Header) + 2 * sizeof(uint64_t);
+
+struct Ktx2LevelIndex {
+	uint64_t byte_offset;
+	uint64_t byte_length;
+	uint64_t uncompressed_byte_length;
+};
+
+static bool block_format_of(uint32_t vk_format, BlockFormat& format) {
+	switch (vk_format) {
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		format = BlockFormat::None;
+		return true;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		format = BlockFormat::BC1;
+		return true;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		format = BlockFormat::BC3;
+		return true;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		format = BlockFormat::BC5;
+		return true;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		format = BlockFormat::BC7;
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool Ktx2::is_ktx2(const uint8_t* data, size_t size) {
+	return size >= sizeof(ktx2_identifier) && std::memcmp(data, ktx2_identifier, sizeof(ktx2_identifier)) == 0;
+}
+
+bool Ktx2::load(const uint8_t* data, size_t size, ImageData& image) {
+	Ktx2Header header;
+	if (!is_ktx2(data, size) || size < ktx2_level_index_offset) {
+		std::cout << "not a ktx2 file: " << image.uri << std::endl;
+		return false;
+	}
+	std::memcpy(&header, data + sizeof(ktx2_identifier), sizeof(header));
+
+	BlockFormat format;
+	if (!block_format_of(header.vk_format, format)) {
+		std::cout << "unsupported ktx2 vkFormat = " << header.vk_format << ": " << image.uri << std::endl;
+		return false;
+	}
+	if (header.supercompression_scheme != 0) {
+		std::cout << "supercompressed ktx2 files are not supported: " << image.uri << std::endl;
+		return false;
+	}
+	if (header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1 || header.pixel_width == 0 || header.pixel_height == 0) {
+		std::cout << "only 2D ktx2 textures are supported: " << image.uri << std::endl;
+		return false;
+	}
+
+	// levelCount 0 asks the loader to generate mips
+	uint32_t n_levels = std::max(header.level_count, 1u);
+	uint32_t full_chain = MipChain::level_count(header.pixel_width, header.pixel_height);
+	if (format != BlockFormat::None && n_levels != full_chain) {
+		std::cout << "block compressed ktx2 file without a full mip chain: " << image.uri << std::endl;
+		return false;
+	}
+	size_t index_offset = ktx2_level_index_offset;
+	if (index_offset + n_levels * sizeof(Ktx2LevelIndex) > size) {
+		std::cout << "truncated ktx2 level index: " << image.uri << std::endl;
+		return false;
+	}
+	std::vector<Ktx2LevelIndex> level_index(n_levels);
+	std::memcpy(level_index.data(), data + index_offset, n_levels * sizeof(Ktx2LevelIndex));
+
+	// partial rgba8 chains keep level 0 only
+	if (format == BlockFormat::None && n_levels != full_chain) {
+		n_levels = 1;
+	}
+
+	std::vector<MipLevel> levels;
+	size_t total_size = 0;
+	uint32_t width = header.pixel_width;
+	uint32_t height = header.pixel_height;
+	for (uint32_t i = 0; i < n_levels; ++i) {
+		size_t level_size = format == BlockFormat::None ? (size_t)width * height * 4 : BlockCompress::level_size(format, width, height);
+		const Ktx2LevelIndex& entry = level_index[i];
+		if (entry.byte_length < level_size || entry.byte_offset > size || size - entry.byte_offset < level_size) {
+			std::cout << "ktx2 level " << i << " out of range: " << image.uri << std::endl;
+			return false;
+		}
+		levels.push_back({ width, height, total_size, level_size });
+		total_size += level_size;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	// the file stores the smallest level first, ImageData wants level 0 first
+	image.pixel_data.resize(total_size);
+	for (uint32_t i = 0; i < n_levels; ++i) {
+		std::memcpy(image.pixel_data.data() + levels[i].offset, data + level_index[i].byte_offset, levels[i].size);
+	}
+	image.width = header.pixel_width;
+	image.height = header.pixel_height;
+	image.channels = 4;
+	image.bit_depth = 8;
+	image.block_format = format;
+	image.mips = n_levels > 1 || format != BlockFormat::None ? levels : std::vector<MipLevel>();
+	return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+
+#include <cstdint>
+#include <cstddef>
+
+// reader for KTX2 textures (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html).
+// Only 2D, single layer, single face images without supercompression in rgba8 or one of the BlockFormats
+struct Ktx2 {
+	static bool is_ktx2(const uint8_t* data, size_t size);
+
+	// fills everything of image but uri. Block compressed files must carry a full mip chain,
+	// rgba8 files without one get their mips generated on the GPU
+	static bool load(const uint8_t* data, size_t size, ImageData& image);
+};
@@ -6,6 +6,8 @@
 #include "free_roam.h"
 
 #include "gltf_parser_bindless.h"
+#include "baked_scene.h"
+#include "mesh_optimizer.h"
 #include "render_global_types.h"
 
 #include "imgui.h"
@@ -23,6 +25,7 @@
 #include <iostream>
 #include <array>
 #include <random>
+#include <chrono>
 
 const int window_width = 1920;
 const int window_height = 960;
@@ -32,6 +35,8 @@ const int jitter_tile_size = 8;
 const int jitter_strata_per_dim = 8;
 const float jitter_radius = 0.02f;
 const float cascade_blend_depth = 1.0f;
+// updates between redraws of each cascade, at most
+const std::vector<uint32_t> cascade_update_periods = { 1, 2, 4 };
 
 
 PerspectiveCamera cam(
@@ -50,14 +55,19 @@ public:
         init_vulkan_context();
         init_imgui();
         if (!load_scene()) {
+            // nothing to draw, nothing was uploaded
             std::cout << "scene load error" << std::endl;
+            cleanup_imgui();
+            cleanup();
+            return;
         }
         init_lighting_pipeline();
         init_render_targets();
+        init_occlusion();
         init_frame_contexts();
         init_texture();
-        connect_render_targets();
         init_shadow();
+        connect_render_targets();
         init_postprocess();
         main_loop();
         cleanup_scene();
@@ -178,6 +188,7 @@ public:
             Shadow.add(Std140AlignmentType::InlineType::Float, "cascadeBlendDepth");
             Shadow.add(Std140AlignmentType::InlineType::Uint, "nCascades");
             Shadow.add(Std140AlignmentType::InlineType::Uint, "cascadeResolution");
+            Shadow.add(Std140AlignmentType::InlineType::Uint, "filter");
             Shadow.add(Cascade, "cascades", 6);
             
             Std140AlignmentType FrameUBO;
@@ -269,18 +280,32 @@ public:
             .build();
         _back_buffer->initialize_state(otcv::ResourceState::ColorAttachment);
     }
+    void init_occlusion() {
+#ifdef SCENE_CULLING_OCCLUSION
+        _depth_pyramid.reset(new DepthPyramid("./spirv/depth_pyramid/", _depth_image));
+        _culling->set_depth_pyramid(_depth_pyramid);
+#endif
+    }
     void init_postprocess() {
         _postprocess_manager.reset(new PostProcessManager("./spirv/post_process/", _lit_image, _back_buffer));
     }
     void init_shadow() {
         _shadow_manager.reset(new ShadowManager(
+            _shader_output_layer_enabled,
             "./spirv/shadows/",
-            "./spirv/scene_culling/",
+            "./spirv/shadow_filter/",
             _cascaded_shadowmap,
-            _scene_graph,
             _scene_refs,
             _bindless_data,
-            _swapchain->mock_images.size()));
+            _culling,
+            _culling_out,
+            1, // view 0 is the camera
+            _swapchain->mock_images.size(),
+            cascade_update_periods));
+#ifdef SHADOW_SAMPLE_DISTRIBUTION
+        _depth_bounds.reset(new DepthBounds("./spirv/depth_bounds/", _depth_image, _swapchain->mock_images.size()));
+        _shadow_manager->set_depth_bounds(_depth_bounds);
+#endif
     }
     void init_lighting_pipeline() {
         _lighting_shader_blob = std::move(otcv::load_shaders_from_dir("./spirv/lighting_pass"));
@@ -320,6 +345,7 @@ public:
             // per-frame descriptor sets 
             ctx.frame_desc_sets[RenderPassType::Geometry] = _frame_desc_set_pool->allocate(_bindless_data->frame_descriptor_set_layout());
             ctx.frame_desc_sets[RenderPassType::Geometry]->bind_buffer(0, ctx.frame_ubos[RenderPassType::Geometry]->_buf);
+            ctx.frame_desc_sets[RenderPassType::Geometry]->bind_buffer(1, _culling_out.ssbo_instance_ids->_buf);
             ctx.frame_desc_sets[RenderPassType::Lighting] = _frame_desc_set_pool->allocate(_lighting_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
             ctx.frame_desc_sets[RenderPassType::Lighting]->bind_buffer(0, ctx.frame_ubos[RenderPassType::Lighting]->_buf);
 
@@ -349,7 +375,13 @@ public:
             ctx.frame_desc_sets[RenderPassType::Lighting]->bind_image_sampler(2, &_albedo_image, &_albedo_sampler);
             ctx.frame_desc_sets[RenderPassType::Lighting]->bind_image_sampler(3, &_normals_image, &_normals_sampler);
             ctx.frame_desc_sets[RenderPassType::Lighting]->bind_image_sampler(4, &_metallic_roughness_image, &_metallic_roughness_sampler);
+#ifdef SHADOW_EVSM
+            otcv::Image* moments = _shadow_manager->filter()->moments();
+            otcv::Sampler* moments_sampler = _shadow_manager->filter()->moments_sampler();
+            ctx.frame_desc_sets[RenderPassType::Lighting]->bind_image_sampler(5, &moments, &moments_sampler);
+#else
             ctx.frame_desc_sets[RenderPassType::Lighting]->bind_image_sampler(5, &_cascaded_shadowmap, &_cascaded_shadowsampler);
+#endif
             ctx.frame_desc_sets[RenderPassType::Lighting]->bind_image_sampler(6, &_noise_texture, &_noise_texture_sampler);
         }
     }
@@ -371,11 +403,56 @@ public:
         ImGui_ImplOTCV_Init(&info);
     }
     bool load_scene() {
-        bool ret = load_gltf(
-            "C:/Users/Yao/models/Sponza/glTF/Sponza.gltf",
+#ifdef GLTF_PARSER_LOAD_BENCHMARK
+        benchmark_load_gltf(std::vector<std::string>(4, "C:/Users/Yao/models/Sponza/glTF/Sponza.gltf"));
+#endif
+#ifdef MESH_PREPROCESSOR_AABB_BENCHMARK
+        benchmark_aabb("./spirv/mesh_preprocess", 100000);
+#endif
+#ifdef SCENE_CULLING_CPU_BENCHMARK
+        benchmark_cpu_culling(1000000);
+#endif
+        const std::string scene_path = "C:/Users/Yao/models/Sponza/glTF/Sponza.gltf";
+        auto load_begin = std::chrono::steady_clock::now();
+        // the baked cache is keyed by the gltf file and everything it references, by size and modification time first
+        // and by content where those changed. The content is only read through once
+        uint64_t source_stamp = gltf_source_stamp(scene_path);
+        uint64_t source_hash = 0;
+        auto hash_sources = [&]() {
+            if (source_hash == 0) {
+                source_hash = gltf_source_hash(scene_path);
+            }
+            return source_hash;
+        };
+        bool ret = source_stamp != 0 && BakedScene::load(
+            scene_path + ".baked",
+            source_stamp,
+            hash_sources,
             _scene_graph,
             _scene_refs,
             _material_res);
+        if (ret) {
+            std::cout << "loaded baked scene";
+        }
+        else {
+            ret = load_gltf(
+                scene_path,
+                _scene_graph,
+                _scene_refs,
+                _material_res);
+            if (!ret) {
+                std::cout << "failed to load gltf scene " << scene_path << std::endl;
+                return false;
+            }
+            // baked scenes are stored deduplicated and with optimized index and vertex order
+            dedup_material_resources(_material_res);
+            MeshOptimizer::optimize_scene(_scene_graph);
+            if (source_stamp != 0 && hash_sources() != 0) {
+                BakedScene::save(scene_path + ".baked", source_stamp, source_hash, _scene_graph, _scene_refs, _material_res);
+            }
+            std::cout << "loaded gltf scene";
+        }
+        std::cout << " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_begin).count() << " ms" << std::endl;
 
         _bindless_data.reset(new BindlessDataManager(
             _physical_device,
@@ -390,11 +467,13 @@ public:
         _bindless_data->set_objects(_scene_graph, _scene_refs);
         
         
+        // the camera and every shadow cascade, culled in one dispatch
         _culling.reset(new SceneCulling(
             "./spirv/scene_culling/",
             _scene_graph,
             _scene_refs,
-            _swapchain->mock_images.size()));
+            _swapchain->mock_images.size(),
+            1 + cascaded_shadowmap_layers));
         _culling_in = _culling->create_object_buffer_context(_scene_graph, _scene_refs, _bindless_data);
         _culling_out = _culling->create_indirect_command_context((uint32_t)PipelineVariant::All, _bindless_data);
 
@@ -402,36 +481,72 @@ public:
     }
 
 
+    // culls the camera together with the cascades, whose commands are drawn first
+    void shadow_pass_commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id) {
+#ifdef SCENE_CULLING_OCCLUSION
+        _culling->commands(cmd_buf, _culling_in, _culling_out, frame_id, OcclusionPhase::First);
+#else
+        _culling->commands(cmd_buf, _culling_in, _culling_out, frame_id);
+#endif
+        _shadow_manager->commands(cmd_buf, frame_id);
+    }
+
     void g_pass_commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id) {
-        FrameContext& f_ctx = _frame_ctxs[frame_id];
+#ifdef SCENE_CULLING_OCCLUSION
+        // the first phase was culled by shadow_pass_commands
+        g_pass_draw_commands(cmd_buf, frame_id, VK_ATTACHMENT_LOAD_OP_CLEAR);
 
-        _culling->commands(cmd_buf, _culling_in, _culling_out, frame_id);
+        cmd_buf->cmd_image_memory_barrier(_depth_image, otcv::ResourceState::DepthStencilAttachment, otcv::ResourceState::FragSample);
+        _depth_pyramid->commands(cmd_buf);
+        cmd_buf->cmd_image_memory_barrier(_depth_image, otcv::ResourceState::FragSample, otcv::ResourceState::DepthStencilAttachment);
 
+        // the second phase draws on top of the first
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd_buf->vk_command_buffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        _culling->commands(cmd_buf, _culling_in, _culling_out, frame_id, OcclusionPhase::Second);
+        g_pass_draw_commands(cmd_buf, frame_id, VK_ATTACHMENT_LOAD_OP_LOAD);
+#else
+        g_pass_draw_commands(cmd_buf, frame_id, VK_ATTACHMENT_LOAD_OP_CLEAR);
+#endif
+
+        cmd_buf->cmd_image_memory_barrier(_albedo_image, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
+        cmd_buf->cmd_image_memory_barrier(_normals_image, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
+        cmd_buf->cmd_image_memory_barrier(_metallic_roughness_image, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
+        cmd_buf->cmd_image_memory_barrier(_depth_image, otcv::ResourceState::DepthStencilAttachment, otcv::ResourceState::FragSample);
+    }
+
+    // one g-buffer rendering of the commands culled last. Leaves the command buffers ready for the next culling
+    void g_pass_draw_commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id, VkAttachmentLoadOp load_op) {
         otcv::RenderingBegin pass_begin;
         pass_begin
             .area(window_width, window_height)
             .color_attachment()
             .image_view(_albedo_image->vk_view)
             .image_layout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
-            .load_store(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE)
+            .load_store(load_op, VK_ATTACHMENT_STORE_OP_STORE)
             .clear_value(0.0f, 0.0f, 0.0f, 1.0f)
             .end()
             .color_attachment()
             .image_view(_normals_image->vk_view)
             .image_layout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
-            .load_store(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE)
+            .load_store(load_op, VK_ATTACHMENT_STORE_OP_STORE)
             .clear_value(0.0f, 0.0f, 0.0f, 1.0f)
             .end()
             .color_attachment()
             .image_view(_metallic_roughness_image->vk_view)
             .image_layout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
-            .load_store(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE)
+            .load_store(load_op, VK_ATTACHMENT_STORE_OP_STORE)
             .clear_value(0.0f, 0.0f, 0.0f, 1.0f)
             .end()
             .depth_stencil_attachment()
             .image_view(_depth_image->vk_view)
             .image_layout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-            .load_store(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE)
+            .load_store(load_op, VK_ATTACHMENT_STORE_OP_STORE)
             .clear_value(1.0f, 0)
             .end();
         cmd_buf->cmd_begin_rendering(pass_begin);
@@ -441,34 +556,39 @@ public:
         
         
         cmd_buf->cmd_bind_vertex_buffer(_bindless_data->_vb);
-        cmd_buf->cmd_bind_index_buffer(_bindless_data->_ib, VK_INDEX_TYPE_UINT16);
-        
-        for (uint32_t pipeline_variant = 0; pipeline_variant < (uint32_t)PipelineVariant::All; ++pipeline_variant) {
-            assert(_bindless_data->_pipeline_bins.find((PipelineVariant)pipeline_variant) != _bindless_data->_pipeline_bins.end());
+        for (uint32_t index_width = 0; index_width < (uint32_t)IndexWidth::All; ++index_width) {
+            otcv::Buffer* ib = _bindless_data->index_buffer((IndexWidth)index_width);
+            if (!ib) {
+                continue;
+            }
+            cmd_buf->cmd_bind_index_buffer(ib, BindlessDataManager::index_type((IndexWidth)index_width));
 
-            otcv::GraphicsPipeline* pipeline = _bindless_data->_pipeline_bins[(PipelineVariant)pipeline_variant];
-            cmd_buf->cmd_bind_graphics_pipeline(pipeline);
-        
-            cmd_buf->cmd_bind_descriptor_set(pipeline, _frame_ctxs[frame_id].frame_desc_sets[RenderPassType::Geometry], DescriptorSetRate::PerFrame);
-            cmd_buf->cmd_bind_descriptor_set(pipeline, _bindless_data->_bindless_object_desc_set, DescriptorSetRate::PerObject);
-            cmd_buf->cmd_bind_descriptor_set(pipeline, _bindless_data->_bindless_material_desc_set, DescriptorSetRate::PerMaterial);
-        
-            uint32_t n_obj = _scene_refs.size();
-            Std430AlignmentType::Range command_range = _culling_out.ssbo_commands->range_of(pipeline_variant * n_obj, SSBOAccess());
-            Std430AlignmentType::Range count_range = _culling_out.ssbo_draw_count->range_of(pipeline_variant, SSBOAccess());
-            cmd_buf->cmd_draw_indexed_indirect_count(
-                _culling_out.ssbo_commands->_buf,
-                command_range.offset,
-                _culling_out.ssbo_draw_count->_buf, count_range.offset, n_obj, command_range.stride);
+            for (uint32_t pipeline_variant = 0; pipeline_variant < (uint32_t)PipelineVariant::All; ++pipeline_variant) {
+                assert(_bindless_data->_pipeline_bins.find((PipelineVariant)pipeline_variant) != _bindless_data->_pipeline_bins.end());
+
+                otcv::GraphicsPipeline* pipeline = _bindless_data->_pipeline_bins[(PipelineVariant)pipeline_variant];
+                cmd_buf->cmd_bind_graphics_pipeline(pipeline);
+
+                cmd_buf->cmd_bind_descriptor_set(pipeline, _frame_ctxs[frame_id].frame_desc_sets[RenderPassType::Geometry], DescriptorSetRate::PerFrame);
+                cmd_buf->cmd_bind_descriptor_set(pipeline, _bindless_data->_bindless_object_desc_set, DescriptorSetRate::PerObject);
+                cmd_buf->cmd_bind_descriptor_set(pipeline, _bindless_data->_bindless_material_desc_set, DescriptorSetRate::PerMaterial);
+
+                uint32_t bucket = SceneCulling::bucket_id((uint32_t)PipelineVariant::All, pipeline_variant, (IndexWidth)index_width);
+                uint32_t max_draws = _culling->bucket_max_draws(bucket);
+                if (max_draws == 0) {
+                    continue;
+                }
+                Std430AlignmentType::Range command_range = _culling_out.ssbo_commands->range_of(_culling->bucket_first_draw(bucket), SSBOAccess());
+                Std430AlignmentType::Range count_range = _culling_out.ssbo_draw_count->range_of(bucket, SSBOAccess());
+                cmd_buf->cmd_draw_indexed_indirect_count(
+                    _culling_out.ssbo_commands->_buf,
+                    command_range.offset,
+                    _culling_out.ssbo_draw_count->_buf, count_range.offset, max_draws, command_range.stride);
+            }
         }
         
         cmd_buf->cmd_end_rendering();
 
-        cmd_buf->cmd_image_memory_barrier(_albedo_image, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
-        cmd_buf->cmd_image_memory_barrier(_normals_image, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
-        cmd_buf->cmd_image_memory_barrier(_metallic_roughness_image, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
-        cmd_buf->cmd_image_memory_barrier(_depth_image, otcv::ResourceState::DepthStencilAttachment, otcv::ResourceState::FragSample);
-
         cmd_buf->cmd_buffer_memory_barrier(_culling_out.ssbo_commands->_buf, otcv::ResourceState::IndirectRead, otcv::ResourceState::ComputeSSBOWrite);
         cmd_buf->cmd_buffer_memory_barrier(_culling_out.ssbo_draw_count->_buf, otcv::ResourceState::IndirectRead, otcv::ResourceState::ComputeSSBOWrite);
     }
@@ -476,6 +596,11 @@ public:
     void lighting_pass_commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id) {
         FrameContext& f_ctx = _frame_ctxs[frame_id];
 
+#ifdef SHADOW_SAMPLE_DISTRIBUTION
+        // read back by the shadow update of this frame id's next turn
+        _depth_bounds->commands(cmd_buf, frame_id);
+#endif
+
         auto lighting = [&]() {
             assert(f_ctx.frame_desc_sets.find(RenderPassType::Lighting) != f_ctx.frame_desc_sets.end());
             // TODO: one lighting model might be shared across different materials.
@@ -545,9 +670,10 @@ public:
         uint32_t image_index;
         vkAcquireNextImageKHR(_device, _swapchain->vk_swapchain, UINT64_MAX, f_ctx.image_available_semaphore->vk_semaphore, VK_NULL_HANDLE, &image_index);
 
+        _bindless_data->stream_textures();
         update_frame_ubos(_current_frame);
         f_ctx.graphics_command_buffers[RenderPassType::Shadow]->reset();
-        f_ctx.graphics_command_buffers[RenderPassType::Shadow]->record(std::bind(&ShadowManager::commands, _shadow_manager.get(), std::placeholders::_1, _current_frame));
+        f_ctx.graphics_command_buffers[RenderPassType::Shadow]->record(std::bind(&Application::shadow_pass_commands, this, std::placeholders::_1, _current_frame));
         f_ctx.graphics_command_buffers[RenderPassType::Geometry]->reset();
         f_ctx.graphics_command_buffers[RenderPassType::Geometry]->record(std::bind(&Application::g_pass_commands, this, std::placeholders::_1, _current_frame));
         f_ctx.graphics_command_buffers[RenderPassType::Lighting]->reset();
@@ -601,7 +727,7 @@ public:
         {
             glm::mat4 proj = cam.update_proj();
             glm::mat4 view = cam.update_view();
-            _culling->update(proj, view, frame_id);
+            _culling->update(0, proj, view, window_height, frame_id);
 
             glm::mat4 proj_view = proj * view;
             _frame_ctxs[frame_id].frame_ubos[RenderPassType::Geometry]->set(StaticUBOAccess()["projectView"], &proj_view);
@@ -637,6 +763,12 @@ public:
             uint32_t n_cascades = cascade_ctxs.size();
             _frame_ctxs[frame_id].frame_ubos[RenderPassType::Lighting]->set(StaticUBOAccess()["shadow"]["nCascades"], &n_cascades);
             _frame_ctxs[frame_id].frame_ubos[RenderPassType::Lighting]->set(StaticUBOAccess()["shadow"]["cascadeResolution"], &cascaded_shadowmap_size);
+#ifdef SHADOW_EVSM
+            uint32_t shadow_filter = 1;
+#else
+            uint32_t shadow_filter = 0;
+#endif
+            _frame_ctxs[frame_id].frame_ubos[RenderPassType::Lighting]->set(StaticUBOAccess()["shadow"]["filter"], &shadow_filter);
             for (uint32_t i = 0; i < cascade_ctxs.size(); ++i) {
                 _frame_ctxs[frame_id].frame_ubos[RenderPassType::Lighting]->set(StaticUBOAccess()["shadow"]["cascades"][i]["zBegin"], &cascade_ctxs[i].z_begin);
                 _frame_ctxs[frame_id].frame_ubos[RenderPassType::Lighting]->set(StaticUBOAccess()["shadow"]["cascades"][i]["zEnd"], &cascade_ctxs[i].z_end);
@@ -678,6 +810,8 @@ public:
     VkSurfaceKHR _surface = VK_NULL_HANDLE;
     VkPhysicalDevice _physical_device = VK_NULL_HANDLE;
     VkDevice _device = VK_NULL_HANDLE;
+    // device features enabled by otcv::create_context. It does not enable shaderOutputLayer, see SHADOW_LAYERED_CASCADES
+    const bool _shader_output_layer_enabled = false;
     otcv::Swapchain* _swapchain;
 
     otcv::CommandPool* _command_pool;
@@ -745,6 +879,8 @@ public:
     std::shared_ptr<SceneCulling> _culling;
     SceneCulling::ObjectBufferContext _culling_in;
     SceneCulling::IndirectCommandContext _culling_out;
+    std::shared_ptr<DepthPyramid> _depth_pyramid;
+    std::shared_ptr<DepthBounds> _depth_bounds;
 
     std::shared_ptr<PostProcessManager> _postprocess_manager;
     std::shared_ptr<ShadowManager> _shadow_manager;
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// read-only memory mapping of an entire file
+class MappedFile {
+public:
+	MappedFile() {};
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& filename);
+	void close();
+
+	const uint8_t* data() const { return _data; }
+	size_t size() const { return _size; }
+	bool is_open() const { return _data != nullptr; }
+
+private:
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#else
+	int _fd = -1;
+#endif
+};
+
+// a view into bytes that are owned by someone else (a mapping, a tinygltf buffer...)
+struct ByteSpan {
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
@@ -1,5 +1,7 @@
 #include "math_common.h"
 
+#include <cassert>
+
 glm::vec3 FrustumUtils::ndc_to_world(glm::vec3 ndc, glm::mat4 proj_inv, glm::mat4 view_inv) {
 	glm::vec4 view_space_coord = proj_inv * glm::vec4(ndc, 1.0f);
 	view_space_coord = view_space_coord / view_space_coord.w;
@@ -55,3 +57,71 @@ glm::vec4 FrustumUtils::plane(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
 	float d = -glm::dot(n, a);
 	return glm::vec4(n, d);
 }
+
+FrustumUtils::Planes FrustumUtils::view_frustum_planes(glm::mat4 proj_inv, glm::mat4 view_inv) {
+	Frustum f = view_frustum_vertices(proj_inv, view_inv);
+	Planes planes;
+	planes[0] = plane(f[0], f[4], f[5]);
+	planes[1] = plane(f[2], f[6], f[7]);
+	planes[2] = plane(f[3], f[7], f[4]);
+	planes[3] = plane(f[1], f[5], f[6]);
+	planes[4] = plane(f[5], f[4], f[7]);
+	planes[5] = plane(f[0], f[1], f[2]);
+	return planes;
+}
+
+std::vector<glm::vec4> FrustumUtils::swept_frustum_planes(const Frustum& f, glm::vec3 sweep_dir) {
+	// faces as in view_frustum_vertices: near, far, left, right, top, bottom
+	const uint32_t faces[6][4] = {
+		{ 0, 1, 2, 3 }, { 4, 5, 6, 7 }, { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 3, 0, 4, 7 }, { 1, 2, 6, 5 }
+	};
+	glm::vec3 centroid(0.0f);
+	for (const glm::vec3& v : f) {
+		centroid += v * 0.125f;
+	}
+	// oriented outwards by the centroid, so that the winding of the vertices does not matter
+	auto outward = [&centroid](glm::vec4 p) -> glm::vec4 {
+		return glm::dot(glm::vec3(p), centroid) + p.w > 0.0f ? -p : p;
+	};
+
+	glm::vec3 dir = glm::normalize(sweep_dir);
+	glm::vec4 face_planes[6];
+	bool facing[6]; // toward sweep_dir, swept past
+	std::vector<glm::vec4> planes;
+	for (uint32_t i = 0; i < 6; ++i) {
+		face_planes[i] = outward(plane(f[faces[i][0]], f[faces[i][1]], f[faces[i][2]]));
+		facing[i] = glm::dot(glm::vec3(face_planes[i]), dir) > 0.0f;
+		if (!facing[i]) {
+			planes.push_back(face_planes[i]);
+		}
+	}
+
+	// edges shared by a face swept past and one that is not
+	for (uint32_t a = 0; a < 6; ++a) {
+		for (uint32_t b = a + 1; b < 6; ++b) {
+			if (facing[a] == facing[b]) {
+				continue;
+			}
+			uint32_t shared[2];
+			uint32_t n_shared = 0;
+			for (uint32_t i = 0; i < 4; ++i) {
+				for (uint32_t j = 0; j < 4; ++j) {
+					if (faces[a][i] == faces[b][j] && n_shared < 2) {
+						shared[n_shared++] = faces[a][i];
+					}
+				}
+			}
+			if (n_shared != 2) {
+				continue;
+			}
+			glm::vec3 v0 = f[shared[0]];
+			glm::vec3 v1 = f[shared[1]];
+			glm::vec4 p = plane(v0, v1, v0 + dir);
+			if (glm::vec3(p) != glm::vec3(0.0f)) {
+				planes.push_back(outward(p));
+			}
+		}
+	}
+	assert(planes.size() <= max_swept_planes);
+	return planes;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "glm/glm.hpp"
 #include <array>
+#include <vector>
 
 struct FrustumUtils {
 	typedef std::array<glm::vec3, 8> Frustum;
@@ -13,4 +14,13 @@ struct FrustumUtils {
 	static void bounding_sphere(const Frustum& f, glm::vec3& center, float& radius);
 
 	static glm::vec4 plane(glm::vec3 a, glm::vec3 b, glm::vec3 c);
+
+	// left, right, top, bottom, far, near. Normals point out of the frustum
+	typedef std::array<glm::vec4, 6> Planes;
+	static Planes view_frustum_planes(glm::mat4 proj_inv, glm::mat4 view_inv);
+
+	// bounding planes of the frustum swept infinitely along sweep_dir: the faces facing away from it, and one plane through
+	// each silhouette edge. At most max_swept_planes, normals point out
+	static const uint32_t max_swept_planes = 16;
+	static std::vector<glm::vec4> swept_frustum_planes(const Frustum& f, glm::vec3 sweep_dir);
 };
@@ -0,0 +1,534 @@
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "thread_pool.h"
+
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <set>
+#include <chrono>
+#include <limits>
+#include <cmath>
+
+MeshOptimizer::CacheStats MeshOptimizer::analyze(const std::vector<uint32_t>& indices, uint32_t n_vertices) {
+	CacheStats stats;
+	stats.n_triangles = (uint32_t)(indices.size() / 3);
+
+	// timestamps instead of an actual queue: a vertex is cached if it entered less than cache_size misses ago
+	std::vector<uint32_t> entered(n_vertices, 0);
+	std::vector<bool> referenced(n_vertices, false);
+	uint32_t time = cache_size + 1;
+	for (uint32_t v : indices) {
+		if (time - entered[v] > cache_size) {
+			entered[v] = time++;
+			++stats.n_transforms;
+		}
+		if (!referenced[v]) {
+			referenced[v] = true;
+			++stats.n_vertices;
+		}
+	}
+	return stats;
+}
+
+std::vector<uint32_t> MeshOptimizer::optimize_vertex_cache(std::vector<uint32_t>& indices, uint32_t n_vertices) {
+	uint32_t n_triangles = (uint32_t)(indices.size() / 3);
+
+	// vertex -> triangles, in CSR layout
+	std::vector<uint32_t> adjacency_offsets(n_vertices + 1, 0);
+	for (uint32_t v : indices) {
+		++adjacency_offsets[v + 1];
+	}
+	std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill = adjacency_offsets;
+		for (uint32_t i = 0; i < indices.size(); ++i) {
+			adjacency[fill[indices[i]]++] = i / 3;
+		}
+	}
+
+	std::vector<uint32_t> live(n_vertices);
+	for (uint32_t v = 0; v < n_vertices; ++v) {
+		live[v] = adjacency_offsets[v + 1] - adjacency_offsets[v];
+	}
+	std::vector<uint32_t> cache_time(n_vertices, 0);
+	std::vector<bool> emitted(n_triangles, false);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	std::vector<uint32_t> clusters;
+
+	uint32_t time = cache_size + 1;
+	uint32_t cursor = 0;
+	auto skip_dead_end = [&]() -> int64_t {
+		while (!dead_end.empty()) {
+			uint32_t v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0) {
+				return v;
+			}
+		}
+		for (; cursor < n_vertices; ++cursor) {
+			if (live[cursor] > 0) {
+				return cursor;
+			}
+		}
+		return -1;
+	};
+
+	int64_t fanning = skip_dead_end();
+	bool flushed = true;
+	std::vector<uint32_t> candidates;
+	while (fanning >= 0) {
+		if (flushed) {
+			clusters.push_back((uint32_t)(output.size() / 3));
+			flushed = false;
+		}
+
+		// emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = adjacency_offsets[fanning]; a < adjacency_offsets[fanning + 1]; ++a) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - cache_time[v] > cache_size) {
+					cache_time[v] = time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// next fanning vertex: the one that stays in the cache longest after emitting all its triangles
+		int64_t best = -1;
+		int64_t best_priority = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0) {
+				continue;
+			}
+			int64_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size) {
+				priority = time - cache_time[v];
+			}
+			if (priority > best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+		if (best < 0) {
+			best = skip_dead_end();
+			flushed = true;
+		}
+		fanning = best;
+	}
+
+	indices = std::move(output);
+	return clusters;
+}
+
+// simulated ACMR of triangles [begin, end) starting from an empty cache
+static void split_cluster(
+	const std::vector<uint32_t>& indices,
+	uint32_t begin,
+	uint32_t end,
+	float max_acmr,
+	std::vector<uint32_t>& cache_time,
+	uint32_t& time,
+	std::vector<uint32_t>& clusters) {
+
+	clusters.push_back(begin);
+	// starting over with a new timestamp range empties the cache
+	time += MeshOptimizer::cache_size + 1;
+	uint32_t cluster_begin = begin;
+	uint32_t misses = 0;
+	for (uint32_t t = begin; t < end; ++t) {
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t v = indices[t * 3 + k];
+			if (time - cache_time[v] > MeshOptimizer::cache_size) {
+				cache_time[v] = time++;
+				++misses;
+			}
+		}
+		// a restart here would not hurt vertex reuse much
+		uint32_t n = t + 1 - cluster_begin;
+		if (t + 1 < end && (float)misses / n <= max_acmr) {
+			clusters.push_back(t + 1);
+			cluster_begin = t + 1;
+			misses = 0;
+			time += MeshOptimizer::cache_size + 1;
+		}
+	}
+}
+
+void MeshOptimizer::optimize_overdraw(
+	std::vector<uint32_t>& indices,
+	const std::vector<glm::vec3>& positions,
+	const std::vector<uint32_t>& hard_clusters,
+	float threshold) {
+
+	uint32_t n_triangles = (uint32_t)(indices.size() / 3);
+	if (n_triangles == 0 || hard_clusters.empty()) {
+		return;
+	}
+
+	float max_acmr = analyze(indices, (uint32_t)positions.size()).acmr() * threshold;
+	std::vector<uint32_t> clusters;
+	std::vector<uint32_t> cache_time(positions.size(), 0);
+	uint32_t time = cache_size + 1;
+	for (uint32_t c = 0; c < hard_clusters.size(); ++c) {
+		uint32_t end = c + 1 < hard_clusters.size() ? hard_clusters[c + 1] : n_triangles;
+		split_cluster(indices, hard_clusters[c], end, max_acmr, cache_time, time, clusters);
+	}
+
+	// area weighted centroid and normal of every cluster
+	struct Cluster {
+		uint32_t begin;
+		uint32_t end;
+		float sort_key;
+	};
+	std::vector<Cluster> sorted(clusters.size());
+	std::vector<glm::vec3> centroids(clusters.size());
+	std::vector<glm::vec3> normals(clusters.size());
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (uint32_t c = 0; c < clusters.size(); ++c) {
+		sorted[c].begin = clusters[c];
+		sorted[c].end = c + 1 < clusters.size() ? clusters[c + 1] : n_triangles;
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for (uint32_t t = sorted[c].begin; t < sorted[c].end; ++t) {
+			const glm::vec3& p0 = positions[indices[t * 3]];
+			const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			centroid += (p0 + p1 + p2) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+		mesh_centroid += centroid;
+		mesh_area += area;
+		centroids[c] = area > 0.0f ? centroid / area : positions[indices[sorted[c].begin * 3]];
+		float normal_length = glm::length(normal);
+		normals[c] = normal_length > 0.0f ? normal / normal_length : glm::vec3(0.0f);
+	}
+	if (mesh_area > 0.0f) {
+		mesh_centroid /= mesh_area;
+	}
+	for (uint32_t c = 0; c < clusters.size(); ++c) {
+		sorted[c].sort_key = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+	}
+
+	// outward facing clusters far from the center occlude the rest from most directions, draw them first
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+		return a.sort_key > b.sort_key;
+	});
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (const Cluster& cluster : sorted) {
+		output.insert(output.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+	}
+	indices = std::move(output);
+}
+
+template<typename T>
+static void permute(std::vector<T>& attribute, const std::vector<uint32_t>& new_ids) {
+	if (attribute.size() != new_ids.size()) {
+		return;
+	}
+	std::vector<T> permuted(attribute.size());
+	for (uint32_t v = 0; v < attribute.size(); ++v) {
+		permuted[new_ids[v]] = attribute[v];
+	}
+	attribute = std::move(permuted);
+}
+
+void MeshOptimizer::optimize_vertex_fetch(MeshData& mesh) {
+	uint32_t n_vertices = (uint32_t)mesh.positions.size();
+	const uint32_t unassigned = ~0u;
+	std::vector<uint32_t> new_ids(n_vertices, unassigned);
+	uint32_t next_id = 0;
+	for (uint32_t& v : mesh.indices) {
+		if (new_ids[v] == unassigned) {
+			new_ids[v] = next_id++;
+		}
+		v = new_ids[v];
+	}
+	// unreferenced vertices go to the end
+	for (uint32_t& id : new_ids) {
+		if (id == unassigned) {
+			id = next_id++;
+		}
+	}
+	// coarser levels only use vertices of the full one
+	for (MeshLod& lod : mesh.lods) {
+		for (uint32_t& v : lod.indices) {
+			v = new_ids[v];
+		}
+	}
+
+	permute(mesh.positions, new_ids);
+	permute(mesh.normals, new_ids);
+	permute(mesh.uv0, new_ids);
+	permute(mesh.uv1, new_ids);
+	permute(mesh.tangents, new_ids);
+}
+
+static void bound_meshlet(const MeshData& mesh, Meshlet& meshlet) {
+	const uint32_t* indices = mesh.indices.data() + meshlet.first_index;
+
+	// sphere around the AABB center
+	glm::vec3 min(std::numeric_limits<float>::max());
+	glm::vec3 max(std::numeric_limits<float>::lowest());
+	for (uint32_t i = 0; i < meshlet.index_count; ++i) {
+		min = glm::min(min, mesh.positions[indices[i]]);
+		max = glm::max(max, mesh.positions[indices[i]]);
+	}
+	meshlet.center = (min + max) * 0.5f;
+	meshlet.radius = 0.0f;
+	for (uint32_t i = 0; i < meshlet.index_count; ++i) {
+		meshlet.radius = std::max(meshlet.radius, glm::length(mesh.positions[indices[i]] - meshlet.center));
+	}
+
+	// cone around the average face normal, wide enough for every face
+	std::vector<glm::vec3> normals;
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i < meshlet.index_count; i += 3) {
+		const glm::vec3& p0 = mesh.positions[indices[i]];
+		const glm::vec3& p1 = mesh.positions[indices[i + 1]];
+		const glm::vec3& p2 = mesh.positions[indices[i + 2]];
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(n);
+		if (area > 0.0f) {
+			normals.push_back(n / area);
+			axis += normals.back();
+		}
+	}
+	float axis_length = glm::length(axis);
+	meshlet.cone_axis = axis_length > 0.0f ? axis / axis_length : glm::vec3(0.0f, 0.0f, 1.0f);
+	float min_dot = axis_length > 0.0f ? 1.0f : -1.0f;
+	for (const glm::vec3& n : normals) {
+		min_dot = std::min(min_dot, glm::dot(n, meshlet.cone_axis));
+	}
+	meshlet.cone_cutoff = min_dot > 0.0f ? std::sqrt(1.0f - min_dot * min_dot) : 2.0f;
+}
+
+void MeshOptimizer::build_meshlets(MeshData& mesh) {
+	mesh.meshlets.clear();
+	if (mesh.indices.empty() || mesh.indices.size() % 3 != 0) {
+		return;
+	}
+	uint32_t n_vertices = (uint32_t)mesh.positions.size();
+	uint32_t n_triangles = (uint32_t)(mesh.indices.size() / 3);
+
+	// vertex -> triangles, in CSR layout
+	std::vector<uint32_t> adjacency_offsets(n_vertices + 1, 0);
+	for (uint32_t v : mesh.indices) {
+		++adjacency_offsets[v + 1];
+	}
+	std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+	std::vector<uint32_t> adjacency(mesh.indices.size());
+	{
+		std::vector<uint32_t> fill = adjacency_offsets;
+		for (uint32_t i = 0; i < mesh.indices.size(); ++i) {
+			adjacency[fill[mesh.indices[i]]++] = i / 3;
+		}
+	}
+
+	std::vector<glm::vec3> triangle_centers(n_triangles);
+	for (uint32_t t = 0; t < n_triangles; ++t) {
+		triangle_centers[t] = (mesh.positions[mesh.indices[t * 3]] + mesh.positions[mesh.indices[t * 3 + 1]] + mesh.positions[mesh.indices[t * 3 + 2]]) / 3.0f;
+	}
+
+	std::vector<bool> emitted(n_triangles, false);
+	// meshlet a vertex was last added to, +1
+	std::vector<uint32_t> stamps(n_vertices, 0);
+	std::vector<uint32_t> output;
+	output.reserve(mesh.indices.size());
+	std::vector<uint32_t> meshlet_vertices;
+	std::vector<uint32_t> meshlet_triangles;
+	uint32_t cursor = 0;
+	int64_t seed = -1;
+
+	auto new_vertices = [&](uint32_t t, uint32_t stamp) {
+		const uint32_t* tri = &mesh.indices[t * 3];
+		uint32_t n = stamps[tri[0]] != stamp ? 1 : 0;
+		n += stamps[tri[1]] != stamp && tri[1] != tri[0] ? 1 : 0;
+		n += stamps[tri[2]] != stamp && tri[2] != tri[0] && tri[2] != tri[1] ? 1 : 0;
+		return n;
+	};
+
+	while (true) {
+		if (seed < 0) {
+			while (cursor < n_triangles && emitted[cursor]) {
+				++cursor;
+			}
+			if (cursor == n_triangles) {
+				break;
+			}
+			seed = cursor;
+		}
+
+		// grow from the seed, each time by the connected triangle adding the fewest vertices, then the closest one
+		uint32_t stamp = (uint32_t)mesh.meshlets.size() + 1;
+		meshlet_vertices.clear();
+		meshlet_triangles.clear();
+		glm::vec3 center_sum(0.0f);
+		int64_t next = seed;
+		while (next >= 0) {
+			uint32_t t = (uint32_t)next;
+			emitted[t] = true;
+			meshlet_triangles.push_back(t);
+			center_sum += triangle_centers[t];
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t v = mesh.indices[t * 3 + k];
+				if (stamps[v] != stamp) {
+					stamps[v] = stamp;
+					meshlet_vertices.push_back(v);
+				}
+			}
+			if (meshlet_triangles.size() == Meshlet::max_triangles) {
+				break;
+			}
+
+			glm::vec3 center = center_sum / (float)meshlet_triangles.size();
+			next = -1;
+			uint32_t best_new = 3;
+			float best_distance = std::numeric_limits<float>::max();
+			for (uint32_t v : meshlet_vertices) {
+				for (uint32_t a = adjacency_offsets[v]; a < adjacency_offsets[v + 1]; ++a) {
+					uint32_t candidate = adjacency[a];
+					if (emitted[candidate]) {
+						continue;
+					}
+					uint32_t n_new = new_vertices(candidate, stamp);
+					if (meshlet_vertices.size() + n_new > Meshlet::max_vertices) {
+						continue;
+					}
+					glm::vec3 offset = triangle_centers[candidate] - center;
+					float distance = glm::dot(offset, offset);
+					if (n_new < best_new || (n_new == best_new && distance < best_distance)) {
+						best_new = n_new;
+						best_distance = distance;
+						next = candidate;
+					}
+				}
+			}
+		}
+
+		// the next meshlet continues next to this one if it can
+		seed = -1;
+		for (uint32_t v : meshlet_vertices) {
+			for (uint32_t a = adjacency_offsets[v]; seed < 0 && a < adjacency_offsets[v + 1]; ++a) {
+				if (!emitted[adjacency[a]]) {
+					seed = adjacency[a];
+				}
+			}
+		}
+
+		// keep the cache optimized order within the meshlet
+		std::sort(meshlet_triangles.begin(), meshlet_triangles.end());
+		Meshlet meshlet{};
+		meshlet.first_index = (uint32_t)output.size();
+		meshlet.index_count = (uint32_t)meshlet_triangles.size() * 3;
+		for (uint32_t t : meshlet_triangles) {
+			output.insert(output.end(), mesh.indices.begin() + t * 3, mesh.indices.begin() + t * 3 + 3);
+		}
+		mesh.meshlets.push_back(meshlet);
+	}
+
+	mesh.indices = std::move(output);
+	for (Meshlet& meshlet : mesh.meshlets) {
+		bound_meshlet(mesh, meshlet);
+	}
+}
+
+void MeshOptimizer::build_lods(MeshData& mesh) {
+	mesh.lods.clear();
+	std::vector<size_t> targets;
+	size_t n_triangles = mesh.indices.size() / 3;
+	for (uint32_t lod = 1; lod < MeshLod::max_lods; ++lod) {
+		targets.push_back((n_triangles >> lod) * 3);
+	}
+
+	size_t previous = mesh.indices.size();
+	for (MeshLod& lod : MeshSimplifier::simplify(mesh.positions, mesh.indices, targets)) {
+		if (lod.indices.empty() || lod.indices.size() * 4 > previous * 3) {
+			continue;
+		}
+		previous = lod.indices.size();
+		optimize_vertex_cache(lod.indices, (uint32_t)mesh.positions.size());
+		mesh.lods.push_back(std::move(lod));
+	}
+}
+
+void MeshOptimizer::optimize(MeshData& mesh) {
+	if (mesh.indices.empty() || mesh.indices.size() % 3 != 0) {
+		return;
+	}
+	uint32_t n_vertices = (uint32_t)mesh.positions.size();
+	std::vector<uint32_t> clusters = optimize_vertex_cache(mesh.indices, n_vertices);
+	optimize_overdraw(mesh.indices, mesh.positions, clusters);
+	build_meshlets(mesh);
+	build_lods(mesh);
+	optimize_vertex_fetch(mesh);
+}
+
+void MeshOptimizer::optimize_scene(const SceneGraph& graph) {
+	auto begin = std::chrono::steady_clock::now();
+
+	std::set<MeshData*> unique_meshes;
+	for (const SceneNode& node : graph) {
+		for (const Renderable& renderable : node.renderables) {
+			if (renderable.mesh) {
+				unique_meshes.insert(renderable.mesh.get());
+			}
+		}
+	}
+
+	// one task per mesh, each reports its stats before and after
+	struct MeshStats {
+		CacheStats before;
+		CacheStats after;
+	};
+	std::vector<std::future<MeshStats>> tasks;
+	for (MeshData* mesh : unique_meshes) {
+		tasks.push_back(ThreadPool::shared().submit([mesh]() {
+			MeshStats stats;
+			stats.before = analyze(mesh->indices, (uint32_t)mesh->positions.size());
+			optimize(*mesh);
+			stats.after = analyze(mesh->indices, (uint32_t)mesh->positions.size());
+			return stats;
+		}));
+	}
+
+	CacheStats before;
+	CacheStats after;
+	for (std::future<MeshStats>& task : tasks) {
+		MeshStats stats = task.get();
+		before.n_triangles += stats.before.n_triangles;
+		before.n_vertices += stats.before.n_vertices;
+		before.n_transforms += stats.before.n_transforms;
+		after.n_triangles += stats.after.n_triangles;
+		after.n_vertices += stats.after.n_vertices;
+		after.n_transforms += stats.after.n_transforms;
+	}
+	size_t n_meshlets = 0;
+	size_t n_lods = 0;
+	for (MeshData* mesh : unique_meshes) {
+		n_meshlets += mesh->meshlets.size();
+		n_lods += mesh->lods.size();
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	std::cout << "optimized " << unique_meshes.size() << " meshes into " << n_meshlets << " meshlets and " << n_lods << " LODs in " << ms << " ms. "
+		<< "ACMR " << before.acmr() << " -> " << after.acmr() << ", "
+		<< "ATVR " << before.atvr() << " -> " << after.atvr() << std::endl;
+}
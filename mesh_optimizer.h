@@ -0,0 +1,53 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+
+#include <vector>
+#include <memory>
+
+// CPU reordering of index and vertex data for cheaper vertex shading. Counterpart of the GPU side MeshPreprocessor
+struct MeshOptimizer {
+	// simulated FIFO post-transform cache
+	static const uint32_t cache_size = 16;
+
+	struct CacheStats {
+		uint32_t n_triangles = 0;
+		uint32_t n_vertices = 0; // referenced by indices
+		uint32_t n_transforms = 0; // cache misses
+
+		// average cache miss ratio: vertex shader invocations per triangle. 0.5 at best, 3 at worst
+		float acmr() const { return n_triangles ? (float)n_transforms / n_triangles : 0.0f; }
+		// average transform to vertex ratio. 1 at best
+		float atvr() const { return n_vertices ? (float)n_transforms / n_vertices : 0.0f; }
+	};
+
+	static CacheStats analyze(const std::vector<uint32_t>& indices, uint32_t n_vertices);
+
+	// Tipsify (Sander et al. 2007). Returns the first triangle of every cluster, i.e. where the cache was flushed
+	static std::vector<uint32_t> optimize_vertex_cache(std::vector<uint32_t>& indices, uint32_t n_vertices);
+
+	// sorts clusters so that triangles facing outwards from the mesh center come first, view independent.
+	// Clusters are split further where a restart costs at most threshold times the mesh ACMR
+	static void optimize_overdraw(
+		std::vector<uint32_t>& indices,
+		const std::vector<glm::vec3>& positions,
+		const std::vector<uint32_t>& clusters,
+		float threshold = 1.05f);
+
+	// renumbers vertices in order of first use and permutes every attribute accordingly. LODs are renumbered along
+	static void optimize_vertex_fetch(MeshData& mesh);
+
+	// groups triangles into spatially compact meshlets, grown greedily over shared vertices, and reorders the indices
+	// meshlet by meshlet. Triangles keep their relative order within a meshlet
+	static void build_meshlets(MeshData& mesh);
+
+	// simplified levels at 1/2, 1/4 and 1/8 of the triangles through MeshSimplifier, each in vertex cache order.
+	// Levels that save less than a quarter of the triangles of the previous one are dropped
+	static void build_lods(MeshData& mesh);
+
+	// vertex cache, overdraw, meshlets, LODs, vertex fetch
+	static void optimize(MeshData& mesh);
+
+	// optimizes every unique mesh of the graph on ThreadPool::shared() and prints ACMR/ATVR before and after
+	static void optimize_scene(const SceneGraph& graph);
+};
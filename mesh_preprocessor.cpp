@@ -1,19 +1,37 @@
 #include "mesh_preprocessor.h"
 #include "render_global_types.h"
+#include "bounds.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <chrono>
 
 MeshPreprocessor::MeshPreprocessor(const std::string& shader_path) {
 	_mesh_presprocess_blob = otcv::load_shaders_from_dir(shader_path);
 	_aabb_pipeline = otcv::ComputePipeline::create(_mesh_presprocess_blob["aabb.comp"]);
+	_aabb_reduce_pipeline = otcv::ComputePipeline::create(_mesh_presprocess_blob["aabb_reduce.comp"]);
 
 	_mesh_preprocess_desc_pool.reset(new NaiveExpandableDescriptorPool);
 	_aabb_in_desc_set = _mesh_preprocess_desc_pool->allocate(_aabb_pipeline->desc_set_layouts[DescriptorSetRate::ComputeRead]);
 	_aabb_out_desc_set = _mesh_preprocess_desc_pool->allocate(_aabb_pipeline->desc_set_layouts[DescriptorSetRate::ComputeWrite]);
+	_aabb_reduce_in_desc_set = _mesh_preprocess_desc_pool->allocate(_aabb_reduce_pipeline->desc_set_layouts[DescriptorSetRate::ComputeRead]);
+	_aabb_reduce_out_desc_set = _mesh_preprocess_desc_pool->allocate(_aabb_reduce_pipeline->desc_set_layouts[DescriptorSetRate::ComputeWrite]);
 
 	_cmd_buf = otcv::get_context().command_pool->allocate();
+	_fence = otcv::Fence::create();
 }
 
 MeshPreprocessor::~MeshPreprocessor() {
 	_aabb_pipeline->destroy();
+	_aabb_reduce_pipeline->destroy();
+}
+
+Std430AlignmentType MeshPreprocessor::aabb_layout() {
+	Std430AlignmentType layout;
+	layout.add(Std430AlignmentType::InlineType::Vec3, "min");
+	layout.add(Std430AlignmentType::InlineType::Vec3, "max");
+	return layout;
 }
 
 void MeshPreprocessor::generate_aabb(
@@ -27,31 +45,57 @@ void MeshPreprocessor::generate_aabb(
 	assert(vertex_offsets.size() == vertex_counts.size());
 	uint32_t n_obj = vertex_offsets.size();
 
-	_aabb_in_desc_set->bind_buffer(0, positions);
+	// split every mesh into chunks so that large meshes spread over many workgroups and small ones take one each
+	std::vector<uint32_t> chunk_first_vertices;
+	std::vector<uint32_t> chunk_vertex_counts;
+	std::vector<uint32_t> mesh_first_chunks(n_obj);
+	std::vector<uint32_t> mesh_chunk_counts(n_obj);
+	for (uint32_t i = 0; i < n_obj; ++i) {
+		mesh_first_chunks[i] = chunk_first_vertices.size();
+		for (uint32_t first = 0; first < vertex_counts[i]; first += _aabb_chunk_size) {
+			chunk_first_vertices.push_back(vertex_offsets[i] + first);
+			chunk_vertex_counts.push_back(std::min(vertex_counts[i] - first, _aabb_chunk_size));
+		}
+		mesh_chunk_counts[i] = chunk_first_vertices.size() - mesh_first_chunks[i];
+	}
+	uint32_t n_chunks = chunk_first_vertices.size();
+
+	// an empty buffer can not be bound
+	Std430AlignmentType Chunk;
+	Chunk.add(Std430AlignmentType::InlineType::Uint, "firstVertex");
+	Chunk.add(Std430AlignmentType::InlineType::Uint, "vertexCount");
+	_chunk_ssbo.reset(new SSBO(Chunk, std::max(n_chunks, 1u)));
+	std::vector<SSBO::WriteContext> chunk_writes(n_chunks);
+	for (uint32_t i = 0; i < n_chunks; ++i) {
+		chunk_writes[i].id = i;
+		chunk_writes[i].access_ctxs.push_back({ SSBOAccess()["firstVertex"], &chunk_first_vertices[i] });
+		chunk_writes[i].access_ctxs.push_back({ SSBOAccess()["vertexCount"], &chunk_vertex_counts[i] });
+	}
+	_chunk_ssbo->write(chunk_writes);
+	_partial_aabb_ssbo.reset(new SSBO(aabb_layout(), std::max(n_chunks, 1u)));
 
 	Std430AlignmentType MeshInfo;
-	MeshInfo.add(Std430AlignmentType::InlineType::Uint, "firstVertex");
-	MeshInfo.add(Std430AlignmentType::InlineType::Uint, "vertexCount");
+	MeshInfo.add(Std430AlignmentType::InlineType::Uint, "firstChunk");
+	MeshInfo.add(Std430AlignmentType::InlineType::Uint, "chunkCount");
 	_mesh_info_ssbo.reset(new SSBO(MeshInfo, n_obj));
 	std::vector<SSBO::WriteContext> ssbo_writes(n_obj);
 	for (uint32_t i = 0; i < n_obj; ++i) {
 		ssbo_writes[i].id = i;
-		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["firstVertex"], &vertex_offsets[i] });
-		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["vertexCount"], &vertex_counts[i] });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["firstChunk"], &mesh_first_chunks[i] });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["chunkCount"], &mesh_chunk_counts[i] });
 	}
 	_mesh_info_ssbo->write(ssbo_writes);
-	_aabb_in_desc_set->bind_buffer(1, _mesh_info_ssbo->_buf);
 
-	Std430AlignmentType AABB;
-	AABB.add(Std430AlignmentType::InlineType::Vec3, "min");
-	AABB.add(Std430AlignmentType::InlineType::Vec3, "max");
-	_aabb_ssbo.reset(new SSBO(AABB, n_obj));
-	_aabb_out_desc_set->bind_buffer(0, _aabb_ssbo->_buf);
+	_aabb_ssbo.reset(new SSBO(aabb_layout(), n_obj));
+
+	_aabb_in_desc_set->bind_buffer(0, positions);
+	_aabb_in_desc_set->bind_buffer(1, _chunk_ssbo->_buf);
+	_aabb_out_desc_set->bind_buffer(0, _partial_aabb_ssbo->_buf);
+	_aabb_reduce_in_desc_set->bind_buffer(0, _partial_aabb_ssbo->_buf);
+	_aabb_reduce_in_desc_set->bind_buffer(1, _mesh_info_ssbo->_buf);
+	_aabb_reduce_out_desc_set->bind_buffer(0, _aabb_ssbo->_buf);
 
 	_cmd_buf->begin(true);
-	_cmd_buf->cmd_bind_compute_pipeline(_aabb_pipeline);
-	_cmd_buf->cmd_bind_descriptor_set(_aabb_pipeline, _aabb_in_desc_set, DescriptorSetRate::ComputeRead);
-	_cmd_buf->cmd_bind_descriptor_set(_aabb_pipeline, _aabb_out_desc_set, DescriptorSetRate::ComputeWrite);
 	if (position_source_state != otcv::ResourceState::ComputeSSBORead) {
 		_cmd_buf->cmd_buffer_memory_barrier(
 			positions,
@@ -59,10 +103,24 @@ void MeshPreprocessor::generate_aabb(
 			otcv::ResourceState::ComputeSSBORead);
 	}
 
-	for (uint32_t i = 0; i < n_obj; ++i) {
-		_cmd_buf->cmd_push_constant(_aabb_pipeline, "meshId", &i);
-		_cmd_buf->cmd_dispatch(otcv::calc_group_count(vertex_counts[i], _compute_group_size), 1, 1);
+	// chunks
+	if (n_chunks > 0) {
+		_cmd_buf->cmd_bind_compute_pipeline(_aabb_pipeline);
+		_cmd_buf->cmd_bind_descriptor_set(_aabb_pipeline, _aabb_in_desc_set, DescriptorSetRate::ComputeRead);
+		_cmd_buf->cmd_bind_descriptor_set(_aabb_pipeline, _aabb_out_desc_set, DescriptorSetRate::ComputeWrite);
+		uint32_t group_count_x = std::min(n_chunks, _max_group_count_x);
+		_cmd_buf->cmd_dispatch(group_count_x, otcv::calc_group_count(n_chunks, group_count_x), 1);
 	}
+	_cmd_buf->cmd_buffer_memory_barrier(
+		_partial_aabb_ssbo->_buf,
+		otcv::ResourceState::ComputeSSBOWrite,
+		otcv::ResourceState::ComputeSSBORead);
+
+	// meshes
+	_cmd_buf->cmd_bind_compute_pipeline(_aabb_reduce_pipeline);
+	_cmd_buf->cmd_bind_descriptor_set(_aabb_reduce_pipeline, _aabb_reduce_in_desc_set, DescriptorSetRate::ComputeRead);
+	_cmd_buf->cmd_bind_descriptor_set(_aabb_reduce_pipeline, _aabb_reduce_out_desc_set, DescriptorSetRate::ComputeWrite);
+	_cmd_buf->cmd_dispatch(otcv::calc_group_count(n_obj, _compute_group_size), 1, 1);
 
 	_cmd_buf->cmd_buffer_memory_barrier(
 		positions,
@@ -77,7 +135,104 @@ void MeshPreprocessor::generate_aabb(
 	otcv::QueueSubmit submit;
 	submit.batch()
 		.add_command_buffer(_cmd_buf)
-		.end();
+		.end()
+		.signal(_fence);
 	otcv::get_context().queue->submit(submit);
+	// the chunk and partial buffers are released with the next call, and callers read the aabbs right away
+	_fence->wait_reset();
+}
+
+void MeshPreprocessor::set_aabb(const std::vector<AABB>& aabbs) {
+	uint32_t n_obj = aabbs.size();
+	_aabb_ssbo.reset(new SSBO(aabb_layout(), n_obj));
+	std::vector<SSBO::WriteContext> ssbo_writes(n_obj);
+	for (uint32_t i = 0; i < n_obj; ++i) {
+		ssbo_writes[i].id = i;
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["min"], &aabbs[i].min });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["max"], &aabbs[i].max });
+	}
+	_aabb_ssbo->write(ssbo_writes);
 }
 
+void MeshPreprocessor::set_meshlets(const std::vector<Meshlet>& meshlets) {
+	Std430AlignmentType layout;
+	layout.add(Std430AlignmentType::InlineType::Vec4, "sphere");
+	layout.add(Std430AlignmentType::InlineType::Vec4, "cone");
+	layout.add(Std430AlignmentType::InlineType::Uint, "firstIndex");
+	layout.add(Std430AlignmentType::InlineType::Uint, "indexCount");
+	// an empty buffer can not be bound
+	uint32_t n_meshlets = std::max((uint32_t)meshlets.size(), 1u);
+	_meshlet_ssbo.reset(new SSBO(layout, n_meshlets));
+
+	std::vector<glm::vec4> spheres(meshlets.size());
+	std::vector<glm::vec4> cones(meshlets.size());
+	std::vector<SSBO::WriteContext> ssbo_writes(meshlets.size());
+	for (uint32_t i = 0; i < meshlets.size(); ++i) {
+		spheres[i] = glm::vec4(meshlets[i].center, meshlets[i].radius);
+		cones[i] = glm::vec4(meshlets[i].cone_axis, meshlets[i].cone_cutoff);
+		ssbo_writes[i].id = i;
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["sphere"], &spheres[i] });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["cone"], &cones[i] });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["firstIndex"], &meshlets[i].first_index });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["indexCount"], &meshlets[i].index_count });
+	}
+	_meshlet_ssbo->write(ssbo_writes);
+}
+
+#ifdef MESH_PREPROCESSOR_AABB_BENCHMARK
+void benchmark_aabb(const std::string& shader_path, uint32_t n_objects) {
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<uint32_t> vertex_count(8, 512);
+	std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+
+	std::vector<uint32_t> vertex_offsets(n_objects);
+	std::vector<uint32_t> vertex_counts(n_objects);
+	uint32_t n_vertices = 0;
+	for (uint32_t i = 0; i < n_objects; ++i) {
+		vertex_offsets[i] = n_vertices;
+		vertex_counts[i] = vertex_count(rng);
+		n_vertices += vertex_counts[i];
+	}
+	std::vector<glm::vec3> positions(n_vertices);
+	for (glm::vec3& p : positions) {
+		p = glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+	}
+
+	auto time_cpu = [&](AABB (*reduce)(const glm::vec3*, size_t), std::vector<AABB>& aabbs) {
+		auto begin = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < n_objects; ++i) {
+			aabbs[i] = reduce(positions.data() + vertex_offsets[i], vertex_counts[i]);
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	};
+	std::vector<AABB> scalar_aabbs(n_objects);
+	std::vector<AABB> simd_aabbs(n_objects);
+	double scalar_ms = time_cpu(&Bounds::aabb_scalar, scalar_aabbs);
+	double simd_ms = time_cpu(&Bounds::aabb, simd_aabbs);
+	for (uint32_t i = 0; i < n_objects; ++i) {
+		assert(scalar_aabbs[i].min == simd_aabbs[i].min && scalar_aabbs[i].max == simd_aabbs[i].max);
+	}
+
+	otcv::BufferBuilder bb;
+	bb.size(positions.size() * sizeof(glm::vec3))
+		.usage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+		.host_access(otcv::BufferBuilder::Access::Invisible);
+	otcv::Buffer* position_buffer = new otcv::Buffer(bb);
+	position_buffer->populate_async(positions.data(), otcv::Buffer::SyncType::GPUBarrier, otcv::ResourceState::ComputeSSBORead, otcv::ResourceState::Created);
+
+	MeshPreprocessor preprocessor(shader_path);
+	auto begin = std::chrono::steady_clock::now();
+	preprocessor.generate_aabb(
+		position_buffer,
+		vertex_offsets,
+		vertex_counts,
+		otcv::ResourceState::ComputeSSBORead,
+		otcv::ResourceState::ComputeSSBORead,
+		otcv::ResourceState::ComputeSSBORead);
+	double gpu_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	delete position_buffer;
+
+	std::cout << "aabb benchmark: " << n_objects << " objects, " << n_vertices << " vertices. CPU scalar " << scalar_ms
+		<< " ms, CPU SIMD " << simd_ms << " ms (" << scalar_ms / simd_ms << "x), GPU " << gpu_ms << " ms" << std::endl;
+}
+#endif
@@ -3,6 +3,7 @@
 #include "otcv_utils.h"
 #include "expandable_descriptor_pool.h"
 #include "static_ubo.h"
+#include "gltf_scene_bindless.h"
 
 class MeshPreprocessor {
 public:
@@ -10,6 +11,8 @@ public:
 	
 	~MeshPreprocessor();
 
+	// one AABB per mesh from a buffer of tightly packed float3 positions. Both passes go in a single submission
+	// that is waited on, so AABB_SSBO() is complete on return
 	void generate_aabb(
 		otcv::Buffer* positions,
 		const std::vector<uint32_t>& vertex_offsets,
@@ -18,20 +21,47 @@ public:
 		otcv::ResourceState position_target_state,
 		otcv::ResourceState aabb_buffer_target_state);
 
+	// uploads aabbs computed on the CPU instead of generating them. The write is synchronous
+	void set_aabb(const std::vector<AABB>& aabbs);
+
 	std::shared_ptr<SSBO> AABB_SSBO() { return _aabb_ssbo; }
 
+	// meshlets of all meshes back to back. The write is synchronous
+	void set_meshlets(const std::vector<Meshlet>& meshlets);
+
+	std::shared_ptr<SSBO> meshlet_SSBO() { return _meshlet_ssbo; }
+
 private:
+	static Std430AlignmentType aabb_layout();
+
 	otcv::ShaderBlob _mesh_presprocess_blob;
+	// aabb.comp reduces chunks of at most _aabb_chunk_size vertices, aabb_reduce.comp merges the chunks of each mesh
 	otcv::ComputePipeline* _aabb_pipeline;
+	otcv::ComputePipeline* _aabb_reduce_pipeline;
 
 	std::shared_ptr<NaiveExpandableDescriptorPool> _mesh_preprocess_desc_pool;
 
 	otcv::DescriptorSet* _aabb_in_desc_set;
 	otcv::DescriptorSet* _aabb_out_desc_set;
+	otcv::DescriptorSet* _aabb_reduce_in_desc_set;
+	otcv::DescriptorSet* _aabb_reduce_out_desc_set;
+	std::shared_ptr<SSBO> _chunk_ssbo;
+	std::shared_ptr<SSBO> _partial_aabb_ssbo;
 	std::shared_ptr<SSBO> _mesh_info_ssbo;
 	std::shared_ptr<SSBO> _aabb_ssbo;
+	std::shared_ptr<SSBO> _meshlet_ssbo;
 
 	otcv::CommandBuffer* _cmd_buf;
+	otcv::Fence* _fence;
 
 	const uint32_t _compute_group_size = 64;
-};
\ No newline at end of file
+	const uint32_t _aabb_chunk_size = 64 * 16;
+	// guaranteed minimum of VkPhysicalDeviceLimits::maxComputeWorkGroupCount[0]
+	const uint32_t _max_group_count_x = 65535;
+};
+
+#ifdef MESH_PREPROCESSOR_AABB_BENCHMARK
+// synthetic scene of n_objects meshes with random vertex counts. Times AABBs through Bounds on the CPU,
+// scalar and SIMD, and through MeshPreprocessor::generate_aabb including its upload and wait
+void benchmark_aabb(const std::string& shader_path, uint32_t n_objects);
+#endif
\ No newline at end of file
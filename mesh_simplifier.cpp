@@ -0,0 +1,372 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <limits>
+#include <cmath>
+
+namespace {
+
+// area weighted sum of squared distances to planes. p^T A p + 2 b.p + c, A symmetric
+struct Quadric {
+	float a00 = 0.0f, a01 = 0.0f, a02 = 0.0f, a11 = 0.0f, a12 = 0.0f, a22 = 0.0f;
+	float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f;
+	float c = 0.0f;
+	float w = 0.0f;
+
+	void add_plane(glm::vec3 n, float d, float weight) {
+		a00 += weight * n.x * n.x;
+		a01 += weight * n.x * n.y;
+		a02 += weight * n.x * n.z;
+		a11 += weight * n.y * n.y;
+		a12 += weight * n.y * n.z;
+		a22 += weight * n.z * n.z;
+		b0 += weight * n.x * d;
+		b1 += weight * n.y * d;
+		b2 += weight * n.z * d;
+		c += weight * d * d;
+		w += weight;
+	}
+
+	void add(const Quadric& q) {
+		a00 += q.a00; a01 += q.a01; a02 += q.a02;
+		a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2;
+		c += q.c;
+		w += q.w;
+	}
+
+	// mean squared distance
+	float error(glm::vec3 p) const {
+		float e = p.x * (a00 * p.x + a01 * p.y + a02 * p.z)
+			+ p.y * (a01 * p.x + a11 * p.y + a12 * p.z)
+			+ p.z * (a02 * p.x + a12 * p.y + a22 * p.z)
+			+ 2.0f * (b0 * p.x + b1 * p.y + b2 * p.z)
+			+ c;
+		return w > 0.0f ? std::max(e / w, 0.0f) : 0.0f;
+	}
+};
+
+static uint64_t edge_key(uint32_t a, uint32_t b) {
+	return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+enum class VertexKind : uint8_t {
+	Manifold,
+	Border, // on an edge with one triangle
+	Locked // attribute seam or an edge with more than two triangles
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	float error;
+	uint32_t version; // of from when queued
+};
+
+}
+
+std::vector<MeshLod> MeshSimplifier::simplify(
+	const std::vector<glm::vec3>& positions,
+	const std::vector<uint32_t>& indices,
+	const std::vector<size_t>& target_index_counts) {
+
+	std::vector<MeshLod> lods;
+	uint32_t n_vertices = (uint32_t)positions.size();
+	if (indices.empty() || target_index_counts.empty()) {
+		return lods;
+	}
+
+	// vertices at the same position. Ones that were split for their attributes are seams and never move
+	std::vector<uint32_t> welded(n_vertices);
+	std::vector<bool> seam(n_vertices, false);
+	{
+		struct PositionHash {
+			size_t operator()(const glm::vec3& p) const {
+				uint32_t bits[3];
+				std::memcpy(bits, &p, sizeof(bits));
+				return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+			}
+		};
+		struct PositionEqual {
+			bool operator()(const glm::vec3& a, const glm::vec3& b) const {
+				return a.x == b.x && a.y == b.y && a.z == b.z;
+			}
+		};
+		std::unordered_map<glm::vec3, uint32_t, PositionHash, PositionEqual> first_at(n_vertices);
+		for (uint32_t v = 0; v < n_vertices; ++v) {
+			auto iter = first_at.insert({ positions[v], v }).first;
+			welded[v] = iter->second;
+			if (iter->second != v) {
+				seam[v] = true;
+				seam[iter->second] = true;
+			}
+		}
+	}
+
+	std::vector<uint32_t> tris = indices;
+	uint32_t n_triangles = (uint32_t)(tris.size() / 3);
+	std::vector<bool> tri_alive(n_triangles, true);
+	size_t n_live_indices = tris.size();
+
+	// triangle planes, borders get a perpendicular plane on top so that the outline holds
+	std::vector<Quadric> quadrics(n_vertices);
+	for (uint32_t t = 0; t < n_triangles; ++t) {
+		glm::vec3 p0 = positions[tris[t * 3 + 0]];
+		glm::vec3 p1 = positions[tris[t * 3 + 1]];
+		glm::vec3 p2 = positions[tris[t * 3 + 2]];
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float double_area = glm::length(n);
+		if (double_area <= 0.0f) {
+			continue;
+		}
+		n = n / double_area;
+		for (uint32_t k = 0; k < 3; ++k) {
+			quadrics[tris[t * 3 + k]].add_plane(n, -glm::dot(n, p0), double_area * 0.5f);
+		}
+	}
+	{
+		std::unordered_map<uint64_t, uint32_t> edge_counts;
+		for (uint32_t i = 0; i < tris.size(); ++i) {
+			uint32_t a = welded[tris[i]];
+			uint32_t b = welded[tris[i - i % 3 + (i + 1) % 3]];
+			++edge_counts[edge_key(a, b)];
+		}
+		const float border_weight = 10.0f;
+		for (uint32_t t = 0; t < n_triangles; ++t) {
+			glm::vec3 p0 = positions[tris[t * 3 + 0]];
+			glm::vec3 p1 = positions[tris[t * 3 + 1]];
+			glm::vec3 p2 = positions[tris[t * 3 + 2]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t a = tris[t * 3 + k];
+				uint32_t b = tris[t * 3 + (k + 1) % 3];
+				if (edge_counts[edge_key(welded[a], welded[b])] != 1) {
+					continue;
+				}
+				glm::vec3 edge = positions[b] - positions[a];
+				glm::vec3 n = glm::cross(edge, normal);
+				float n_length = glm::length(n);
+				if (n_length <= 0.0f) {
+					continue;
+				}
+				n = n / n_length;
+				float weight = glm::dot(edge, edge) * border_weight;
+				quadrics[a].add_plane(n, -glm::dot(n, positions[a]), weight);
+				quadrics[b].add_plane(n, -glm::dot(n, positions[a]), weight);
+			}
+		}
+	}
+
+	std::vector<VertexKind> kinds(n_vertices);
+	std::unordered_map<uint64_t, uint32_t> edge_counts;
+	// vertex -> triangles. Collapses move the surviving ones of the removed vertex over, dead ones are skipped
+	std::vector<std::vector<uint32_t>> vertex_tris(n_vertices);
+	// bumped whenever the cheapest collapse of a vertex is recomputed, queued collapses of older versions are stale
+	std::vector<uint32_t> versions(n_vertices, 0);
+	// min-heap by error
+	std::vector<Collapse> queue;
+	auto queue_order = [](const Collapse& a, const Collapse& b) {
+		return a.error > b.error;
+	};
+	std::vector<uint32_t> ring;
+	float max_error = 0.0f;
+	size_t target = 0;
+
+	auto snapshot = [&]() {
+		MeshLod lod;
+		lod.indices.reserve(n_live_indices);
+		for (uint32_t t = 0; t < n_triangles; ++t) {
+			if (tri_alive[t]) {
+				lod.indices.insert(lod.indices.end(), tris.begin() + t * 3, tris.begin() + t * 3 + 3);
+			}
+		}
+		lod.error = std::sqrt(max_error);
+		lods.push_back(std::move(lod));
+	};
+
+	// edges made by collapses of this pass count 0, so borders never collapse along them until reclassified
+	auto edge_count = [&](uint32_t a, uint32_t b) {
+		auto iter = edge_counts.find(edge_key(welded[a], welded[b]));
+		return iter == edge_counts.end() ? 0u : iter->second;
+	};
+
+	auto cheapest_collapse = [&](uint32_t v) {
+		Collapse best = { v, v, std::numeric_limits<float>::max(), versions[v] };
+		if (kinds[v] == VertexKind::Locked) {
+			return best;
+		}
+		for (uint32_t t : vertex_tris[v]) {
+			if (!tri_alive[t]) {
+				continue;
+			}
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t to = tris[t * 3 + k];
+				if (to == v) {
+					continue;
+				}
+				if (kinds[v] == VertexKind::Border && edge_count(v, to) != 1) {
+					continue;
+				}
+				Quadric q = quadrics[v];
+				q.add(quadrics[to]);
+				float error = q.error(positions[to]);
+				if (error < best.error) {
+					best = { v, to, error, versions[v] };
+				}
+			}
+		}
+		return best;
+	};
+
+	auto enqueue = [&](uint32_t v) {
+		++versions[v];
+		Collapse collapse = cheapest_collapse(v);
+		if (collapse.to != v) {
+			queue.push_back(collapse);
+			std::push_heap(queue.begin(), queue.end(), queue_order);
+		}
+	};
+
+	while (target < target_index_counts.size()) {
+		// classify against the live triangles
+		edge_counts.clear();
+		for (uint32_t t = 0; t < n_triangles; ++t) {
+			if (!tri_alive[t]) {
+				continue;
+			}
+			for (uint32_t k = 0; k < 3; ++k) {
+				++edge_counts[edge_key(welded[tris[t * 3 + k]], welded[tris[t * 3 + (k + 1) % 3]])];
+			}
+		}
+		for (uint32_t v = 0; v < n_vertices; ++v) {
+			kinds[v] = seam[v] ? VertexKind::Locked : VertexKind::Manifold;
+		}
+		for (const auto& edge : edge_counts) {
+			if (edge.second == 2) {
+				continue;
+			}
+			VertexKind kind = edge.second == 1 ? VertexKind::Border : VertexKind::Locked;
+			for (uint32_t v : { (uint32_t)(edge.first >> 32), (uint32_t)(edge.first & 0xffffffffu) }) {
+				kinds[v] = std::max(kinds[v], kind);
+			}
+		}
+
+		for (std::vector<uint32_t>& vtris : vertex_tris) {
+			vtris.clear();
+		}
+		for (uint32_t t = 0; t < n_triangles; ++t) {
+			if (tri_alive[t]) {
+				for (uint32_t k = 0; k < 3; ++k) {
+					vertex_tris[tris[t * 3 + k]].push_back(t);
+				}
+			}
+		}
+
+		// cheapest collapse of every vertex that may move
+		queue.clear();
+		for (uint32_t v = 0; v < n_vertices; ++v) {
+			if (!vertex_tris[v].empty()) {
+				enqueue(v);
+			}
+		}
+		// only the cheaper part per pass, the classification goes stale as the topology changes
+		size_t budget = std::max<size_t>(queue.size() / 4, std::min<size_t>(queue.size(), 1));
+
+		size_t n_collapsed = 0;
+		while (!queue.empty() && n_collapsed < budget) {
+			std::pop_heap(queue.begin(), queue.end(), queue_order);
+			Collapse collapse = queue.back();
+			queue.pop_back();
+			if (collapse.version != versions[collapse.from]) {
+				continue;
+			}
+
+			// reject collapses flipping one of the remaining triangles
+			bool flips = false;
+			for (uint32_t t : vertex_tris[collapse.from]) {
+				const uint32_t* tri = &tris[t * 3];
+				if (!tri_alive[t] || tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+					continue;
+				}
+				glm::vec3 p[3];
+				glm::vec3 q[3];
+				for (uint32_t k = 0; k < 3; ++k) {
+					p[k] = positions[tri[k]];
+					q[k] = tri[k] == collapse.from ? positions[collapse.to] : p[k];
+				}
+				glm::vec3 n_before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 n_after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(n_before, n_after) <= 0.0f;
+				if (flips) {
+					break;
+				}
+			}
+			if (flips) {
+				continue;
+			}
+
+			for (uint32_t t : vertex_tris[collapse.from]) {
+				if (!tri_alive[t]) {
+					continue;
+				}
+				uint32_t* tri = &tris[t * 3];
+				for (uint32_t k = 0; k < 3; ++k) {
+					if (tri[k] == collapse.from) {
+						tri[k] = collapse.to;
+					}
+				}
+				if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+					tri_alive[t] = false;
+					n_live_indices -= 3;
+				}
+				else {
+					vertex_tris[collapse.to].push_back(t);
+				}
+			}
+			vertex_tris[collapse.from].clear();
+			++versions[collapse.from];
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			max_error = std::max(max_error, collapse.error);
+			++n_collapsed;
+
+			if (n_live_indices <= target_index_counts[target]) {
+				break;
+			}
+
+			// the quadric of to changed and collapses onto from are gone. Every neighbour of from is one of to now,
+			// so re-queueing the one-ring of to covers both
+			std::vector<uint32_t>& to_tris = vertex_tris[collapse.to];
+			to_tris.erase(std::remove_if(to_tris.begin(), to_tris.end(), [&](uint32_t t) {
+				return !tri_alive[t];
+			}), to_tris.end());
+			ring.clear();
+			for (uint32_t t : to_tris) {
+				ring.insert(ring.end(), tris.begin() + t * 3, tris.begin() + t * 3 + 3);
+			}
+			std::sort(ring.begin(), ring.end());
+			ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+			for (uint32_t v : ring) {
+				enqueue(v);
+			}
+		}
+
+		if (n_live_indices <= target_index_counts[target]) {
+			snapshot();
+			++target;
+			// one level covers every target it passed at once
+			while (target < target_index_counts.size() && n_live_indices <= target_index_counts[target]) {
+				++target;
+			}
+		}
+		else if (n_collapsed == 0) {
+			// stuck above the target
+			if (lods.empty() || n_live_indices < lods.back().indices.size()) {
+				snapshot();
+			}
+			break;
+		}
+	}
+	return lods;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+
+#include <vector>
+
+// quadric error metric edge collapse (Garland and Heckbert 1997). Collapses move a vertex onto one of its neighbours,
+// so every level indexes the vertex buffer of the original mesh
+struct MeshSimplifier {
+	// one level per target, targets in decreasing order. Levels are snapshots of a single collapse sequence, cheapest
+	// first with the neighbours of every collapse re-queued at their new cost, see MeshLod::error. Stops early once
+	// nothing can collapse, the last level then holds what was reached.
+	// Vertices on attribute seams and complex edges stay, open borders only collapse along themselves
+	static std::vector<MeshLod> simplify(
+		const std::vector<glm::vec3>& positions,
+		const std::vector<uint32_t>& indices,
+		const std::vector<size_t>& target_index_counts);
+};
@@ -1,24 +1,124 @@
 #include "math_common.h"
 #include "scene_culling.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+
+static_assert(SceneCulling::max_views == CpuCulling::max_views, "one view limit for the shaders and the CPU");
+static_assert(SceneCulling::max_planes == CpuCulling::max_planes, "one plane limit for the shaders and the CPU");
+static_assert(FrustumUtils::max_swept_planes <= SceneCulling::max_planes, "swept frustums are culled against");
+static_assert(SceneCulling::layer_mask_shift == CpuCulling::layer_mask_shift, "one instance id layout for the shaders and the CPU");
+
 SceneCulling::SceneCulling(
 	const std::string& shader_path,
 	const SceneGraph& scene,
 	const SceneGraphFlatRefs& scene_refs,
-	uint32_t _in_flight_frames) {
+	uint32_t _in_flight_frames,
+	uint32_t n_views) {
 
 	_shader_blob = otcv::load_shaders_from_dir(shader_path);
+#if defined(SCENE_CULLING_CPU)
+	// for its descriptor set layouts, nothing is dispatched
 	_pipeline = otcv::ComputePipeline::create(_shader_blob["frustum_cull.comp"]);
+	_cpu = true;
+#elif defined(SCENE_CULLING_MESHLETS)
+	_pipeline = otcv::ComputePipeline::create(_shader_blob["object_cull.comp"]);
+	_meshlet_pipeline = otcv::ComputePipeline::create(_shader_blob["meshlet_cull.comp"]);
+#else
+	_pipeline = otcv::ComputePipeline::create(_shader_blob["frustum_cull.comp"]);
+#endif
 	_desc_pool.reset(new NaiveExpandableDescriptorPool);
 	_n_obj = scene_refs.size();
+	_n_views = n_views;
+	assert(_n_views > 0 && _n_views <= max_views);
+
+	// command slots of each bucket
+	uint32_t n_buckets = (uint32_t)PipelineVariant::All * (uint32_t)IndexWidth::All;
+#if defined(SCENE_CULLING_CPU)
+	// one per object in the bucket, see CpuCulling
+	_bucket_max_draws.assign(n_buckets, 0);
+	for (const ObjectRef& ref : scene_refs) {
+		const MeshData& mesh = *scene[ref.node_id].renderables[ref.renderable_id].mesh;
+		_bucket_max_draws[bucket_id((uint32_t)PipelineVariant::All, (uint32_t)ref.pipeline_variant, index_width(mesh))] += 1;
+	}
+#elif defined(SCENE_CULLING_MESHLETS)
+	// one per meshlet of every object in the bucket
+	_bucket_max_draws.assign(n_buckets, 0);
+	for (const ObjectRef& ref : scene_refs) {
+		const MeshData& mesh = *scene[ref.node_id].renderables[ref.renderable_id].mesh;
+		uint32_t bucket = bucket_id((uint32_t)PipelineVariant::All, (uint32_t)ref.pipeline_variant, index_width(mesh));
+		_bucket_max_draws[bucket] += mesh.meshlets.size();
+	}
+#else
+	// commands sit at the draw slots of their mesh, one per LOD it has, and so do the instance id ranges of its objects.
+	// See BindlessDataManager::set_objects
+	_bucket_max_draws.assign(n_buckets, 0);
+	{
+		std::set<const MeshData*> meshes;
+		for (const ObjectRef& ref : scene_refs) {
+			const MeshData& mesh = *scene[ref.node_id].renderables[ref.renderable_id].mesh;
+			if (meshes.insert(&mesh).second) {
+				_bucket_max_draws[bucket_id((uint32_t)PipelineVariant::All, (uint32_t)ref.pipeline_variant, index_width(mesh))] += lod_count(mesh);
+			}
+			_n_instances += lod_count(mesh);
+		}
+	}
+#endif
+	_bucket_first_draws.resize(n_buckets);
+	_n_draws = 0;
+	for (uint32_t bucket = 0; bucket < n_buckets; ++bucket) {
+		_bucket_first_draws[bucket] = _n_draws;
+		_n_draws += _bucket_max_draws[bucket];
+	}
+
+	for (uint32_t phase = 0; phase < (uint32_t)OcclusionPhase::All; ++phase) {
+		Std140AlignmentType PhaseUBO;
+		PhaseUBO.add(Std140AlignmentType::InlineType::Uint, "occlusionPhase");
+		_phase_ubos[phase].reset(new StaticUBO(PhaseUBO));
+		_phase_ubos[phase]->set(StaticUBOAccess()["occlusionPhase"], &phase);
+	}
+
+	Std430AlignmentType Depth;
+	Depth.add(Std430AlignmentType::InlineType::Float, "value");
+	_placeholder_pyramid.reset(new SSBO(Depth, 1));
 
 	_frame_ctxs.resize(_in_flight_frames);
 	for (FrameContext& ctx : _frame_ctxs) {
+		Std140AlignmentType View;
+		View.add(Std140AlignmentType::InlineType::Vec4, "frustum_faces", max_planes);
+		View.add(Std140AlignmentType::InlineType::Uint, "nPlanes");
+		View.add(Std140AlignmentType::InlineType::Vec4, "viewOrigin");
+		View.add(Std140AlignmentType::InlineType::Float, "coneCulling");
+		View.add(Std140AlignmentType::InlineType::Float, "lodScale");
+		View.add(Std140AlignmentType::InlineType::Uint, "layers");
 		Std140AlignmentType UBO;
-		UBO.add(Std140AlignmentType::InlineType::Vec4, "frustum_faces", 6);
+		UBO.add(View, "views", max_views);
+		UBO.add(Std140AlignmentType::InlineType::Uint, "nViews");
+		UBO.add(Std140AlignmentType::InlineType::Mat4, "viewProj");
+		UBO.add(Std140AlignmentType::InlineType::Uint, "depthWidth");
+		UBO.add(Std140AlignmentType::InlineType::Uint, "depthHeight");
+		UBO.add(Std140AlignmentType::InlineType::Uint, "pyramidLevels");
 		ctx._ubo.reset(new StaticUBO(UBO));
-		ctx._desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
-		ctx._desc_set->bind_buffer(0, ctx._ubo->_buf);
+		for (uint32_t phase = 0; phase < (uint32_t)OcclusionPhase::All; ++phase) {
+			ctx._desc_sets[phase] = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
+			ctx._desc_sets[phase]->bind_buffer(0, ctx._ubo->_buf);
+			ctx._desc_sets[phase]->bind_buffer(1, _phase_ubos[phase]->_buf);
+			ctx._desc_sets[phase]->bind_buffer(2, _placeholder_pyramid->_buf);
+		}
+		uint32_t no_pyramid = 0;
+		ctx._ubo->set(StaticUBOAccess()["pyramidLevels"], &no_pyramid);
+		ctx._ubo->set(StaticUBOAccess()["nViews"], &_n_views);
+		uint32_t unlayered = 1;
+		for (uint32_t view = 0; view < _n_views; ++view) {
+			ctx._ubo->set(StaticUBOAccess()["views"][view]["layers"], &unlayered);
+		}
+		ctx._cpu_views.resize(_n_views);
+		if (_meshlet_pipeline) {
+			ctx._meshlet_desc_set = _desc_pool->allocate(_meshlet_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
+			ctx._meshlet_desc_set->bind_buffer(0, ctx._ubo->_buf);
+		}
 	}
 }
 
@@ -26,6 +126,34 @@ SceneCulling::~SceneCulling() {
 
 }
 
+void SceneCulling::layer_views(uint32_t first_view, uint32_t n_layers) {
+	assert(first_view > 0 && first_view + n_layers <= _n_views);
+	// the layer mask shares the instance id with the object id
+	assert(n_layers <= 32 - layer_mask_shift && _n_obj <= (1u << layer_mask_shift));
+	for (FrameContext& ctx : _frame_ctxs) {
+		for (uint32_t layer = 0; layer < n_layers; ++layer) {
+			uint32_t layers = layer == 0 ? n_layers : 0;
+			ctx._ubo->set(StaticUBOAccess()["views"][first_view + layer]["layers"], &layers);
+			ctx._cpu_views[first_view + layer].layers = layers;
+		}
+	}
+}
+
+void SceneCulling::set_depth_pyramid(std::shared_ptr<DepthPyramid> depth_pyramid) {
+	_depth_pyramid = depth_pyramid;
+	uint32_t depth_width = depth_pyramid->width();
+	uint32_t depth_height = depth_pyramid->height();
+	uint32_t n_levels = depth_pyramid->n_levels();
+	for (FrameContext& ctx : _frame_ctxs) {
+		for (uint32_t phase = 0; phase < (uint32_t)OcclusionPhase::All; ++phase) {
+			ctx._desc_sets[phase]->bind_buffer(2, depth_pyramid->ssbo()->_buf);
+		}
+		ctx._ubo->set(StaticUBOAccess()["depthWidth"], &depth_width);
+		ctx._ubo->set(StaticUBOAccess()["depthHeight"], &depth_height);
+		ctx._ubo->set(StaticUBOAccess()["pyramidLevels"], &n_levels);
+	}
+}
+
 SceneCulling::ObjectBufferContext SceneCulling::create_object_buffer_context(
 	const SceneGraph& scene,
 	const SceneGraphFlatRefs& scene_refs,
@@ -33,16 +161,35 @@ SceneCulling::ObjectBufferContext SceneCulling::create_object_buffer_context(
 
 	ObjectBufferContext obj_buf_ctx;
 
-	obj_buf_ctx.ssbo_aabbs = bindless_data->_mesh_preprocessor->AABB_SSBO();
-
 	Std430AlignmentType ObjectData;
 	ObjectData.add(Std430AlignmentType::InlineType::Mat4, "model");
 	ObjectData.add(Std430AlignmentType::InlineType::Uint, "indexCount");
 	ObjectData.add(Std430AlignmentType::InlineType::Uint, "firstIndex");
 	ObjectData.add(Std430AlignmentType::InlineType::Int, "vertexOffset");
 	ObjectData.add(Std430AlignmentType::InlineType::Uint, "pipelineVariant");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "indexWidth");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "meshId");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "drawSlot");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "firstInstance");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "instanceCount");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "firstMeshlet");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "meshletCount");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "lodCount");
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "lodFirstIndex", MeshLod::max_lods);
+	ObjectData.add(Std430AlignmentType::InlineType::Uint, "lodIndexCount", MeshLod::max_lods);
+	ObjectData.add(Std430AlignmentType::InlineType::Float, "lodError", MeshLod::max_lods);
+	ObjectData.add(Std430AlignmentType::InlineType::Vec4, "sphere");
+	ObjectData.add(Std430AlignmentType::InlineType::Vec4, "obbCenter");
+	ObjectData.add(Std430AlignmentType::InlineType::Vec4, "obbHalfAxes", 3);
 	obj_buf_ctx.ssbo_objects.reset(new SSBO(ObjectData, _n_obj));
 
+	// the scene is static, so the bounding volumes are transformed to world space once here
+	std::vector<glm::vec4> world_spheres(_n_obj);
+	std::vector<glm::vec4> world_obb_centers(_n_obj);
+	std::vector<glm::vec4> world_obb_half_axes(_n_obj * 3);
+
+	std::vector<CpuCulling::Object> cpu_objects(_cpu ? _n_obj : 0);
+
 	std::vector<SSBO::WriteContext> ssbo_writes(_n_obj);
 	for (uint32_t i = 0; i < _n_obj; ++i) {
 		const SceneNode& scene_node = scene[scene_refs[i].node_id];
@@ -54,12 +201,87 @@ SceneCulling::ObjectBufferContext SceneCulling::create_object_buffer_context(
 		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["firstIndex"], &segment.index_start });
 		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["vertexOffset"], &segment.vertex_start });
 		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["pipelineVariant"], &scene_refs[i].pipeline_variant });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["indexWidth"], &segment.index_width });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["meshId"], &segment.mesh_id });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["drawSlot"], &segment.draw_slot });
+		// within the bucket sized in the constructor
+		assert(_meshlet_pipeline || _cpu || segment.draw_slot + segment.lod_count <=
+			_bucket_max_draws[bucket_id((uint32_t)PipelineVariant::All, (uint32_t)scene_refs[i].pipeline_variant, segment.index_width)]);
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["firstInstance"], &segment.first_instance });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["instanceCount"], &segment.instance_count });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["firstMeshlet"], &segment.first_meshlet });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["meshletCount"], &segment.meshlet_count });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["lodCount"], &segment.lod_count });
+		for (uint32_t lod = 0; lod < MeshLod::max_lods; ++lod) {
+			ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["lodFirstIndex"][lod], &segment.lod_index_starts[lod] });
+			ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["lodIndexCount"][lod], &segment.lod_index_counts[lod] });
+			ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["lodError"][lod], &segment.lod_errors[lod] });
+		}
+
+		const glm::mat4& model = scene_node.world_transform;
+		float max_scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		world_spheres[i] = glm::vec4(glm::vec3(model * glm::vec4(mesh->sphere.center, 1.0f)), mesh->sphere.radius * max_scale);
+		world_obb_centers[i] = model * glm::vec4(mesh->obb.center, 1.0f);
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["sphere"], &world_spheres[i] });
+		ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["obbCenter"], &world_obb_centers[i] });
+		for (uint32_t axis = 0; axis < 3; ++axis) {
+			glm::vec4& half_axis = world_obb_half_axes[i * 3 + axis];
+			half_axis = model * glm::vec4(mesh->obb.axes[axis] * mesh->obb.half_extents[axis], 0.0f);
+			ssbo_writes[i].access_ctxs.push_back({ SSBOAccess()["obbHalfAxes"][axis], &half_axis });
+		}
+
+		if (_cpu) {
+			CpuCulling::Object& o = cpu_objects[i];
+			o.sphere = world_spheres[i];
+			o.obb_center = world_obb_centers[i];
+			for (uint32_t axis = 0; axis < 3; ++axis) {
+				o.obb_half_axes[axis] = world_obb_half_axes[i * 3 + axis];
+			}
+			o.bucket = bucket_id((uint32_t)PipelineVariant::All, (uint32_t)scene_refs[i].pipeline_variant, segment.index_width);
+			o.vertex_offset = segment.vertex_start;
+			o.lod_count = segment.lod_count;
+			for (uint32_t lod = 0; lod < MeshLod::max_lods; ++lod) {
+				o.lod_first_index[lod] = segment.lod_index_starts[lod];
+				o.lod_index_count[lod] = segment.lod_index_counts[lod];
+				o.lod_error[lod] = segment.lod_errors[lod] * max_scale;
+			}
+		}
 	}
 	obj_buf_ctx.ssbo_objects->write(ssbo_writes);
 
+	if (_cpu) {
+		obj_buf_ctx.cpu_culling.reset(new CpuCulling(cpu_objects, (uint32_t)_bucket_first_draws.size()));
+		for (uint32_t bucket = 0; bucket < _bucket_first_draws.size(); ++bucket) {
+			assert(obj_buf_ctx.cpu_culling->bucket_first_draw(bucket) == _bucket_first_draws[bucket]);
+		}
+	}
+
+	// buckets are sized by what they hold, the shaders find their commands through this
+	Std430AlignmentType BucketFirstDraw;
+	BucketFirstDraw.add(Std430AlignmentType::InlineType::Uint, "value");
+	obj_buf_ctx.ssbo_bucket_first_draws.reset(new SSBO(BucketFirstDraw, _bucket_first_draws.size()));
+	std::vector<SSBO::WriteContext> bucket_writes(_bucket_first_draws.size());
+	for (uint32_t i = 0; i < _bucket_first_draws.size(); ++i) {
+		bucket_writes[i].id = i;
+		bucket_writes[i].access_ctxs.push_back({ SSBOAccess()["value"], &_bucket_first_draws[i] });
+	}
+	obj_buf_ctx.ssbo_bucket_first_draws->write(bucket_writes);
+
 	obj_buf_ctx.desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::ComputeRead]);
 	obj_buf_ctx.desc_set->bind_buffer(0, obj_buf_ctx.ssbo_objects->_buf);
-	obj_buf_ctx.desc_set->bind_buffer(1, obj_buf_ctx.ssbo_aabbs->_buf);
+	if (!_meshlet_pipeline) {
+		// frustum_cull.comp
+		obj_buf_ctx.desc_set->bind_buffer(1, obj_buf_ctx.ssbo_bucket_first_draws->_buf);
+	}
+
+	if (_meshlet_pipeline) {
+		obj_buf_ctx.ssbo_meshlets = bindless_data->_mesh_preprocessor->meshlet_SSBO();
+
+		obj_buf_ctx.meshlet_desc_set = _desc_pool->allocate(_meshlet_pipeline->desc_set_layouts[DescriptorSetRate::ComputeRead]);
+		obj_buf_ctx.meshlet_desc_set->bind_buffer(0, obj_buf_ctx.ssbo_objects->_buf);
+		obj_buf_ctx.meshlet_desc_set->bind_buffer(1, obj_buf_ctx.ssbo_meshlets->_buf);
+		obj_buf_ctx.meshlet_desc_set->bind_buffer(2, obj_buf_ctx.ssbo_bucket_first_draws->_buf);
+	}
 
 	return obj_buf_ctx;
 }
@@ -69,6 +291,8 @@ SceneCulling::IndirectCommandContext SceneCulling::create_indirect_command_conte
 	std::shared_ptr<BindlessDataManager> bindless_data) {
 
 	IndirectCommandContext indirect_cmd_ctx;
+	uint32_t n_buckets = n_pipeline_variants * (uint32_t)IndexWidth::All;
+	assert(n_buckets == _bucket_first_draws.size());
 	
 	// draw command buffer does not need to be initialized
 	Std430AlignmentType DrawCommand;
@@ -77,68 +301,277 @@ SceneCulling::IndirectCommandContext SceneCulling::create_indirect_command_conte
 	DrawCommand.add(Std430AlignmentType::InlineType::Uint, "firstIndex");
 	DrawCommand.add(Std430AlignmentType::InlineType::Int, "vertexOffset");
 	DrawCommand.add(Std430AlignmentType::InlineType::Uint, "firstInstance");
-	indirect_cmd_ctx.ssbo_commands.reset(new SSBO(DrawCommand, _n_obj * n_pipeline_variants, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT));
+	indirect_cmd_ctx.ssbo_commands.reset(new SSBO(DrawCommand, std::max(_n_draws, 1u) * _n_views, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT));
+
+	// does not need to be initialized either. Only ranges covered by visible instances are read.
+	// One per command with meshlets, otherwise one range of the objects of each mesh per LOD. Either for every view
+	Std430AlignmentType InstanceId;
+	InstanceId.add(Std430AlignmentType::InlineType::Uint, "objId");
+	indirect_cmd_ctx.ssbo_instance_ids.reset(new SSBO(InstanceId, std::max(_meshlet_pipeline || _cpu ? _n_draws : _n_instances, 1u) * _n_views));
 
 	Std430AlignmentType DrawCount;
 	DrawCount.add(Std430AlignmentType::InlineType::Uint, "value");
-	indirect_cmd_ctx.ssbo_draw_count.reset(new SSBO(DrawCount, n_pipeline_variants, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT));
+	indirect_cmd_ctx.ssbo_draw_count.reset(new SSBO(DrawCount, n_buckets * _n_views, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT));
 
 	// initialize draw count buffer with 0. Also need to zero out every frame
-	std::vector<SSBO::WriteContext> draw_count_writes(n_pipeline_variants);
+	std::vector<SSBO::WriteContext> draw_count_writes(n_buckets * _n_views);
 	uint32_t zero_count = 0;
-	for (uint32_t i = 0; i < n_pipeline_variants; ++i) {
+	for (uint32_t i = 0; i < draw_count_writes.size(); ++i) {
 		draw_count_writes[i].id = i;
 		draw_count_writes[i].access_ctxs.push_back({ SSBOAccess()["value"], &zero_count });
 	}
 	indirect_cmd_ctx.ssbo_draw_count->write(draw_count_writes);
+
+	// nothing was visible before the first frame
+	Std430AlignmentType Visibility;
+	Visibility.add(Std430AlignmentType::InlineType::Uint, "visible");
+	indirect_cmd_ctx.ssbo_visibility.reset(new SSBO(Visibility, _n_obj));
+	std::vector<SSBO::WriteContext> visibility_writes(_n_obj);
+	uint32_t invisible = 0;
+	for (uint32_t i = 0; i < _n_obj; ++i) {
+		visibility_writes[i].id = i;
+		visibility_writes[i].access_ctxs.push_back({ SSBOAccess()["visible"], &invisible });
+	}
+	indirect_cmd_ctx.ssbo_visibility->write(visibility_writes);
+	
+	if (_cpu) {
+		// written by CpuCulling while recording and copied over. One per frame in flight, the GPU may still read the others
+		VkDeviceSize size = indirect_cmd_ctx.ssbo_commands->_buf->builder._info.size
+			+ indirect_cmd_ctx.ssbo_draw_count->_buf->builder._info.size
+			+ indirect_cmd_ctx.ssbo_instance_ids->_buf->builder._info.size;
+		for (uint32_t i = 0; i < _frame_ctxs.size(); ++i) {
+			otcv::BufferBuilder bb;
+			bb.size(size)
+				.usage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+				.host_access(otcv::BufferBuilder::Access::Coherent);
+			indirect_cmd_ctx.cpu_frames.emplace_back(new otcv::Buffer(bb));
+		}
+	}
 	
+	if (!_meshlet_pipeline) {
+		indirect_cmd_ctx.desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::ComputeWrite]);
+		indirect_cmd_ctx.desc_set->bind_buffer(0, indirect_cmd_ctx.ssbo_commands->_buf);
+		indirect_cmd_ctx.desc_set->bind_buffer(1, indirect_cmd_ctx.ssbo_draw_count->_buf);
+		indirect_cmd_ctx.desc_set->bind_buffer(2, indirect_cmd_ctx.ssbo_instance_ids->_buf);
+		indirect_cmd_ctx.desc_set->bind_buffer(3, indirect_cmd_ctx.ssbo_visibility->_buf);
+		return indirect_cmd_ctx;
+	}
+
+	// one per (object, view)
+	Std430AlignmentType VisibleObject;
+	VisibleObject.add(Std430AlignmentType::InlineType::Uint, "objId");
+	indirect_cmd_ctx.ssbo_visible_objects.reset(new SSBO(VisibleObject, _n_obj * _n_views));
+
+	// reset to (0, 1, 1) every frame
+	Std430AlignmentType DispatchCommand;
+	DispatchCommand.add(Std430AlignmentType::InlineType::Uint, "x");
+	DispatchCommand.add(Std430AlignmentType::InlineType::Uint, "y");
+	DispatchCommand.add(Std430AlignmentType::InlineType::Uint, "z");
+	indirect_cmd_ctx.ssbo_dispatch.reset(new SSBO(DispatchCommand, 1, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT));
+
 	indirect_cmd_ctx.desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::ComputeWrite]);
-	indirect_cmd_ctx.desc_set->bind_buffer(0, indirect_cmd_ctx.ssbo_commands->_buf);
-	indirect_cmd_ctx.desc_set->bind_buffer(1, indirect_cmd_ctx.ssbo_draw_count->_buf);
+	indirect_cmd_ctx.desc_set->bind_buffer(0, indirect_cmd_ctx.ssbo_visible_objects->_buf);
+	indirect_cmd_ctx.desc_set->bind_buffer(1, indirect_cmd_ctx.ssbo_dispatch->_buf);
+	indirect_cmd_ctx.desc_set->bind_buffer(2, indirect_cmd_ctx.ssbo_visibility->_buf);
+
+	indirect_cmd_ctx.meshlet_desc_set = _desc_pool->allocate(_meshlet_pipeline->desc_set_layouts[DescriptorSetRate::ComputeWrite]);
+	indirect_cmd_ctx.meshlet_desc_set->bind_buffer(0, indirect_cmd_ctx.ssbo_commands->_buf);
+	indirect_cmd_ctx.meshlet_desc_set->bind_buffer(1, indirect_cmd_ctx.ssbo_draw_count->_buf);
+	indirect_cmd_ctx.meshlet_desc_set->bind_buffer(2, indirect_cmd_ctx.ssbo_instance_ids->_buf);
+	indirect_cmd_ctx.meshlet_desc_set->bind_buffer(3, indirect_cmd_ctx.ssbo_visible_objects->_buf);
 
 	return indirect_cmd_ctx;
 }
 
-void SceneCulling::update(const glm::mat4& proj, const glm::mat4& view, uint32_t frame_id) {
-	// update frame ubo
-	// TODO: update frustum planes
-
-	FrustumUtils::Frustum f = FrustumUtils::view_frustum_vertices(glm::inverse(proj), glm::inverse(view));
-	glm::vec4 left = FrustumUtils::plane(f[0], f[4], f[5]);
-	glm::vec4 right = FrustumUtils::plane(f[2], f[6], f[7]);
-	glm::vec4 top = FrustumUtils::plane(f[3], f[7], f[4]);
-	glm::vec4 bottom = FrustumUtils::plane(f[1], f[5], f[6]);
-	glm::vec4 far = FrustumUtils::plane(f[5], f[4], f[7]);
-	glm::vec4 near = FrustumUtils::plane(f[0], f[1], f[2]);
-
-	_frame_ctxs[frame_id]._ubo->set(StaticUBOAccess()["frustum_faces"][0], &left);
-	_frame_ctxs[frame_id]._ubo->set(StaticUBOAccess()["frustum_faces"][1], &right);
-	_frame_ctxs[frame_id]._ubo->set(StaticUBOAccess()["frustum_faces"][2], &top);
-	_frame_ctxs[frame_id]._ubo->set(StaticUBOAccess()["frustum_faces"][3], &bottom);
-	_frame_ctxs[frame_id]._ubo->set(StaticUBOAccess()["frustum_faces"][4], &far);
-	_frame_ctxs[frame_id]._ubo->set(StaticUBOAccess()["frustum_faces"][5], &near);
+void SceneCulling::update(
+	uint32_t view_id,
+	const glm::mat4& proj,
+	const glm::mat4& view,
+	uint32_t viewport_height,
+	uint32_t frame_id,
+	bool front_face_culled) {
+
+	assert(view_id < _n_views);
+	FrameContext& ctx = _frame_ctxs[frame_id];
+
+	FrustumUtils::Planes planes = FrustumUtils::view_frustum_planes(glm::inverse(proj), glm::inverse(view));
+	set_cull_planes(view_id, frame_id, std::vector<glm::vec4>(planes.begin(), planes.end()));
+
+	// meshlet cone culling needs the eye, or only the view direction of orthographic projections
+	glm::mat4 view_inv = glm::inverse(view);
+	bool orthographic = proj[3][3] == 1.0f;
+	glm::vec4 view_origin = orthographic ? glm::vec4(-glm::normalize(glm::vec3(view_inv[2])), 0.0f) : view_inv[3];
+	float cone_culling = front_face_culled ? -1.0f : 1.0f;
+	ctx._ubo->set(StaticUBOAccess()["views"][view_id]["viewOrigin"], &view_origin);
+	ctx._ubo->set(StaticUBOAccess()["views"][view_id]["coneCulling"], &cone_culling);
+
+	// an error of e at distance d covers e / d * proj[1][1] * viewport_height / 2 pixels, without the division when orthographic
+	float lod_scale = std::abs(proj[1][1]) * viewport_height * 0.5f / _lod_error_pixels;
+	ctx._ubo->set(StaticUBOAccess()["views"][view_id]["lodScale"], &lod_scale);
+
+	// boxes are projected onto the depth pyramid for occlusion
+	if (view_id == 0) {
+		glm::mat4 view_proj = proj * view;
+		ctx._ubo->set(StaticUBOAccess()["viewProj"], &view_proj);
+	}
+
+	CpuCulling::View& cpu_view = ctx._cpu_views[view_id];
+	cpu_view.view_origin = view_origin;
+	cpu_view.lod_scale = lod_scale;
+}
+
+void SceneCulling::set_cull_planes(uint32_t view_id, uint32_t frame_id, const std::vector<glm::vec4>& planes) {
+	assert(view_id < _n_views);
+	assert(planes.size() <= max_planes);
+	FrameContext& ctx = _frame_ctxs[frame_id];
+	for (uint32_t i = 0; i < planes.size(); ++i) {
+		ctx._ubo->set(StaticUBOAccess()["views"][view_id]["frustum_faces"][i], &planes[i]);
+	}
+	uint32_t n_planes = (uint32_t)planes.size();
+	ctx._ubo->set(StaticUBOAccess()["views"][view_id]["nPlanes"], &n_planes);
+	ctx._cpu_views[view_id].planes = planes;
+}
+
+void SceneCulling::skip_view(uint32_t view_id, uint32_t frame_id) {
+	// every bounding volume is behind a plane infinitely far away
+	set_cull_planes(view_id, frame_id, { glm::vec4(0.0f, 0.0f, 0.0f, std::numeric_limits<float>::max()) });
+}
+
+static void memory_barrier(
+	otcv::CommandBuffer* cmd_buf,
+	VkPipelineStageFlags src_stage,
+	VkAccessFlags src_access,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access) {
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	vkCmdPipelineBarrier(cmd_buf->vk_command_buffer, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 }
 
 void SceneCulling::commands(
 	otcv::CommandBuffer* cmd_buf,
 	ObjectBufferContext in_context,
 	IndirectCommandContext out_context,
-	uint32_t frame_id) {
+	uint32_t frame_id,
+	OcclusionPhase phase) {
+
+	assert(phase == OcclusionPhase::None || _depth_pyramid);
 
 	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_draw_count->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::TransferDst);
 	cmd_buf->cmd_fill_buffer(out_context.ssbo_draw_count->_buf, 0);
 	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_draw_count->_buf, otcv::ResourceState::TransferDst, otcv::ResourceState::ComputeSSBOWrite);
 	
-	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::TransferDst);
-	cmd_buf->cmd_fill_buffer(out_context.ssbo_commands->_buf, 0);
-	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::TransferDst, otcv::ResourceState::ComputeSSBOWrite);
+	// instance ids are read as a storage buffer by vertex shaders, which ResourceState does not cover
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	// visibility written by the previous OcclusionPhase::Second
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
+	if (_cpu) {
+		cpu_commands(cmd_buf, in_context, out_context, frame_id, phase);
+		return;
+	}
+	else if (_meshlet_pipeline) {
+		meshlet_commands(cmd_buf, in_context, out_context, frame_id, phase);
+	}
+	else {
+		// commands of meshes without visible instances have to draw nothing
+		cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::TransferDst);
+		cmd_buf->cmd_fill_buffer(out_context.ssbo_commands->_buf, 0);
+		cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::TransferDst, otcv::ResourceState::ComputeSSBOWrite);
+
+		cmd_buf->cmd_bind_compute_pipeline(_pipeline);
+		cmd_buf->cmd_bind_descriptor_set(_pipeline, _frame_ctxs[frame_id]._desc_sets[(uint32_t)phase], DescriptorSetRate::PerFrame);
+		cmd_buf->cmd_bind_descriptor_set(_pipeline, in_context.desc_set, DescriptorSetRate::ComputeRead);
+		cmd_buf->cmd_bind_descriptor_set(_pipeline, out_context.desc_set, DescriptorSetRate::ComputeWrite);
+		cmd_buf->cmd_dispatch(otcv::calc_group_count(_n_obj, _compute_group_size), 1, 1);
+	}
+
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::IndirectRead);
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_draw_count->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::IndirectRead);
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void SceneCulling::meshlet_commands(
+	otcv::CommandBuffer* cmd_buf,
+	ObjectBufferContext in_context,
+	IndirectCommandContext out_context,
+	uint32_t frame_id,
+	OcclusionPhase phase) {
+
+	// dispatch of the meshlet pass back to (0, 1, 1). Last read by the previous frame's meshlet pass
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_dispatch->_buf, otcv::ResourceState::IndirectRead, otcv::ResourceState::TransferDst);
+	vkCmdFillBuffer(cmd_buf->vk_command_buffer, out_context.ssbo_dispatch->_buf->vk_buffer, 0, sizeof(uint32_t), 0);
+	vkCmdFillBuffer(cmd_buf->vk_command_buffer, out_context.ssbo_dispatch->_buf->vk_buffer, sizeof(uint32_t), 2 * sizeof(uint32_t), 1);
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_dispatch->_buf, otcv::ResourceState::TransferDst, otcv::ResourceState::ComputeSSBOWrite);
+
+	// objects inside the frustum, and unoccluded in the given phase
 	cmd_buf->cmd_bind_compute_pipeline(_pipeline);
-	cmd_buf->cmd_bind_descriptor_set(_pipeline, _frame_ctxs[frame_id]._desc_set, DescriptorSetRate::PerFrame);
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, _frame_ctxs[frame_id]._desc_sets[(uint32_t)phase], DescriptorSetRate::PerFrame);
 	cmd_buf->cmd_bind_descriptor_set(_pipeline, in_context.desc_set, DescriptorSetRate::ComputeRead);
 	cmd_buf->cmd_bind_descriptor_set(_pipeline, out_context.desc_set, DescriptorSetRate::ComputeWrite);
 	cmd_buf->cmd_dispatch(otcv::calc_group_count(_n_obj, _compute_group_size), 1, 1);
 
-	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::IndirectRead);
-	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_draw_count->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::IndirectRead);
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_dispatch->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::IndirectRead);
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	// their meshlets, one workgroup per object
+	cmd_buf->cmd_bind_compute_pipeline(_meshlet_pipeline);
+	cmd_buf->cmd_bind_descriptor_set(_meshlet_pipeline, _frame_ctxs[frame_id]._meshlet_desc_set, DescriptorSetRate::PerFrame);
+	cmd_buf->cmd_bind_descriptor_set(_meshlet_pipeline, in_context.meshlet_desc_set, DescriptorSetRate::ComputeRead);
+	cmd_buf->cmd_bind_descriptor_set(_meshlet_pipeline, out_context.meshlet_desc_set, DescriptorSetRate::ComputeWrite);
+	vkCmdDispatchIndirect(cmd_buf->vk_command_buffer, out_context.ssbo_dispatch->_buf->vk_buffer, 0);
+}
+
+void SceneCulling::cpu_commands(
+	otcv::CommandBuffer* cmd_buf,
+	ObjectBufferContext in_context,
+	IndirectCommandContext out_context,
+	uint32_t frame_id,
+	OcclusionPhase phase) {
+
+	// counts were zeroed like for the shaders. Instance ids were last read by vertex shaders
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::TransferDst);
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_draw_count->_buf, otcv::ResourceState::ComputeSSBOWrite, otcv::ResourceState::TransferDst);
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	// no occlusion on the CPU, the first phase draws everything in the frusta and the second nothing
+	if (phase != OcclusionPhase::Second) {
+		cpu_copy_commands(cmd_buf, in_context, out_context, frame_id);
+	}
+
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_commands->_buf, otcv::ResourceState::TransferDst, otcv::ResourceState::IndirectRead);
+	cmd_buf->cmd_buffer_memory_barrier(out_context.ssbo_draw_count->_buf, otcv::ResourceState::TransferDst, otcv::ResourceState::IndirectRead);
+	memory_barrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void SceneCulling::cpu_copy_commands(
+	otcv::CommandBuffer* cmd_buf,
+	ObjectBufferContext in_context,
+	IndirectCommandContext out_context,
+	uint32_t frame_id) {
+
+	// the instance ids go between the commands and the counts of the host buffer, which keeps all three 4 byte aligned
+	otcv::Buffer* host = out_context.cpu_frames[frame_id].get();
+	VkDeviceSize commands_size = out_context.ssbo_commands->_buf->builder._info.size;
+	VkDeviceSize instance_ids_size = out_context.ssbo_instance_ids->_buf->builder._info.size;
+	VkDeviceSize draw_count_size = out_context.ssbo_draw_count->_buf->builder._info.size;
+	uint8_t* mapped = static_cast<uint8_t*>(host->mapped);
+	in_context.cpu_culling->cull(
+		_frame_ctxs[frame_id]._cpu_views,
+		reinterpret_cast<CpuCulling::DrawCommand*>(mapped),
+		reinterpret_cast<uint32_t*>(mapped + commands_size + instance_ids_size),
+		reinterpret_cast<uint32_t*>(mapped + commands_size));
+
+	VkBufferCopy region{};
+	region.size = commands_size;
+	vkCmdCopyBuffer(cmd_buf->vk_command_buffer, host->vk_buffer, out_context.ssbo_commands->_buf->vk_buffer, 1, &region);
+	region.srcOffset = commands_size;
+	region.size = instance_ids_size;
+	vkCmdCopyBuffer(cmd_buf->vk_command_buffer, host->vk_buffer, out_context.ssbo_instance_ids->_buf->vk_buffer, 1, &region);
+	region.srcOffset = commands_size + instance_ids_size;
+	region.size = draw_count_size;
+	vkCmdCopyBuffer(cmd_buf->vk_command_buffer, host->vk_buffer, out_context.ssbo_draw_count->_buf->vk_buffer, 1, &region);
 }
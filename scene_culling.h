@@ -7,15 +7,36 @@
 #include "expandable_descriptor_pool.h"
 #include "camera.h"
 #include "bindless_data_manager.h"
+#include "depth_pyramid.h"
+#include "cpu_culling.h"
 
 
+// two-phase occlusion culling. The first phase draws what was visible last frame, the depth it leaves is reduced into
+// a DepthPyramid, and the second phase draws whatever else passes against that pyramid. Visibility carries over per object
+enum class OcclusionPhase : uint32_t {
+	None, // frustum only
+	First, // in the frustum and visible last frame
+	Second, // in the frustum, not occluded and not drawn by First. Records the visibility of next frame's First
+	All
+};
+
 class SceneCulling {
 public:
+	// MAX_VIEWS and MAX_PLANES of the culling shaders
+	static const uint32_t max_views = 8;
+	static const uint32_t max_planes = 16;
+	// LAYER_MASK_SHIFT of the culling shaders. Instance ids of layered views hold the object id below it and the mask
+	// of the layers the instance is drawn into above it
+	static const uint32_t layer_mask_shift = 24;
+
+	// n_views: every object is loaded once and tested against all views (e.g. the camera and the shadow cascades) in
+	// the same dispatch. Each view has its own commands, draw counts and instance ids. Only view 0 is occlusion culled
 	SceneCulling(
 		const std::string& shader_path,
 		const SceneGraph& scene,
 		const SceneGraphFlatRefs& scene_refs,
-		uint32_t _in_flight_frames);
+		uint32_t _in_flight_frames,
+		uint32_t n_views = 1);
 
 	~SceneCulling();
 
@@ -24,7 +45,13 @@ public:
 	struct ObjectBufferContext {
 		otcv::DescriptorSet* desc_set;
 		std::shared_ptr<SSBO> ssbo_objects;
-		std::shared_ptr<SSBO> ssbo_aabbs;
+		// meshlet culling only
+		otcv::DescriptorSet* meshlet_desc_set = nullptr;
+		std::shared_ptr<SSBO> ssbo_meshlets;
+		// GPU culling only
+		std::shared_ptr<SSBO> ssbo_bucket_first_draws;
+		// CPU culling only
+		std::shared_ptr<CpuCulling> cpu_culling;
 	};
 	ObjectBufferContext create_object_buffer_context(
 		const SceneGraph& scene,
@@ -35,30 +62,116 @@ public:
 		otcv::DescriptorSet* desc_set;
 		std::shared_ptr<SSBO> ssbo_commands;
 		std::shared_ptr<SSBO> ssbo_draw_count;
+		std::shared_ptr<SSBO> ssbo_instance_ids; // object id of each visible instance. read by vertex shaders via gl_InstanceIndex
+		std::shared_ptr<SSBO> ssbo_visibility; // one per object, kept across frames by OcclusionPhase::Second
+		// meshlet culling only. Objects inside the frustum and the indirect dispatch of the meshlet pass over them
+		otcv::DescriptorSet* meshlet_desc_set = nullptr;
+		std::shared_ptr<SSBO> ssbo_visible_objects;
+		std::shared_ptr<SSBO> ssbo_dispatch;
+		// CPU culling only. Host visible, one per frame in flight: commands, instance ids, draw counts
+		std::vector<std::shared_ptr<otcv::Buffer>> cpu_frames;
 	};
+	// one bucket of commands and one draw count for each (view, pipeline variant, index width)
 	IndirectCommandContext create_indirect_command_context(
 		uint32_t n_pipeline_variants,
 		std::shared_ptr<BindlessDataManager> bindless_data);
 
-	void update(const glm::mat4& proj, const glm::mat4& view, uint32_t frame_id);
+	static uint32_t bucket_id(uint32_t n_pipeline_variants, uint32_t pipeline_variant, IndexWidth index_width) {
+		return n_pipeline_variants * (uint32_t)index_width + pipeline_variant;
+	}
+
+	// commands of a bucket in IndirectCommandContext::ssbo_commands. One slot per LOD of each mesh in it, per object with
+	// SCENE_CULLING_CPU, or per meshlet with SCENE_CULLING_MESHLETS
+	uint32_t bucket_first_draw(uint32_t bucket, uint32_t view = 0) const { return view * _n_draws + _bucket_first_draws[bucket]; }
+	uint32_t bucket_max_draws(uint32_t bucket) const { return _bucket_max_draws[bucket]; }
+	// of a bucket in IndirectCommandContext::ssbo_draw_count
+	uint32_t draw_count_id(uint32_t bucket, uint32_t view = 0) const { return view * (uint32_t)_bucket_first_draws.size() + bucket; }
+	uint32_t n_views() const { return _n_views; }
+
+	// viewport_height in pixels, LODs are picked per view so that their error stays within _lod_error_pixels.
+	// front_face_culled: the view draws back faces only (shadow maps), so meshlets facing it entirely are culled
+	// instead of those facing away from it
+	void update(
+		uint32_t view_id,
+		const glm::mat4& proj,
+		const glm::mat4& view,
+		uint32_t viewport_height,
+		uint32_t frame_id,
+		bool front_face_culled = false);
+
+	// replaces the frustum planes of the last update, e.g. by the volume of everything casting into a shadow cascade.
+	// Normals point out, at most max_planes. Call after update
+	void set_cull_planes(uint32_t view_id, uint32_t frame_id, const std::vector<glm::vec4>& planes);
+
+	// nothing is visible in the view this frame, e.g. a shadow cascade drawn in an earlier frame. Until the next update
+	void skip_view(uint32_t view_id, uint32_t frame_id);
 
+	// the views first_view onwards are drawn as the n_layers layers of one pass, e.g. shadow cascades into an array.
+	// Whatever is visible in any of them gets one command in first_view, drawn n_layers times as many instances:
+	// gl_InstanceIndex / n_layers indexes its instance id, whose layer mask tells which of the layers
+	// gl_InstanceIndex % n_layers it belongs in. The later views get no commands. Not view 0. Set before recording any commands
+	void layer_views(uint32_t first_view, uint32_t n_layers);
+
+	// the depth pyramid tested against by OcclusionPhase::Second. Set before recording any commands
+	void set_depth_pyramid(std::shared_ptr<DepthPyramid> depth_pyramid);
+
+	// phases other than None need a depth pyramid, built between First and Second.
+	// Views other than 0 are culled by None and First, Second leaves them empty
 	void commands(
 		otcv::CommandBuffer* cmd_buf,
 		ObjectBufferContext in_context,
 		IndirectCommandContext out_context,
-		uint32_t frame_id);
+		uint32_t frame_id,
+		OcclusionPhase phase = OcclusionPhase::None);
 
 private:
+	void meshlet_commands(
+		otcv::CommandBuffer* cmd_buf,
+		ObjectBufferContext in_context,
+		IndirectCommandContext out_context,
+		uint32_t frame_id,
+		OcclusionPhase phase);
+
+	// CpuCulling writes to the host buffer of the frame, which is copied to the buffers of the draws
+	void cpu_commands(
+		otcv::CommandBuffer* cmd_buf,
+		ObjectBufferContext in_context,
+		IndirectCommandContext out_context,
+		uint32_t frame_id,
+		OcclusionPhase phase);
+
+	void cpu_copy_commands(
+		otcv::CommandBuffer* cmd_buf,
+		ObjectBufferContext in_context,
+		IndirectCommandContext out_context,
+		uint32_t frame_id);
+
+	// frustum_cull.comp, or object_cull.comp followed by meshlet_cull.comp. Layouts only when culling on the CPU
 	otcv::ComputePipeline* _pipeline;
+	otcv::ComputePipeline* _meshlet_pipeline = nullptr;
 	otcv::ShaderBlob _shader_blob;
 	std::shared_ptr<NaiveExpandableDescriptorPool> _desc_pool;
 
 	struct FrameContext {
-		otcv::DescriptorSet* _desc_set; // set 0, updated per frame
+		otcv::DescriptorSet* _desc_sets[(uint32_t)OcclusionPhase::All]; // set 0, updated per frame
+		otcv::DescriptorSet* _meshlet_desc_set = nullptr;
 		std::shared_ptr<StaticUBO> _ubo;
+		std::vector<CpuCulling::View> _cpu_views;
 	};
 	std::vector<FrameContext> _frame_ctxs;
+	std::shared_ptr<StaticUBO> _phase_ubos[(uint32_t)OcclusionPhase::All];
+
+	// stands in for the pyramid until one is set
+	std::shared_ptr<SSBO> _placeholder_pyramid;
+	std::shared_ptr<DepthPyramid> _depth_pyramid;
 
 	uint32_t _n_obj;
+	uint32_t _n_views;
+	bool _cpu = false; // SCENE_CULLING_CPU
+	std::vector<uint32_t> _bucket_first_draws;
+	std::vector<uint32_t> _bucket_max_draws;
+	uint32_t _n_draws; // per view
+	uint32_t _n_instances = 0; // instance ids per view, instanced frustum culling only
 	const uint32_t _compute_group_size = 64;
+	const float _lod_error_pixels = 1.0f;
 };
\ No newline at end of file
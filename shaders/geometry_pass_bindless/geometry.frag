@@ -39,6 +39,19 @@ layout(set = 2, binding = 0) uniform MaterialUBO {
 
 layout(set = 2, binding = 1) uniform texture2D textures[];
 layout(set = 2, binding = 2) uniform sampler samplers[];
+// finest mip level of each image that has been streamed in so far
+layout(set = 2, binding = 3) readonly buffer ImageMinLod {
+	float imageMinLod[];
+};
+
+vec4 sampleTexture(int imageId, int samplerId, vec2 uv) {
+	float minLod = imageMinLod[imageId];
+	if (minLod > 0.0f) {
+		float lod = textureQueryLod(sampler2D(textures[nonuniformEXT(imageId)], samplers[nonuniformEXT(samplerId)]), uv).y;
+		return textureLod(sampler2D(textures[nonuniformEXT(imageId)], samplers[nonuniformEXT(samplerId)]), uv, max(lod, minLod));
+	}
+	return texture(sampler2D(textures[nonuniformEXT(imageId)], samplers[nonuniformEXT(samplerId)]), uv);
+}
 
 void main() {
 	if (inMaterialId < 0) {
@@ -52,11 +65,7 @@ void main() {
 
     vec4 albedo = vec4(1.0f);
     if (texIds.baseColorId >= 0 && samplerIds.baseColorId >= 0) {
-		// vec4 color = texture(sampler2D(u_textures[i], u_sampler), uv);
-        albedo = texture(sampler2D(
-			textures[nonuniformEXT(texIds.baseColorId)],
-			samplers[nonuniformEXT(samplerIds.baseColorId)]),
-			inUV);
+        albedo = sampleTexture(texIds.baseColorId, samplerIds.baseColorId, inUV);
     }
 	albedo = albedo * cfg.baseColorFactor;
 	if (cfg.alphaMode == 1 && albedo.w < cfg.alphaCutoff) {
@@ -74,10 +83,10 @@ void main() {
 	    vec3 t = normalize(inWorldTangent.xyz);
 	    vec3 b = cross(n, t) * inWorldTangent.w;
 	    mat3 tbn = mat3(t, b, n);
-	    vec3 tbnCoord = texture(sampler2D(
-			textures[nonuniformEXT(texIds.normalId)],
-			samplers[nonuniformEXT(samplerIds.normalId)]),
-			inUV).xyz * 2.0 - 1.0;
+	    // z is rebuilt from xy so that two channel (BC5) normal maps work too
+	    vec3 tbnCoord;
+	    tbnCoord.xy = sampleTexture(texIds.normalId, samplerIds.normalId, inUV).xy * 2.0 - 1.0;
+	    tbnCoord.z = sqrt(max(1.0 - dot(tbnCoord.xy, tbnCoord.xy), 0.0));
 	    tbnCoord.xy *= vec2(normalScale);
 	    tbnCoord = normalize(tbnCoord);
 	    worldNormal = normalize(tbn * tbnCoord);
@@ -90,10 +99,8 @@ void main() {
 	outNormal = vec4(worldNormal, 1.0f);
 
     if (texIds.metallicRoughnessId >= 0 && samplerIds.metallicRoughnessId >= 0) {
-	    outMetallicRoughness = texture(sampler2D(
-			textures[nonuniformEXT(texIds.metallicRoughnessId)],
-			samplers[nonuniformEXT(samplerIds.metallicRoughnessId)]),
-			inUV) * vec4(metallicFactor, roughnessFactor, 0.0f, 0.0f);
+	    outMetallicRoughness = sampleTexture(texIds.metallicRoughnessId, samplerIds.metallicRoughnessId, inUV)
+			* vec4(metallicFactor, roughnessFactor, 0.0f, 0.0f);
     } else {
 		outMetallicRoughness = vec4(metallicFactor, roughnessFactor, 0.0f, 0.0f);
     }
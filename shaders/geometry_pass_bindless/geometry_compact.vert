@@ -0,0 +1,56 @@
+#version 460 // gl_InstanceIndex includes firstInstance https://www.khronos.org/opengl/wiki/Vertex_Shader/Defined_Inputs
+#extension GL_EXT_nonuniform_qualifier : require
+
+// VertexLayout::Compact, see VertexPacking
+layout(location = 0) in vec4 inPosition; // unorm16, xyz within the mesh AABB. w holds the high bytes of the uv
+layout(location = 1) in vec4 inTangentFrame; // snorm16 quaternion, sign of w is the bitangent sign
+layout(location = 2) in vec2 inUV; // unorm16, low 16 bits of the 24 bit uv within the mesh UV bounds, see VertexPacking::pack_uvs
+
+layout(location = 0) out vec3 outWorldNormal;
+layout(location = 1) out vec2 outUV;
+layout(location = 2) out vec4 outWorldTangent;
+layout(location = 3) flat out int outMaterialId;
+
+layout(set = 0, binding = 0) uniform FrameUBO {
+	mat4 projectView;
+} fUbo;
+
+layout(std430, set = 0, binding = 1) readonly buffer InstanceBuffer {
+    uint instanceObjIds[]; // written by frustum_cull.comp
+};
+
+layout(set = 1, binding = 0) uniform ObjectUBO {
+    mat4 model;
+    int matId;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform; // offset xy, scale zw
+} oUbos[];
+
+void main() {
+	uint objId = instanceObjIds[gl_InstanceIndex];
+
+	mat4 objModelMat = oUbos[nonuniformEXT(objId)].model;
+	vec3 position = oUbos[nonuniformEXT(objId)].positionOffset.xyz + oUbos[nonuniformEXT(objId)].positionScale.xyz * inPosition.xyz;
+	gl_Position = fUbo.projectView * objModelMat * vec4(position, 1.0f);
+
+	vec4 q = normalize(inTangentFrame);
+	vec3 normal = vec3(
+		2.0f * (q.x * q.z + q.w * q.y),
+		2.0f * (q.y * q.z - q.w * q.x),
+		1.0f - 2.0f * (q.x * q.x + q.y * q.y));
+	vec3 tangent = vec3(
+		1.0f - 2.0f * (q.y * q.y + q.z * q.z),
+		2.0f * (q.x * q.y + q.w * q.z),
+		2.0f * (q.x * q.z - q.w * q.y));
+	float bitangentSign = q.w < 0.0f ? -1.0f : 1.0f;
+
+	outWorldNormal = normalize(inverse(transpose(mat3(objModelMat))) * normal);
+	vec4 uvTransform = oUbos[nonuniformEXT(objId)].uvTransform;
+	uint uvHigh = uint(round(inPosition.w * 65535.0f));
+	vec2 uv24 = vec2(uvHigh & 0xFFu, uvHigh >> 8) * 65536.0f + round(inUV * 65535.0f);
+	outUV = uvTransform.xy + uvTransform.zw * (uv24 / 16777215.0f);
+	vec3 worldTangent = normalize(mat3(objModelMat) * tangent);
+	outWorldTangent = vec4(worldTangent, bitangentSign);
+	outMaterialId = oUbos[nonuniformEXT(objId)].matId;
+}
@@ -26,6 +26,7 @@ struct Shadow {
     float cascadeBlendDepth;
     uint nCascades;
     uint cascadeResolution;
+    uint filter; // 0 -- jittered PCF on depths, 1 -- EVSM moments (ShadowFilter) in samplerCascadedShadow
     Cascade cascades[MAX_CASCADE_COUNT];
 };
 
@@ -117,6 +118,47 @@ float blocker_receiver_distance(
     return abs(lightSpaceBlockerCoord.z - lightSpaceCoord.z);
 }
 
+// must match ShadowFilter::exponents and shadow_filter/evsm_moments.frag
+const vec2 EVSM_EXPONENTS = vec2(5.54f, 5.54f);
+
+float chebyshev_upper_bound(vec2 moments, float mean, float minVariance) {
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float pMax = variance / (variance + d * d);
+    // light bleeding reduction: cut off the low tail of the bound
+    pMax = clamp((pMax - 0.2f) / (1.0f - 0.2f), 0.0f, 1.0f);
+    return mean <= moments.x ? 1.0f : pMax;
+}
+
+float evsm_shadow_factor(
+    uint targetCascade,
+    vec4 lightSpaceCoord,
+    mat4 lightProject,
+    vec3 normal,
+    vec3 lightDir) {
+
+    vec4 lightClipSpaceCoord = lightProject * lightSpaceCoord;
+    vec4 lightSpaceNDC = lightClipSpaceCoord * vec4(1.0f / lightClipSpaceCoord.w);
+    vec2 shadowUV = (lightSpaceNDC.xy + vec2(1.0f)) * vec2(0.5f);
+
+    float cosTheta = dot(normal, lightDir);
+    if (cosTheta <= 0.0f) {
+        return 0.0f;
+    }
+
+    // moments are filtered, so no depth bias is needed. Only a minimum variance against acne
+    vec4 moments = texture(samplerCascadedShadow, vec3(shadowUV, targetCascade));
+    float depth = lightSpaceNDC.z * 2.0f - 1.0f;
+    float pos = exp(EVSM_EXPONENTS.x * depth);
+    float neg = -exp(-EVSM_EXPONENTS.y * depth);
+
+    vec2 depthScale = 0.0001f * EVSM_EXPONENTS * vec2(pos, -neg);
+    vec2 minVariance = depthScale * depthScale;
+    float posFactor = chebyshev_upper_bound(moments.xy, pos, minVariance.x);
+    float negFactor = chebyshev_upper_bound(moments.zw, neg, minVariance.y);
+    return min(posFactor, negFactor);
+}
+
 bool uv_out_of_bound(vec2 uv) {
     return any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0)));
 }
@@ -226,6 +268,34 @@ float pcss_shadow_factor(
 }
 
 
+float cascade_shadow_factor(
+    uint targetCascade,
+    vec4 lightSpaceCoord,
+    mat4 lightProject,
+    vec3 normal,
+    vec3 lightDir) {
+
+    // the last cascade is selected beyond what its map was drawn for
+    vec4 lightClipSpaceCoord = lightProject * lightSpaceCoord;
+    vec3 lightSpaceNDC = lightClipSpaceCoord.xyz / lightClipSpaceCoord.w;
+    if (uv_out_of_bound((lightSpaceNDC.xy + vec2(1.0f)) * vec2(0.5f)) || lightSpaceNDC.z > 1.0f) {
+        return 1.0f;
+    }
+
+    if (fUbo.shadow.filter == 1) {
+        return evsm_shadow_factor(targetCascade, lightSpaceCoord, lightProject, normal, lightDir);
+    }
+    return pcf_shadow_factor(
+        targetCascade,
+        lightSpaceCoord,
+        lightProject,
+        normal,
+        lightDir,
+        fUbo.shadow.nJitterStrataPerDim,
+        fUbo.shadow.nJitterTiles,
+        fUbo.shadow.jitterRadius);
+}
+
 void main() {
     // world position
     float depth = texture(samplerDepth, inUV).r;
@@ -248,15 +318,12 @@ void main() {
     }
 
     vec4 lightSpaceCoord0 = fUbo.shadow.cascades[targetCascade].lightSpaceView * worldSpaceCoord;
-    float shadowFactor0 = pcf_shadow_factor(
+    float shadowFactor0 = cascade_shadow_factor(
                             targetCascade,
                             lightSpaceCoord0,
                             fUbo.shadow.cascades[targetCascade].lightSpaceProject,
                             normal,
-                            -normalize(fUbo.light.direction),
-                            fUbo.shadow.nJitterStrataPerDim,
-                            fUbo.shadow.nJitterTiles,
-                            fUbo.shadow.jitterRadius);
+                            -normalize(fUbo.light.direction));
 
     float shadowFactor = shadowFactor0;
     // check if cascade blending is required
@@ -264,15 +331,12 @@ void main() {
         targetCascade < fUbo.shadow.nCascades - 1) {
 
 		vec4 lightSpaceCoord1 = fUbo.shadow.cascades[targetCascade + 1].lightSpaceView * worldSpaceCoord;
-        float shadowFactor1 = pcf_shadow_factor(
+        float shadowFactor1 = cascade_shadow_factor(
                             targetCascade + 1,
                             lightSpaceCoord1,
                             fUbo.shadow.cascades[targetCascade + 1].lightSpaceProject,
                             normal,
-                            -normalize(fUbo.light.direction),
-                            fUbo.shadow.nJitterStrataPerDim,
-                            fUbo.shadow.nJitterTiles,
-                            fUbo.shadow.jitterRadius);
+                            -normalize(fUbo.light.direction));
         float blendFactor = clamp(1.0f - (fUbo.shadow.cascades[targetCascade].zEnd - zView) / fUbo.shadow.cascadeBlendDepth, 0.0f, 1.0f);
         shadowFactor = mix(shadowFactor0, shadowFactor1, smoothstep(0.0f, 1.0f, blendFactor));
     }
@@ -0,0 +1,23 @@
+#version 450
+
+// second half of the separable blur of evsm_moments.frag, vertically into the layer being filtered
+
+layout(location = 0) in vec2 inUV;
+
+layout(location = 0) out vec4 outMoments;
+
+layout(set = 0, binding = 0) uniform sampler2D samplerMoments;
+
+const int BLUR_RADIUS = 4;
+const float BLUR_WEIGHTS[BLUR_RADIUS + 1] = float[](0.2042f, 0.1802f, 0.1238f, 0.0663f, 0.0276f); // gaussian, sigma 2
+
+void main() {
+    ivec2 size = textureSize(samplerMoments, 0);
+    ivec2 texel = ivec2(inUV * vec2(size));
+    vec4 sum = vec4(0.0f);
+    for (int i = -BLUR_RADIUS; i <= BLUR_RADIUS; ++i) {
+        ivec2 p = ivec2(texel.x, clamp(texel.y + i, 0, size.y - 1));
+        sum += BLUR_WEIGHTS[abs(i)] * texelFetch(samplerMoments, p, 0);
+    }
+    outMoments = sum;
+}
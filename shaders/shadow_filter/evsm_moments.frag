@@ -0,0 +1,50 @@
+#version 450
+
+// first half of the separable blur, see ShadowFilter. Depths of one shadowmap layer are warped into exponential
+// variance moments, averaged over 2x2 texels into the half resolution target and blurred horizontally.
+// Moments are linear, so they average, blur and mip like colors
+
+layout(location = 0) in vec2 inUV;
+
+layout(location = 0) out vec4 outMoments;
+
+layout(set = 0, binding = 0) uniform UBO {
+    uint layer;
+} Ubo;
+
+layout(set = 0, binding = 1) uniform sampler2DArray samplerShadow;
+
+const vec2 EVSM_EXPONENTS = vec2(5.54f, 5.54f); // ShadowFilter::exponents, positive and negative
+const int BLUR_RADIUS = 4;
+const float BLUR_WEIGHTS[BLUR_RADIUS + 1] = float[](0.2042f, 0.1802f, 0.1238f, 0.0663f, 0.0276f); // gaussian, sigma 2
+
+vec4 moments(float depth) {
+    depth = depth * 2.0f - 1.0f;
+    float pos = exp(EVSM_EXPONENTS.x * depth);
+    float neg = -exp(-EVSM_EXPONENTS.y * depth);
+    return vec4(pos, pos * pos, neg, neg * neg);
+}
+
+// of the 2x2 shadowmap texels under a target texel
+vec4 averaged_moments(ivec2 texel, ivec2 shadowSize) {
+    vec4 sum = vec4(0.0f);
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            ivec2 p = min(texel * 2 + ivec2(x, y), shadowSize - 1);
+            sum += moments(texelFetch(samplerShadow, ivec3(p, Ubo.layer), 0).r);
+        }
+    }
+    return 0.25f * sum;
+}
+
+void main() {
+    ivec2 shadowSize = textureSize(samplerShadow, 0).xy;
+    ivec2 size = max(shadowSize / 2, ivec2(1));
+    ivec2 texel = ivec2(inUV * vec2(size));
+    vec4 sum = vec4(0.0f);
+    for (int i = -BLUR_RADIUS; i <= BLUR_RADIUS; ++i) {
+        ivec2 p = ivec2(clamp(texel.x + i, 0, size.x - 1), texel.y);
+        sum += BLUR_WEIGHTS[abs(i)] * averaged_moments(p, shadowSize);
+    }
+    outMoments = sum;
+}
@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec2 inUV;
+
+layout(location = 0) out vec2 outUV;
+
+void main() {
+	gl_Position = vec4(inPosition, 1.0f);
+	outUV = inUV;
+}
\ No newline at end of file
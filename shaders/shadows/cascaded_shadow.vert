@@ -1,21 +1,28 @@
-#version 460 // to support gl_BaseInstance https://www.khronos.org/opengl/wiki/Vertex_Shader/Defined_Inputs
+#version 460 // gl_InstanceIndex includes firstInstance https://www.khronos.org/opengl/wiki/Vertex_Shader/Defined_Inputs
 #extension GL_EXT_nonuniform_qualifier : require
 
 #define MAX_CASCADES 4
 
-layout(location = 0) in vec3 inPosition;
+layout(location = 0) in vec3 inPosition; // float or unorm16 depending on the VertexLayout
 
 layout(set = 0, binding = 0) uniform FrameUBO {
 	mat4 projectView;
 } fUbo;
 
+layout(std430, set = 0, binding = 1) readonly buffer InstanceBuffer {
+    uint instanceObjIds[]; // written by frustum_cull.comp
+};
+
 layout(set = 1, binding = 0) uniform ObjectUBO {
     mat4 model;
     int matId;
+    vec4 positionOffset;
+    vec4 positionScale;
 } oUbos[];
 
 void main() {
-	uint objId = gl_BaseInstance;
+	uint objId = instanceObjIds[gl_InstanceIndex];
 	mat4 objModelMat = oUbos[nonuniformEXT(objId)].model;
-	gl_Position = fUbo.projectView * objModelMat * vec4(inPosition, 1.0f);
+	vec3 position = oUbos[nonuniformEXT(objId)].positionOffset.xyz + oUbos[nonuniformEXT(objId)].positionScale.xyz * inPosition;
+	gl_Position = fUbo.projectView * objModelMat * vec4(position, 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#version 460 // gl_InstanceIndex includes firstInstance https://www.khronos.org/opengl/wiki/Vertex_Shader/Defined_Inputs
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_ARB_shader_viewport_layer_array : require // shaderOutputLayer
+
+// cascaded_shadow.vert for all cascades in one pass over the whole shadowmap array, see SHADOW_LAYERED_CASCADES.
+// Every command is instanced once per layer, the instance id holds the layers its object is visible in, see SceneCulling::layer_views
+
+#define MAX_LAYERS 8 // SceneCulling::max_views
+#define LAYER_MASK_SHIFT 24 // SceneCulling::layer_mask_shift
+
+layout(location = 0) in vec3 inPosition; // float or unorm16 depending on the VertexLayout
+
+layout(set = 0, binding = 0) uniform FrameUBO {
+	mat4 projectViews[MAX_LAYERS]; // of each cascade
+	uint nLayers;
+} fUbo;
+
+layout(std430, set = 0, binding = 1) readonly buffer InstanceBuffer {
+    uint instanceObjIds[]; // written by frustum_cull.comp, one per nLayers instances
+};
+
+layout(set = 1, binding = 0) uniform ObjectUBO {
+    mat4 model;
+    int matId;
+    vec4 positionOffset;
+    vec4 positionScale;
+} oUbos[];
+
+void main() {
+	uint layer = uint(gl_InstanceIndex) % fUbo.nLayers;
+	uint instance = instanceObjIds[uint(gl_InstanceIndex) / fUbo.nLayers];
+	uint objId = instance & ((1u << LAYER_MASK_SHIFT) - 1u);
+	gl_Layer = int(layer);
+	if (((instance >> (LAYER_MASK_SHIFT + layer)) & 1u) == 0u) {
+		// culled in this layer, every vertex on the same point outside the clip volume makes the triangles degenerate
+		gl_Position = vec4(2.0f, 2.0f, 2.0f, 1.0f);
+		return;
+	}
+	mat4 objModelMat = oUbos[nonuniformEXT(objId)].model;
+	vec3 position = oUbos[nonuniformEXT(objId)].positionOffset.xyz + oUbos[nonuniformEXT(objId)].positionScale.xyz * inPosition;
+	gl_Position = fUbo.projectViews[layer] * objModelMat * vec4(position, 1.0f);
+}
\ No newline at end of file
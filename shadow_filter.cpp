@@ -0,0 +1,197 @@
+#include "shadow_filter.h"
+
+#include <algorithm>
+
+ShadowFilter::ShadowFilter(const std::string& shader_path, otcv::Image* shadowmap) {
+	_shadowmap = shadowmap;
+	// each moment texel averages 2x2 shadowmap texels, see evsm_moments.frag
+	uint32_t width = std::max(shadowmap->builder._image_info.extent.width / 2, 1u);
+	uint32_t height = std::max(shadowmap->builder._image_info.extent.height / 2, 1u);
+	uint32_t n_layers = shadowmap->builder._image_info.arrayLayers;
+
+	_moments = otcv::ImageBuilder()
+		.size(width, height, 1)
+		.format(_format)
+		.layers(n_layers)
+		.usage(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+		.view_type(VK_IMAGE_VIEW_TYPE_2D_ARRAY)
+		.enable_mips()
+		.build();
+	_moments->initialize_state(otcv::ResourceState::FragSample);
+	_blurred_rows = otcv::ImageBuilder()
+		.size(width, height, 1)
+		.format(_format)
+		.usage(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
+		.build();
+	_blurred_rows->initialize_state(otcv::ResourceState::ColorAttachment);
+
+	// texel fetches only
+	_shadowmap_sampler = otcv::SamplerBuilder()
+		.filter(VK_FILTER_NEAREST, VK_FILTER_NEAREST)
+		.build();
+	_blurred_rows_sampler = otcv::SamplerBuilder()
+		.filter(VK_FILTER_NEAREST, VK_FILTER_NEAREST)
+		.build();
+	_moments_sampler = otcv::SamplerBuilder()
+		.filter(VK_FILTER_LINEAR, VK_FILTER_LINEAR)
+		.address_mode(VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE)
+		.build();
+
+	_shader_blob = std::move(otcv::load_shaders_from_dir(shader_path));
+	_screen_quad = otcv::screen_quad_ndc();
+	auto build_pipeline = [this](const std::string& fragment_shader) -> otcv::GraphicsPipeline* {
+		otcv::GraphicsPipelineBuilder pipeline_builder;
+		pipeline_builder.pipline_rendering()
+			.add_color_attachment_format(_format)
+			.end()
+			.shader_vertex(_shader_blob["screen_quad.vert"])
+			.shader_fragment(_shader_blob[fragment_shader])
+			.vertex_state(_screen_quad->builder)
+			.add_dynamic_state(VK_DYNAMIC_STATE_VIEWPORT)
+			.add_dynamic_state(VK_DYNAMIC_STATE_SCISSOR);
+		return pipeline_builder.build();
+	};
+	_moments_pipeline = build_pipeline("evsm_moments.frag");
+	_blur_pipeline = build_pipeline("evsm_blur.frag");
+
+	_desc_pool.reset(new NaiveExpandableDescriptorPool());
+	for (uint32_t layer = 0; layer < n_layers; ++layer) {
+		Std140AlignmentType UBO;
+		UBO.add(Std140AlignmentType::InlineType::Uint, "layer");
+		std::shared_ptr<StaticUBO> ubo(new StaticUBO(UBO));
+		ubo->set(StaticUBOAccess()["layer"], &layer);
+		_layer_ubos.push_back(ubo);
+
+		otcv::DescriptorSet* desc_set = _desc_pool->allocate(_moments_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
+		desc_set->bind_buffer(0, ubo->_buf);
+		desc_set->bind_image_sampler(1, &_shadowmap, &_shadowmap_sampler);
+		_layer_desc_sets.push_back(desc_set);
+	}
+	_blur_desc_set = _desc_pool->allocate(_blur_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
+	_blur_desc_set->bind_image_sampler(0, &_blurred_rows, &_blurred_rows_sampler);
+}
+
+ShadowFilter::~ShadowFilter() {
+
+}
+
+void ShadowFilter::commands(otcv::CommandBuffer* cmd_buf, const std::vector<uint32_t>& layers) {
+	if (layers.empty()) {
+		return;
+	}
+	uint32_t width = _moments->builder._image_info.extent.width;
+	uint32_t height = _moments->builder._image_info.extent.height;
+
+	auto full_screen_pass = [&](VkImageView target, otcv::GraphicsPipeline* pipeline, otcv::DescriptorSet* desc_set) {
+		otcv::RenderingBegin pass_begin;
+		pass_begin
+			.area(width, height)
+			.color_attachment()
+			.image_view(target)
+			.image_layout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+			.load_store(VK_ATTACHMENT_LOAD_OP_DONT_CARE, VK_ATTACHMENT_STORE_OP_STORE)
+			.end();
+		cmd_buf->cmd_begin_rendering(pass_begin);
+		cmd_buf->cmd_set_viewport(width, height);
+		cmd_buf->cmd_set_scissor(width, height);
+		cmd_buf->cmd_bind_graphics_pipeline(pipeline);
+		cmd_buf->cmd_bind_descriptor_set(pipeline, desc_set);
+		cmd_buf->cmd_bind_vertex_buffer(_screen_quad);
+		vkCmdDraw(cmd_buf->vk_command_buffer, 3, 1, 0, 0);
+		cmd_buf->cmd_end_rendering();
+	};
+
+	cmd_buf->cmd_image_memory_barrier(_moments, otcv::ResourceState::FragSample, otcv::ResourceState::ColorAttachment);
+	for (uint32_t layer : layers) {
+		full_screen_pass(_blurred_rows->vk_view, _moments_pipeline, _layer_desc_sets[layer]);
+		cmd_buf->cmd_image_memory_barrier(_blurred_rows, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
+
+		VkImageSubresourceRange subrange{};
+		subrange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		subrange.baseMipLevel = 0;
+		subrange.levelCount = 1;
+		subrange.baseArrayLayer = layer;
+		subrange.layerCount = 1;
+		full_screen_pass(_moments->view_of_subresource(subrange), _blur_pipeline, _blur_desc_set);
+		cmd_buf->cmd_image_memory_barrier(_blurred_rows, otcv::ResourceState::FragSample, otcv::ResourceState::ColorAttachment);
+	}
+	build_mips(cmd_buf, layers);
+	cmd_buf->cmd_image_memory_barrier(_moments, otcv::ResourceState::ColorAttachment, otcv::ResourceState::FragSample);
+}
+
+static void level_barrier(
+	otcv::CommandBuffer* cmd_buf,
+	otcv::Image* image,
+	uint32_t level,
+	VkImageLayout old_layout,
+	VkImageLayout new_layout,
+	VkPipelineStageFlags src_stage,
+	VkAccessFlags src_access,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access) {
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image->vk_image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = level;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = image->builder._image_info.arrayLayers;
+	vkCmdPipelineBarrier(cmd_buf->vk_command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void ShadowFilter::build_mips(otcv::CommandBuffer* cmd_buf, const std::vector<uint32_t>& layers) {
+	// every level is in the layout of ColorAttachment before and after, as far as otcv is concerned
+	uint32_t n_levels = _moments->builder._image_info.mipLevels;
+	int32_t width = _moments->builder._image_info.extent.width;
+	int32_t height = _moments->builder._image_info.extent.height;
+	for (uint32_t level = 1; level < n_levels; ++level) {
+		// the base level was rendered, every other source was the blit destination of the previous iteration
+		VkImageLayout src_layout = level == 1 ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		level_barrier(cmd_buf, _moments, level - 1,
+			src_layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+		level_barrier(cmd_buf, _moments, level,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+		int32_t level_width = std::max(width >> 1, 1);
+		int32_t level_height = std::max(height >> 1, 1);
+		std::vector<VkImageBlit> regions;
+		for (uint32_t layer : layers) {
+			VkImageBlit region{};
+			region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, layer, 1 };
+			region.srcOffsets[1] = { width, height, 1 };
+			region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, layer, 1 };
+			region.dstOffsets[1] = { level_width, level_height, 1 };
+			regions.push_back(region);
+		}
+		vkCmdBlitImage(cmd_buf->vk_command_buffer,
+			_moments->vk_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			_moments->vk_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			(uint32_t)regions.size(), regions.data(), VK_FILTER_LINEAR);
+
+		level_barrier(cmd_buf, _moments, level - 1,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		width = level_width;
+		height = level_height;
+	}
+	if (n_levels > 1) {
+		level_barrier(cmd_buf, _moments, n_levels - 1,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+}
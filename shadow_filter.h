@@ -0,0 +1,52 @@
+#pragma once
+
+#include "otcv.h"
+#include "otcv_utils.h"
+#include "static_ubo.h"
+#include "expandable_descriptor_pool.h"
+
+#include <vector>
+
+// exponential variance shadow maps. Layers of a depth shadowmap are warped into moments at half its resolution, blurred
+// in two passes and mipmapped, so that lighting resolves soft shadows with one filtered fetch instead of many depth compares
+class ShadowFilter {
+public:
+	// EVSM_EXPONENTS of the shaders, positive and negative. The squared moments of depths in [-1, 1] stay below the
+	// largest 16 bit float, e^(2 * 5.54) < 65504
+	static constexpr float exponents[2] = { 5.54f, 5.54f };
+
+	ShadowFilter(const std::string& shader_path, otcv::Image* shadowmap);
+	~ShadowFilter();
+
+	// shadowmap in FragSample. Only the layers given are filtered, the rest keep their moments.
+	// The moments are left in FragSample
+	void commands(otcv::CommandBuffer* cmd_buf, const std::vector<uint32_t>& layers);
+
+	// same layers as the shadowmap at half its resolution, mipmapped
+	otcv::Image* moments() { return _moments; }
+	otcv::Sampler* moments_sampler() { return _moments_sampler; }
+
+private:
+	// level 0 of the layers to the coarser levels, with blits
+	void build_mips(otcv::CommandBuffer* cmd_buf, const std::vector<uint32_t>& layers);
+
+	otcv::Image* _shadowmap;
+	otcv::Sampler* _shadowmap_sampler;
+	otcv::Image* _moments;
+	otcv::Sampler* _moments_sampler;
+	otcv::Image* _blurred_rows; // one layer at a time, between the two passes
+	otcv::Sampler* _blurred_rows_sampler;
+
+	otcv::ShaderBlob _shader_blob;
+	otcv::VertexBuffer* _screen_quad;
+	otcv::GraphicsPipeline* _moments_pipeline;
+	otcv::GraphicsPipeline* _blur_pipeline;
+	std::shared_ptr<NaiveExpandableDescriptorPool> _desc_pool;
+
+	std::vector<std::shared_ptr<StaticUBO>> _layer_ubos;
+	std::vector<otcv::DescriptorSet*> _layer_desc_sets; // evsm_moments.frag
+	otcv::DescriptorSet* _blur_desc_set; // evsm_blur.frag
+
+	// 8 bytes per texel. 32 bit floats would allow larger exponents and less light bleeding at twice the memory
+	const VkFormat _format = VK_FORMAT_R16G16B16A16_SFLOAT;
+};
@@ -1,59 +1,56 @@
 #include "shadow_manager.h"
 
+#include <cmath>
+
 
 ShadowManager::ShadowManager(
+	bool output_layer_enabled,
 	const std::string& shadow_shader_path,
-	const std::string& culling_shader_path,
+	const std::string& shadow_filter_shader_path,
 	otcv::Image* shadowmap,
-	const SceneGraph& scene,
 	const SceneGraphFlatRefs& scene_refs,
 	std::shared_ptr<BindlessDataManager> bindless_data,
-	uint32_t in_flight_frames) {
+	std::shared_ptr<SceneCulling> culling,
+	SceneCulling::IndirectCommandContext culling_out,
+	uint32_t first_view,
+	uint32_t in_flight_frames,
+	const std::vector<uint32_t>& update_periods) {
 
 	_shadowmap = shadowmap;
+#ifdef SHADOW_LAYERED_CASCADES
+	// cascaded_shadow_layered.vert writes gl_Layer
+	_layered = output_layer_enabled;
+#endif
 
 	std::map<uint32_t, uint32_t> vs_indexing_limits = {
 		{otcv::pack(DescriptorSetRate::PerObject, 0), scene_refs.size()}
 	};
 	std::map<std::string, otcv::ShaderLoadHint> file_hints = {
-		{"cascaded_shadow.vert", {otcv::ShaderLoadHint::Hint::DescriptorIndexing, &vs_indexing_limits}}
+		{"cascaded_shadow.vert", {otcv::ShaderLoadHint::Hint::DescriptorIndexing, &vs_indexing_limits}},
+		{"cascaded_shadow_layered.vert", {otcv::ShaderLoadHint::Hint::DescriptorIndexing, &vs_indexing_limits}}
 	};
 	_shader_blob = std::move(otcv::load_shaders_from_dir(shadow_shader_path, file_hints));
 
 	{
+		// one depth only pipeline for every caster. The pipeline variants are drawn from their own lists and only differ
+		// in cull mode, which is dynamic: single sided casters cull the faces towards the light, double sided ones none
 		otcv::GraphicsPipelineBuilder pipeline_builder;
 		pipeline_builder.pipline_rendering()
 			.depth_stencil_attachment_format(shadowmap->builder._image_info.format)
 			.end()
-			.shader_vertex(_shader_blob["cascaded_shadow.vert"])
+			.shader_vertex(_shader_blob[_layered ? "cascaded_shadow_layered.vert" : "cascaded_shadow.vert"])
 			.cull_back_face(VK_FRONT_FACE_CLOCKWISE)
 			.depth_test();
 		{
 			otcv::VertexBufferBuilder vbb;
-			vbb.add_binding().add_attribute(0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3));
-			pipeline_builder.vertex_state(vbb); // bind position attribute only
-		}
-		pipeline_builder
-			.add_dynamic_state(VK_DYNAMIC_STATE_VIEWPORT)
-			.add_dynamic_state(VK_DYNAMIC_STATE_SCISSOR);
-		_pipeline_bins[PipelineVariant::BackFaceCulled] = pipeline_builder.build();
-	}
-	{
-		otcv::GraphicsPipelineBuilder pipeline_builder;
-		pipeline_builder.pipline_rendering()
-			.depth_stencil_attachment_format(shadowmap->builder._image_info.format)
-			.end()
-			.shader_vertex(_shader_blob["cascaded_shadow.vert"])
-			.depth_test();
-		{
-			otcv::VertexBufferBuilder vbb;
-			vbb.add_binding().add_attribute(0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(glm::vec3));
+			bindless_data->add_position_attribute(vbb);
 			pipeline_builder.vertex_state(vbb); // bind position attribute only
 		}
 		pipeline_builder
 			.add_dynamic_state(VK_DYNAMIC_STATE_VIEWPORT)
-			.add_dynamic_state(VK_DYNAMIC_STATE_SCISSOR);
-		_pipeline_bins[PipelineVariant::DoubleSided] = pipeline_builder.build();
+			.add_dynamic_state(VK_DYNAMIC_STATE_SCISSOR)
+			.add_dynamic_state(VK_DYNAMIC_STATE_CULL_MODE);
+		_pipeline = pipeline_builder.build();
 	}
 
 	_desc_pool.reset(new NaiveExpandableDescriptorPool());
@@ -62,27 +59,69 @@ ShadowManager::ShadowManager(
 	uint32_t n_cascades = shadowmap->builder._image_info.arrayLayers;
 	for (FrameContext& frame : _frame_ctxs) {
 		frame.resize(n_cascades); // number of cascades
-		for (CascadeContext& cascade : frame) {
-			cascade.desc_set = _desc_pool->allocate(_pipeline_bins.begin()->second->desc_set_layouts[DescriptorSetRate::PerFrame]);
+		if (_layered) {
+			continue;
+		}
+		for (uint32_t layer = 0; layer < n_cascades; ++layer) {
+			CascadeContext& cascade = frame[layer];
+			cascade.desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
 
 			Std140AlignmentType FrameUBO;
 			FrameUBO.add(Std140AlignmentType::InlineType::Mat4, "projectView");
+			FrameUBO.add(Std140AlignmentType::InlineType::Uint, "layer");
 			cascade.ubo.reset(new StaticUBO(FrameUBO));
+			cascade.ubo->set(StaticUBOAccess()["layer"], &layer);
 			cascade.desc_set->bind_buffer(0, cascade.ubo->_buf);
 			// cascade.cascade_splits = { 0.0f, 0.0f };
 		}
 	}
+	if (_layered) {
+		assert(n_cascades <= SceneCulling::max_views);
+		_layered_ctxs.resize(in_flight_frames);
+		for (LayeredContext& layered : _layered_ctxs) {
+			layered.desc_set = _desc_pool->allocate(_pipeline->desc_set_layouts[DescriptorSetRate::PerFrame]);
+
+			Std140AlignmentType FrameUBO;
+			FrameUBO.add(Std140AlignmentType::InlineType::Mat4, "projectViews", SceneCulling::max_views);
+			FrameUBO.add(Std140AlignmentType::InlineType::Uint, "nLayers");
+			layered.ubo.reset(new StaticUBO(FrameUBO));
+			layered.ubo->set(StaticUBOAccess()["nLayers"], &n_cascades);
+			layered.desc_set->bind_buffer(0, layered.ubo->_buf);
+		}
+	}
 
 	_bindless_data = bindless_data;
 
-	_scene_cullings.resize(n_cascades);
-	_culling_out.resize(n_cascades);
-	for (uint32_t i = 0; i < n_cascades; ++i) {
-		_scene_cullings[i].reset(new SceneCulling(culling_shader_path, scene, scene_refs, in_flight_frames));
-		_culling_out[i] = _scene_cullings[i]->create_indirect_command_context((uint32_t)PipelineVariant::All, _bindless_data);
+	_culling = culling;
+	_culling_out = culling_out;
+	_first_view = first_view;
+	assert(_first_view + n_cascades <= _culling->n_views());
+	if (_layered) {
+		// one list for every cascade, instanced once per cascade
+		_culling->layer_views(_first_view, n_cascades);
+	}
+	// commands of every view index into the same instance ids
+	for (FrameContext& frame : _frame_ctxs) {
+		for (CascadeContext& cascade : frame) {
+			if (cascade.desc_set) {
+				cascade.desc_set->bind_buffer(1, _culling_out.ssbo_instance_ids->_buf);
+			}
+		}
+	}
+	for (LayeredContext& layered : _layered_ctxs) {
+		layered.desc_set->bind_buffer(1, _culling_out.ssbo_instance_ids->_buf);
 	}
-	_culling_in = _scene_cullings[0]->create_object_buffer_context(scene, scene_refs, _bindless_data);
 	_n_obj = scene_refs.size();
+
+#ifdef SHADOW_EVSM
+	_filter.reset(new ShadowFilter(shadow_filter_shader_path, shadowmap));
+#endif
+
+	_caches.resize(n_cascades);
+	for (uint32_t i = 0; i < n_cascades && i < update_periods.size(); ++i) {
+		assert(update_periods[i] > 0);
+		_caches[i].update_period = update_periods[i];
+	}
 }
 
 ShadowManager::~ShadowManager() {
@@ -90,90 +129,244 @@ ShadowManager::~ShadowManager() {
 }
 
 std::vector<CSM::CascadeContext> ShadowManager::update(glm::vec3 light_dir, PerspectiveCamera& camera, uint32_t frame_id, float blend_overlap) {
+	std::pair<float, float> depth_range = { camera.near, camera.far };
+	float min_depth, max_depth;
+	if (_depth_bounds && _depth_bounds->read(frame_id, min_depth, max_depth)) {
+		glm::mat4 proj_inv = glm::inverse(camera.proj);
+		auto view_distance = [&proj_inv](float depth) -> float {
+			glm::vec4 p = proj_inv * glm::vec4(0.0f, 0.0f, depth, 1.0f);
+			return -p.z / p.w;
+		};
+		float steps = _depth_range_steps;
+		depth_range.first = std::exp2(std::floor(std::log2(view_distance(min_depth)) * steps) / steps);
+		depth_range.second = std::exp2(std::ceil(std::log2(view_distance(max_depth)) * steps) / steps);
+	}
+
 	std::vector<CSM::CascadeContext> cascade_ctxs = CSM::csm_ortho_projections(
 		camera,
 		light_dir,
 		_shadowmap->builder._image_info.arrayLayers,
 		_shadowmap->builder._image_info.extent.width,
-		blend_overlap);
+		blend_overlap,
+		_bindless_data->_scene_aabb,
+		depth_range);
 	assert(cascade_ctxs.size() == _shadowmap->builder._image_info.arrayLayers);
 
-	StaticUBOAccess acc;
-	acc["projectView"];
 	FrameContext& frame_ctx = _frame_ctxs[frame_id];
 	for (uint32_t cascade = 0; cascade < frame_ctx.size(); ++cascade) {
+		CascadeCache& cache = _caches[cascade];
+		bool due = (_n_updates + cascade) % cache.update_period == 0;
+		bool moved = cascade_ctxs[cascade].light_view != cache.drawn.light_view ||
+			cascade_ctxs[cascade].light_proj != cache.drawn.light_proj;
+		// the splits move with the depth range on screen. A cached map serves the new slice as long as it covers it
+		bool covered = cache.valid && covers(cache.drawn, cascade_ctxs[cascade].slice);
+		frame_ctx[cascade].redraw = !covered || (due && (moved || cache.dirty));
+		if (!frame_ctx[cascade].redraw) {
+			_culling->skip_view(_first_view + cascade, frame_id);
+			// selected by the new splits, which leave no gaps between the cascades, and drawn with the old matrices
+			CSM::CascadeContext kept = cache.drawn;
+			kept.z_begin = cascade_ctxs[cascade].z_begin;
+			kept.z_end = cascade_ctxs[cascade].z_end;
+			cascade_ctxs[cascade] = kept;
+			continue;
+		}
+		cache.valid = true;
+		cache.dirty = false;
+		cache.drawn = cascade_ctxs[cascade];
+
 		// traverse and update cascades
 		glm::mat4 light_pv = cascade_ctxs[cascade].light_proj * cascade_ctxs[cascade].light_view;
-		frame_ctx[cascade].ubo->set(acc, &(light_pv));
+		if (_layered) {
+			_layered_ctxs[frame_id].ubo->set(StaticUBOAccess()["projectViews"][cascade], &(light_pv));
+		}
+		else {
+			frame_ctx[cascade].ubo->set(StaticUBOAccess()["projectView"], &(light_pv));
+		}
 
-		// update culling
-		_scene_cullings[cascade]->update(cascade_ctxs[cascade].light_proj, cascade_ctxs[cascade].light_view, frame_id);
+		// update culling. Meshlets of single sided casters facing the light are culled, as the pipeline drops their faces
+		_culling->update(
+			_first_view + cascade,
+			cascade_ctxs[cascade].light_proj,
+			cascade_ctxs[cascade].light_view,
+			_shadowmap->builder._image_info.extent.height,
+			frame_id,
+			true);
+		// everything between the slice of the camera frustum and the light, rather than the ortho box
+		_culling->set_cull_planes(_first_view + cascade, frame_id, cascade_ctxs[cascade].caster_planes);
 	}
+	++_n_updates;
 	return cascade_ctxs;
 }
 
-void ShadowManager::commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id) {
-	// TODO: ensure an _shadowmap image is already transitioned to ResourceState::DepthStencilAttachment state
+bool ShadowManager::covers(const CSM::CascadeContext& drawn, const FrustumUtils::Frustum& slice) {
+	// the slice is convex, so its corners tell. Each receiver in it needs its texel inside the ortho box, and the casters
+	// toward the light inside the swept volume they were culled by, which holds them once it holds the receiver
+	const float epsilon = 1e-4f;
+	glm::mat4 light_pv = drawn.light_proj * drawn.light_view;
+	for (const glm::vec3& corner : slice) {
+		glm::vec4 p = light_pv * glm::vec4(corner, 1.0f);
+		if (std::abs(p.x) > p.w || std::abs(p.y) > p.w || p.z < 0.0f || p.z > p.w) {
+			return false;
+		}
+		for (const glm::vec4& plane : drawn.caster_planes) {
+			if (glm::dot(glm::vec3(plane), corner) + plane.w > epsilon * std::abs(plane.w) + epsilon) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
-	uint32_t width = _shadowmap->builder._image_info.extent.width;
-	uint32_t height = _shadowmap->builder._image_info.extent.height;
-	for (uint32_t cascade = 0; cascade < _shadowmap->builder._image_info.arrayLayers; ++cascade) {
-		// cull frustum 
-		_scene_cullings[cascade]->commands(cmd_buf, _culling_in, _culling_out[cascade], frame_id);
-
-		VkImageSubresourceRange subrange{};
-		subrange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-		subrange.baseMipLevel = 0;
-		subrange.levelCount = 1;
-		subrange.baseArrayLayer = cascade;
-		subrange.layerCount = 1;
-
-		otcv::RenderingBegin pass_begin;
-		pass_begin
-			.area(width, height)
-			.depth_stencil_attachment()
-			.image_view(_shadowmap->view_of_subresource(subrange))
-			.image_layout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-			.load_store(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE)
-			.clear_value(1.0f, 0)
-			.end();
-		cmd_buf->cmd_begin_rendering(pass_begin);
-
-		cmd_buf->cmd_set_viewport(width, height);
-		cmd_buf->cmd_set_scissor(width, height);
-
-		cmd_buf->cmd_bind_vertex_buffer(_bindless_data->_vb);
-		cmd_buf->cmd_bind_index_buffer(_bindless_data->_ib, VK_INDEX_TYPE_UINT16);
-
-		// TODO: issuing a draw call for each pipeline variant is not really necessary 
-		// as shadow pipeline do not differentiate materials
-		// this can be solve by writing another version of frustum_cull.comp shader that puts all indirect commands in one place
-		for (uint32_t pipeline_variant = 0; pipeline_variant < (uint32_t)PipelineVariant::All; ++pipeline_variant) {
-			assert(_pipeline_bins.find((PipelineVariant)pipeline_variant) != _pipeline_bins.end());
+void ShadowManager::invalidate(const AABB& box) {
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	for (CascadeCache& cache : _caches) {
+		bool outside = false;
+		for (const glm::vec4& plane : cache.drawn.caster_planes) {
+			float d = glm::dot(glm::vec3(plane), center) + plane.w;
+			outside = outside || d > glm::dot(glm::abs(glm::vec3(plane)), extent);
+		}
+		cache.dirty = cache.dirty || !outside;
+	}
+}
 
-			otcv::GraphicsPipeline* pipeline = _pipeline_bins[(PipelineVariant)pipeline_variant];
-			cmd_buf->cmd_bind_graphics_pipeline(pipeline);
+void ShadowManager::draw_view(otcv::CommandBuffer* cmd_buf, otcv::DescriptorSet* desc_set, uint32_t view) {
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, desc_set, DescriptorSetRate::PerFrame);
 
-			cmd_buf->cmd_bind_descriptor_set(pipeline, _frame_ctxs[frame_id][cascade].desc_set, DescriptorSetRate::PerFrame);
-			cmd_buf->cmd_bind_descriptor_set(pipeline, _bindless_data->_bindless_object_desc_set, DescriptorSetRate::PerObject);
+	// the compacted list of each pipeline variant, per index width. Only the cull mode changes in between
+	for (uint32_t index_width = 0; index_width < (uint32_t)IndexWidth::All; ++index_width) {
+		otcv::Buffer* ib = _bindless_data->index_buffer((IndexWidth)index_width);
+		if (!ib) {
+			continue;
+		}
+		cmd_buf->cmd_bind_index_buffer(ib, BindlessDataManager::index_type((IndexWidth)index_width));
+
+		for (uint32_t pipeline_variant = 0; pipeline_variant < (uint32_t)PipelineVariant::All; ++pipeline_variant) {
+			uint32_t bucket = SceneCulling::bucket_id((uint32_t)PipelineVariant::All, pipeline_variant, (IndexWidth)index_width);
+			uint32_t max_draws = _culling->bucket_max_draws(bucket);
+			if (max_draws == 0) {
+				continue;
+			}
+			vkCmdSetCullMode(cmd_buf->vk_command_buffer,
+				(PipelineVariant)pipeline_variant == PipelineVariant::DoubleSided ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT);
 
-			
-			Std430AlignmentType::Range command_range = _culling_out[cascade].ssbo_commands->range_of(pipeline_variant * _n_obj, SSBOAccess());
-			Std430AlignmentType::Range count_range = _culling_out[cascade].ssbo_draw_count->range_of(pipeline_variant, SSBOAccess());
+			Std430AlignmentType::Range command_range = _culling_out.ssbo_commands->range_of(_culling->bucket_first_draw(bucket, view), SSBOAccess());
+			Std430AlignmentType::Range count_range = _culling_out.ssbo_draw_count->range_of(_culling->draw_count_id(bucket, view), SSBOAccess());
 			cmd_buf->cmd_draw_indexed_indirect_count(
-				_culling_out[cascade].ssbo_commands->_buf,
+				_culling_out.ssbo_commands->_buf,
 				command_range.offset,
-				_culling_out[cascade].ssbo_draw_count->_buf,
+				_culling_out.ssbo_draw_count->_buf,
 				count_range.offset,
-				_n_obj,
+				max_draws,
 				command_range.stride);
 		}
+	}
+}
+
+void ShadowManager::layered_commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id) {
+	uint32_t width = _shadowmap->builder._image_info.extent.width;
+	uint32_t height = _shadowmap->builder._image_info.extent.height;
+	uint32_t n_cascades = _shadowmap->builder._image_info.arrayLayers;
+
+	std::vector<VkClearRect> redrawn;
+	for (uint32_t cascade = 0; cascade < n_cascades; ++cascade) {
+		if (_frame_ctxs[frame_id][cascade].redraw) {
+			VkClearRect rect{};
+			rect.rect.extent = { width, height };
+			rect.baseArrayLayer = cascade;
+			rect.layerCount = 1;
+			redrawn.push_back(rect);
+		}
+	}
+	if (redrawn.empty()) {
+		return;
+	}
 
-		cmd_buf->cmd_end_rendering();
+	// every layer of the array view at once. Loaded, so that cached layers survive, the redrawn ones are cleared below
+	VkRenderingAttachmentInfo depth_attachment{};
+	depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	depth_attachment.imageView = _shadowmap->vk_view;
+	depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	VkRenderingInfo rendering_info{};
+	rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	rendering_info.renderArea.extent = { width, height };
+	rendering_info.layerCount = n_cascades;
+	rendering_info.pDepthAttachment = &depth_attachment;
+	vkCmdBeginRendering(cmd_buf->vk_command_buffer, &rendering_info);
 
-		cmd_buf->cmd_buffer_memory_barrier(_culling_out[cascade].ssbo_commands->_buf, otcv::ResourceState::IndirectRead, otcv::ResourceState::ComputeSSBOWrite);
-		cmd_buf->cmd_buffer_memory_barrier(_culling_out[cascade].ssbo_draw_count->_buf, otcv::ResourceState::IndirectRead, otcv::ResourceState::ComputeSSBOWrite);
+	VkClearAttachment clear{};
+	clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	clear.clearValue.depthStencil = { 1.0f, 0 };
+	vkCmdClearAttachments(cmd_buf->vk_command_buffer, 1, &clear, (uint32_t)redrawn.size(), redrawn.data());
+
+	cmd_buf->cmd_set_viewport(width, height);
+	cmd_buf->cmd_set_scissor(width, height);
+	cmd_buf->cmd_bind_vertex_buffer(_bindless_data->_vb);
+	cmd_buf->cmd_bind_graphics_pipeline(_pipeline);
+	cmd_buf->cmd_bind_descriptor_set(_pipeline, _bindless_data->_bindless_object_desc_set, DescriptorSetRate::PerObject);
+	// instances of cached cascades are dropped by the vertex shader, their views were skipped in culling
+	draw_view(cmd_buf, _layered_ctxs[frame_id].desc_set, _first_view);
+
+	vkCmdEndRendering(cmd_buf->vk_command_buffer);
+}
+
+void ShadowManager::commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id) {
+	// TODO: ensure an _shadowmap image is already transitioned to ResourceState::DepthStencilAttachment state
+
+	if (_layered) {
+		layered_commands(cmd_buf, frame_id);
+	}
+	else {
+		uint32_t width = _shadowmap->builder._image_info.extent.width;
+		uint32_t height = _shadowmap->builder._image_info.extent.height;
+		for (uint32_t cascade = 0; cascade < _shadowmap->builder._image_info.arrayLayers; ++cascade) {
+			if (!_frame_ctxs[frame_id][cascade].redraw) {
+				// the layer keeps what it was drawn with
+				continue;
+			}
+
+			VkImageSubresourceRange subrange{};
+			subrange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			subrange.baseMipLevel = 0;
+			subrange.levelCount = 1;
+			subrange.baseArrayLayer = cascade;
+			subrange.layerCount = 1;
+
+			otcv::RenderingBegin pass_begin;
+			pass_begin
+				.area(width, height)
+				.depth_stencil_attachment()
+				.image_view(_shadowmap->view_of_subresource(subrange))
+				.image_layout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+				.load_store(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE)
+				.clear_value(1.0f, 0)
+				.end();
+			cmd_buf->cmd_begin_rendering(pass_begin);
+
+			cmd_buf->cmd_set_viewport(width, height);
+			cmd_buf->cmd_set_scissor(width, height);
+
+			cmd_buf->cmd_bind_vertex_buffer(_bindless_data->_vb);
+
+			cmd_buf->cmd_bind_graphics_pipeline(_pipeline);
+			cmd_buf->cmd_bind_descriptor_set(_pipeline, _bindless_data->_bindless_object_desc_set, DescriptorSetRate::PerObject);
+			draw_view(cmd_buf, _frame_ctxs[frame_id][cascade].desc_set, _first_view + cascade);
+
+			cmd_buf->cmd_end_rendering();
+		}
 	}
 
 	cmd_buf->cmd_image_memory_barrier(_shadowmap, otcv::ResourceState::DepthStencilAttachment, otcv::ResourceState::FragSample);
-}
\ No newline at end of file
+
+	if (_filter) {
+		std::vector<uint32_t> redrawn;
+		for (uint32_t cascade = 0; cascade < _frame_ctxs[frame_id].size(); ++cascade) {
+			if (_frame_ctxs[frame_id][cascade].redraw) {
+				redrawn.push_back(cascade);
+			}
+		}
+		_filter->commands(cmd_buf, redrawn);
+	}
+}
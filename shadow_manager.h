@@ -9,44 +9,102 @@
 #include "csm.h"
 #include "bindless_data_manager.h"
 #include "scene_culling.h"
+#include "depth_bounds.h"
+#include "shadow_filter.h"
 
 class ShadowManager {
 public:
-	// cascaded shadowmaps only
+	// cascaded shadowmaps only. Cascades are culled as views first_view onwards of culling, together with the other views
+	// of it (the camera), by whoever owns culling.
+	// update_periods: cascade i is redrawn at most every update_periods[i] updates, staggered between cascades. Every
+	// update if empty.
+	// output_layer_enabled: the device was created with VkPhysicalDeviceVulkan12Features::shaderOutputLayer enabled.
+	// With SHADOW_LAYERED_CASCADES and that, the cascade views are layered in culling and drawn in one pass, otherwise
+	// one pass per cascade
 	ShadowManager(
+		bool output_layer_enabled,
 		const std::string& shadow_shader_path,
-		const std::string& culling_shader_path,
+		const std::string& shadow_filter_shader_path, // SHADOW_EVSM
 		otcv::Image* shadowmap,
-		const SceneGraph& scene,
 		const SceneGraphFlatRefs& scene_refs,
 		std::shared_ptr<BindlessDataManager> bindless_data,
-		uint32_t in_flight_frames);
+		std::shared_ptr<SceneCulling> culling,
+		SceneCulling::IndirectCommandContext culling_out,
+		uint32_t first_view,
+		uint32_t in_flight_frames,
+		const std::vector<uint32_t>& update_periods = {});
 	~ShadowManager();
 
-	// only allow 1 directional light at this point
+	// only allow 1 directional light at this point. A cascade is redrawn when its snapped bounds changed or it was
+	// invalidated, once its period is due, and right away when its map no longer covers its slice of the view.
+	// Returns what the cascades in the shadowmap were drawn with, over the current splits
 	std::vector<CSM::CascadeContext> update(glm::vec3 light_dir, PerspectiveCamera& camera, uint32_t frame_id, float blend_overlap);
 
+	// cascades are split over the depths the bounds found on screen, frames in flight ago, instead of the whole camera
+	// range. Set before the first update
+	void set_depth_bounds(std::shared_ptr<DepthBounds> depth_bounds) { _depth_bounds = depth_bounds; }
+
+	// objects moved within the world space box, before and after. Redraws the cascades they cast into on their next turn
+	void invalidate(const AABB& box);
+
+	// draws what was culled into the cascade views. Leaves the command buffers in IndirectRead
 	void commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id);
 
+	// moments of the redrawn cascades are filtered after commands with SHADOW_EVSM, null otherwise
+	std::shared_ptr<ShadowFilter> filter() { return _filter; }
+
 	// std::vector<std::pair<float, float>> get_cascade_splits(uint32_t frame_id);
 
 private:
+	// whether the map drawn for drawn holds every receiver in slice and what casts onto it
+	static bool covers(const CSM::CascadeContext& drawn, const FrustumUtils::Frustum& slice);
+
+	// binds the frame descriptor set and draws the lists of view. Inside a rendering pass
+	void draw_view(otcv::CommandBuffer* cmd_buf, otcv::DescriptorSet* desc_set, uint32_t view);
+
+	// SHADOW_LAYERED_CASCADES. The lists of the first cascade view cover every cascade, see SceneCulling::layer_views
+	void layered_commands(otcv::CommandBuffer* cmd_buf, uint32_t frame_id);
+
 	otcv::Image* _shadowmap;
 	otcv::ShaderBlob _shader_blob;
-	std::map<PipelineVariant, otcv::GraphicsPipeline*> _pipeline_bins;
+	otcv::GraphicsPipeline* _pipeline;
 	std::shared_ptr<NaiveExpandableDescriptorPool> _desc_pool;
 	struct CascadeContext {
-		otcv::DescriptorSet* desc_set;
+		otcv::DescriptorSet* desc_set = nullptr; // own pass per cascade only
 		std::shared_ptr<StaticUBO> ubo;
+		bool redraw = false;
 		// std::pair<float, float> cascade_splits;
 	};
 	typedef std::vector<CascadeContext> FrameContext;
 	std::vector<FrameContext> _frame_ctxs; // frame id -- cascade id
 
+	bool _layered = false;
+	struct LayeredContext {
+		otcv::DescriptorSet* desc_set;
+		std::shared_ptr<StaticUBO> ubo; // projection of every cascade
+	};
+	std::vector<LayeredContext> _layered_ctxs; // frame id
+
+	// what each layer of the shadowmap holds
+	struct CascadeCache {
+		bool valid = false;
+		bool dirty = false; // casters moved since it was drawn
+		CSM::CascadeContext drawn;
+		uint32_t update_period = 1;
+	};
+	std::vector<CascadeCache> _caches;
+	uint64_t _n_updates = 0;
+
+	std::shared_ptr<DepthBounds> _depth_bounds;
+	std::shared_ptr<ShadowFilter> _filter;
+	// the range found is widened to steps of 1 / _depth_range_steps octave, which keeps the cascades still while the
+	// range changes a little and covers what moved into view since
+	const float _depth_range_steps = 8.0f;
+
 	std::shared_ptr<BindlessDataManager> _bindless_data;
 
-	std::vector<std::shared_ptr<SceneCulling>> _scene_cullings; // one cull per cascade
-	SceneCulling::ObjectBufferContext _culling_in;
-	std::vector<SceneCulling::IndirectCommandContext> _culling_out;
+	std::shared_ptr<SceneCulling> _culling; // one view per cascade
+	SceneCulling::IndirectCommandContext _culling_out;
+	uint32_t _first_view;
 	uint32_t _n_obj;
 };
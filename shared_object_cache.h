@@ -4,6 +4,7 @@
 #include "global_handles.h"
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 template <typename _Type, typename _Builder, typename _Key>
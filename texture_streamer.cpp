@@ -0,0 +1,152 @@
+#include "texture_streamer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+TextureStreamer::TextureStreamer(uint32_t n_images, size_t bytes_per_frame) {
+	_bytes_per_frame = bytes_per_frame;
+	_images.resize(n_images, { nullptr, nullptr });
+
+	otcv::BufferBuilder bb;
+	bb.size(std::max(n_images, 1u) * sizeof(float))
+		.usage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+		.host_access(otcv::BufferBuilder::Access::Coherent);
+	_min_lod_buf = new otcv::Buffer(bb);
+	_min_lods = static_cast<float*>(_min_lod_buf->mapped);
+	std::fill(_min_lods, _min_lods + n_images, 0.0f);
+
+	_cmd_buf = otcv::get_context().command_pool->allocate();
+	_fence = otcv::Fence::create();
+}
+
+TextureStreamer::~TextureStreamer() {
+	if (!_in_flight.empty()) {
+		_fence->wait_reset();
+	}
+	delete _staging;
+	delete _min_lod_buf;
+}
+
+uint32_t TextureStreamer::first_resident_level(const std::vector<MipLevel>& levels, uint32_t resident_size) {
+	for (uint32_t i = 0; i < levels.size(); ++i) {
+		if (levels[i].width <= resident_size && levels[i].height <= resident_size) {
+			return i;
+		}
+	}
+	return levels.empty() ? 0 : (uint32_t)levels.size() - 1;
+}
+
+void TextureStreamer::add(uint32_t image_id, otcv::Image* image, std::shared_ptr<ImageData> image_data, uint32_t first_level) {
+	assert(image_id < _images.size() && first_level < image_data->mips.size());
+	_images[image_id] = { image, image_data };
+	_min_lods[image_id] = (float)first_level;
+	for (uint32_t level = first_level; level-- > 0;) {
+		_pending.push_back({ image_id, level });
+	}
+	_pending_sorted = false;
+}
+
+void TextureStreamer::update() {
+	// the previous batch is a frame old, waiting on it hardly ever blocks.
+	// Publishing only after the fence keeps frames already in flight from sampling levels still being written
+	if (!_in_flight.empty()) {
+		_fence->wait_reset();
+		for (const PendingLevel& landed : _in_flight) {
+			_min_lods[landed.image_id] = std::min(_min_lods[landed.image_id], (float)landed.level);
+		}
+		_in_flight.clear();
+		if (_pending.empty()) {
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _begin).count();
+			std::cout << "texture streaming finished in " << ms << " ms" << std::endl;
+		}
+	}
+	if (_pending.empty()) {
+		return;
+	}
+	if (!_started) {
+		_started = true;
+		_begin = std::chrono::steady_clock::now();
+	}
+	if (!_pending_sorted) {
+		// coarsest level of every image before any finer one. Stable, so each image's levels stay in descending order
+		std::stable_sort(_pending.begin(), _pending.end(), [](const PendingLevel& a, const PendingLevel& b) {
+			return a.level > b.level;
+		});
+		_pending_sorted = true;
+	}
+
+	// always make progress, even if a single level exceeds the budget
+	size_t batch_size = 0;
+	size_t n_levels = 0;
+	while (n_levels < _pending.size()) {
+		const PendingLevel& p = _pending[n_levels];
+		size_t size = (_images[p.image_id].data->mips[p.level].size + 15) & ~size_t(15);
+		if (n_levels > 0 && batch_size + size > _bytes_per_frame) {
+			break;
+		}
+		batch_size += size;
+		++n_levels;
+	}
+	_in_flight.assign(_pending.begin(), _pending.begin() + n_levels);
+	_pending.erase(_pending.begin(), _pending.begin() + n_levels);
+
+	if (!_staging || _staging->builder._info.size < batch_size) {
+		delete _staging;
+		otcv::BufferBuilder sbb;
+		sbb.size(std::max(batch_size, _bytes_per_frame))
+			.usage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+			.host_access(otcv::BufferBuilder::Access::Coherent);
+		_staging = new otcv::Buffer(sbb);
+	}
+
+	_cmd_buf->reset();
+	_cmd_buf->begin(true);
+	size_t staging_offset = 0;
+	for (const PendingLevel& p : _in_flight) {
+		const StreamedImage& streamed = _images[p.image_id];
+		const MipLevel& level = streamed.data->mips[p.level];
+		std::memcpy(static_cast<uint8_t*>(_staging->mapped) + staging_offset, streamed.data->pixels() + level.offset, level.size);
+
+		// only this level changes layout. The rest of the image keeps being sampled by frames in flight
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = streamed.image->vk_image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, p.level, 1, 0, 1 };
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		vkCmdPipelineBarrier(_cmd_buf->vk_command_buffer,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = staging_offset;
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, p.level, 0, 1 };
+		region.imageExtent = { level.width, level.height, 1 };
+		vkCmdCopyBufferToImage(_cmd_buf->vk_command_buffer, _staging->vk_buffer, streamed.image->vk_image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkCmdPipelineBarrier(_cmd_buf->vk_command_buffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		staging_offset += (level.size + 15) & ~size_t(15);
+	}
+	_cmd_buf->end();
+
+	otcv::QueueSubmit submit;
+	submit.batch()
+		.add_command_buffer(_cmd_buf)
+		.end()
+		.signal(_fence);
+	otcv::get_context().queue->submit(submit);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "otcv.h"
+#include "gltf_scene_bindless.h"
+
+#include <memory>
+#include <vector>
+#include <chrono>
+
+// uploads the fine mip levels of images over the frames following startup, coarsest level of every image first
+// and no more than a byte budget per frame. Shaders clamp sampling of each image to the finest level that has landed,
+// read from min_lod_buffer()
+class TextureStreamer {
+public:
+	TextureStreamer(uint32_t n_images, size_t bytes_per_frame);
+	~TextureStreamer();
+
+	// levels [first_level, end) of image_data.mips are resident already, the finer ones get streamed.
+	// image must be in ResourceState::FragSample
+	void add(uint32_t image_id, otcv::Image* image, std::shared_ptr<ImageData> image_data, uint32_t first_level);
+
+	// once per frame, before recording. Publishes the levels uploaded by the previous call and submits the next batch
+	void update();
+
+	bool done() const { return _pending.empty() && _in_flight.empty(); }
+
+	// one float per image
+	otcv::Buffer* min_lod_buffer() { return _min_lod_buf; }
+
+	// first level no larger than resident_size in either dimension
+	static uint32_t first_resident_level(const std::vector<MipLevel>& levels, uint32_t resident_size);
+
+private:
+	struct StreamedImage {
+		otcv::Image* image;
+		std::shared_ptr<ImageData> data;
+	};
+	struct PendingLevel {
+		uint32_t image_id;
+		uint32_t level;
+	};
+
+	size_t _bytes_per_frame;
+	std::vector<StreamedImage> _images;
+	// coarsest first
+	std::vector<PendingLevel> _pending;
+	bool _pending_sorted = true;
+	std::vector<PendingLevel> _in_flight;
+
+	otcv::Buffer* _min_lod_buf;
+	float* _min_lods;
+	otcv::Buffer* _staging = nullptr;
+
+	otcv::CommandBuffer* _cmd_buf;
+	otcv::Fence* _fence;
+
+	bool _started = false;
+	std::chrono::steady_clock::time_point _begin;
+};
@@ -0,0 +1,48 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t n_threads) {
+	n_threads = std::max(n_threads, 1u);
+	for (uint32_t i = 0; i < n_threads; ++i) {
+		_workers.emplace_back(&ThreadPool::worker_loop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_cv.notify_all();
+	for (std::thread& worker : _workers) {
+		worker.join();
+	}
+}
+
+uint32_t ThreadPool::default_thread_count() {
+	// hardware_concurrency() is allowed to return 0 when unknown
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::worker_loop() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+			// drain remaining tasks before stopping so that no future is left without a value
+			if (_tasks.empty()) {
+				return;
+			}
+			task = std::move(_tasks.front());
+			_tasks.pop();
+		}
+		task();
+	}
+}
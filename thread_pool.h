@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// fixed size pool of worker threads executing tasks in submission order
+class ThreadPool {
+public:
+	ThreadPool(uint32_t n_threads = default_thread_count());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template<typename F>
+	auto submit(F&& task) -> std::future<decltype(task())> {
+		typedef decltype(task()) R;
+		std::shared_ptr<std::packaged_task<R()>> packaged = std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+		std::future<R> result = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_tasks.push([packaged]() { (*packaged)(); });
+		}
+		_cv.notify_one();
+		return result;
+	}
+
+	uint32_t size() const { return (uint32_t)_workers.size(); }
+
+	static uint32_t default_thread_count();
+
+	// process-wide pool for asset loading work. Tasks submitted here must not block on other tasks of the same pool
+	static ThreadPool& shared();
+
+private:
+	void worker_loop();
+
+	std::vector<std::thread> _workers;
+	std::queue<std::function<void()>> _tasks;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	bool _stop = false;
+};
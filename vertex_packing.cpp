@@ -0,0 +1,181 @@
+#include "vertex_packing.h"
+
+#include <algorithm>
+#include <cmath>
+
+static uint16_t to_unorm16(float v) {
+	return (uint16_t)std::lround(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f);
+}
+
+static uint32_t to_unorm24(float v) {
+	return (uint32_t)std::lround(std::min(std::max(v, 0.0f), 1.0f) * 16777215.0f);
+}
+
+static int16_t to_snorm16(float v) {
+	return (int16_t)std::lround(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f);
+}
+
+// (v - offset) / scale in [0, 1]. Flat extents map to 0
+static float normalize_in(float v, float offset, float scale) {
+	return scale > 0.0f ? (v - offset) / scale : 0.0f;
+}
+
+VertexPacking::Dequantization VertexPacking::position_dequantization(const AABB& aabb) {
+	Dequantization dq;
+	dq.offset = aabb.min;
+	dq.scale = aabb.max - aabb.min;
+	return dq;
+}
+
+VertexPacking::Dequantization VertexPacking::uv_dequantization(const std::vector<glm::vec2>& uvs) {
+	Dequantization dq;
+	dq.offset = glm::vec3(0.0f);
+	dq.scale = glm::vec3(0.0f);
+	if (uvs.empty()) {
+		return dq;
+	}
+	glm::vec2 min = uvs[0];
+	glm::vec2 max = uvs[0];
+	for (const glm::vec2& uv : uvs) {
+		min.x = std::min(min.x, uv.x);
+		min.y = std::min(min.y, uv.y);
+		max.x = std::max(max.x, uv.x);
+		max.y = std::max(max.y, uv.y);
+	}
+	dq.offset = glm::vec3(min.x, min.y, 0.0f);
+	dq.scale = glm::vec3(max.x - min.x, max.y - min.y, 0.0f);
+	return dq;
+}
+
+void VertexPacking::pack_positions(const std::vector<glm::vec3>& positions, const Dequantization& dq, std::vector<uint16_t>& out) {
+	for (const glm::vec3& p : positions) {
+		out.push_back(to_unorm16(normalize_in(p.x, dq.offset.x, dq.scale.x)));
+		out.push_back(to_unorm16(normalize_in(p.y, dq.offset.y, dq.scale.y)));
+		out.push_back(to_unorm16(normalize_in(p.z, dq.offset.z, dq.scale.z)));
+		out.push_back(0);
+	}
+}
+
+bool VertexPacking::uvs_fit(const Dequantization& dq, uint32_t texture_size) {
+	return std::max(dq.scale.x, dq.scale.y) * (float)texture_size <= 16777215.0f;
+}
+
+void VertexPacking::pack_uvs(
+	const std::vector<glm::vec2>& uvs,
+	uint32_t n_vertices,
+	const Dequantization& dq,
+	std::vector<uint16_t>& out,
+	uint16_t* position_w) {
+
+	if (uvs.empty()) {
+		out.insert(out.end(), n_vertices * 2, 0);
+		return;
+	}
+	for (uint32_t v = 0; v < n_vertices; ++v) {
+		uint32_t u24 = to_unorm24(normalize_in(uvs[v].x, dq.offset.x, dq.scale.x));
+		uint32_t v24 = to_unorm24(normalize_in(uvs[v].y, dq.offset.y, dq.scale.y));
+		out.push_back((uint16_t)(u24 & 0xFFFF));
+		out.push_back((uint16_t)(v24 & 0xFFFF));
+		position_w[v * 4] = (uint16_t)((u24 >> 16) | ((v24 >> 16) << 8));
+	}
+}
+
+void VertexPacking::pack_tangent_frames(
+	const std::vector<glm::vec3>& normals,
+	const std::vector<glm::vec4>& tangents,
+	uint32_t n_vertices,
+	std::vector<int16_t>& out) {
+
+	for (uint32_t v = 0; v < n_vertices; ++v) {
+		glm::vec3 normal = normals.empty() ? glm::vec3(0.0f, 0.0f, 1.0f) : normals[v];
+		glm::vec4 tangent = tangents.empty() ? glm::vec4(0.0f) : tangents[v];
+		std::array<float, 4> q = tangent_frame(normal, tangent);
+		for (float c : q) {
+			out.push_back(to_snorm16(c));
+		}
+	}
+}
+
+std::array<float, 4> VertexPacking::tangent_frame(glm::vec3 normal, glm::vec4 tangent) {
+	// orthonormal frame. Gram-Schmidt the tangent, make one up if there is none
+	float n_length = glm::length(normal);
+	glm::vec3 n = n_length > 0.0f ? normal / n_length : glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::vec3 t = glm::vec3(tangent.x, tangent.y, tangent.z);
+	t = t - n * glm::dot(n, t);
+	float t_length = glm::length(t);
+	if (t_length < 1e-6f) {
+		t = std::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		t = glm::normalize(t - n * glm::dot(n, t));
+	}
+	else {
+		t = t / t_length;
+	}
+	// right handed, so the columns (t, b, n) form a rotation
+	glm::vec3 b = glm::cross(n, t);
+
+	// rotation matrix to quaternion, m[row][column]
+	float m[3][3] = {
+		{ t.x, b.x, n.x },
+		{ t.y, b.y, n.y },
+		{ t.z, b.z, n.z }
+	};
+	float x, y, z, w;
+	float trace = m[0][0] + m[1][1] + m[2][2];
+	if (trace > 0.0f) {
+		float s = 0.5f / std::sqrt(trace + 1.0f);
+		w = 0.25f / s;
+		x = (m[2][1] - m[1][2]) * s;
+		y = (m[0][2] - m[2][0]) * s;
+		z = (m[1][0] - m[0][1]) * s;
+	}
+	else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+		float s = 2.0f * std::sqrt(1.0f + m[0][0] - m[1][1] - m[2][2]);
+		w = (m[2][1] - m[1][2]) / s;
+		x = 0.25f * s;
+		y = (m[0][1] + m[1][0]) / s;
+		z = (m[0][2] + m[2][0]) / s;
+	}
+	else if (m[1][1] > m[2][2]) {
+		float s = 2.0f * std::sqrt(1.0f + m[1][1] - m[0][0] - m[2][2]);
+		w = (m[0][2] - m[2][0]) / s;
+		x = (m[0][1] + m[1][0]) / s;
+		y = 0.25f * s;
+		z = (m[1][2] + m[2][1]) / s;
+	}
+	else {
+		float s = 2.0f * std::sqrt(1.0f + m[2][2] - m[0][0] - m[1][1]);
+		w = (m[1][0] - m[0][1]) / s;
+		x = (m[0][2] + m[2][0]) / s;
+		y = (m[1][2] + m[2][1]) / s;
+		z = 0.25f * s;
+	}
+	float q_length = std::sqrt(x * x + y * y + z * z + w * w);
+	x /= q_length;
+	y /= q_length;
+	z /= q_length;
+	w /= q_length;
+
+	// q and -q are the same rotation. Settle on w > 0, at least one snorm16 step so that negating it is visible
+	if (w < 0.0f) {
+		x = -x;
+		y = -y;
+		z = -z;
+		w = -w;
+	}
+	const float min_w = 1.0f / 32767.0f;
+	if (w < min_w) {
+		float xyz_scale = std::sqrt(1.0f - min_w * min_w);
+		x *= xyz_scale;
+		y *= xyz_scale;
+		z *= xyz_scale;
+		w = min_w;
+	}
+	// mirrored uv: negative w
+	if (tangent.w < 0.0f) {
+		x = -x;
+		y = -y;
+		z = -z;
+		w = -w;
+	}
+	return { x, y, z, w };
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "gltf_scene_bindless.h"
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+// CPU side encoding of VertexLayout::Compact. Decoded in geometry_compact.vert and cascaded_shadow.vert
+struct VertexPacking {
+	// value = offset + scale * unorm
+	struct Dequantization {
+		glm::vec3 offset = glm::vec3(0.0f);
+		glm::vec3 scale = glm::vec3(1.0f);
+	};
+
+	static Dequantization position_dequantization(const AABB& aabb);
+	// xy of the returned vectors, uv0 of every vertex lies within
+	static Dequantization uv_dequantization(const std::vector<glm::vec2>& uvs);
+
+	// unorm16x4, w left 0 for pack_uvs
+	static void pack_positions(const std::vector<glm::vec3>& positions, const Dequantization& dq, std::vector<uint16_t>& out);
+	// whether the 24 bit steps of pack_uvs within dq stay below a texel of a texture_size texture. UVs tiled over more
+	// than 16777215 / texture_size repeats do not
+	static bool uvs_fit(const Dequantization& dq, uint32_t texture_size);
+	// 24 bit fixed point within dq. The low 16 bits of u and v go to out as unorm16x2, their high 8 bits to the w of
+	// the packed positions of the same vertices, u in the low byte. position_w: w of the first vertex, 4 apart
+	static void pack_uvs(
+		const std::vector<glm::vec2>& uvs,
+		uint32_t n_vertices,
+		const Dequantization& dq,
+		std::vector<uint16_t>& out,
+		uint16_t* position_w);
+	// snorm16x4 per vertex. Missing normals or tangents get an arbitrary orthonormal frame
+	static void pack_tangent_frames(
+		const std::vector<glm::vec3>& normals,
+		const std::vector<glm::vec4>& tangents,
+		uint32_t n_vertices,
+		std::vector<int16_t>& out);
+
+	// unit quaternion (x, y, z, w) rotating the z axis to the normal and the x axis to the tangent.
+	// The sign of w carries the bitangent sign, so w is kept away from 0
+	static std::array<float, 4> tangent_frame(glm::vec3 normal, glm::vec4 tangent);
+};